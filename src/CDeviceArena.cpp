@@ -0,0 +1,338 @@
+/*
+ * CDeviceArena.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include "CDeviceArena.h"
+#include "COpenCL.hpp"
+
+namespace liboi
+{
+
+/// Creates an empty arena. Blocks of block_size bytes (or larger, for larger allocations) are
+/// reserved on demand, limited to CL_DEVICE_MAX_MEM_ALLOC_SIZE.
+CDeviceArena::CDeviceArena(cl_device_id device, cl_context context, cl_command_queue queue, size_t block_size)
+{
+	int status = CL_SUCCESS;
+	mContext = context;
+	mQueue = queue;
+	mNextRegion = 0;
+
+	// The alignment is reported in bits.
+	cl_uint align_bits = 0;
+	status = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &align_bits, NULL);
+	CHECK_OPENCL_ERROR(status, "clGetDeviceInfo failed.");
+	mAlignment = max(size_t(align_bits / 8), sizeof(cl_float4));
+
+	cl_ulong max_alloc = 0;
+	status = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+	CHECK_OPENCL_ERROR(status, "clGetDeviceInfo failed.");
+	mBlockSize = Align(min(size_t(max_alloc), block_size));
+}
+
+CDeviceArena::~CDeviceArena()
+{
+	for(auto & it: mRegions)
+		ReleaseBindings(it.second);
+
+	for(auto & block: mBlocks)
+	{
+		if(block.buffer)
+			clReleaseMemObject(block.buffer);
+	}
+}
+
+/// Reserves a region of at least size bytes and returns its ID. The first gap large enough in an
+/// existing block is used, otherwise a new block is reserved.
+unsigned int CDeviceArena::Allocate(size_t size)
+{
+	lock_guard<mutex> lock(mMutex);
+	int status = CL_SUCCESS;
+	size = Align(max(size, size_t(1)));
+	unsigned int region_id = mNextRegion++;
+
+	// First fit in the existing blocks
+	for(unsigned int i = 0; i < mBlocks.size(); i++)
+	{
+		Block & block = mBlocks[i];
+		if(block.buffer == NULL)
+			continue;
+
+		size_t end = 0;
+		bool gap = false;
+		for(auto & it: block.regions)
+		{
+			gap = (it.first - end >= size);
+			if(gap)
+				break;
+
+			end = it.first + mRegions[it.second].size;
+		}
+
+		if(gap || block.size - end >= size)
+		{
+			Place(region_id, i, end, size);
+			return region_id;
+		}
+	}
+
+	// Reserve a new block, reusing an empty slot if possible.
+	Block block;
+	block.size = max(mBlockSize, size);
+	block.buffer = clCreateBuffer(mContext, CL_MEM_READ_WRITE, block.size, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer(arena) failed.");
+
+	unsigned int block_id = 0;
+	while(block_id < mBlocks.size() && mBlocks[block_id].buffer != NULL)
+		block_id++;
+
+	if(block_id == mBlocks.size())
+		mBlocks.push_back(block);
+	else
+		mBlocks[block_id] = block;
+
+	Place(region_id, block_id, 0, size);
+	return region_id;
+}
+
+/// Creates a sub-buffer of size bytes at offset within the region and stores it in handle.
+/// offset must be a multiple of the alignment, see Align. The sub-buffer is released by Unbind or Free.
+void CDeviceArena::Bind(unsigned int region_id, size_t offset, size_t size, cl_mem * handle, cl_mem_flags flags)
+{
+	lock_guard<mutex> lock(mMutex);
+	Region & region = mRegions.at(region_id);
+	assert(offset % mAlignment == 0);
+	assert(offset + size <= region.size);
+
+	Binding binding;
+	binding.handle = handle;
+	binding.offset = offset;
+	binding.size = size;
+	binding.flags = flags;
+
+	*handle = CreateSubBuffer(region, binding);
+	region.bindings.push_back(binding);
+}
+
+/// Removes the gaps left by freed regions. Every block with a gap is copied, packed, into a new
+/// block on the device; the sub-buffers of the moved regions are recreated and their handles updated.
+/// Work already enqueued on the old sub-buffers completes before they are released.
+void CDeviceArena::Compact()
+{
+	lock_guard<mutex> lock(mMutex);
+	int status = CL_SUCCESS;
+
+	for(unsigned int i = 0; i < mBlocks.size(); i++)
+	{
+		Block & block = mBlocks[i];
+		if(block.buffer == NULL)
+			continue;
+
+		// Skip blocks which are already packed.
+		size_t end = 0;
+		bool packed = true;
+		for(auto & it: block.regions)
+		{
+			if(it.first != end)
+				packed = false;
+
+			end = it.first + mRegions[it.second].size;
+		}
+
+		if(packed)
+			continue;
+
+		cl_mem buffer = clCreateBuffer(mContext, CL_MEM_READ_WRITE, block.size, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(arena) failed.");
+
+		map<size_t, unsigned int> regions;
+		end = 0;
+		for(auto & it: block.regions)
+		{
+			Region & region = mRegions[it.second];
+			status = clEnqueueCopyBuffer(mQueue, block.buffer, buffer, region.offset, end, region.size, 0, NULL, NULL);
+			CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+
+			ReleaseBindings(region);
+			region.offset = end;
+			regions[end] = it.second;
+			end += region.size;
+		}
+
+		clReleaseMemObject(block.buffer);
+		block.buffer = buffer;
+		block.regions.swap(regions);
+
+		for(auto & it: block.regions)
+		{
+			Region & region = mRegions[it.second];
+			for(auto & binding: region.bindings)
+				*binding.handle = CreateSubBuffer(region, binding);
+		}
+	}
+}
+
+cl_mem CDeviceArena::CreateSubBuffer(const Region & region, const Binding & binding)
+{
+#if MAX_OPENCL_VERSION >= 110
+	int status = CL_SUCCESS;
+	cl_buffer_region sub_region;
+	sub_region.origin = region.offset + binding.offset;
+	sub_region.size = binding.size;
+
+	cl_mem buffer = clCreateSubBuffer(mBlocks[region.block].buffer, binding.flags, CL_BUFFER_CREATE_TYPE_REGION, &sub_region, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateSubBuffer failed.");
+	return buffer;
+#else
+	throw runtime_error("CDeviceArena requires OpenCL 1.1 or later.");
+#endif // MAX_OPENCL_VERSION >= 110
+}
+
+/// Releases one reference to the region. Once the last owner releases it, the region and its remaining
+/// sub-buffers are released, setting their handles to NULL. Blocks which become empty are released.
+/// Owners of a shared region must Unbind their sub-buffers before calling Free.
+void CDeviceArena::Free(unsigned int region_id)
+{
+	lock_guard<mutex> lock(mMutex);
+	auto it = mRegions.find(region_id);
+	if(it == mRegions.end())
+		return;
+
+	Region & region = it->second;
+	if(--region.refs > 0)
+		return;
+
+	ReleaseBindings(region);
+	for(auto & binding: region.bindings)
+		*binding.handle = NULL;
+
+	Block & block = mBlocks[region.block];
+	block.regions.erase(region.offset);
+	if(block.regions.size() == 0)
+	{
+		clReleaseMemObject(block.buffer);
+		block.buffer = NULL;
+	}
+
+	mRegions.erase(it);
+}
+
+/// Returns the number of bytes in allocated regions.
+size_t CDeviceArena::GetAllocatedSize()
+{
+	lock_guard<mutex> lock(mMutex);
+	size_t size = 0;
+	for(auto & it: mRegions)
+		size += it.second.size;
+
+	return size;
+}
+
+/// Returns the number of bytes reserved on the device.
+size_t CDeviceArena::GetReservedSize()
+{
+	lock_guard<mutex> lock(mMutex);
+	size_t size = 0;
+	for(auto & block: mBlocks)
+	{
+		if(block.buffer)
+			size += block.size;
+	}
+
+	return size;
+}
+
+void CDeviceArena::Place(unsigned int region_id, unsigned int block, size_t offset, size_t size)
+{
+	Region & region = mRegions[region_id];
+	region.block = block;
+	region.offset = offset;
+	region.size = size;
+	region.refs = 1;
+	mBlocks[block].regions[offset] = region_id;
+}
+
+/// Releases the sub-buffers bound to the region, their handles are left dangling.
+void CDeviceArena::ReleaseBindings(Region & region)
+{
+	for(auto & binding: region.bindings)
+	{
+		if(*binding.handle)
+			clReleaseMemObject(*binding.handle);
+	}
+}
+
+/// Adds an owner to the region, which is then only released once Free has been called by every owner.
+/// This permits read-only data to be shared, see COILibData::ShareBuffers.
+void CDeviceArena::Retain(unsigned int region_id)
+{
+	lock_guard<mutex> lock(mMutex);
+	mRegions.at(region_id).refs++;
+}
+
+/// Releases the sub-buffer stored in handle (see Bind) and sets handle to NULL. Handles which are not bound
+/// to the region are ignored.
+void CDeviceArena::Unbind(unsigned int region_id, cl_mem * handle)
+{
+	lock_guard<mutex> lock(mMutex);
+	Region & region = mRegions.at(region_id);
+	for(auto it = region.bindings.begin(); it != region.bindings.end(); ++it)
+	{
+		if(it->handle != handle)
+			continue;
+
+		if(*handle)
+			clReleaseMemObject(*handle);
+
+		*handle = NULL;
+		region.bindings.erase(it);
+		return;
+	}
+}
+
+/// Enqueues a single non-blocking write of size bytes from host_mem to the start of the region on queue,
+/// or on the arena's queue if queue is NULL. host_mem must remain valid until the queue has processed the write.
+void CDeviceArena::Write(unsigned int region_id, const void * host_mem, size_t size, cl_command_queue queue)
+{
+	lock_guard<mutex> lock(mMutex);
+	int status = CL_SUCCESS;
+	const Region & region = mRegions.at(region_id);
+	assert(size <= region.size);
+
+	if(queue == NULL)
+		queue = mQueue;
+
+	status = clEnqueueWriteBuffer(queue, mBlocks[region.block].buffer, CL_FALSE, region.offset, size, host_mem, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+}
+
+} /* namespace liboi */
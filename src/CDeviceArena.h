@@ -0,0 +1,115 @@
+/*
+ * CDeviceArena.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *
+ *  Description:
+ *      Sub-allocates device memory from a few large cl_mem blocks. Each allocation is a
+ *      region of a block at an offset aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN. Sub-buffers
+ *      (clCreateSubBuffer) created inside a region are bound to a cl_mem owned by the caller;
+ *      when the region is moved by Compact the sub-buffer is recreated and the caller's cl_mem
+ *      is updated, thus the caller's cl_mem must not move while the region is allocated.
+ *      Regions may be shared by several owners (see Retain), each of which binds its own cl_mem.
+ *
+ *      The public functions may be called from several threads. Requires OpenCL 1.1 or later.
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CDEVICEARENA_H_
+#define CDEVICEARENA_H_
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include "liboi.hpp"
+
+using namespace std;
+
+namespace liboi
+{
+
+class CDeviceArena
+{
+protected:
+	struct Binding
+	{
+		cl_mem * handle;	// Owned by the caller, updated when the region moves.
+		size_t offset;		// Relative to the start of the region
+		size_t size;
+		cl_mem_flags flags;
+	};
+
+	struct Region
+	{
+		unsigned int block;
+		size_t offset;
+		size_t size;
+		unsigned int refs;		// Number of owners, see Retain and Free
+		vector<Binding> bindings;
+	};
+
+	struct Block
+	{
+		cl_mem buffer;
+		size_t size;
+		map<size_t, unsigned int> regions;	// Offset -> region ID of the live regions in this block.
+	};
+
+	cl_context mContext;
+	cl_command_queue mQueue;
+	size_t mAlignment;		// In bytes
+	size_t mBlockSize;
+
+	vector<Block> mBlocks;		// Released blocks have a NULL buffer and may be reused.
+	map<unsigned int, Region> mRegions;
+	unsigned int mNextRegion;
+	mutex mMutex;
+
+public:
+	CDeviceArena(cl_device_id device, cl_context context, cl_command_queue queue, size_t block_size = 64 * 1024 * 1024);
+	virtual ~CDeviceArena();
+
+	size_t Align(size_t size) { return (size + mAlignment - 1) / mAlignment * mAlignment; };
+	unsigned int Allocate(size_t size);
+	void Bind(unsigned int region, size_t offset, size_t size, cl_mem * handle, cl_mem_flags flags = CL_MEM_READ_ONLY);
+	void Compact();
+	void Free(unsigned int region);
+	size_t GetAllocatedSize();
+	size_t GetReservedSize();
+	void Retain(unsigned int region);
+	void Unbind(unsigned int region, cl_mem * handle);
+	void Write(unsigned int region, const void * host_mem, size_t size, cl_command_queue queue = NULL);
+
+protected:
+	cl_mem CreateSubBuffer(const Region & region, const Binding & binding);
+	void Place(unsigned int region_id, unsigned int block, size_t offset, size_t size);
+	void ReleaseBindings(Region & region);
+};
+
+} /* namespace liboi */
+
+#endif /* CDEVICEARENA_H_ */
@@ -0,0 +1,120 @@
+/*
+ * CDeviceArena_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+
+#include "gtest/gtest.h"
+#include "liboi_tests.h"
+#include "COpenCL.hpp"
+#include "CDeviceArena.h"
+
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Writes three regions, frees the middle one and compacts the arena. Checks that the remaining sub-buffers
+/// were updated and still contain their data, and that a new region reuses the space.
+TEST(CDeviceArena, CL_Compact)
+{
+	size_t test_size = 1000;
+	unsigned int n_regions = 3;
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CDeviceArena arena(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), 16 * 1024 * 1024);
+
+	vector<unsigned int> regions(n_regions);
+	vector<cl_mem> buffers(n_regions, NULL);
+	vector< valarray<cl_float> > values(n_regions);
+	for(unsigned int i = 0; i < n_regions; i++)
+	{
+		values[i].resize(test_size);
+		for(size_t j = 0; j < test_size; j++)
+			values[i][j] = i * test_size + j;
+
+		regions[i] = arena.Allocate(sizeof(cl_float) * test_size);
+		arena.Bind(regions[i], 0, sizeof(cl_float) * test_size, &buffers[i]);
+		arena.Write(regions[i], &values[i][0], sizeof(cl_float) * test_size);
+	}
+	clFinish(cl.GetQueue());
+
+	size_t reserved = arena.GetReservedSize();
+	size_t allocated = arena.GetAllocatedSize();
+
+	arena.Free(regions[1]);
+	EXPECT_TRUE(buffers[1] == NULL);
+	EXPECT_LT(arena.GetAllocatedSize(), allocated);
+
+	cl_mem old_buffer = buffers[2];
+	arena.Compact();
+	EXPECT_TRUE(buffers[2] != old_buffer);
+
+	// Read back through the (new) sub-buffers
+	int status = CL_SUCCESS;
+	valarray<cl_float> cl_val(test_size);
+	for(unsigned int i = 0; i < n_regions; i += 2)
+	{
+		status = clEnqueueReadBuffer(cl.GetQueue(), buffers[i], CL_TRUE, 0, sizeof(cl_float) * test_size, &cl_val[0], 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+		for(size_t j = 0; j < test_size; j++)
+			EXPECT_EQ(values[i][j], cl_val[j]) << " region " << i << " at index " << j;
+	}
+
+	// A new region fits in the space which was freed.
+	regions[1] = arena.Allocate(sizeof(cl_float) * test_size);
+	EXPECT_EQ(reserved, arena.GetReservedSize());
+
+	for(unsigned int i = 0; i < n_regions; i++)
+		arena.Free(regions[i]);
+
+	EXPECT_EQ(size_t(0), arena.GetReservedSize());
+}
+
+/// Shares a region between two owners. The region and the other owner's sub-buffer survive until the last
+/// owner frees it.
+TEST(CDeviceArena, CL_Retain)
+{
+	size_t test_size = 1000;
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CDeviceArena arena(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), 16 * 1024 * 1024);
+
+	valarray<cl_float> values(test_size);
+	for(size_t j = 0; j < test_size; j++)
+		values[j] = j;
+
+	cl_mem owner_a = NULL;
+	cl_mem owner_b = NULL;
+	unsigned int region = arena.Allocate(sizeof(cl_float) * test_size);
+	arena.Bind(region, 0, sizeof(cl_float) * test_size, &owner_a);
+	arena.Write(region, &values[0], sizeof(cl_float) * test_size);
+	clFinish(cl.GetQueue());
+
+	arena.Retain(region);
+	arena.Bind(region, 0, sizeof(cl_float) * test_size, &owner_b);
+
+	// Release the first owner
+	arena.Unbind(region, &owner_a);
+	arena.Free(region);
+	EXPECT_TRUE(owner_a == NULL);
+	EXPECT_TRUE(owner_b != NULL);
+	EXPECT_LT(size_t(0), arena.GetAllocatedSize());
+
+	int status = CL_SUCCESS;
+	valarray<cl_float> cl_val(test_size);
+	status = clEnqueueReadBuffer(cl.GetQueue(), owner_b, CL_TRUE, 0, sizeof(cl_float) * test_size, &cl_val[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	for(size_t j = 0; j < test_size; j++)
+		EXPECT_EQ(values[j], cl_val[j]) << " at index " << j;
+
+	// The last owner releases the region
+	arena.Unbind(region, &owner_b);
+	arena.Free(region);
+	EXPECT_TRUE(owner_b == NULL);
+	EXPECT_EQ(size_t(0), arena.GetReservedSize());
+}
@@ -0,0 +1,188 @@
+/*
+ * CImageRing.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include "CImageRing.h"
+#include "CRoutine.h"
+
+namespace liboi
+{
+
+/// Allocates n_slots device images of image_size bytes, one pinned staging buffer per slot and a
+/// transfer queue on the same device and context as queue.
+CImageRing::CImageRing(cl_device_id device, cl_context context, cl_command_queue queue, unsigned int n_slots, size_t image_size)
+{
+	int status = CL_SUCCESS;
+
+	mContext = context;
+	mQueue = queue;
+	mImageSize = image_size;
+	mActiveSlot = -1;
+	mNextSlot = 0;
+
+	mTransferQueue = clCreateCommandQueue(mContext, device, 0, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateCommandQueue failed.");
+
+	for(unsigned int i = 0; i < n_slots; i++)
+	{
+		cl_mem image = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mImageSize, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(image) failed.");
+
+		cl_mem staging = clCreateBuffer(mContext, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, mImageSize, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(staging) failed.");
+
+		void * staging_ptr = clEnqueueMapBuffer(mTransferQueue, staging, CL_TRUE, CL_MAP_WRITE, 0, mImageSize, 0, NULL, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clEnqueueMapBuffer failed.");
+
+		mImages.push_back(image);
+		mStaging.push_back(staging);
+		mStagingPtr.push_back(staging_ptr);
+		mUploadEvents.push_back(NULL);
+		mReleaseEvents.push_back(NULL);
+	}
+}
+
+CImageRing::~CImageRing()
+{
+	clFinish(mQueue);
+	clFinish(mTransferQueue);
+
+	for(unsigned int i = 0; i < mImages.size(); i++)
+	{
+		ReleaseEvent(mUploadEvents[i]);
+		ReleaseEvent(mReleaseEvents[i]);
+		clEnqueueUnmapMemObject(mTransferQueue, mStaging[i], mStagingPtr[i], 0, NULL, NULL);
+	}
+
+	clFinish(mTransferQueue);
+	for(unsigned int i = 0; i < mImages.size(); i++)
+	{
+		clReleaseMemObject(mStaging[i]);
+		clReleaseMemObject(mImages[i]);
+	}
+
+	clReleaseCommandQueue(mTransferQueue);
+}
+
+/// Returns the device image buffer of the specified slot.
+cl_mem CImageRing::GetImage(unsigned int slot)
+{
+	return mImages.at(slot);
+}
+
+/// Enqueues a marker on the compute queue that completes once all work enqueued thus far
+/// (i.e. all work using the image in slot) is complete. The next upload into slot waits on it.
+void CImageRing::Release(unsigned int slot)
+{
+	int status = CL_SUCCESS;
+	ReleaseEvent(mReleaseEvents[slot]);
+
+#if MAX_OPENCL_VERSION >= 120
+	status = clEnqueueMarkerWithWaitList(mQueue, 0, NULL, &mReleaseEvents[slot]);
+#else
+	status = clEnqueueMarker(mQueue, &mReleaseEvents[slot]);
+#endif
+	CHECK_OPENCL_ERROR(status, "clEnqueueMarker failed.");
+
+	// The next upload into slot waits on the marker from the transfer queue, make sure it is submitted.
+	status = clFlush(mQueue);
+	CHECK_OPENCL_ERROR(status, "clFlush failed.");
+}
+
+void CImageRing::ReleaseEvent(cl_event & event)
+{
+	if(event)
+		clReleaseEvent(event);
+
+	event = NULL;
+}
+
+/// Makes the image in slot the active image. Work enqueued on the compute queue after this call
+/// waits for the upload into slot to complete, the host does not block.
+void CImageRing::Select(unsigned int slot)
+{
+	int status = CL_SUCCESS;
+
+	if(mActiveSlot >= 0 && (unsigned int) mActiveSlot != slot)
+		Release(mActiveSlot);
+
+	mActiveSlot = slot;
+
+	if(mUploadEvents[slot] == NULL)
+		return;
+
+#if MAX_OPENCL_VERSION >= 120
+	status = clEnqueueBarrierWithWaitList(mQueue, 1, &mUploadEvents[slot], NULL);
+#else
+	status = clEnqueueWaitForEvents(mQueue, 1, &mUploadEvents[slot]);
+#endif
+	CHECK_OPENCL_ERROR(status, "clEnqueueBarrier failed.");
+}
+
+/// Copies host_mem into the staging buffer of the next slot and enqueues a non-blocking upload
+/// on the transfer queue. Returns the slot, pass it to Select before evaluating the image.
+/// host_mem may be modified as soon as this function returns.
+unsigned int CImageRing::Upload(const float * host_mem)
+{
+	int status = CL_SUCCESS;
+	unsigned int slot = mNextSlot;
+	mNextSlot = (mNextSlot + 1) % mImages.size();
+
+	// If the slot is in use, all work enqueued thus far must finish before it is overwritten.
+	if(mActiveSlot >= 0 && (unsigned int) mActiveSlot == slot)
+	{
+		Release(slot);
+		mActiveSlot = -1;
+	}
+
+	// The previous upload must finish reading the staging buffer before it is overwritten.
+	if(mUploadEvents[slot])
+	{
+		status = CRoutine::waitForEventAndRelease(&mUploadEvents[slot]);
+		CHECK_OPENCL_ERROR(status, "waitForEventAndRelease failed.");
+		mUploadEvents[slot] = NULL;
+	}
+
+	memcpy(mStagingPtr[slot], host_mem, mImageSize);
+
+	cl_uint n_wait = (mReleaseEvents[slot]) ? 1 : 0;
+	cl_event * wait_list = (mReleaseEvents[slot]) ? &mReleaseEvents[slot] : NULL;
+	status = clEnqueueWriteBuffer(mTransferQueue, mImages[slot], CL_FALSE, 0, mImageSize, mStagingPtr[slot],
+			n_wait, wait_list, &mUploadEvents[slot]);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+
+	status = clFlush(mTransferQueue);
+	CHECK_OPENCL_ERROR(status, "clFlush failed.");
+
+	return slot;
+}
+
+} /* namespace liboi */
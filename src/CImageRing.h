@@ -0,0 +1,88 @@
+/*
+ * CImageRing.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *
+ *  Description:
+ *      A ring of N device image buffers which are filled asynchronously from host
+ *      memory on a dedicated transfer queue. While the image in one slot is being
+ *      evaluated on the compute queue, the next image is uploaded to another slot.
+ *
+ *      Synchronization is done entirely with events:
+ *       - The compute queue waits only on the upload event of the slot it uses (Select).
+ *       - An upload into a slot waits only on a marker enqueued on the compute queue when
+ *         that slot was last released, thus it cannot overwrite an image still in use.
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CIMAGERING_H_
+#define CIMAGERING_H_
+
+#include <vector>
+#include "liboi.hpp"
+
+using namespace std;
+
+namespace liboi
+{
+
+class CImageRing
+{
+protected:
+	cl_context mContext;
+	cl_command_queue mQueue;			// Compute queue, not owned.
+	cl_command_queue mTransferQueue;	// Owned.
+
+	size_t mImageSize;					// In bytes
+	vector<cl_mem> mImages;
+	vector<cl_mem> mStaging;			// Pinned staging buffers, mapped for their lifetime.
+	vector<void *> mStagingPtr;
+	vector<cl_event> mUploadEvents;		// Completion of the last upload into each slot.
+	vector<cl_event> mReleaseEvents;	// Completion of the compute work which used each slot.
+
+	int mActiveSlot;
+	unsigned int mNextSlot;
+
+public:
+	CImageRing(cl_device_id device, cl_context context, cl_command_queue queue, unsigned int n_slots, size_t image_size);
+	virtual ~CImageRing();
+
+	cl_mem GetImage(unsigned int slot);
+	unsigned int GetNSlots() { return mImages.size(); };
+
+	void Select(unsigned int slot);
+
+	unsigned int Upload(const float * host_mem);
+
+protected:
+	void Release(unsigned int slot);
+	static void ReleaseEvent(cl_event & event);
+};
+
+} /* namespace liboi */
+
+#endif /* CIMAGERING_H_ */
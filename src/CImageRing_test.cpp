@@ -0,0 +1,53 @@
+/*
+ * CImageRing_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+
+#include "gtest/gtest.h"
+#include "liboi_tests.h"
+#include "COpenCL.hpp"
+#include "CImageRing.h"
+
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Uploads more images than there are slots, reusing the host buffer immediately after each upload,
+/// and checks that each selected slot contains the expected image when read on the compute queue.
+TEST(CImageRing, CL_UploadSelect)
+{
+	size_t test_size = 10000;
+	unsigned int n_slots = 3;
+	unsigned int n_images = 7;
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CImageRing ring(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), n_slots, sizeof(cl_float) * test_size);
+	EXPECT_EQ(n_slots, ring.GetNSlots());
+
+	valarray<cl_float> image(test_size);
+	valarray<cl_float> result(test_size);
+
+	for(unsigned int k = 0; k < n_images; k++)
+	{
+		for(size_t i = 0; i < test_size; i++)
+			image[i] = k * test_size + i;
+
+		unsigned int slot = ring.Upload(&image[0]);
+		EXPECT_EQ(k % n_slots, slot);
+
+		// Overwrite the host image, the upload must not be affected.
+		image = -1;
+
+		ring.Select(slot);
+		int status = clEnqueueReadBuffer(cl.GetQueue(), ring.GetImage(slot), CL_TRUE, 0, sizeof(cl_float) * test_size,
+				&result[0], 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+		for(size_t i = 0; i < test_size; i++)
+			EXPECT_EQ(k * test_size + i, result[i]);
+	}
+}
@@ -0,0 +1,218 @@
+/*
+ * CImageWriter.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <fitsio.h>
+#include "CImageWriter.h"
+#include "COpenCL.hpp"
+
+namespace liboi
+{
+
+/// Starts the writer thread.
+CImageWriter::CImageWriter()
+{
+	mBusy = false;
+	mStop = false;
+	mThread = thread(&CImageWriter::Run, this);
+}
+
+/// Writes all pending images, then stops the writer thread.
+CImageWriter::~CImageWriter()
+{
+	Flush();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStop = true;
+	}
+	mJobReady.notify_all();
+	mThread.join();
+}
+
+/// Enqueues a non-blocking read of width * height * depth floats from image on queue into a pooled
+/// buffer and schedules the buffer to be written to filename on the writer thread. Returns immediately.
+/// Because the queue is in-order, later work enqueued on queue may modify image freely.
+///
+/// If load_layer is specified, image holds a single layer of the cube. load_layer(layer) is called before
+/// each layer is read and must enqueue the work placing that layer in image on queue.
+void CImageWriter::Export(cl_command_queue queue, cl_mem image, string filename,
+		unsigned int width, unsigned int height, unsigned int depth, float scale,
+		function<void(unsigned int)> load_layer)
+{
+	int status = CL_SUCCESS;
+	size_t num_elements = size_t(width) * height * depth;
+
+	Job job;
+	job.filename = filename;
+	job.width = width;
+	job.height = height;
+	job.depth = depth;
+	job.scale = scale;
+	job.read_event = NULL;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		if(mPool.size() > 0)
+		{
+			job.image.swap(mPool.back());
+			mPool.pop_back();
+		}
+	}
+	job.image.resize(num_elements);
+
+	if(load_layer)
+	{
+		// The queue is in-order, so the event of the last read covers all layers.
+		size_t layer_size = size_t(width) * height;
+		try
+		{
+			for(unsigned int layer = 0; layer < depth; layer++)
+			{
+				load_layer(layer);
+				status = clEnqueueReadBuffer(queue, image, CL_FALSE, 0, layer_size * sizeof(cl_float), &job.image[layer * layer_size],
+						0, NULL, (layer + 1 == depth) ? &job.read_event : NULL);
+				CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+			}
+		}
+		catch(...)
+		{
+			// Reads of earlier layers must finish before the buffer is released.
+			clFinish(queue);
+			throw;
+		}
+	}
+	else
+	{
+		status = clEnqueueReadBuffer(queue, image, CL_FALSE, 0, num_elements * sizeof(cl_float), &job.image[0], 0, NULL, &job.read_event);
+		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+	}
+	clFlush(queue);
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+	}
+	mJobReady.notify_one();
+}
+
+/// Blocks until all scheduled images have been written.
+void CImageWriter::Flush()
+{
+	unique_lock<mutex> lock(mMutex);
+	while(mJobs.size() > 0 || mBusy)
+		mJobDone.wait(lock);
+}
+
+/// Writer thread main loop.
+void CImageWriter::Run()
+{
+	unique_lock<mutex> lock(mMutex);
+	while(true)
+	{
+		while(mJobs.size() == 0 && !mStop)
+			mJobReady.wait(lock);
+
+		if(mJobs.size() == 0 && mStop)
+			break;
+
+		Job job = std::move(mJobs.front());
+		mJobs.pop_front();
+		mBusy = true;
+
+		lock.unlock();
+		if(job.read_event)
+		{
+			clWaitForEvents(1, &job.read_event);
+			clReleaseEvent(job.read_event);
+		}
+		WriteFITS(job.filename, &job.image[0], job.width, job.height, job.depth, job.scale);
+		lock.lock();
+
+		mPool.push_back(std::move(job.image));
+		mBusy = false;
+		mJobDone.notify_all();
+	}
+}
+
+/// Writes an image (or a cube if depth > 1) to a FITS file with a simple RA/DEC WCS.
+/// scale is in mas/pixel. Errors are reported on stderr.
+void CImageWriter::WriteFITS(string filename, const float * image,
+		unsigned int width, unsigned int height, unsigned int depth, float scale)
+{
+	fitsfile *fptr;
+	int status = 0;
+	long fpixel = 1, nelements;
+	int naxis = (depth > 1) ? 3 : 2;
+	long naxes[3];
+
+	/*Initialise storage*/
+	naxes[0] = (long) width;
+	naxes[1] = (long) height;
+	naxes[2] = (long) depth;
+	nelements = naxes[0] * naxes[1] * naxes[2];
+
+	/*Create new file*/
+	if (status == 0)
+		fits_create_file(&fptr, filename.c_str(), &status);
+
+	/*Create primary array image*/
+	if (status == 0)
+		fits_create_img(fptr, FLOAT_IMG, naxis, naxes, &status);
+
+	double RPMAS = (M_PI / 180.0) / 3600000.0;
+	double image_scale_rad = scale * RPMAS;
+
+	// Write keywords to get WCS to work //
+	fits_write_key_dbl(fptr, "CDELT1", -image_scale_rad, 3, "Radians per pixel", &status);
+	fits_write_key_dbl(fptr, "CDELT2", image_scale_rad, 3, "Radians per pixel", &status);
+	fits_write_key_dbl(fptr, "CRVAL1", 0.0, 3, "X-coordinate of reference pixel", &status);
+	fits_write_key_dbl(fptr, "CRVAL2", 0.0, 3, "Y-coordinate of reference pixel", &status);
+	fits_write_key_lng(fptr, "CRPIX1", naxes[0]/2, "reference pixel in X", &status);
+	fits_write_key_lng(fptr, "CRPIX2", naxes[1]/2, "reference pixel in Y", &status);
+	fits_write_key_str(fptr, "CTYPE1", "RA",  "Name of X-coordinate", &status);
+	fits_write_key_str(fptr, "CTYPE2", "DEC", "Name of Y-coordinate", &status);
+	fits_write_key_str(fptr, "CUNIT1", "rad", "Unit of X-coordinate", &status);
+	fits_write_key_str(fptr, "CUNIT2", "rad", "Unit of Y-coordinate", &status);
+
+	/*Write image*/
+	if (status == 0)
+		fits_write_img(fptr, TFLOAT, fpixel, nelements, const_cast<float *>(image), &status);
+
+	/*Close file*/
+	if (status == 0)
+		fits_close_file(fptr, &status);
+
+	/*Report any errors*/
+	fits_report_error(stderr, status);
+}
+
+} /* namespace liboi */
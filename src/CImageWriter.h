@@ -0,0 +1,97 @@
+/*
+ * CImageWriter.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *
+ *  Description:
+ *      Writes images to FITS files on a background thread. The image data is read
+ *      from the OpenCL device into a pooled heap buffer without blocking the caller;
+ *      the writer thread waits for the read to complete, encodes and writes the file
+ *      and then returns the buffer to the pool for the next export.
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CIMAGEWRITER_H_
+#define CIMAGEWRITER_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "liboi.hpp"
+
+using namespace std;
+
+namespace liboi
+{
+
+class CImageWriter
+{
+protected:
+	struct Job
+	{
+		string filename;
+		vector<float> image;
+		unsigned int width;
+		unsigned int height;
+		unsigned int depth;
+		float scale;
+		cl_event read_event;	// Completion of the read into image, may be NULL.
+	};
+
+	deque<Job> mJobs;
+	vector< vector<float> > mPool;	// Buffers of completed jobs, reused by Export.
+	bool mBusy;
+	bool mStop;
+
+	mutex mMutex;
+	condition_variable mJobReady;
+	condition_variable mJobDone;
+	thread mThread;
+
+public:
+	CImageWriter();
+	virtual ~CImageWriter();
+
+	void Export(cl_command_queue queue, cl_mem image, string filename,
+			unsigned int width, unsigned int height, unsigned int depth, float scale,
+			function<void(unsigned int)> load_layer = nullptr);
+	void Flush();
+
+	static void WriteFITS(string filename, const float * image,
+			unsigned int width, unsigned int height, unsigned int depth, float scale);
+
+protected:
+	void Run();
+};
+
+} /* namespace liboi */
+
+#endif /* CIMAGEWRITER_H_ */
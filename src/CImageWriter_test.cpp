@@ -0,0 +1,150 @@
+/*
+ * CImageWriter_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <fitsio.h>
+#include "gtest/gtest.h"
+#include "liboi_tests.h"
+#include "COpenCL.hpp"
+#include "CImageWriter.h"
+
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Reads the primary image of a FITS file into image and its dimensions into naxes. Returns the number of axes.
+static int ReadFITS(string filename, valarray<float> & image, long * naxes)
+{
+	fitsfile * fptr;
+	int status = 0;
+	int naxis = 0;
+	naxes[0] = naxes[1] = naxes[2] = 1;
+
+	fits_open_file(&fptr, filename.c_str(), READONLY, &status);
+	fits_get_img_dim(fptr, &naxis, &status);
+	fits_get_img_size(fptr, 3, naxes, &status);
+
+	image.resize(naxes[0] * naxes[1] * naxes[2]);
+	float nulval = 0;
+	int anynul = 0;
+	fits_read_img(fptr, TFLOAT, 1, image.size(), &nulval, &image[0], &anynul, &status);
+	fits_close_file(fptr, &status);
+
+	EXPECT_EQ(0, status) << " reading " << filename;
+	return naxis;
+}
+
+/// Exports several images from the same device buffer, overwriting the buffer on the queue after each
+/// export, and checks that every file contains the image as it was when Export was called.
+TEST(CImageWriter, CL_Export)
+{
+	unsigned int width = 32;
+	unsigned int height = 16;
+	unsigned int n_images = 4;
+	size_t test_size = width * height;
+
+	char dir_template[] = "/tmp/liboi_writer_XXXXXX";
+	ASSERT_TRUE(mkdtemp(dir_template) != NULL);
+	string dir = dir_template;
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	int status = CL_SUCCESS;
+	cl_mem buffer = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * test_size, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+
+	vector< valarray<cl_float> > images(n_images);
+	vector<string> filenames(n_images);
+	{
+		CImageWriter writer;
+		for(unsigned int k = 0; k < n_images; k++)
+		{
+			images[k].resize(test_size);
+			for(size_t i = 0; i < test_size; i++)
+				images[k][i] = k * test_size + i;
+
+			status = clEnqueueWriteBuffer(cl.GetQueue(), buffer, CL_TRUE, 0, sizeof(cl_float) * test_size, &images[k][0], 0, NULL, NULL);
+			CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+
+			filenames[k] = dir + "/image_" + to_string(k) + ".fits";
+			writer.Export(cl.GetQueue(), buffer, filenames[k], width, height, 1, 0.025);
+		}
+
+		writer.Flush();
+	}
+
+	for(unsigned int k = 0; k < n_images; k++)
+	{
+		valarray<float> image;
+		long naxes[3];
+		EXPECT_EQ(2, ReadFITS(filenames[k], image, naxes));
+		EXPECT_EQ(long(width), naxes[0]);
+		EXPECT_EQ(long(height), naxes[1]);
+		ASSERT_EQ(test_size, image.size());
+
+		for(size_t i = 0; i < test_size; i++)
+			EXPECT_EQ(images[k][i], image[i]) << " image " << k << " at index " << i;
+
+		remove(filenames[k].c_str());
+	}
+
+	clReleaseMemObject(buffer);
+	rmdir(dir.c_str());
+}
+
+/// Exports a cube from a buffer holding a single layer, loading each layer through the callback, and checks
+/// that the file is a cube containing every layer.
+TEST(CImageWriter, CL_ExportCube)
+{
+	unsigned int width = 32;
+	unsigned int height = 16;
+	unsigned int depth = 3;
+	size_t layer_size = width * height;
+
+	char dir_template[] = "/tmp/liboi_writer_XXXXXX";
+	ASSERT_TRUE(mkdtemp(dir_template) != NULL);
+	string filename = string(dir_template) + "/cube.fits";
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	int status = CL_SUCCESS;
+	cl_mem buffer = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * layer_size, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+
+	valarray<cl_float> cube(layer_size * depth);
+	for(size_t i = 0; i < cube.size(); i++)
+		cube[i] = i;
+
+	{
+		CImageWriter writer;
+		writer.Export(cl.GetQueue(), buffer, filename, width, height, depth, 0.025,
+			[&](unsigned int layer)
+			{
+				int status = clEnqueueWriteBuffer(cl.GetQueue(), buffer, CL_TRUE, 0, sizeof(cl_float) * layer_size,
+						&cube[layer * layer_size], 0, NULL, NULL);
+				CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+			});
+		writer.Flush();
+	}
+
+	valarray<float> image;
+	long naxes[3];
+	EXPECT_EQ(3, ReadFITS(filename, image, naxes));
+	EXPECT_EQ(long(width), naxes[0]);
+	EXPECT_EQ(long(height), naxes[1]);
+	EXPECT_EQ(long(depth), naxes[2]);
+	ASSERT_EQ(cube.size(), image.size());
+
+	for(size_t i = 0; i < cube.size(); i++)
+		EXPECT_EQ(cube[i], image[i]) << " at index " << i;
+
+	remove(filename.c_str());
+	clReleaseMemObject(buffer);
+	rmdir(dir_template);
+}
@@ -0,0 +1,311 @@
+/*
+ * CLibOI_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+
+#include "gtest/gtest.h"
+#include "liboi_tests.h"
+#include "liboi.hpp"
+#include "CRoutine.h"
+#include "CUniformDisk.h"
+#include <cmath>
+
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Marks an unsorted list of pixels with duplicates and checks that consecutive pixels are combined into runs
+/// which do not cross the end of a row.
+TEST(CLibOI, CL_MarkImageDirty_Coalesce)
+{
+	unsigned int width = 8;
+	unsigned int height = 4;
+	valarray<cl_float> image(1.0, width * height);
+
+	CLibOI liboi(OPENCL_DEVICE_TYPE);
+	liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+	liboi.SetImageSource(&image[0]);
+	liboi.SetImageInfo(width, height, 1, 0.025);
+	liboi.SetImageDeltaUpload(true);
+	liboi.Init();
+
+	// The first upload is complete.
+	liboi.CopyImageToBuffer(0);
+	ASSERT_EQ(size_t(1), liboi.GetChangedRegions().size());
+	EXPECT_EQ(width, liboi.GetChangedRegions()[0].width);
+	EXPECT_EQ(height, liboi.GetChangedRegions()[0].height);
+
+	vector<unsigned int> pixels = {3, 1, 2, 7, 8, 9, 2, 20};
+	liboi.MarkImageDirty(pixels);
+	liboi.CopyImageToBuffer(0);
+
+	// [x, y, width] of the expected runs, in order
+	unsigned int expected[4][3] = {{1, 0, 3}, {7, 0, 1}, {0, 1, 2}, {4, 2, 1}};
+	const vector<ImageRect> & regions = liboi.GetChangedRegions();
+	ASSERT_EQ(size_t(4), regions.size());
+	for(unsigned int i = 0; i < regions.size(); i++)
+	{
+		EXPECT_EQ(expected[i][0], regions[i].x) << " region " << i;
+		EXPECT_EQ(expected[i][1], regions[i].y) << " region " << i;
+		EXPECT_EQ(expected[i][2], regions[i].width) << " region " << i;
+		EXPECT_EQ(1u, regions[i].height) << " region " << i;
+	}
+}
+
+/// Changes pixels inside and outside a marked rectangle and checks that only the marked pixels are
+/// transferred by a delta upload, and that an upload with nothing marked transfers nothing.
+TEST(CLibOI, CL_DeltaUpload)
+{
+	unsigned int width = 64;
+	unsigned int height = 32;
+	valarray<cl_float> image(width * height);
+	for(unsigned int i = 0; i < width * height; i++)
+		image[i] = i;
+
+	CLibOI liboi(OPENCL_DEVICE_TYPE);
+	liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+	liboi.SetImageSource(&image[0]);
+	liboi.SetImageInfo(width, height, 1, 0.025);
+	liboi.SetImageDeltaUpload(true);
+	liboi.Init();
+	liboi.CopyImageToBuffer(0);
+
+	valarray<cl_float> original = image;
+	image = -1;
+	liboi.MarkImageDirty(10, 5, 20, 3);
+	liboi.CopyImageToBuffer(0);
+
+	valarray<cl_float> cl_image(width * height);
+	liboi.ExportImage(&cl_image[0], width, height, 1);
+	for(unsigned int y = 0; y < height; y++)
+	{
+		for(unsigned int x = 0; x < width; x++)
+		{
+			bool marked = (x >= 10 && x < 30 && y >= 5 && y < 8);
+			float expected = (marked) ? -1 : original[y * width + x];
+			EXPECT_EQ(expected, cl_image[y * width + x]) << " at (" << x << ", " << y << ")";
+		}
+	}
+
+	// Nothing is marked, the device image is unchanged.
+	image = -2;
+	liboi.CopyImageToBuffer(0);
+	EXPECT_EQ(size_t(0), liboi.GetChangedRegions().size());
+	valarray<cl_float> cl_unchanged(width * height);
+	liboi.ExportImage(&cl_unchanged[0], width, height, 1);
+	for(unsigned int i = 0; i < width * height; i++)
+		EXPECT_EQ(cl_image[i], cl_unchanged[i]) << " at index " << i;
+}
+
+/// Delta uploads of a two-layer image. Changing the layer uploads the whole layer, marked regions
+/// are then taken from that layer.
+TEST(CLibOI, CL_DeltaUpload_Layers)
+{
+	unsigned int width = 32;
+	unsigned int height = 16;
+	unsigned int n = width * height;
+	valarray<cl_float> image(2 * n);
+	for(unsigned int i = 0; i < 2 * n; i++)
+		image[i] = i;
+
+	CLibOI liboi(OPENCL_DEVICE_TYPE);
+	liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+	liboi.SetImageSource(&image[0]);
+	liboi.SetImageInfo(width, height, 2, 0.025);
+	liboi.SetImageDeltaUpload(true);
+	liboi.Init();
+	liboi.CopyImageToBuffer(0);
+	liboi.CopyImageToBuffer(1);
+
+	// The device holds the current layer only, compare its total flux.
+	double flux = valarray<cl_float>(image[slice(n, n, 1)]).sum();
+	EXPECT_NEAR(flux, liboi.TotalFlux(), MAX_REL_ERROR * flux);
+
+	image[n + 3 * width + 4] += 1000;
+	liboi.MarkImageDirty(4, 3, 1, 1);
+	liboi.CopyImageToBuffer(1);
+	EXPECT_NEAR(flux + 1000, liboi.TotalFlux(), MAX_REL_ERROR * flux);
+}
+
+/// Exports a two-layer image. Each layer is normalized separately and the loaded layer is restored.
+TEST(CLibOI, CL_ExportImage_Cube)
+{
+	unsigned int width = 32;
+	unsigned int height = 16;
+	unsigned int n = width * height;
+	valarray<cl_float> image(2 * n);
+	for(unsigned int i = 0; i < 2 * n; i++)
+		image[i] = i + 1;
+
+	CLibOI liboi(OPENCL_DEVICE_TYPE);
+	liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+	liboi.SetImageSource(&image[0]);
+	liboi.SetImageInfo(width, height, 2, 0.025);
+	liboi.Init();
+	liboi.CopyImageToBuffer(0);
+
+	valarray<cl_float> cube(2 * n);
+	liboi.ExportImage(&cube[0], width, height, 2);
+	for(unsigned int layer = 0; layer < 2; layer++)
+	{
+		double sum = valarray<cl_float>(image[slice(layer * n, n, 1)]).sum();
+		for(unsigned int i = 0; i < n; i++)
+		{
+			double expected = image[layer * n + i] / sum;
+			ASSERT_NEAR(expected, cube[layer * n + i], MAX_REL_ERROR * expected) << " layer " << layer << " index " << i;
+		}
+	}
+
+	// Layer 0 was restored, the device holds its normalized copy.
+	liboi.SetImageInfo(width, height, 1, 0.025);
+	valarray<cl_float> restored(n);
+	liboi.ExportImage(&restored[0], width, height, 1);
+	for(unsigned int i = 0; i < n; i++)
+		EXPECT_EQ(cube[i], restored[i]) << " at index " << i;
+}
+
+/// Uploads an image, rewrites the same host array in place and uploads it again in each host image mode.
+/// The device must see the rewritten contents, including when the array is wrapped without a copy.
+/// Double images exercise the device conversion, or the host conversion buffer on devices without fp64.
+/// Zero-copy float images arrive normalized, so the exported image is compared after Normalize.
+TEST(CLibOI, CL_HostImageModes)
+{
+	unsigned int width = 32;
+	unsigned int height = 16;
+	unsigned int n = width * height;
+	LibOIEnums::HostImageModes modes[] = {LibOIEnums::HOST_IMAGE_COPY, LibOIEnums::HOST_IMAGE_PINNED,
+			LibOIEnums::HOST_IMAGE_ZERO_COPY, LibOIEnums::HOST_IMAGE_AUTO};
+
+	for(auto mode: modes)
+	{
+		valarray<cl_float> image(n);
+		valarray<double> image_double(n);
+
+		for(unsigned int type = 0; type < 2; type++)
+		{
+			CLibOI liboi(OPENCL_DEVICE_TYPE);
+			liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+			if(type == 0)
+				liboi.SetImageSource(&image[0]);
+			else
+				liboi.SetImageSource(&image_double[0], LibOIEnums::IMAGE_DOUBLE);
+			liboi.SetImageInfo(width, height, 1, 0.025);
+			liboi.SetHostImageMode(mode);
+			liboi.Init();
+
+			for(unsigned int pass = 0; pass < 3; pass++)
+			{
+				for(unsigned int i = 0; i < n; i++)
+				{
+					image[i] = pass * n + i;
+					image_double[i] = pass * n + i;
+				}
+
+				liboi.CopyImageToBuffer(0);
+				liboi.Normalize();
+
+				double sum = n * (pass * n + (n - 1) / 2.0);
+				valarray<cl_float> cl_image(n);
+				liboi.ExportImage(&cl_image[0], width, height, 1);
+				for(unsigned int i = 0; i < n; i++)
+				{
+					double expected = (pass * n + i) / sum;
+					ASSERT_NEAR(expected, cl_image[i], expected * MAX_REL_ERROR) << " mode " << mode << " type " << type << " pass " << pass << " index " << i;
+				}
+			}
+		}
+	}
+}
+
+/// Evaluates a uniform disk against a sample data set with EvaluateAll and checks every output against the
+/// separate ImageToChi2, ImageToLogLike, ImageToChi, ImageToChi2Breakdown and ImageToData calls.
+TEST(CLibOI, CL_EvaluateAll)
+{
+	unsigned int width = 128;
+	unsigned int height = 128;
+	float scale = 0.025;
+	CUniformDisk model(width, height, scale, 0.5, 0, 0);
+	valarray<cl_float> image = model.GetImage_CL();
+
+	CLibOI liboi(OPENCL_DEVICE_TYPE);
+	liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+	liboi.SetImageSource(&image[0]);
+	liboi.SetImageInfo(width, height, 1, scale);
+	int data_num = liboi.LoadData(LIBOI_KERNEL_PATH + "../../samples/PointSource_noise.oifits");
+	liboi.Init();
+	liboi.CopyImageToBuffer(0);
+
+	unsigned int n_data = liboi.GetNDataAllocated(data_num);
+	ASSERT_GT(n_data, 0u);
+
+	EvaluateResult result;
+	ASSERT_TRUE(liboi.EvaluateAll(data_num, LibOIEnums::EVAL_ALL, result));
+
+	// The sums are reduced differently, allow for rounding.
+	float chi2 = liboi.ImageToChi2(data_num);
+	EXPECT_NEAR(chi2, result.chi2, MAX_REL_ERROR * fabs(chi2));
+
+	float loglike = liboi.ImageToLogLike(data_num);
+	EXPECT_NEAR(loglike, result.loglike, MAX_REL_ERROR * fabs(loglike));
+
+	unsigned int n = LibOIEnums::N_OBSERVABLE_TYPES;
+	valarray<float> observable_chi2(n);
+	ASSERT_TRUE(liboi.ImageToChi2Breakdown(data_num, &observable_chi2[0], n));
+	ASSERT_EQ((unsigned int) LibOIEnums::N_OBSERVABLE_TYPES, n);
+	for(unsigned int i = 0; i < n; i++)
+		EXPECT_NEAR(observable_chi2[i], result.observable_chi2[i], MAX_REL_ERROR * fabs(observable_chi2[i])) << " type " << i;
+
+	n = n_data;
+	valarray<float> chi(n_data);
+	ASSERT_TRUE(liboi.ImageToChi(data_num, &chi[0], n));
+	ASSERT_EQ(n_data, n);
+	ASSERT_EQ(size_t(n_data), result.chi.size());
+	for(unsigned int i = 0; i < n_data; i++)
+		EXPECT_NEAR(chi[i], result.chi[i], MAX_REL_ERROR * fabs(chi[i])) << " at index " << i;
+
+	liboi.ImageToData(data_num);
+	n = n_data;
+	valarray<float> sim_data(n_data);
+	liboi.GetSimulatedData(&sim_data[0], n);
+	ASSERT_EQ(n_data, n);
+	ASSERT_EQ(size_t(n_data), result.sim_data.size());
+	for(unsigned int i = 0; i < n_data; i++)
+		EXPECT_NEAR(sim_data[i], result.sim_data[i], MAX_REL_ERROR * fabs(sim_data[i])) << " at index " << i;
+}
+
+/// The chi2 accumulated chunk by chunk on the device matches the chi2 of the whole data set, and the
+/// early exit returns a lower bound which exceeds the threshold.
+TEST(CLibOI, CL_ImageToChi2_Threshold)
+{
+	unsigned int width = 128;
+	unsigned int height = 128;
+	float scale = 0.025;
+	CUniformDisk model(width, height, scale, 0.5, 0, 0);
+	valarray<cl_float> image = model.GetImage_CL();
+
+	CLibOI liboi(OPENCL_DEVICE_TYPE);
+	liboi.SetKernelSourcePath(LIBOI_KERNEL_PATH);
+	liboi.SetImageSource(&image[0]);
+	liboi.SetImageInfo(width, height, 1, scale);
+	int data_num = liboi.LoadData(LIBOI_KERNEL_PATH + "../../samples/PointSource_noise.oifits");
+	liboi.Init();
+	liboi.CopyImageToBuffer(0);
+
+	float chi2 = liboi.ImageToChi2(data_num);
+	ASSERT_GT(chi2, 0);
+
+	bool exceeded = true;
+	float chunked_chi2 = liboi.ImageToChi2(data_num, 2 * chi2, exceeded);
+	EXPECT_FALSE(exceeded);
+	EXPECT_NEAR(chi2, chunked_chi2, MAX_REL_ERROR * chi2);
+
+	float threshold = chi2 / 100;
+	float partial_chi2 = liboi.ImageToChi2(data_num, threshold, exceeded);
+	EXPECT_TRUE(exceeded);
+	EXPECT_GT(partial_chi2, threshold);
+	EXPECT_LE(partial_chi2, chi2 * (1 + MAX_REL_ERROR));
+}
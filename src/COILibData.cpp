@@ -33,10 +33,22 @@
  */
 
 #include "COILibData.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <iomanip>
 #include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "oi_tools.hpp"
 #include "oi_export.hpp"
+#include "liboi.hpp"
+#include "CDeviceArena.h"
 
 //temp
 #include <limits>
@@ -47,65 +59,171 @@ namespace liboi
 {
 
 #define MJD 2400000.5
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
 
-COILibData::COILibData(string filename, cl_context context, cl_command_queue queue)
+mutex COILibData::sSharedMutex;
+map<tuple<cl_context, CDeviceArena *, uint64_t>, COILibData *> COILibData::sSharedData;
+
+/// Continues the 64-bit FNV-1a hash with size bytes at data.
+static uint64_t HashBytes(const void * data, size_t size, uint64_t hash = FNV_OFFSET_BASIS)
+{
+	const unsigned char * bytes = (const unsigned char *) data;
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+/// A second 64-bit hash of size bytes at data, including the size. It is unrelated to HashBytes, so data sets
+/// whose HashBytes collide are told apart, see HashFile.
+static uint64_t CheckBytes(const void * data, size_t size)
+{
+	const unsigned char * bytes = (const unsigned char *) data;
+	uint64_t hash = size * 0x9E3779B97F4A7C15ULL;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 29;
+	}
+
+	return hash;
+}
+
+/// Continues the FNV-1a hash with the size and the contents of values.
+template <typename T>
+static uint64_t HashArray(const vector<T> & values, uint64_t hash)
+{
+	size_t n = values.size();
+	hash = HashBytes(&n, sizeof(size_t), hash);
+	return HashBytes(values.data(), sizeof(T) * n, hash);
+}
+
+template <typename T>
+static uint64_t HashArray(const valarray<T> & values, uint64_t hash)
+{
+	size_t n = values.size();
+	hash = HashBytes(&n, sizeof(size_t), hash);
+	return (n > 0) ? HashBytes(&values[0], sizeof(T) * n, hash) : hash;
+}
+
+COILibData::COILibData(string filename, cl_context context, cl_command_queue queue, CDeviceArenaPtr arena, string cache_path,
+		bool keep_host_data)
 {
 	mContext = context;
 	mQueue = queue;
+	mArena = arena;
 	mFileName = filename;
+	mKeepHostData = keep_host_data;
 	mAveJD = 0;
 	mAveWavelength = 0;
-
-	// Read in the data.
-	COIFile tmp;
-	try
-	{
-		tmp.open(filename);
-		mData = tmp.read();
-	}
-	catch(CCfits::FITS::CantOpen)
-	{
-
-	}
+	mLogLikeConstant.resize(LibOIEnums::N_OBSERVABLE_TYPES, 0.0);
 
 	// Set the OpenCL buffers to NULL
 	mData_cl = 0;
 	mData_err_cl = 0;
+	mData_inv_err_cl = 0;
 	mData_uv_cl = 0;
 	mData_Vis_uv_ref = 0;
 	mData_V2_uv_ref = 0;
 	mData_T3_uv_ref = 0;
 	mData_T3_sign = 0;
+	mData_segment_id = 0;
+	mData_segment_range = 0;
+	mData_uv_chunk_id = 0;
+	mData_uv_chunk_range = 0;
+	mNUVChunks = 0;
+	mUVChunkSize = 0;
+	mData_cov_blocks = 0;
+	mData_cov_factors = 0;
+	mData_bootstrap_block = 0;
+	mArenaRegion = -1;
+	mArenaSize = 0;
+	mContentHash = 0;
+	mContentCheck = 0;
+	mSharedRegion = -1;
+	mBuffersShared = false;
+
+	// Files are identified by the hash of their contents. If the same file has already been uploaded, neither it
+	// nor the cache are read again, see ShareBuffers. The file is not parsed in that case, so a second hash of the
+	// file, which includes its size, guards against collisions instead of comparing the data.
+	mContentHash = HashFile(filename, &mContentCheck);
+	auto matches = [this](const COILibData & source)
+	{
+		return source.mContentCheck != 0 && source.mContentCheck == mContentCheck;
+	};
 
+	if(ShareBuffers(matches))
+		return;
+
+	// Skip reading the OIFITS file if it has been cached, see ReadCache.
+	string cache_file = CacheFileName(cache_path, mContentHash);
+	if(ReadCache(cache_file))
+	{
+		RegisterBuffers();
+		return;
+	}
+
+	// Read in the data.
+	mData = ReadData();
 	InitData();
+	WriteCache(cache_file);
+
+	// The tables can be read from the file again, see GetData.
+	if(!mKeepHostData)
+		mData.reset();
 }
 
-COILibData::COILibData(const OIDataList & data, cl_context context, cl_command_queue queue)
+COILibData::COILibData(const OIDataList & data, cl_context context, cl_command_queue queue, CDeviceArenaPtr arena)
 {
 	mContext = context;
 	mQueue = queue;
-	mData = data;
+	mArena = arena;
+	mData = make_shared<const OIDataList>(data);
+	mKeepHostData = true;	// There is no file to re-read the data from.
 	mAveJD = 0;
 	mAveWavelength = 0;
+	mLogLikeConstant.resize(LibOIEnums::N_OBSERVABLE_TYPES, 0.0);
 
 	// Set the OpenCL buffers to NULL
 	mData_cl = 0;
 	mData_err_cl = 0;
+	mData_inv_err_cl = 0;
 	mData_uv_cl = 0;
 	mData_Vis_uv_ref = 0;
 	mData_V2_uv_ref = 0;
 	mData_T3_uv_ref = 0;
 	mData_T3_sign = 0;
+	mData_segment_id = 0;
+	mData_segment_range = 0;
+	mData_uv_chunk_id = 0;
+	mData_uv_chunk_range = 0;
+	mNUVChunks = 0;
+	mUVChunkSize = 0;
+	mData_cov_blocks = 0;
+	mData_cov_factors = 0;
+	mData_bootstrap_block = 0;
+	mArenaRegion = -1;
+	mArenaSize = 0;
+	mContentHash = 0;
+	mContentCheck = 0;
+	mSharedRegion = -1;
+	mBuffersShared = false;
 
 	InitData();
 }
 
 COILibData::~COILibData()
 {
+	UnregisterBuffers();
 	DeallocateMemory();
 }
 
 /// Initializes statistics on the data set and uploads the data to the OpenCL device.
+/// mNUV must already include the padding of the UV points, see InitData.
+///
+/// If an arena was specified, all buffers except the covariance and active UV buffers are sub-buffers of a single
+/// region of the arena which is uploaded by CopyToDevice with one write, see WriteBuffer.
 void COILibData::AllocateMemory()
 {
 	// In case it has been called before, clean up memory.
@@ -115,46 +233,217 @@ void COILibData::AllocateMemory()
 	// An array of cl_floats arranged as follows: [vis_real, vis_imag, v2, t3_amp, t3_phi]
 	// The number of data must always be greater than zero.
 	assert(mNData > 0);
-	mData_cl = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_float) * mNData, NULL, NULL);
-	mData_err_cl = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_float) * mNData, NULL, NULL);
 
 	// Copy over the UV points.  We MUST always have at least one UV point (otherwise the data would be nonsense).
 	assert(mNUV > 0);
 
-	// Allocate the optimial buffer size for the UV points
-	// For NVidia Fermi, there are 16 processors per multiprocessor
-	// For ATI hardware, there are 20 processors per multiprocessor
-// TODO: We need to dynamically determine the vendor
-	mNUV = NextHighestMultiple(16, mNUV);
+	vector<pair<cl_mem *, size_t> > buffers = ReadOnlyBuffers();
+	vector<pair<cl_mem *, size_t> > instance_buffers = InstanceBuffers();
+	buffers.insert(buffers.end(), instance_buffers.begin(), instance_buffers.end());
+	AllocateBuffers(buffers);
+}
 
-	mData_uv_cl = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_float2) * mNUV, NULL, NULL);
+/// Allocates [buffer, size in bytes] of each of the buffers, buffers with a size of zero are not allocated.
+/// If an arena was specified, the buffers are bound to a new region, mArenaRegion, at the offsets in mArenaLayout.
+void COILibData::AllocateBuffers(const vector<pair<cl_mem *, size_t> > & buffers)
+{
+	if(mArena)
+	{
+		mArenaSize = 0;
+		for(auto buffer: buffers)
+		{
+			mArenaLayout[buffer.first] = mArenaSize;
+			mArenaSize += mArena->Align(buffer.second);
+		}
+
+		mArenaRegion = mArena->Allocate(mArenaSize);
+		for(auto buffer: buffers)
+		{
+			if(buffer.second > 0)
+				mArena->Bind(mArenaRegion, mArenaLayout[buffer.first], buffer.second, buffer.first);
+		}
+	}
+	else
+	{
+		for(auto buffer: buffers)
+		{
+			if(buffer.second > 0)
+				*buffer.first = clCreateBuffer(mContext, CL_MEM_READ_ONLY, buffer.second, NULL, NULL);
+		}
+	}
 
-	mData_Vis_uv_ref = 0;
-	if(mNVis > 0)
-		mData_Vis_uv_ref = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_uint) * mNVis, NULL, NULL);
+	// Wait for the queue to process
+	clFinish(mQueue);
+}
 
-	mData_V2_uv_ref = 0;
-	if(mNV2 > 0)
-		mData_V2_uv_ref = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_uint) * mNV2, NULL, NULL);
+/// Returns [buffer, size in bytes] of the buffers which are only written when the data are uploaded.
+/// They depend on the data alone and may be shared by data sets with identical content, see ShareBuffers.
+vector<pair<cl_mem *, size_t> > COILibData::ReadOnlyBuffers()
+{
+	vector<pair<cl_mem *, size_t> > buffers = {
+		{&mData_cl, sizeof(cl_float) * mNData},
+		{&mData_err_cl, sizeof(cl_float) * mNData},
+		{&mData_uv_cl, sizeof(cl_float2) * mNUV},
+		{&mData_Vis_uv_ref, sizeof(cl_uint) * mNVis},
+		{&mData_V2_uv_ref, sizeof(cl_uint) * mNV2},
+		{&mData_T3_uv_ref, sizeof(cl_uint4) * mNT3},
+		{&mData_T3_sign, sizeof(cl_short4) * mNT3},
+		// Chi2 segment IDs and the ranges over which they are found.
+		{&mData_segment_id, sizeof(cl_uint) * mNData},
+		{&mData_segment_range, sizeof(cl_uint2) * NumSegments()}};
+
+	return buffers;
+}
+
+/// Returns [buffer, size in bytes] of the buffers which depend on the weights or covariance of this data set,
+/// see UploadInverseErrors and UploadUVChunks.
+vector<pair<cl_mem *, size_t> > COILibData::InstanceBuffers()
+{
+	vector<pair<cl_mem *, size_t> > buffers = {
+		{&mData_inv_err_cl, sizeof(cl_float) * mNData},
+		// UV chunk IDs and the ranges over which they are found.
+		{&mData_uv_chunk_id, sizeof(cl_uint) * mNData},
+		{&mData_uv_chunk_range, sizeof(cl_uint2) * LIBOI_N_UV_CHUNKS}};
+
+	return buffers;
+}
+
+/// Makes the read-only buffers of this data set available to data sets with the same content, see ShareBuffers.
+void COILibData::RegisterBuffers()
+{
+	if(mContentHash == 0)
+		return;
+
+	lock_guard<mutex> lock(sSharedMutex);
+	sSharedData.insert(make_pair(make_tuple(mContext, mArena.get(), mContentHash), this));
+}
+
+/// Uses the read-only buffers (see ReadOnlyBuffers) of a data set with the same content (mContentHash) which
+/// was uploaded earlier to the same context and arena instead of uploading another copy of the data.
+/// The buffers are reference counted, by OpenCL or by the arena, so either data set may be released first.
+/// The weights, covariance and bootstrap blocks and the buffers derived from them remain separate.
+/// If matches is given, the buffers are only shared if it returns true for the data set found, which guards
+/// against hash collisions. Returns false if there is no such data set.
+bool COILibData::ShareBuffers(function<bool(const COILibData &)> matches)
+{
+	if(mContentHash == 0)
+		return false;
 
-	mData_T3_uv_ref = 0;
-	mData_T3_sign = 0;
-	if(mNT3 > 0)
 	{
-		mData_T3_uv_ref = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_uint4) * mNT3, NULL, NULL);
-		mData_T3_sign = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_short4) * mNT3, NULL, NULL);
+		lock_guard<mutex> lock(sSharedMutex);
+		auto it = sSharedData.find(make_tuple(mContext, mArena.get(), mContentHash));
+		if(it == sSharedData.end())
+			return false;
+
+		COILibData & source = *(it->second);
+		if(matches && !matches(source))
+			return false;
+
+		DeallocateMemory();
+
+		// Host copies of the data, these do not change once the data are uploaded.
+		mNVis = source.mNVis;
+		mNV2 = source.mNV2;
+		mNT3 = source.mNT3;
+		mNUV = source.mNUV;
+		mNData = source.mNData;
+		mAveJD = source.mAveJD;
+		mAveWavelength = source.mAveWavelength;
+		mUVPoints = source.mUVPoints;
+		mUVOrder = source.mUVOrder;
+		mVisUVRef = source.mVisUVRef;
+		mV2UVRef = source.mV2UVRef;
+		mT3UVRef = source.mT3UVRef;
+		mUVChunkID = source.mUVChunkID;
+		mNUVChunks = source.mNUVChunks;
+		mUVChunkSize = source.mUVChunkSize;
+
+		vector<pair<cl_mem *, size_t> > buffers = ReadOnlyBuffers();
+		vector<pair<cl_mem *, size_t> > source_buffers = source.ReadOnlyBuffers();
+		if(mArena)
+		{
+			// Bind sub-buffers of our own to the source's region so that they follow it when the arena is compacted.
+			assert(source.mArenaRegion >= 0 && source.mSharedRegion < 0);
+			mSharedRegion = source.mArenaRegion;
+			mArena->Retain(mSharedRegion);
+			for(unsigned int i = 0; i < buffers.size(); i++)
+			{
+				if(buffers[i].second > 0)
+					mArena->Bind(mSharedRegion, source.mArenaLayout.at(source_buffers[i].first), buffers[i].second, buffers[i].first);
+			}
+		}
+		else
+		{
+			for(unsigned int i = 0; i < buffers.size(); i++)
+			{
+				*buffers[i].first = *source_buffers[i].first;
+				if(*buffers[i].first)
+					clRetainMemObject(*buffers[i].first);
+			}
+		}
+
+		source.mBuffersShared = true;
+		mBuffersShared = true;
 	}
 
+	// Upload the buffers of this data set
+	AllocateBuffers(InstanceBuffers());
+	if(mArenaRegion >= 0)
+		mStaging.assign(mArenaSize, 0);
+
+	ClearActiveUV();
+	UploadUVChunks();
+	mWeights.resize(mNData);
+	mWeights = 1;
+	UploadInverseErrors();
+
+	if(mStaging.size() > 0)
+		mArena->Write(mArenaRegion, &mStaging[0], mStaging.size(), mQueue);
+
 	// Wait for the queue to process
 	clFinish(mQueue);
+	vector<char>().swap(mStaging);
+
+	return true;
+}
+
+/// Stops other data sets from sharing the read-only buffers of this data set, see RegisterBuffers.
+/// Data sets which already share them are unaffected.
+void COILibData::UnregisterBuffers()
+{
+	lock_guard<mutex> lock(sSharedMutex);
+	auto it = sSharedData.find(make_tuple(mContext, mArena.get(), mContentHash));
+	if(it != sSharedData.end() && it->second == this)
+		sSharedData.erase(it);
 }
 
 /// Deallocates memory allocated on the OpenCL device.
 void COILibData::DeallocateMemory()
 {
+	// Sub-buffers in the arena are released (and set to zero) by the arena. Regions may be shared with other
+	// data sets (see ShareBuffers) and are only released by the arena once no data set uses them.
+	if(mArenaRegion >= 0)
+	{
+		for(auto buffer: mArenaLayout)
+			mArena->Unbind(mArenaRegion, buffer.first);
+		mArena->Free(mArenaRegion);
+	}
+
+	if(mSharedRegion >= 0)
+	{
+		for(auto buffer: ReadOnlyBuffers())
+			mArena->Unbind(mSharedRegion, buffer.first);
+		mArena->Free(mSharedRegion);
+	}
+
+	mArenaRegion = -1;
+	mSharedRegion = -1;
+	mArenaLayout.clear();
+
 	// Free OpenCL memory
 	if(mData_cl) clReleaseMemObject(mData_cl);
 	if(mData_err_cl) clReleaseMemObject(mData_err_cl);
+	if(mData_inv_err_cl) clReleaseMemObject(mData_inv_err_cl);
 
 	if(mData_uv_cl) clReleaseMemObject(mData_uv_cl);
 	if(mData_Vis_uv_ref) clReleaseMemObject(mData_Vis_uv_ref);
@@ -162,6 +451,22 @@ void COILibData::DeallocateMemory()
 	if(mData_T3_uv_ref) clReleaseMemObject(mData_T3_uv_ref);
 
 	if(mData_T3_sign) clReleaseMemObject(mData_T3_sign);
+
+	if(mData_segment_id) clReleaseMemObject(mData_segment_id);
+	if(mData_segment_range) clReleaseMemObject(mData_segment_range);
+
+	if(mData_uv_chunk_id) clReleaseMemObject(mData_uv_chunk_id);
+	if(mData_uv_chunk_range) clReleaseMemObject(mData_uv_chunk_range);
+
+	if(mData_cov_blocks) clReleaseMemObject(mData_cov_blocks);
+	if(mData_cov_factors) clReleaseMemObject(mData_cov_factors);
+	mData_cov_blocks = 0;
+	mData_cov_factors = 0;
+
+	if(mData_bootstrap_block) clReleaseMemObject(mData_bootstrap_block);
+	mData_bootstrap_block = 0;
+
+	ClearActiveUV();
 }
 
 /// \brief Exports the real and current simulated data to a file beginning with base_filename;
@@ -199,6 +504,7 @@ void COILibData::ExportData(string base_filename, cl_mem simulated_data)
 			t3_err, mData_err_cl,
 			t3_uv_ref, mData_T3_uv_ref,
 			t3_uv_sign, mData_T3_sign);
+	RestoreUVOrder(mUVOrder, uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref);
 
 	ccoifits::Export_ToText(base_filename, uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref);
 
@@ -216,6 +522,7 @@ void COILibData::ExportData(string base_filename, cl_mem simulated_data)
 				t3_err, mData_err_cl,
 				t3_uv_ref, mData_T3_uv_ref,
 				t3_uv_sign, mData_T3_sign);
+		RestoreUVOrder(mUVOrder, uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref);
 
 		ccoifits::Export_ToText(base_filename + "_model", uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref);
 	}
@@ -237,7 +544,8 @@ void COILibData::InitData()
 	vector<tuple<unsigned int, unsigned int, unsigned int>> t3_uv_ref;
 	vector<tuple<short, short, short>> t3_uv_sign;
 
-	ccoifits::Export_MinUV(mData, uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref, t3_uv_sign);
+	ccoifits::Export_MinUV(*mData, uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref, t3_uv_sign);
+	ReorderUV(uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref, mUVOrder);
 
 	// Generate some statistics on the data set:
 	mNVis = vis.size();
@@ -245,11 +553,30 @@ void COILibData::InitData()
 	mNT3 = t3.size();
 	mNUV = uv_points.size();
 	// Average JD (notice we need to add in MJD)
-	mAveJD = AverageMJD(mData) + MJD;
-	mAveWavelength = AverageWavelength(mData);
+	mAveJD = AverageMJD(*mData) + MJD;
+	mAveWavelength = AverageWavelength(*mData);
 	// Total number of double/floats allocated for storage on the OpenCL context:
 	mNData = TotalBufferSize(mNVis, mNV2, mNT3);
 
+	// Data read from a file are identified by the hash of the file (see the constructor), others by the hash
+	// of the exported data, see ShareBuffers.
+	if(mContentHash == 0)
+	{
+		uint64_t hash = HashBytes(&mAveJD, sizeof(double));
+		hash = HashBytes(&mAveWavelength, sizeof(double), hash);
+		hash = HashArray(uv_points, hash);
+		hash = HashArray(vis, hash);
+		hash = HashArray(vis_err, hash);
+		hash = HashArray(vis_uv_ref, hash);
+		hash = HashArray(vis2, hash);
+		hash = HashArray(vis2_err, hash);
+		hash = HashArray(vis2_uv_ref, hash);
+		hash = HashArray(t3, hash);
+		hash = HashArray(t3_err, hash);
+		hash = HashArray(t3_uv_ref, hash);
+		mContentHash = HashArray(t3_uv_sign, hash);
+	}
+
 	cout << "Data set information for: " << endl;
 	cout << " " << mFileName << endl;
 	cout << "N Vis: " << mNVis << endl;
@@ -258,9 +585,591 @@ void COILibData::InitData()
 	cout << "N UV : " << mNUV << endl;
 	cout << "Average JD: " << std::fixed << std::setprecision(5) << mAveJD << endl;
 
+	// The hash of the exported data is only 64 bits, compare the data set found with this one before sharing.
+	auto matches = [&](const COILibData & source)
+	{
+		return SameContent(source, uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref,
+				t3_uv_sign);
+	};
+
+	if(ShareBuffers(matches))
+		return;
+
+	// Allocate the optimial buffer size for the UV points
+	// For NVidia Fermi, there are 16 processors per multiprocessor
+	// For ATI hardware, there are 20 processors per multiprocessor
+// TODO: We need to dynamically determine the vendor
+	mNUV = NextHighestMultiple(16, mNUV);
+
 	// Copy data over to the OpenCL device.
 	AllocateMemory();
 	CopyToDevice(uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref, t3_uv_sign);
+	RegisterBuffers();
+}
+
+/// Assigns each datum to a chi2 segment and uploads the segment IDs to the OpenCL device.
+///
+/// Segments are numbered [observable type * LIBOI_N_UV_BINS + uv radius bin] where the
+/// observable types are enumerated in LibOIEnums::ObservableTypes. The UV radius is divided
+/// into LIBOI_N_UV_BINS linear bins spanning zero to the longest UV radius in the data set.
+/// T3 data are binned by the longest leg of the triangle.
+/// The [start, end) range of the observable type is also stored for each segment so that the
+/// segmented reduction need not scan the entire data buffer.
+void COILibData::BuildSegments(const vector<pair<double,double> > & uv_points,
+	const vector<unsigned int> & vis_uv_ref,
+	const vector<unsigned int> & vis2_uv_ref,
+	const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref)
+{
+	unsigned int n_segments = NumSegments();
+
+	// Compute the UV radii and the bin size
+	size_t nUV = uv_points.size();
+	valarray<double> uv_radius(nUV);
+	double max_radius = 0;
+	for(size_t i = 0; i < nUV; i++)
+	{
+		uv_radius[i] = sqrt(uv_points[i].first * uv_points[i].first + uv_points[i].second * uv_points[i].second);
+		max_radius = max(max_radius, uv_radius[i]);
+	}
+
+	double bin_size = max_radius / LIBOI_N_UV_BINS;
+	valarray<cl_uint> uv_bin(nUV);
+	for(size_t i = 0; i < nUV; i++)
+	{
+		uv_bin[i] = 0;
+		if(bin_size > 0)
+			uv_bin[i] = min((unsigned int)(uv_radius[i] / bin_size), (unsigned int) LIBOI_N_UV_BINS - 1);
+	}
+
+	// Assign the segment IDs
+	valarray<cl_uint> t_segment_id(mNData);
+	unsigned int v2_offset = CalculateOffset_V2(mNVis);
+	unsigned int t3_offset = CalculateOffset_T3(mNVis, mNV2);
+	unsigned int bin = 0;
+
+	for(unsigned int i = 0; i < mNVis; i++)
+	{
+		bin = uv_bin[vis_uv_ref[i]];
+		t_segment_id[i] = LibOIEnums::VIS_AMP * LIBOI_N_UV_BINS + bin;
+		t_segment_id[mNVis + i] = LibOIEnums::VIS_PHI * LIBOI_N_UV_BINS + bin;
+	}
+
+	for(unsigned int i = 0; i < mNV2; i++)
+		t_segment_id[v2_offset + i] = LibOIEnums::V2 * LIBOI_N_UV_BINS + uv_bin[vis2_uv_ref[i]];
+
+	for(unsigned int i = 0; i < mNT3; i++)
+	{
+		bin = max(uv_bin[get<0>(t3_uv_ref[i])], max(uv_bin[get<1>(t3_uv_ref[i])], uv_bin[get<2>(t3_uv_ref[i])]));
+		t_segment_id[t3_offset + i] = LibOIEnums::T3_AMP * LIBOI_N_UV_BINS + bin;
+		t_segment_id[t3_offset + mNT3 + i] = LibOIEnums::T3_PHI * LIBOI_N_UV_BINS + bin;
+	}
+
+	// Ranges of each observable type in the data buffer
+	unsigned int type_start[LibOIEnums::N_OBSERVABLE_TYPES + 1] =
+		{0, mNVis, v2_offset, t3_offset, t3_offset + mNT3, mNData};
+
+	valarray<cl_uint2> t_segment_range(n_segments);
+	for(unsigned int i = 0; i < n_segments; i++)
+	{
+		unsigned int type = i / LIBOI_N_UV_BINS;
+		t_segment_range[i].s[0] = type_start[type];
+		t_segment_range[i].s[1] = type_start[type + 1];
+	}
+
+	WriteBuffer(mData_segment_id, 0, sizeof(cl_uint) * mNData, &t_segment_id[0]);
+	WriteBuffer(mData_segment_range, 0, sizeof(cl_uint2) * n_segments, &t_segment_range[0]);
+
+	// The temporary buffers go out of scope when we return, wait for the writes to complete.
+	clFinish(mQueue);
+}
+
+/// Divides the UV points into at most LIBOI_N_UV_CHUNKS chunks of mUVChunkSize points and assigns
+/// each datum the chunk of the highest-indexed UV point it references. Once the Fourier transform
+/// of chunks [0, k] has been computed, every datum with a chunk ID <= k may be evaluated.
+/// This permits the chi2 to be accumulated chunk-by-chunk, see CLibOI::ImageToChi2(data, threshold, exceeded).
+void COILibData::BuildUVChunks(unsigned int n_uv,
+	const vector<unsigned int> & vis_uv_ref,
+	const vector<unsigned int> & vis2_uv_ref,
+	const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref)
+{
+	// Chunks are a multiple of 16 UV points, matching the padding in AllocateMemory.
+	mUVChunkSize = NextHighestMultiple(16, (n_uv - 1) / LIBOI_N_UV_CHUNKS);
+	mNUVChunks = (n_uv + mUVChunkSize - 1) / mUVChunkSize;
+
+	valarray<cl_uint> & t_chunk_id = mUVChunkID;
+	t_chunk_id.resize(mNData);
+	unsigned int v2_offset = CalculateOffset_V2(mNVis);
+	unsigned int t3_offset = CalculateOffset_T3(mNVis, mNV2);
+	unsigned int chunk = 0;
+
+	for(unsigned int i = 0; i < mNVis; i++)
+	{
+		chunk = vis_uv_ref[i] / mUVChunkSize;
+		t_chunk_id[i] = chunk;
+		t_chunk_id[mNVis + i] = chunk;
+	}
+
+	for(unsigned int i = 0; i < mNV2; i++)
+		t_chunk_id[v2_offset + i] = vis2_uv_ref[i] / mUVChunkSize;
+
+	for(unsigned int i = 0; i < mNT3; i++)
+	{
+		chunk = max(get<0>(t3_uv_ref[i]), max(get<1>(t3_uv_ref[i]), get<2>(t3_uv_ref[i]))) / mUVChunkSize;
+		t_chunk_id[t3_offset + i] = chunk;
+		t_chunk_id[t3_offset + mNT3 + i] = chunk;
+	}
+
+	UploadUVChunks();
+}
+
+/// Uploads the UV chunk IDs in mUVChunkID and the [start, end) range of the data in each chunk.
+///
+/// Whitened chi elements depend on all of the elements in their covariance block (see SetCovariance),
+/// so every element of a block is assigned to the last chunk referenced by the block.
+void COILibData::UploadUVChunks()
+{
+	unsigned int chunk = 0;
+	valarray<cl_uint> t_chunk_id = mUVChunkID;
+
+	for(auto block: mCovarianceBlocks)
+	{
+		valarray<cl_uint> block_ids = t_chunk_id[slice(block.start, block.size, 1)];
+		t_chunk_id[slice(block.start, block.size, 1)] = block_ids.max();
+	}
+
+	// Find the [start, end) range of the data in each chunk. Empty chunks have start = end = 0.
+	valarray<cl_uint2> t_chunk_range(LIBOI_N_UV_CHUNKS);
+	for(unsigned int i = 0; i < LIBOI_N_UV_CHUNKS; i++)
+	{
+		t_chunk_range[i].s[0] = mNData;
+		t_chunk_range[i].s[1] = 0;
+	}
+
+	for(unsigned int i = 0; i < mNData; i++)
+	{
+		chunk = t_chunk_id[i];
+		t_chunk_range[chunk].s[0] = min(t_chunk_range[chunk].s[0], i);
+		t_chunk_range[chunk].s[1] = max(t_chunk_range[chunk].s[1], i + 1);
+	}
+
+	for(unsigned int i = 0; i < LIBOI_N_UV_CHUNKS; i++)
+	{
+		if(t_chunk_range[i].s[1] == 0)
+			t_chunk_range[i].s[0] = 0;
+	}
+
+	// The same ranges within the Vis, V2 and T3 data, counting each complex value once, see GetUVChunkTypeRanges.
+	unsigned int type_offset[3] = {CalculateOffset_Vis(), CalculateOffset_V2(mNVis), CalculateOffset_T3(mNVis, mNV2)};
+	unsigned int type_size[3] = {mNVis, mNV2, mNT3};
+	unsigned int type_parts[3] = {2, 1, 2};
+	mUVChunkTypeRange.resize(3 * LIBOI_N_UV_CHUNKS);
+	for(unsigned int i = 0; i < 3 * LIBOI_N_UV_CHUNKS; i++)
+	{
+		mUVChunkTypeRange[i].s[0] = 0;
+		mUVChunkTypeRange[i].s[1] = 0;
+	}
+
+	for(unsigned int type = 0; type < 3; type++)
+	{
+		for(unsigned int i = 0; i < type_size[type]; i++)
+		{
+			for(unsigned int part = 0; part < type_parts[type]; part++)
+			{
+				cl_uint2 & range = mUVChunkTypeRange[3 * t_chunk_id[type_offset[type] + part * type_size[type] + i] + type];
+				if(range.s[1] == 0)
+					range.s[0] = i;
+
+				range.s[1] = i + 1;
+			}
+		}
+	}
+
+	WriteBuffer(mData_uv_chunk_id, 0, sizeof(cl_uint) * mNData, &t_chunk_id[0]);
+	WriteBuffer(mData_uv_chunk_range, 0, sizeof(cl_uint2) * LIBOI_N_UV_CHUNKS, &t_chunk_range[0]);
+
+	// The temporary buffers go out of scope when we return, wait for the writes to complete.
+	clFinish(mQueue);
+}
+
+/// Sets the bootstrap resampling block of each datum, in the same order as the data buffer. All data in a block
+/// are weighted by the same multiplicity in a bootstrap replicate, see CRoutine_Chi::Chi2Bootstrap. Block numbers
+/// need not be contiguous, for example data may be grouped by baseline or time of observation.
+/// An empty array restores the default blocks, see GetBootstrapBlocks.
+/// Throws a runtime_error if the size does not match the data.
+void COILibData::SetBootstrapBlocks(const valarray<cl_uint> & blocks)
+{
+	if(blocks.size() != 0 && blocks.size() != mNData)
+		throw runtime_error("Number of bootstrap blocks does not match the number of data.");
+
+	mBootstrapBlock.resize(blocks.size());
+	mBootstrapBlock = blocks;
+
+	if(mData_bootstrap_block) clReleaseMemObject(mData_bootstrap_block);
+	mData_bootstrap_block = 0;
+}
+
+/// Sets the block-diagonal covariance of the data. Elements which are not in a block remain
+/// uncorrelated with the uncertainties given in the data file.
+///
+/// Each block is factored once here. The chi routines then whiten the chi elements of each block,
+/// (data - model) / sigma, by a triangular solve against the Cholesky factor of its correlation matrix.
+/// Throws a runtime_error if the blocks overlap, extend past the data, or are not positive definite.
+void COILibData::SetCovariance(const vector<CovarianceBlock> & blocks)
+{
+	vector<CovarianceBlock> t_blocks = blocks;
+	sort(t_blocks.begin(), t_blocks.end(),
+			[](const CovarianceBlock & a, const CovarianceBlock & b) { return a.start < b.start; });
+
+	unsigned int end = 0;
+	for(auto block: t_blocks)
+	{
+		if(block.start < end || block.start + block.size > mNData)
+			throw runtime_error("Covariance blocks overlap or exceed the size of the data.");
+
+		if(block.covariance.size() != block.size * block.size)
+			throw runtime_error("Covariance block does not match its specified size.");
+
+		end = block.start + block.size;
+	}
+
+	mCovarianceBlocks = t_blocks;
+	if(mData_bootstrap_block) clReleaseMemObject(mData_bootstrap_block);
+	mData_bootstrap_block = 0;
+	UploadInverseErrors();
+	UploadUVChunks();
+}
+
+/// Reads the uncertainties back from the OpenCL device and calls UploadInverseErrors(err).
+void COILibData::UploadInverseErrors()
+{
+	int status = CL_SUCCESS;
+	valarray<cl_float> t_err(mNData);
+	status = clEnqueueReadBuffer(mQueue, mData_err_cl, CL_TRUE, 0, sizeof(cl_float) * mNData, &t_err[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	UploadInverseErrors(t_err);
+}
+
+/// Computes the inverse uncertainties used by the chi kernels from the uncertainties in the data file (t_err),
+/// the weights (see SetWeights) and the covariance blocks (see SetCovariance) and uploads them to the OpenCL device.
+/// The covariance blocks are factored and uploaded here too.
+///
+/// The weights are folded into the inverse uncertainties, sqrt(weight) / sigma, so that the chi2 becomes
+/// sum(weight * chi^2). Elements with zero weight contribute nothing. Within a covariance block, masked elements
+/// are decoupled from the rest of the block, the remaining elements are whitened by their own sub-matrix.
+///
+/// The log-likelihood constants, -sum(weight * (log(sigma) + log(2 pi) / 2)) - log(det(L)),
+/// are computed for each observable type.
+void COILibData::UploadInverseErrors(const valarray<cl_float> & t_err)
+{
+	int status = CL_SUCCESS;
+
+	if(mData_cov_blocks) clReleaseMemObject(mData_cov_blocks);
+	if(mData_cov_factors) clReleaseMemObject(mData_cov_factors);
+	mData_cov_blocks = 0;
+	mData_cov_factors = 0;
+
+	valarray<double> t_sigma(mNData);
+	valarray<cl_float> t_inv_err(mNData);
+	valarray<double> log_det(0.0, mNData);	// log(L_ii) contribution of each element
+	for(unsigned int i = 0; i < mNData; i++)
+		t_sigma[i] = t_err[i];
+
+	unsigned int n_blocks = mCovarianceBlocks.size();
+	unsigned int n_factors = 0;
+	for(auto block: mCovarianceBlocks)
+		n_factors += block.size * (block.size + 1) / 2;
+
+	valarray<cl_uint4> t_blocks(n_blocks);
+	valarray<cl_float> t_factors(n_factors);
+	unsigned int offset = 0;
+	for(unsigned int b = 0; b < n_blocks; b++)
+	{
+		const CovarianceBlock & block = mCovarianceBlocks[b];
+		unsigned int n = block.size;
+		unsigned int start = block.start;
+
+		// Split the covariance into sigma and the correlation matrix, cov = D * corr * D
+		for(unsigned int i = 0; i < n; i++)
+			t_sigma[start + i] = sqrt(block.covariance[i*n + i]);
+
+		// Masked elements are decoupled by replacing their rows and columns with those of the identity.
+		valarray<double> corr(n*n);
+		for(unsigned int i = 0; i < n; i++)
+		{
+			for(unsigned int j = 0; j < n; j++)
+			{
+				if(mWeights[start + i] > 0 && mWeights[start + j] > 0)
+					corr[i*n + j] = block.covariance[i*n + j] / (t_sigma[start + i] * t_sigma[start + j]);
+				else
+					corr[i*n + j] = (i == j) ? 1 : 0;
+			}
+		}
+
+		if(!Cholesky(corr, n))
+			throw runtime_error("Covariance block is not positive definite.");
+
+		// Pack the lower triangle by rows. The diagonal is stored inverted so the kernel multiplies.
+		t_blocks[b].s[0] = start;
+		t_blocks[b].s[1] = n;
+		t_blocks[b].s[2] = offset;
+		t_blocks[b].s[3] = 0;
+		for(unsigned int i = 0; i < n; i++)
+		{
+			for(unsigned int j = 0; j < i; j++)
+				t_factors[offset + j] = corr[i*n + j];
+
+			t_factors[offset + i] = 1.0 / corr[i*n + i];
+			log_det[start + i] = log(corr[i*n + i]);
+			offset += i + 1;
+		}
+	}
+
+	// Inverse uncertainties, including the weights.
+	for(unsigned int i = 0; i < mNData; i++)
+		t_inv_err[i] = sqrt(mWeights[i]) / t_sigma[i];
+
+	// log(L) = -sum(log(sigma)) - log(det(L)) - N/2 log(2 pi) - chi2 / 2. Everything except chi2 is cached
+	// for each observable type.
+	unsigned int type_start[LibOIEnums::N_OBSERVABLE_TYPES + 1] =
+		{0, mNVis, CalculateOffset_V2(mNVis), CalculateOffset_T3(mNVis, mNV2), CalculateOffset_T3(mNVis, mNV2) + mNT3, mNData};
+
+	for(unsigned int type = 0; type < LibOIEnums::N_OBSERVABLE_TYPES; type++)
+	{
+		double constant = 0;
+		for(unsigned int i = type_start[type]; i < type_start[type + 1]; i++)
+			constant -= mWeights[i] * (log(t_sigma[i]) + 0.5 * log(2 * M_PI)) + log_det[i];
+
+		mLogLikeConstant[type] = constant;
+	}
+
+	WriteBuffer(mData_inv_err_cl, 0, sizeof(cl_float) * mNData, &t_inv_err[0]);
+
+	if(n_blocks > 0)
+	{
+		mData_cov_blocks = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_uint4) * n_blocks, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+		mData_cov_factors = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_float) * n_factors, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+
+		status  = clEnqueueWriteBuffer(mQueue, mData_cov_blocks, CL_FALSE, 0, sizeof(cl_uint4) * n_blocks, &t_blocks[0], 0, NULL, NULL);
+		status |= clEnqueueWriteBuffer(mQueue, mData_cov_factors, CL_FALSE, 0, sizeof(cl_float) * n_factors, &t_factors[0], 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+	}
+
+	// The temporary buffers go out of scope when we return, wait for the writes to complete.
+	clFinish(mQueue);
+}
+
+/// Sets the weight of each datum, weights[i] >= 0, in the same order as the data buffer.
+/// The chi2 becomes sum(weight * chi^2), a weight of zero masks the datum. UV points which are only
+/// referenced by masked data are skipped by the Fourier transform.
+/// Throws a runtime_error if the size does not match the data or a weight is negative.
+void COILibData::SetWeights(const valarray<cl_float> & weights)
+{
+	if(weights.size() != mNData)
+		throw runtime_error("Number of weights does not match the number of data.");
+
+	if(weights.min() < 0)
+		throw runtime_error("Weights must be non-negative.");
+
+	mWeights = weights;
+	ClearActiveUV();
+	UploadInverseErrors();
+}
+
+/// Returns the sum of the log-likelihood constants of the observable types selected in observables,
+/// see LibOIEnums::ObservableFlags.
+double COILibData::GetLogLikeConstant(unsigned int observables)
+{
+	double constant = 0;
+	for(unsigned int type = 0; type < LibOIEnums::N_OBSERVABLE_TYPES; type++)
+	{
+		if(observables & (1 << type))
+			constant += mLogLikeConstant[type];
+	}
+
+	return constant;
+}
+
+/// Returns the bootstrap resampling block of each datum. Unless set by SetBootstrapBlocks, each measurement
+/// is its own block: the amplitude and phase of a complex visibility or triple product are resampled together,
+/// as are all data in a covariance block (see SetCovariance).
+valarray<cl_uint> COILibData::GetBootstrapBlocks()
+{
+	if(mBootstrapBlock.size() == mNData)
+		return mBootstrapBlock;
+
+	// Union-find over the data, each block is labeled by its lowest index.
+	valarray<cl_uint> t_block(mNData);
+	for(unsigned int i = 0; i < mNData; i++)
+		t_block[i] = i;
+
+	auto find = [&t_block](cl_uint i)
+	{
+		while(t_block[i] != i)
+			i = t_block[i] = t_block[t_block[i]];
+		return i;
+	};
+	auto join = [&t_block, &find](cl_uint a, cl_uint b)
+	{
+		a = find(a);
+		b = find(b);
+		t_block[max(a, b)] = min(a, b);
+	};
+
+	unsigned int t3_offset = CalculateOffset_T3(mNVis, mNV2);
+	for(unsigned int i = 0; i < mNVis; i++)
+		join(i, mNVis + i);
+	for(unsigned int i = 0; i < mNT3; i++)
+		join(t3_offset + i, t3_offset + mNT3 + i);
+	for(auto block: mCovarianceBlocks)
+	{
+		for(unsigned int i = 1; i < block.size; i++)
+			join(block.start, block.start + i);
+	}
+
+	for(unsigned int i = 0; i < mNData; i++)
+		t_block[i] = find(i);
+
+	return t_block;
+}
+
+/// Returns a buffer of the bootstrap resampling block of each datum, see GetBootstrapBlocks.
+/// The buffer is cached until the blocks or the covariance change.
+cl_mem COILibData::GetLoc_BootstrapBlock()
+{
+	if(mData_bootstrap_block)
+		return mData_bootstrap_block;
+
+	int status = CL_SUCCESS;
+	valarray<cl_uint> t_block = GetBootstrapBlocks();
+	mData_bootstrap_block = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_uint) * mNData, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+	status = clEnqueueWriteBuffer(mQueue, mData_bootstrap_block, CL_TRUE, 0, sizeof(cl_uint) * mNData, &t_block[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+
+	return mData_bootstrap_block;
+}
+
+/// Returns a buffer of the indices of the UV points referenced by unmasked data of the observable types
+/// selected in observables. n_active is set to the number of indices. If every UV point referenced by the data
+/// is in use, no buffer is created, 0 is returned and n_active is set to GetNumUV().
+/// The buffers are cached until the weights or data change.
+cl_mem COILibData::GetLoc_ActiveUV(unsigned int observables, unsigned int & n_active)
+{
+	observables &= LibOIEnums::ALL_OBSERVABLES;
+	auto it = mActiveUV.find(observables);
+	if(it != mActiveUV.end())
+	{
+		n_active = it->second.second;
+		return it->second.first;
+	}
+
+	// Flag the UV points which are referenced by any datum and those which are in use.
+	vector<bool> referenced(mNUV, false);
+	vector<bool> active(mNUV, false);
+	unsigned int v2_offset = CalculateOffset_V2(mNVis);
+	unsigned int t3_offset = CalculateOffset_T3(mNVis, mNV2);
+	bool vis_amp = observables & LibOIEnums::VIS_AMP_FLAG;
+	bool vis_phi = observables & LibOIEnums::VIS_PHI_FLAG;
+	bool v2 = observables & LibOIEnums::V2_FLAG;
+	bool t3_amp = observables & LibOIEnums::T3_AMP_FLAG;
+	bool t3_phi = observables & LibOIEnums::T3_PHI_FLAG;
+
+	for(unsigned int i = 0; i < mNVis; i++)
+	{
+		referenced[mVisUVRef[i]] = true;
+		if((vis_amp && mWeights[i] > 0) || (vis_phi && mWeights[mNVis + i] > 0))
+			active[mVisUVRef[i]] = true;
+	}
+
+	for(unsigned int i = 0; i < mNV2; i++)
+	{
+		referenced[mV2UVRef[i]] = true;
+		if(v2 && mWeights[v2_offset + i] > 0)
+			active[mV2UVRef[i]] = true;
+	}
+
+	for(unsigned int i = 0; i < mNT3; i++)
+	{
+		bool in_use = (t3_amp && mWeights[t3_offset + i] > 0) || (t3_phi && mWeights[t3_offset + mNT3 + i] > 0);
+		unsigned int uv[3] = {get<0>(mT3UVRef[i]), get<1>(mT3UVRef[i]), get<2>(mT3UVRef[i])};
+		for(unsigned int j = 0; j < 3; j++)
+		{
+			referenced[uv[j]] = true;
+			if(in_use)
+				active[uv[j]] = true;
+		}
+	}
+
+	valarray<cl_uint> t_index(mNUV);
+	unsigned int n_referenced = 0;
+	n_active = 0;
+	for(unsigned int i = 0; i < mNUV; i++)
+	{
+		if(referenced[i])
+			n_referenced++;
+
+		if(active[i])
+			t_index[n_active++] = i;
+	}
+
+	int status = CL_SUCCESS;
+	cl_mem index = 0;
+	if(n_active == n_referenced)
+	{
+		n_active = mNUV;
+	}
+	else if(n_active > 0)
+	{
+		index = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_uint) * n_active, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+		status = clEnqueueWriteBuffer(mQueue, index, CL_TRUE, 0, sizeof(cl_uint) * n_active, &t_index[0], 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+	}
+
+	mActiveUV[observables] = make_pair(index, n_active);
+	return index;
+}
+
+/// Releases the cached active UV index buffers.
+void COILibData::ClearActiveUV()
+{
+	for(auto it: mActiveUV)
+	{
+		if(it.second.first) clReleaseMemObject(it.second.first);
+	}
+
+	mActiveUV.clear();
+}
+
+/// Computes the Cholesky factorization, A = L * L^T, of the n x n symmetric matrix A (row-major) in place.
+/// Only the lower triangle of the result is valid. Returns false if A is not positive definite.
+bool COILibData::Cholesky(valarray<double> & A, unsigned int n)
+{
+	for(unsigned int j = 0; j < n; j++)
+	{
+		double sum = A[j*n + j];
+		for(unsigned int k = 0; k < j; k++)
+			sum -= A[j*n + k] * A[j*n + k];
+
+		if(!(sum > 0))
+			return false;
+
+		A[j*n + j] = sqrt(sum);
+
+		for(unsigned int i = j + 1; i < n; i++)
+		{
+			sum = A[i*n + j];
+			for(unsigned int k = 0; k < j; k++)
+				sum -= A[i*n + k] * A[j*n + k];
+
+			A[i*n + j] = sum / A[j*n + j];
+		}
+	}
+
+	return true;
 }
 
 unsigned int COILibData::CalculateOffset_Vis(void)
@@ -422,6 +1331,26 @@ void COILibData::CopyFromDevice(vector<pair<double,double> > & uv_points, cl_mem
 }
 
 
+/// Copies the weights (see SetWeights), covariance (see SetCovariance) and bootstrap blocks (see SetBootstrapBlocks)
+/// of source, a data set of the same size. Used by COILibDataList::ReplaceData.
+/// Throws a length_error if the number of data differ.
+void COILibData::CopySettings(const COILibData & source)
+{
+	if(source.mNData != mNData)
+		throw length_error("Size of data allocation does not match allocated size");
+
+	mWeights = source.mWeights;
+	mCovarianceBlocks = source.mCovarianceBlocks;
+	mBootstrapBlock.resize(source.mBootstrapBlock.size());
+	mBootstrapBlock = source.mBootstrapBlock;
+
+	if(mData_bootstrap_block) clReleaseMemObject(mData_bootstrap_block);
+	mData_bootstrap_block = 0;
+	ClearActiveUV();
+	UploadInverseErrors();
+	UploadUVChunks();
+}
+
 /// Copies the data which resides in host memory to the OpenCL device
 void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 		const valarray<complex<double>> & vis, const valarray<pair<double,double>> & vis_err, const vector<unsigned int> & vis_uv_ref,
@@ -431,8 +1360,6 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 		const vector<tuple<short, short, short>> & t3_uv_sign)
 {
 
-	int status = CL_SUCCESS;
-
 	//
 	// Start uploading data to the OpenCL device. We need to copy the above data into
 	// OpenCL data types to ensure things are moved correctly.
@@ -443,6 +1370,13 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 	// The number of data must always be greater than zero.
 	assert(mNData > 0);
 
+	// All uncertainties, used to compute the inverse uncertainties, see UploadInverseErrors.
+	valarray<cl_float> t_err(mNData);
+
+	// Gather the arena region on the host and upload it with one write, see WriteBuffer.
+	if(mArenaRegion >= 0)
+		mStaging.assign(mArenaSize, 0);
+
 	// #####
 	// UV points:
 	// Stored as pair of floats: [(u,v)_0, ..., (u,v)_N]
@@ -464,8 +1398,8 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 
 	// Copy over the UV points.  We MUST always have at least one UV point (otherwise the data would be nonsense).
 	assert(mNUV > 0);
-	status  = clEnqueueWriteBuffer(mQueue, mData_uv_cl, CL_FALSE, 0, sizeof(cl_float2) * mNUV, &t_uv_points[0], 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+	WriteBuffer(mData_uv_cl, 0, sizeof(cl_float2) * mNUV, &t_uv_points[0]);
+	mUVPoints = t_uv_points;
 
 	// #####
 	// Vis.
@@ -481,15 +1415,17 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 		t_vis_err[i] = vis_err[i].first;
 		t_vis_err[mNVis + i] = vis_err[i].second;
 		t_vis_uvref[i] = vis_uv_ref[i];
+
+		t_err[i] = t_vis_err[i];
+		t_err[mNVis + i] = t_vis_err[mNVis + i];
 	}
 
 	if(mNVis > 0)
 	{
 		// Copy the data.  No offset, this is always at the start of the buffer.
-		status  = clEnqueueWriteBuffer(mQueue, mData_cl, CL_FALSE, 0, sizeof(cl_float) * 2*mNVis, &t_vis[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_err_cl, CL_FALSE, 0, sizeof(cl_float) * 2*mNVis, &t_vis_err[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_Vis_uv_ref, CL_FALSE, 0, sizeof(cl_uint) * mNVis, &t_vis_uvref[0], 0, NULL, NULL);
-		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+		WriteBuffer(mData_cl, 0, sizeof(cl_float) * 2*mNVis, &t_vis[0]);
+		WriteBuffer(mData_err_cl, 0, sizeof(cl_float) * 2*mNVis, &t_vis_err[0]);
+		WriteBuffer(mData_Vis_uv_ref, 0, sizeof(cl_uint) * mNVis, &t_vis_uvref[0]);
 	}
 
 	// #####
@@ -498,20 +1434,22 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 	valarray<cl_float> t_vis2(mNV2);
 	valarray<cl_float> t_vis2_err(mNV2);
 	valarray<cl_uint> t_vis2_uvref(mNV2);
+	unsigned int v2_offset = CalculateOffset_V2(mNVis);
 	for(unsigned int i = 0; i < mNV2; i++)
 	{
 		t_vis2[i] = vis2[i];
 		t_vis2_err[i] = vis2_err[i];
 		t_vis2_uvref[i] = vis2_uv_ref[i];
+
+		t_err[v2_offset + i] = t_vis2_err[i];
 	}
 
 	if(mNV2 > 0)
 	{
 		int offset = CalculateOffset_V2(mNVis);
-		status  = clEnqueueWriteBuffer(mQueue, mData_cl, CL_FALSE, sizeof(cl_float) * offset, sizeof(cl_float) * mNV2, &t_vis2[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_err_cl, CL_FALSE, sizeof(cl_float) * offset, sizeof(cl_float) * mNV2, &t_vis2_err[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_V2_uv_ref, CL_FALSE, 0, sizeof(cl_uint) * mNV2, &t_vis2_uvref[0], 0, NULL, NULL);
-		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+		WriteBuffer(mData_cl, sizeof(cl_float) * offset, sizeof(cl_float) * mNV2, &t_vis2[0]);
+		WriteBuffer(mData_err_cl, sizeof(cl_float) * offset, sizeof(cl_float) * mNV2, &t_vis2_err[0]);
+		WriteBuffer(mData_V2_uv_ref, 0, sizeof(cl_uint) * mNV2, &t_vis2_uvref[0]);
 	}
 
 
@@ -523,6 +1461,7 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 	valarray<cl_float> t_t3_err(2*mNT3);
 	valarray<cl_uint4> t_t3_uvref(mNT3);
 	valarray<cl_short4> t_t3_sign(mNT3);
+	unsigned int t3_offset = CalculateOffset_T3(mNVis, mNV2);
 	for(unsigned int i = 0; i < mNT3; i++)
 	{
 		t_t3[i] = real(t3[i]);
@@ -530,6 +1469,9 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 		t_t3_err[i] = t3_err[i].first;
 		t_t3_err[mNT3 + i] = t3_err[i].second;
 
+		t_err[t3_offset + i] = t_t3_err[i];
+		t_err[t3_offset + mNT3 + i] = t_t3_err[mNT3 + i];
+
 		// UV references
 		t_t3_uvref[i].s[0] = get<0>(t3_uv_ref[i]);
 		t_t3_uvref[i].s[1] = get<1>(t3_uv_ref[i]);
@@ -546,15 +1488,73 @@ void COILibData::CopyToDevice(const vector<pair<double,double> > & uv_points,
 	if(mNT3 > 0)
 	{
 		int offset = CalculateOffset_T3(mNVis, mNV2);
-		status  = clEnqueueWriteBuffer(mQueue, mData_cl, CL_FALSE, sizeof(cl_float) * offset, sizeof(cl_float) * 2*mNT3, &t_t3[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_err_cl, CL_FALSE, sizeof(cl_float) * offset, sizeof(cl_float) * 2*mNT3, &t_t3_err[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_T3_uv_ref, CL_FALSE, 0, sizeof(cl_uint4) * mNT3, &t_t3_uvref[0], 0, NULL, NULL);
-		status |= clEnqueueWriteBuffer(mQueue, mData_T3_sign, CL_FALSE, 0, sizeof(cl_short4) * mNT3, &t_t3_sign[0], 0, NULL, NULL);
-		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+		WriteBuffer(mData_cl, sizeof(cl_float) * offset, sizeof(cl_float) * 2*mNT3, &t_t3[0]);
+		WriteBuffer(mData_err_cl, sizeof(cl_float) * offset, sizeof(cl_float) * 2*mNT3, &t_t3_err[0]);
+		WriteBuffer(mData_T3_uv_ref, 0, sizeof(cl_uint4) * mNT3, &t_t3_uvref[0]);
+		WriteBuffer(mData_T3_sign, 0, sizeof(cl_short4) * mNT3, &t_t3_sign[0]);
+	}
+
+	CopyToDevice_Derived(uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref, t_err);
+}
+
+/// Computes the chi2 segments, UV chunks and inverse uncertainties of the data and uploads them, keeps host
+/// copies of the UV references and completes the upload started by CopyToDevice or ReadCache.
+void COILibData::CopyToDevice_Derived(const vector<pair<double,double> > & uv_points,
+		const vector<unsigned int> & vis_uv_ref, const vector<unsigned int> & vis2_uv_ref,
+		const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
+		const valarray<cl_float> & t_err)
+{
+	// #####
+	// Chi2 segments
+	BuildSegments(uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref);
+	BuildUVChunks(uv_points.size(), vis_uv_ref, vis2_uv_ref, t3_uv_ref);
+
+	// Keep a host copy of the UV references to determine which UV points are in use.
+	mVisUVRef = vis_uv_ref;
+	mV2UVRef = vis2_uv_ref;
+	mT3UVRef = t3_uv_ref;
+	ClearActiveUV();
+
+	// #####
+	// Inverse uncertainties, same layout as mData_err_cl
+	if(mWeights.size() != mNData)
+	{
+		mWeights.resize(mNData);
+		mWeights = 1;
 	}
+	UploadInverseErrors(t_err);
+
+	if(mStaging.size() > 0)
+		mArena->Write(mArenaRegion, &mStaging[0], mStaging.size(), mQueue);
 
 	// Wait for the queue to process
 	clFinish(mQueue);
+	vector<char>().swap(mStaging);
+}
+
+/// Returns a shared, read-only copy of the OIFITS data. If the data were loaded from the cache or released after
+/// loading (see COILibDataList::SetKeepHostData), the OIFITS file is read again. Released data are only kept for as
+/// long as a caller holds the returned snapshot, which all calls in the meantime share. Concurrent calls are
+/// serialized so that the file is read at most once.
+OIDataSnapshot COILibData::GetData(void)
+{
+	// Lock the data, automatically unlocks
+	lock_guard<mutex> lock(mDataMutex);
+
+	if(mData)
+		return mData;
+
+	OIDataSnapshot data = mDataSnapshot.lock();
+	if(!data)
+	{
+		data = ReadData();
+		if(mKeepHostData)
+			mData = data;
+		else
+			mDataSnapshot = data;
+	}
+
+	return data;
 }
 
 /// Copies up to n of the data from the OpenCL device to output.
@@ -585,6 +1585,12 @@ void COILibData::GetDataUncertainties(float * output, unsigned int & n)
 	clFinish(mQueue);
 }
 
+/// Returns the number of chi2 segments, see COILibData::BuildSegments
+unsigned int COILibData::NumSegments(void)
+{
+	return LibOIEnums::N_OBSERVABLE_TYPES * LIBOI_N_UV_BINS;
+}
+
 // Calculate the total number of elements in the data buffer following the data storage definition in COILibData.h
 unsigned int COILibData::TotalBufferSize(unsigned int n_vis, unsigned int n_v2, unsigned int n_t3)
 {
@@ -612,7 +1618,10 @@ void COILibData::Replace(const OIDataList & new_data)
 	vector<tuple<unsigned int, unsigned int, unsigned int>> t3_uv_ref;
 	vector<tuple<short, short, short>> t3_uv_sign;
 
+	valarray<cl_uint> uv_order;
+
 	ccoifits::Export_MinUV(new_data, uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref, t3_uv_sign);
+	ReorderUV(uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref, uv_order);
 
 	unsigned int n_vis = vis.size();
 	unsigned int n_v2 = vis2.size();
@@ -647,8 +1656,474 @@ void COILibData::Replace(const OIDataList & new_data)
 		throw length_error("Size of data allocation does not match allocated size");
 	}
 
+	// Nothing is modified until the checks above pass. The read-only buffers may be shared with other
+	// data sets, see ShareBuffers, so stop sharing them first.
+	UnregisterBuffers();
+	mContentHash = 0;
+	mContentCheck = 0;
+	mUVOrder = uv_order;
+
+	// The replacement gets buffers of its own if the existing ones are shared.
+	if(mBuffersShared)
+	{
+		AllocateMemory();
+		mBuffersShared = false;
+	}
+
 	// Copy data over to the OpenCL device.
 	CopyToDevice(uv_points, vis, vis_err, vis_uv_ref, vis2, vis2_err, vis2_uv_ref, t3, t3_err, t3_uv_ref, t3_uv_sign);
+
+	// The replacement cannot be re-read from the file, always keep it.
+	lock_guard<mutex> lock(mDataMutex);
+	mData = make_shared<const OIDataList>(new_data);
+	mDataSnapshot.reset();
+	mKeepHostData = true;
+}
+
+/// Renumbers the UV points in the order in which they are first referenced by the Vis, V2 and T3 data (first-touch
+/// order) and remaps the references to match. Export_MinUV returns the UV points in no particular order, so the
+/// gathers in the FT to data kernels jump around the FT buffer. Because the data are typically sorted by time and
+/// baseline, consecutive data now read nearby FT entries and the UV chunks (see BuildUVChunks) complete in order.
+/// The order of the data themselves is unchanged. The original index of each UV point is stored in uv_order.
+void COILibData::ReorderUV(vector<pair<double,double> > & uv_points,
+	vector<unsigned int> & vis_uv_ref,
+	vector<unsigned int> & vis2_uv_ref,
+	vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
+	valarray<cl_uint> & uv_order)
+{
+	unsigned int n_uv = uv_points.size();
+	unsigned int next = 0;
+	vector<unsigned int> new_index(n_uv, n_uv);
+	auto touch = [&](unsigned int & uv)
+	{
+		if(new_index[uv] == n_uv)
+			new_index[uv] = next++;
+		uv = new_index[uv];
+	};
+
+	for(auto & uv: vis_uv_ref)
+		touch(uv);
+	for(auto & uv: vis2_uv_ref)
+		touch(uv);
+	for(auto & t3: t3_uv_ref)
+	{
+		touch(get<0>(t3));
+		touch(get<1>(t3));
+		touch(get<2>(t3));
+	}
+
+	// Points which are not referenced at all go last.
+	uv_order.resize(n_uv);
+	vector<pair<double,double> > t_uv_points(n_uv);
+	for(unsigned int i = 0; i < n_uv; i++)
+	{
+		if(new_index[i] == n_uv)
+			new_index[i] = next++;
+
+		uv_order[new_index[i]] = i;
+		t_uv_points[new_index[i]] = uv_points[i];
+	}
+
+	uv_points.swap(t_uv_points);
+}
+
+/// Undoes ReorderUV with the order uv_order on UV points and references read back from the OpenCL device,
+/// see CopyFromDevice. Padding UV points beyond those in uv_order keep their position.
+void COILibData::RestoreUVOrder(const valarray<cl_uint> & uv_order,
+	vector<pair<double,double> > & uv_points,
+	vector<unsigned int> & vis_uv_ref,
+	vector<unsigned int> & vis2_uv_ref,
+	vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref)
+{
+	unsigned int n_order = uv_order.size();
+	auto original = [&](unsigned int & uv)
+	{
+		if(uv < n_order)
+			uv = uv_order[uv];
+	};
+
+	vector<pair<double,double> > t_uv_points(uv_points);
+	for(unsigned int i = 0; i < min(n_order, (unsigned int) uv_points.size()); i++)
+		t_uv_points[uv_order[i]] = uv_points[i];
+	uv_points.swap(t_uv_points);
+
+	for(auto & uv: vis_uv_ref)
+		original(uv);
+	for(auto & uv: vis2_uv_ref)
+		original(uv);
+	for(auto & t3: t3_uv_ref)
+	{
+		original(get<0>(t3));
+		original(get<1>(t3));
+		original(get<2>(t3));
+	}
+}
+
+/// Returns true if source, a data set which has been uploaded, has the same content as this data set, whose counts
+/// are set but whose data have only been exported and reordered, see InitData. The counts, average JD and wavelength,
+/// UV points and UV references are compared with the host copies of source. The data, uncertainties and T3 signs are
+/// packed as in CopyToDevice and compared with the buffers of source, which are read back from the OpenCL device.
+/// Used to rule out hash collisions in ShareBuffers.
+bool COILibData::SameContent(const COILibData & source, const vector<pair<double,double> > & uv_points,
+	const valarray<complex<double>> & vis, const valarray<pair<double,double>> & vis_err,
+	const vector<unsigned int> & vis_uv_ref,
+	const valarray<double> & vis2, const valarray<double> & vis2_err,
+	const vector<unsigned int> & vis2_uv_ref,
+	const valarray<complex<double>> & t3, const valarray<pair<double,double> > & t3_err,
+	const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
+	const vector<tuple<short, short, short>> & t3_uv_sign)
+{
+	int status = CL_SUCCESS;
+
+	if(source.mNVis != mNVis || source.mNV2 != mNV2 || source.mNT3 != mNT3 || source.mNData != mNData
+			|| source.mNUV != (unsigned int) NextHighestMultiple(16, uv_points.size())
+			|| source.mAveJD != mAveJD || source.mAveWavelength != mAveWavelength)
+		return false;
+
+	if(source.mUVPoints.size() < uv_points.size() || source.mUVOrder.size() != mUVOrder.size())
+		return false;
+
+	for(unsigned int i = 0; i < uv_points.size(); i++)
+	{
+		if(source.mUVPoints[i].s[0] != cl_float(uv_points[i].first) || source.mUVPoints[i].s[1] != cl_float(uv_points[i].second))
+			return false;
+	}
+
+	for(unsigned int i = 0; i < mUVOrder.size(); i++)
+	{
+		if(source.mUVOrder[i] != mUVOrder[i])
+			return false;
+	}
+
+	if(source.mVisUVRef != vis_uv_ref || source.mV2UVRef != vis2_uv_ref || source.mT3UVRef != t3_uv_ref)
+		return false;
+
+	// Pack the data and uncertainties, [vis_real, vis_imag, v2, t3_amp, t3_phi], and the T3 signs.
+	valarray<cl_float> t_data(mNData);
+	valarray<cl_float> t_err(mNData);
+	valarray<cl_short4> t_t3_sign(mNT3);
+	unsigned int v2_offset = CalculateOffset_V2(mNVis);
+	unsigned int t3_offset = CalculateOffset_T3(mNVis, mNV2);
+	for(unsigned int i = 0; i < mNVis; i++)
+	{
+		t_data[i] = real(vis[i]);
+		t_data[mNVis + i] = imag(vis[i]);
+		t_err[i] = vis_err[i].first;
+		t_err[mNVis + i] = vis_err[i].second;
+	}
+
+	for(unsigned int i = 0; i < mNV2; i++)
+	{
+		t_data[v2_offset + i] = vis2[i];
+		t_err[v2_offset + i] = vis2_err[i];
+	}
+
+	for(unsigned int i = 0; i < mNT3; i++)
+	{
+		t_data[t3_offset + i] = real(t3[i]);
+		t_data[t3_offset + mNT3 + i] = imag(t3[i]);
+		t_err[t3_offset + i] = t3_err[i].first;
+		t_err[t3_offset + mNT3 + i] = t3_err[i].second;
+
+		t_t3_sign[i].s[0] = get<0>(t3_uv_sign[i]);
+		t_t3_sign[i].s[1] = get<1>(t3_uv_sign[i]);
+		t_t3_sign[i].s[2] = get<2>(t3_uv_sign[i]);
+		t_t3_sign[i].s[3] = 0;
+	}
+
+	// The buffers of source belong to the same context, read them on this data set's queue.
+	valarray<cl_float> s_data(mNData);
+	valarray<cl_float> s_err(mNData);
+	valarray<cl_short4> s_t3_sign(mNT3);
+	status  = clEnqueueReadBuffer(mQueue, source.mData_cl, CL_FALSE, 0, sizeof(cl_float) * mNData, &s_data[0], 0, NULL, NULL);
+	status |= clEnqueueReadBuffer(mQueue, source.mData_err_cl, CL_FALSE, 0, sizeof(cl_float) * mNData, &s_err[0], 0, NULL, NULL);
+	if(mNT3 > 0)
+		status |= clEnqueueReadBuffer(mQueue, source.mData_T3_sign, CL_FALSE, 0, sizeof(cl_short4) * mNT3, &s_t3_sign[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+	clFinish(mQueue);
+
+	// Compare the bits, NaN never equals itself.
+	return memcmp(&t_data[0], &s_data[0], sizeof(cl_float) * mNData) == 0
+			&& memcmp(&t_err[0], &s_err[0], sizeof(cl_float) * mNData) == 0
+			&& (mNT3 == 0 || memcmp(&t_t3_sign[0], &s_t3_sign[0], sizeof(cl_short4) * mNT3) == 0);
+}
+
+/// Returns the name of the cache file in cache_path of a source file whose contents have the hash source_hash
+/// (see HashFile): the hash in hexadecimal. Returns an empty string if cache_path is empty or the hash is zero.
+string COILibData::CacheFileName(string cache_path, uint64_t source_hash)
+{
+	if(cache_path.empty() || source_hash == 0)
+		return "";
+
+	stringstream name;
+	name << cache_path << "/" << hex << setw(16) << setfill('0') << source_hash << ".liboicache";
+	return name.str();
+}
+
+/// Returns the FNV-1a hash of the contents of filename, or zero if it cannot be read.
+/// If check is given, it is set to a second, unrelated hash of the contents and size of the file (see CheckBytes),
+/// or zero.
+uint64_t COILibData::HashFile(string filename, uint64_t * check)
+{
+	if(check)
+		*check = 0;
+
+	if(filename.empty())
+		return 0;
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		return 0;
+
+	struct stat info;
+	void * contents = MAP_FAILED;
+	if(fstat(fd, &info) == 0 && info.st_size > 0)
+		contents = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(contents == MAP_FAILED)
+		return 0;
+
+	uint64_t hash = HashBytes(contents, info.st_size);
+	if(check)
+		*check = CheckBytes(contents, info.st_size);
+	munmap(contents, info.st_size);
+
+	return hash;
+}
+
+/// Loads the data from cache_file (see WriteCache) if it exists and is valid. The file is mapped into memory
+/// and the arrays are uploaded to the OpenCL device directly from the mapping. The OIDataList is not read
+/// until GetData() is called. Returns false if the data were not loaded.
+bool COILibData::ReadCache(string cache_file)
+{
+	if(cache_file.empty())
+		return false;
+
+	int fd = open(cache_file.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat info;
+	void * contents = MAP_FAILED;
+	if(fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(CacheHeader))
+		contents = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(contents == MAP_FAILED)
+		return false;
+
+	const char * base = (const char *) contents;
+	const CacheHeader * header = (const CacheHeader *) base;
+	size_t sections[N_CACHE_SECTIONS];
+	if(memcmp(header->magic, LIBOI_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != LIBOI_CACHE_VERSION
+			|| header->n_data != TotalBufferSize(header->n_vis, header->n_v2, header->n_t3)
+			|| header->n_uv_padded != (cl_uint) NextHighestMultiple(16, header->n_uv)
+			|| CacheLayout(*header, sections) != size_t(info.st_size))
+	{
+		munmap(contents, info.st_size);
+		return false;
+	}
+
+	mNVis = header->n_vis;
+	mNV2 = header->n_v2;
+	mNT3 = header->n_t3;
+	mNUV = header->n_uv_padded;
+	mNData = header->n_data;
+	mAveJD = header->ave_jd;
+	mAveWavelength = header->ave_wavelength;
+	unsigned int n_uv = header->n_uv;
+
+	AllocateMemory();
+
+	if(mArenaRegion >= 0)
+		mStaging.assign(mArenaSize, 0);
+
+	const cl_float2 * t_uv_points = (const cl_float2 *) (base + sections[CACHE_UV]);
+	const cl_float * t_err = (const cl_float *) (base + sections[CACHE_ERR]);
+	const cl_uint * t_vis_uvref = (const cl_uint *) (base + sections[CACHE_VIS_UV_REF]);
+	const cl_uint * t_vis2_uvref = (const cl_uint *) (base + sections[CACHE_V2_UV_REF]);
+	const cl_uint4 * t_t3_uvref = (const cl_uint4 *) (base + sections[CACHE_T3_UV_REF]);
+
+	WriteBuffer(mData_uv_cl, 0, sizeof(cl_float2) * mNUV, t_uv_points);
+	WriteBuffer(mData_cl, 0, sizeof(cl_float) * mNData, base + sections[CACHE_DATA]);
+	WriteBuffer(mData_err_cl, 0, sizeof(cl_float) * mNData, t_err);
+	if(mNVis > 0)
+		WriteBuffer(mData_Vis_uv_ref, 0, sizeof(cl_uint) * mNVis, t_vis_uvref);
+	if(mNV2 > 0)
+		WriteBuffer(mData_V2_uv_ref, 0, sizeof(cl_uint) * mNV2, t_vis2_uvref);
+	if(mNT3 > 0)
+	{
+		WriteBuffer(mData_T3_uv_ref, 0, sizeof(cl_uint4) * mNT3, t_t3_uvref);
+		WriteBuffer(mData_T3_sign, 0, sizeof(cl_short4) * mNT3, base + sections[CACHE_T3_SIGN]);
+	}
+
+	// Host copies used to derive the segments, chunks and inverse uncertainties.
+	mUVPoints = valarray<cl_float2>(t_uv_points, mNUV);
+	mUVOrder = valarray<cl_uint>((const cl_uint *) (base + sections[CACHE_UV_ORDER]), n_uv);
+	vector<pair<double,double> > uv_points(n_uv);
+	for(unsigned int i = 0; i < n_uv; i++)
+		uv_points[i] = make_pair(t_uv_points[i].s[0], t_uv_points[i].s[1]);
+
+	vector<unsigned int> vis_uv_ref(t_vis_uvref, t_vis_uvref + mNVis);
+	vector<unsigned int> vis2_uv_ref(t_vis2_uvref, t_vis2_uvref + mNV2);
+	vector<tuple<unsigned int, unsigned int, unsigned int>> t3_uv_ref(mNT3);
+	for(unsigned int i = 0; i < mNT3; i++)
+		t3_uv_ref[i] = make_tuple(t_t3_uvref[i].s[0], t_t3_uvref[i].s[1], t_t3_uvref[i].s[2]);
+
+	// The mapping must remain valid until the uploads complete, CopyToDevice_Derived waits for the queue.
+	CopyToDevice_Derived(uv_points, vis_uv_ref, vis2_uv_ref, t3_uv_ref, valarray<cl_float>(t_err, mNData));
+	munmap(contents, info.st_size);
+
+	return true;
+}
+
+/// Reads the OIFITS file mFileName. Returns an empty data list if the file cannot be opened.
+OIDataSnapshot COILibData::ReadData()
+{
+	OIDataList data;
+	COIFile tmp;
+	try
+	{
+		tmp.open(mFileName);
+		data = tmp.read();
+	}
+	catch(CCfits::FITS::CantOpen)
+	{
+
+	}
+
+	return make_shared<const OIDataList>(move(data));
+}
+
+/// Computes the offset of each section of a cache file (see WriteCache) and returns the size of the file.
+size_t COILibData::CacheLayout(const CacheHeader & header, size_t * sections)
+{
+	size_t sizes[N_CACHE_SECTIONS];
+	sizes[CACHE_UV] = sizeof(cl_float2) * header.n_uv_padded;
+	sizes[CACHE_DATA] = sizeof(cl_float) * header.n_data;
+	sizes[CACHE_ERR] = sizeof(cl_float) * header.n_data;
+	sizes[CACHE_VIS_UV_REF] = sizeof(cl_uint) * header.n_vis;
+	sizes[CACHE_V2_UV_REF] = sizeof(cl_uint) * header.n_v2;
+	sizes[CACHE_T3_UV_REF] = sizeof(cl_uint4) * header.n_t3;
+	sizes[CACHE_T3_SIGN] = sizeof(cl_short4) * header.n_t3;
+	sizes[CACHE_UV_ORDER] = sizeof(cl_uint) * header.n_uv;
+
+	// Sections are aligned to 16 bytes so they may be used in place.
+	size_t offset = (sizeof(CacheHeader) + 15) / 16 * 16;
+	for(unsigned int i = 0; i < N_CACHE_SECTIONS; i++)
+	{
+		sections[i] = offset;
+		offset += (sizes[i] + 15) / 16 * 16;
+	}
+
+	return offset;
+}
+
+/// Writes the data, as laid out in the OpenCL buffers, to cache_file. The file is written under a temporary
+/// name and renamed so that concurrent readers never see a partial file. The cache is optional, so failures
+/// (including OpenCL errors while reading the buffers back) are ignored and leave no file behind.
+void COILibData::WriteCache(string cache_file)
+{
+	int status = CL_SUCCESS;
+	if(cache_file.empty() || mNData == 0)
+		return;
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(CacheHeader));
+	memcpy(header.magic, LIBOI_CACHE_MAGIC, sizeof(header.magic));
+	header.version = LIBOI_CACHE_VERSION;
+	header.n_vis = mNVis;
+	header.n_v2 = mNV2;
+	header.n_t3 = mNT3;
+	header.n_uv = 0;
+	header.n_uv_padded = mNUV;
+	header.n_data = mNData;
+	header.ave_jd = mAveJD;
+	header.ave_wavelength = mAveWavelength;
+
+	// UV points beyond those in the data are padded with infinities, see CopyToDevice.
+	for(unsigned int i = 0; i < mNUV; i++)
+	{
+		if(mUVPoints[i].s[0] != numeric_limits<float>::infinity())
+			header.n_uv = i + 1;
+	}
+
+	size_t sections[N_CACHE_SECTIONS];
+	size_t file_size = CacheLayout(header, sections);
+	vector<char> contents(file_size, 0);
+	memcpy(&contents[0], &header, sizeof(CacheHeader));
+
+	// Read the device buffers back into the file image.
+	cl_mem buffers[N_CACHE_SECTIONS] = {mData_uv_cl, mData_cl, mData_err_cl, mData_Vis_uv_ref, mData_V2_uv_ref,
+			mData_T3_uv_ref, mData_T3_sign, 0};
+	for(unsigned int i = 0; i < N_CACHE_SECTIONS; i++)
+	{
+		size_t size = ((i + 1 < N_CACHE_SECTIONS) ? sections[i + 1] : file_size) - sections[i];
+		size_t n_bytes = 0;
+		if(buffers[i])
+		{
+			status = clGetMemObjectInfo(buffers[i], CL_MEM_SIZE, sizeof(size_t), &n_bytes, NULL);
+			if(status != CL_SUCCESS)
+				break;
+
+			n_bytes = min(n_bytes, size);
+			status = clEnqueueReadBuffer(mQueue, buffers[i], CL_FALSE, 0, n_bytes, &contents[sections[i]], 0, NULL, NULL);
+			if(status != CL_SUCCESS)
+				break;
+		}
+	}
+
+	// Reads which were already enqueued must finish before contents goes out of scope.
+	if(clFinish(mQueue) != CL_SUCCESS || status != CL_SUCCESS)
+		return;
+
+	// The UV order only exists on the host.
+	if(mUVOrder.size() == header.n_uv && header.n_uv > 0)
+		memcpy(&contents[sections[CACHE_UV_ORDER]], &mUVOrder[0], sizeof(cl_uint) * header.n_uv);
+
+	// mkstemp gives every writer, thread or process, a temporary file of its own.
+	string tmp_template = cache_file + ".XXXXXX";
+	vector<char> tmp_name(tmp_template.begin(), tmp_template.end());
+	tmp_name.push_back('\0');
+	int fd = mkstemp(&tmp_name[0]);
+	if(fd < 0)
+		return;
+
+	bool good = (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0);
+	size_t written = 0;
+	while(good && written < contents.size())
+	{
+		ssize_t n = write(fd, &contents[written], contents.size() - written);
+		if(n <= 0)
+			good = false;
+		else
+			written += n;
+	}
+
+	if(close(fd) != 0)
+		good = false;
+
+	if(good)
+		rename(&tmp_name[0], cache_file.c_str());
+	else
+		remove(&tmp_name[0]);
+}
+
+/// Writes size bytes from host_mem to buffer at offset (in bytes). While CopyToDevice gathers the arena region
+/// on the host, the data are copied into the staging block instead. Otherwise a non-blocking write is enqueued.
+void COILibData::WriteBuffer(cl_mem & buffer, size_t offset, size_t size, const void * host_mem)
+{
+	int status = CL_SUCCESS;
+
+	if(mStaging.size() > 0)
+	{
+		memcpy(&mStaging[mArenaLayout.at(&buffer) + offset], host_mem, size);
+		return;
+	}
+
+	status = clEnqueueWriteBuffer(mQueue, buffer, CL_FALSE, offset, size, host_mem, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
 }
 
 } // namespace liboi
@@ -38,7 +38,12 @@
 
 #include <string>
 #include <complex>
+#include <functional>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <cstdint>
 #include "COpenCL.hpp"
 #include "oi_file.hpp"
 
@@ -48,44 +53,146 @@ using namespace ccoifits;
 namespace liboi
 {
 
+class CDeviceArena;
+typedef shared_ptr<CDeviceArena> CDeviceArenaPtr;
+
+typedef shared_ptr<const OIDataList> OIDataSnapshot;
+
+#define LIBOI_CACHE_MAGIC "LIBOIDC"
+#define LIBOI_CACHE_VERSION 2
+
+/// Header of a data cache file, see COILibData::WriteCache. It is followed by the sections enumerated in
+/// COILibData::CacheSections, each aligned to 16 bytes.
+struct CacheHeader
+{
+	char magic[8];
+	cl_uint version;
+	cl_uint n_vis;
+	cl_uint n_v2;
+	cl_uint n_t3;
+	cl_uint n_uv;			// UV points in the data
+	cl_uint n_uv_padded;	// UV points in the buffer, see AllocateMemory
+	cl_uint n_data;
+	cl_uint reserved;
+	cl_double ave_jd;
+	cl_double ave_wavelength;
+};
+
+/// A block of the (block-diagonal) data covariance matrix.
+/// The block spans data buffer elements [start, start + size), covariance is stored in row-major order.
+struct CovarianceBlock
+{
+	unsigned int start;
+	unsigned int size;
+	valarray<double> covariance;
+};
+
 class COILibData
 {
 protected:
+	/// Sections of a data cache file, in file order.
+	enum CacheSections
+	{
+		CACHE_UV,
+		CACHE_DATA,
+		CACHE_ERR,
+		CACHE_VIS_UV_REF,
+		CACHE_V2_UV_REF,
+		CACHE_T3_UV_REF,
+		CACHE_T3_SIGN,
+		CACHE_UV_ORDER,
+		N_CACHE_SECTIONS
+	};
+
+
 	// OpenCL properties:
 	cl_context mContext;
 	cl_command_queue mQueue;
 
-	// Data list
-	OIDataList mData;
+	// Device memory arena, may be NULL. See AllocateMemory. Each data set holds a reference so that the arena
+	// outlives the buffers allocated in it.
+	CDeviceArenaPtr mArena;
+	int mArenaRegion;
+	size_t mArenaSize;
+	map<cl_mem *, size_t> mArenaLayout;	// Offset of each buffer within the arena region
+	vector<char> mStaging;				// Host copy of the arena region, only while CopyToDevice runs
+
+	// Sharing of the read-only buffers between data sets with identical content, see ShareBuffers
+	uint64_t mContentHash;		// Zero if unknown
+	uint64_t mContentCheck;		// Second hash of the file read, see HashFile. Zero for other data.
+	int mSharedRegion;			// Arena region of another data set holding the read-only buffers, or -1
+	bool mBuffersShared;		// Read-only buffers are in use by more than one data set
+	static mutex sSharedMutex;
+	static map<tuple<cl_context, CDeviceArena *, uint64_t>, COILibData *> sSharedData;	// Data sets which uploaded their buffers
+
+	// Data list. Unless mKeepHostData is set, data read from a file are released after they are uploaded and
+	// re-read by GetData; mDataSnapshot then tracks the copy handed out so repeated calls share it.
+	// GetData is called without a lock on the data list, so these are guarded by mDataMutex.
+	OIDataSnapshot mData;
+	weak_ptr<const OIDataList> mDataSnapshot;
+	bool mKeepHostData;
+	mutex mDataMutex;
 
 	// OpenCL memory objects for the data
 	cl_mem mData_cl; 			// All data, stored in cl_floats in [vis_real, vis_imag, v2, t3_amp, t3_phi] order
 	cl_mem mData_err_cl;
+	cl_mem mData_inv_err_cl;	// 1 / mData_err_cl, precomputed so the chi kernels multiply rather than divide
 
-	cl_mem mData_uv_cl;			// UV points.  Ideally arranged in an optimal ordering for the OpenCL device (GPU).
+	cl_mem mData_uv_cl;			// UV points in the order in which the data reference them, see ReorderUV.
 	cl_mem mData_Vis_uv_ref;	// Contains the index of the UV point for creating the i-th Vis point
 	cl_mem mData_V2_uv_ref;		// Contains the index of the UV point for creating the i-th V2 point
 	cl_mem mData_T3_uv_ref;		// Contains the index of the UV point for creating the i-th T3 point.  A cl_uint4 in [uv_ab, uv_bc, uv_ca, empty]
 
 	cl_mem mData_T3_sign;		// Contains signs indicating conjugation of uv points. A cl_short4 in [uv_ab, uv_bc, uv_ca, 0] order
 
+	cl_mem mData_segment_id;	// Chi2 segment of each datum, [observable type * LIBOI_N_UV_BINS + uv radius bin]
+	cl_mem mData_segment_range;	// cl_uint2 [start, end) of the observable type which contains each segment
+
+	cl_mem mData_uv_chunk_id;	// UV chunk after which each datum may be computed, see BuildUVChunks
+	cl_mem mData_uv_chunk_range;// cl_uint2 [start, end) of the data which belong to each UV chunk
+	valarray<cl_uint> mUVChunkID;	// Host copy of mData_uv_chunk_id
+	valarray<cl_uint2> mUVChunkTypeRange;	// [start, end) of the Vis, V2 and T3 data in each UV chunk, see GetUVChunkTypeRanges
+
+	// Block-diagonal covariance, see SetCovariance
+	vector<CovarianceBlock> mCovarianceBlocks;
+	cl_mem mData_cov_blocks;	// cl_uint4 [start, size, factor offset, 0] for each block
+	cl_mem mData_cov_factors;	// Packed lower-triangular Cholesky factors of the correlation matrix of each block
+
+	// Weights and observable selection, see SetWeights and GetLoc_ActiveUV
+	valarray<cl_float> mWeights;	// Weight of each datum, same layout as mData_cl. Zero masks the datum.
+	valarray<cl_float2> mUVPoints;	// Host copy of mData_uv_cl
+	valarray<cl_uint> mUVOrder;		// Index in the Export_MinUV order of each UV point in mData_uv_cl, see ReorderUV
+	vector<unsigned int> mVisUVRef;	// Host copies of the UV references
+	vector<unsigned int> mV2UVRef;
+	vector<tuple<unsigned int, unsigned int, unsigned int>> mT3UVRef;
+	map<unsigned int, pair<cl_mem, unsigned int>> mActiveUV;	// Cached [index buffer, size] of the UV points in use for an observables mask
+
+	// Bootstrap resampling blocks, see SetBootstrapBlocks
+	valarray<cl_uint> mBootstrapBlock;	// User-specified block of each datum, empty for the default blocks
+	cl_mem mData_bootstrap_block;		// Cached device copy of GetBootstrapBlocks
+
 	// A few things we will need to know about the data
 	unsigned int mNVis;
 	unsigned int mNV2;
 	unsigned int mNT3;
 	unsigned int mNUV;
 	unsigned int mNData;
+	unsigned int mNUVChunks;
+	unsigned int mUVChunkSize;
 	double mAveJD;
 	double mAveWavelength;
+	valarray<double> mLogLikeConstant;	// -sum(log(data_err)) - N/2 log(2 pi) for each observable type, constant for a given data set
 
 	string mFileName;
 
 public:
-	COILibData(string filename, cl_context context, cl_command_queue queue);
-	COILibData(const OIDataList & data, cl_context context, cl_command_queue queue);
+	COILibData(string filename, cl_context context, cl_command_queue queue, CDeviceArenaPtr arena = nullptr, string cache_path = "",
+			bool keep_host_data = true);
+	COILibData(const OIDataList & data, cl_context context, cl_command_queue queue, CDeviceArenaPtr arena = nullptr);
 	virtual ~COILibData();
 
 protected:
+	void AllocateBuffers(const vector<pair<cl_mem *, size_t> > & buffers);
 	void AllocateMemory();
 
 public:
@@ -94,6 +201,21 @@ public:
 	static unsigned int CalculateOffset_T3(unsigned int n_vis, unsigned int n_v2);
 
 protected:
+	void BuildSegments(const vector<pair<double,double> > & uv_points,
+		const vector<unsigned int> & vis_uv_ref,
+		const vector<unsigned int> & vis2_uv_ref,
+		const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref);
+
+	void BuildUVChunks(unsigned int n_uv,
+		const vector<unsigned int> & vis_uv_ref,
+		const vector<unsigned int> & vis2_uv_ref,
+		const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref);
+
+	static size_t CacheLayout(const CacheHeader & header, size_t * sections);
+	static string CacheFileName(string cache_path, uint64_t source_hash);
+	static bool Cholesky(valarray<double> & A, unsigned int n);
+	void ClearActiveUV();
+
 	void CopyFromDevice(vector<pair<double,double> > & uv_points, cl_mem uv_buffer,
 		valarray<complex<double>> & vis, cl_mem vis_buffer,
 		valarray<pair<double,double>> & vis_err, cl_mem vis_err_buffer,
@@ -106,12 +228,20 @@ protected:
 		vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref, cl_mem t3_uv_ref_buffer,
 		vector<tuple<short, short, short>> & t3_uv_sign, cl_mem t3_uv_sign_buffer);
 
+public:
+	void CopySettings(const COILibData & source);
+
+protected:
 	void CopyToDevice(const vector<pair<double,double> > & uv_points,
 		const valarray<complex<double>> & vis, const valarray<pair<double,double>> & vis_err, const vector<unsigned int> & vis_uv_ref,
 		const valarray<double> & vis2, const valarray<double> & vis2_err, const vector<unsigned int> & vis2_uv_ref,
 		const valarray<complex<double>> & t3, const valarray<pair<double,double> > & t3_err,
 		const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
 		const vector<tuple<short, short, short>> & t3_uv_sign);
+	void CopyToDevice_Derived(const vector<pair<double,double> > & uv_points,
+		const vector<unsigned int> & vis_uv_ref, const vector<unsigned int> & vis2_uv_ref,
+		const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
+		const valarray<cl_float> & t_err);
 
 protected:
 	void DeallocateMemory();
@@ -123,31 +253,93 @@ public:
 	// Inline the get location functions
 	double GetAveJD(void) { return mAveJD; };
 	double GetAveWavelength(void) { return mAveWavelength; };
-	OIDataList GetData(void) { return mData; };
+	cl_context GetContext(void) { return mContext; };
+	OIDataSnapshot GetData(void);
 	void GetData(float * output, unsigned int & n);
 	void GetDataUncertainties(float * output, unsigned int & n);
 	string GetFilename(void) { return mFileName; };
+	double GetLogLikeConstant(unsigned int observables);
 	cl_mem GetLoc_Data() { return mData_cl; };
 	cl_mem GetLoc_DataErr() { return mData_err_cl; };
+	cl_mem GetLoc_DataInvErr() { return mData_inv_err_cl; };
 	cl_mem GetLoc_Vis_UVRef() { return mData_Vis_uv_ref; };
 	cl_mem GetLoc_V2_UVRef() { return mData_V2_uv_ref; };
 	cl_mem GetLoc_T3_UVRef() { return mData_T3_uv_ref; };
 	cl_mem GetLoc_T3_sign() { return mData_T3_sign; };
 	cl_mem GetLoc_DataUVPoints() { return mData_uv_cl; };
+	cl_mem GetLoc_SegmentID() { return mData_segment_id; };
+	cl_mem GetLoc_SegmentRange() { return mData_segment_range; };
+	cl_mem GetLoc_UVChunkID() { return mData_uv_chunk_id; };
+	cl_mem GetLoc_UVChunkRange() { return mData_uv_chunk_range; };
+	cl_mem GetLoc_CovBlocks() { return mData_cov_blocks; };
+	cl_mem GetLoc_CovFactors() { return mData_cov_factors; };
+	cl_mem GetLoc_ActiveUV(unsigned int observables, unsigned int & n_active);
+	cl_mem GetLoc_BootstrapBlock();
+	valarray<cl_uint> GetBootstrapBlocks();
+	unsigned int GetNumCovBlocks() { return mCovarianceBlocks.size(); };
 	unsigned int GetNumData() { return mNData; };
 	unsigned int GetNumT3() { return mNT3; };
 	unsigned int GetNumUV() { return mNUV; };
+	unsigned int GetNumUVChunks() { return mNUVChunks; };
+	unsigned int GetUVChunkSize() { return mUVChunkSize; };
+	const cl_uint2 * GetUVChunkTypeRanges(unsigned int chunk) { return &mUVChunkTypeRange[3 * chunk]; };
+	valarray<cl_float2> GetUVPoints() { return mUVPoints; };
 	unsigned int GetNumV2() { return mNV2; };
 	unsigned int GetNumVis() { return mNVis; };
+	cl_command_queue GetQueue() { return mQueue; };
+	valarray<cl_uint> GetUVOrder() { return mUVOrder; };
 
 protected:
+	static uint64_t HashFile(string filename, uint64_t * check = NULL);
 	void InitData();
+	vector<pair<cl_mem *, size_t> > InstanceBuffers();
+	bool ReadCache(string cache_file);
+	OIDataSnapshot ReadData();
+	vector<pair<cl_mem *, size_t> > ReadOnlyBuffers();
+	void RegisterBuffers();
 
 public:
+	static unsigned int NumSegments(void);
 	static unsigned int TotalBufferSize(unsigned int n_vis, unsigned int n_v2, unsigned int n_t3);
 
 	void Replace(const OIDataList & new_data);
 
+	static void ReorderUV(vector<pair<double,double> > & uv_points,
+		vector<unsigned int> & vis_uv_ref,
+		vector<unsigned int> & vis2_uv_ref,
+		vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
+		valarray<cl_uint> & uv_order);
+	static void RestoreUVOrder(const valarray<cl_uint> & uv_order,
+		vector<pair<double,double> > & uv_points,
+		vector<unsigned int> & vis_uv_ref,
+		vector<unsigned int> & vis2_uv_ref,
+		vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref);
+
+public:
+	void SetBootstrapBlocks(const valarray<cl_uint> & blocks);
+	void SetCovariance(const vector<CovarianceBlock> & blocks);
+	void SetQueue(cl_command_queue queue) { mQueue = queue; };
+	void SetWeights(const valarray<cl_float> & weights);
+
+protected:
+	bool SameContent(const COILibData & source, const vector<pair<double,double> > & uv_points,
+		const valarray<complex<double>> & vis, const valarray<pair<double,double>> & vis_err,
+		const vector<unsigned int> & vis_uv_ref,
+		const valarray<double> & vis2, const valarray<double> & vis2_err,
+		const vector<unsigned int> & vis2_uv_ref,
+		const valarray<complex<double>> & t3, const valarray<pair<double,double> > & t3_err,
+		const vector<tuple<unsigned int, unsigned int, unsigned int>> & t3_uv_ref,
+		const vector<tuple<short, short, short>> & t3_uv_sign);
+	bool ShareBuffers(function<bool(const COILibData &)> matches = nullptr);
+	void UnregisterBuffers();
+	void UploadInverseErrors();
+	void UploadInverseErrors(const valarray<cl_float> & t_err);
+	void UploadUVChunks();
+	void WriteBuffer(cl_mem & buffer, size_t offset, size_t size, const void * host_mem);
+	void WriteCache(string cache_file);
+
+public:
+
 	/// Returns the integer multiple of base which is higher than value.
 	inline int NextHighestMultiple(int base, int value)
 	{
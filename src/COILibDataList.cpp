@@ -33,14 +33,19 @@
  */
 
 #include "COILibDataList.h"
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <fitsio.h>
+#include "CDeviceArena.h"
 
 namespace liboi
 {
 
 COILibDataList::COILibDataList()
 {
-	// TODO Auto-generated constructor stub
-
+	mKeepHostData = true;
+	Publish(vector<COILibDataPtr>());
 }
 
 COILibDataList::~COILibDataList()
@@ -49,21 +54,26 @@ COILibDataList::~COILibDataList()
 }
 
 COILibDataPtr COILibDataList::at(unsigned int id)
+{
+	return GetSnapshot()->at(id);
+}
+
+/// Removes the gaps left in the arena by removed data sets, see CDeviceArena::Compact. Compaction moves the
+/// device buffers of the remaining data sets, so it must not run while other threads evaluate data.
+void COILibDataList::Compact()
 {
 	// Lock the data, automatically unlocks
 	lock_guard<mutex> lock(mDataMutex);
 
-	return mDataList.at(id);
+	if(mArena)
+		mArena->Compact();
 }
 
 void COILibDataList::ExportData(unsigned int data_num, string file_basename, cl_mem simulated_data)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
-
 	try
 	{
-		mDataList[data_num]->ExportData(file_basename, simulated_data);
+		GetSnapshot()->at(data_num)->ExportData(file_basename, simulated_data);
 	}
 	catch(...)
 	{
@@ -71,29 +81,25 @@ void COILibDataList::ExportData(unsigned int data_num, string file_basename, cl_
 	}
 }
 
-OIDataList COILibDataList::GetData(unsigned int data_num)
+/// Returns a shared, read-only copy of the OIFITS data of the specified data set, see COILibData::GetData.
+/// An empty data list is returned if the data set does not exist.
+OIDataSnapshot COILibDataList::GetData(unsigned int data_num)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
-
 	try
 	{
-		return mDataList[data_num]->GetData();
+		return GetSnapshot()->at(data_num)->GetData();
 	}
 	catch(...)
 	{
-		return OIDataList();
+		return make_shared<const OIDataList>();
 	}
 }
 
 void COILibDataList::GetData(int data_num, float * output, unsigned int & n)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
-
 	try
 	{
-		mDataList[data_num]->GetData(output, n);
+		GetSnapshot()->at(data_num)->GetData(output, n);
 	}
 	catch(...)
 	{
@@ -103,12 +109,9 @@ void COILibDataList::GetData(int data_num, float * output, unsigned int & n)
 
 void COILibDataList::GetDataUncertainties(int data_num, float * output, unsigned int & n)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
-
 	try
 	{
-		mDataList[data_num]->GetDataUncertainties(output, n);
+		GetSnapshot()->at(data_num)->GetDataUncertainties(output, n);
 	}
 	catch(...)
 	{
@@ -119,12 +122,11 @@ void COILibDataList::GetDataUncertainties(int data_num, float * output, unsigned
 /// Returns the total number of data points (UV + T3) in all data sets
 int COILibDataList::GetNData()
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
+	Snapshot data_list = GetSnapshot();
 
 	// Calculate the total sum of the number of data points.
 	int tmp = 0;
-	for(auto data: mDataList)
+	for(auto data: *data_list)
 		tmp += data->GetNumData();
 
     return tmp;
@@ -134,11 +136,10 @@ int COILibDataList::GetNData()
 /// for all data sets.
 int COILibDataList::GetNDataAllocated()
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
+	Snapshot data_list = GetSnapshot();
 
 	int tmp = 0;
-	for(auto data: mDataList)
+	for(auto data: *data_list)
 		tmp += data->GetNumData();
 
     return tmp;
@@ -147,12 +148,9 @@ int COILibDataList::GetNDataAllocated()
 /// Returns the size of the data_num's allocated data block.
 int COILibDataList::GetNDataAllocated(unsigned int data_num)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
-
 	try
 	{
-		return mDataList[data_num]->GetNumData();
+		return GetSnapshot()->at(data_num)->GetNumData();
 	}
 	catch(...)
 	{
@@ -160,35 +158,128 @@ int COILibDataList::GetNDataAllocated(unsigned int data_num)
 	}
 }
 
-/// Reads in an OIFITS file, returns a COILibData object.
-void COILibDataList::LoadData(string filename, cl_context context, cl_command_queue queue)
+/// Reads in an OIFITS file and appends it to the list. The list is not locked while the file is read.
+/// Returns the index of the new data set.
+unsigned int COILibDataList::LoadData(string filename, cl_context context, cl_command_queue queue)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
+	CDeviceArenaPtr arena;
+	string cache_path;
+	bool keep_host_data = true;
+	{
+		lock_guard<mutex> lock(mDataMutex);
+		arena = mArena;
+		cache_path = mCachePath;
+		keep_host_data = mKeepHostData;
+	}
 
-	COILibDataPtr tmp(new COILibData(filename, context, queue));
-	mDataList.push_back(tmp);
+	COILibDataPtr tmp(new COILibData(filename, context, queue, arena, cache_path, keep_host_data));
+	return Publish(vector<COILibDataPtr>(1, tmp));
 }
 
-/// Reads in an OIFITS file, returns a COILibData object.
-void COILibDataList::LoadData(const OIDataList & data, cl_context context, cl_command_queue queue)
+/// Uploads data to the OpenCL device and appends it to the list. Returns the index of the new data set.
+unsigned int COILibDataList::LoadData(const OIDataList & data, cl_context context, cl_command_queue queue)
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
+	CDeviceArenaPtr arena;
+	{
+		lock_guard<mutex> lock(mDataMutex);
+		arena = mArena;
+	}
+
+	COILibDataPtr tmp(new COILibData(data, context, queue, arena));
+	return Publish(vector<COILibDataPtr>(1, tmp));
+}
+
+/// Reads in several OIFITS files in parallel and appends them to the list in the order given.
+///
+/// Files are read, repacked and uploaded by n_threads worker threads (default: one per hardware thread).
+/// Each worker uploads on its own transfer queue so that uploads overlap with the parsing of other files;
+/// afterwards the data sets use queue. The list is locked only while the finished data sets are appended.
+/// Parallel reading requires a thread-safe (reentrant) build of cfitsio, otherwise the files are read one
+/// at a time by a single worker. If any file fails to load, the exception is rethrown after all workers
+/// finish and no data sets are appended.
+/// Returns the index of the first new data set.
+unsigned int COILibDataList::LoadData(const vector<string> & filenames, cl_context context, cl_command_queue queue, unsigned int n_threads)
+{
+	int status = CL_SUCCESS;
+	size_t n_files = filenames.size();
+	if(n_files == 0)
+		return size();
+
+	if(n_threads == 0)
+		n_threads = max(thread::hardware_concurrency(), 1u);
+	n_threads = min(n_threads, (unsigned int) n_files);
+	if(!fits_is_reentrant())
+		n_threads = 1;
+
+	cl_device_id device;
+	status = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+	CHECK_OPENCL_ERROR(status, "clGetCommandQueueInfo failed.");
+
+	CDeviceArenaPtr arena;
+	string cache_path;
+	bool keep_host_data = true;
+	{
+		lock_guard<mutex> lock(mDataMutex);
+		arena = mArena;
+		cache_path = mCachePath;
+		keep_host_data = mKeepHostData;
+	}
+
+	vector<COILibDataPtr> loaded(n_files);
+	vector<exception_ptr> errors(n_files);
+	atomic<size_t> next_file(0);
+
+	auto worker = [&]()
+	{
+		// Exceptions must not escape the thread, fall back to the compute queue instead.
+		int queue_status = CL_SUCCESS;
+		cl_command_queue transfer_queue = clCreateCommandQueue(context, device, 0, &queue_status);
+		if(queue_status != CL_SUCCESS)
+			transfer_queue = NULL;
+
+		for(size_t i = next_file++; i < n_files; i = next_file++)
+		{
+			try
+			{
+				// The constructor waits for its uploads to finish.
+				loaded[i] = COILibDataPtr(new COILibData(filenames[i], context, (transfer_queue) ? transfer_queue : queue, arena, cache_path,
+						keep_host_data));
+				loaded[i]->SetQueue(queue);
+			}
+			catch(...)
+			{
+				errors[i] = current_exception();
+			}
+		}
+
+		if(transfer_queue)
+			clReleaseCommandQueue(transfer_queue);
+	};
+
+	vector<thread> threads;
+	for(unsigned int i = 0; i < n_threads; i++)
+		threads.push_back(thread(worker));
+
+	for(auto & t: threads)
+		t.join();
+
+	for(auto & error: errors)
+	{
+		if(error)
+			rethrow_exception(error);
+	}
 
-	COILibDataPtr tmp(new COILibData(data, context, queue));
-	mDataList.push_back(tmp);
+	return Publish(loaded);
 }
 
 /// Finds the maximum number of data points (Vis2 + T3) and returns that number.
 int COILibDataList::MaxNumData()
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
+	Snapshot data_list = GetSnapshot();
 
 	int tmp;
 	int max = 0;
-    for(auto data: mDataList)
+    for(auto data: *data_list)
     {
     	tmp = data->GetNumData();
     	if(tmp > max)
@@ -201,12 +292,11 @@ int COILibDataList::MaxNumData()
 /// Finds the maximum number of data points (Vis2 + T3) and returns that number.
 int COILibDataList::MaxUVPoints()
 {
-	// Lock the data, automatically unlocks
-	lock_guard<mutex> lock(mDataMutex);
+	Snapshot data_list = GetSnapshot();
 
 	int tmp;
 	int max = 0;
-    for(auto data: mDataList)
+    for(auto data: *data_list)
     {
     	tmp = data->GetNumUV();
     	if(tmp > max)
@@ -216,38 +306,111 @@ int COILibDataList::MaxUVPoints()
     return max;
 }
 
-/// Removes the specified data file from device and host memory
+/// Appends data to the list by publishing a copy of the current list with data added at the end.
+/// Readers holding an older snapshot are unaffected. Returns the index of the first appended element, which
+/// remains valid when several threads publish at once.
+unsigned int COILibDataList::Publish(const vector<COILibDataPtr> & data)
+{
+	// Lock the data, automatically unlocks
+	lock_guard<mutex> lock(mDataMutex);
+
+	shared_ptr<vector<COILibDataPtr>> tmp = make_shared<vector<COILibDataPtr>>();
+	if(mDataList)
+		tmp->assign(mDataList->begin(), mDataList->end());
+	unsigned int first = tmp->size();
+	tmp->insert(tmp->end(), data.begin(), data.end());
+	atomic_store(&mDataList, Snapshot(tmp));
+
+	return first;
+}
+
+/// Removes the specified data file from the list. Its device and host memory are freed once no reader holds
+/// a snapshot which contains it. The arena is not compacted here because readers may still be using the
+/// buffers of the remaining data sets, see Compact.
 void COILibDataList::RemoveData(unsigned int data_num)
 {
 	// Lock the data, automatically unlocks
 	lock_guard<mutex> lock(mDataMutex);
 
-	try
-	{
-		mDataList.erase(mDataList.begin() + data_num);
-	}
-	catch(...)
+	if(data_num >= mDataList->size())
+		return;
+
 	{
-		// do nothing
+		shared_ptr<vector<COILibDataPtr>> tmp = make_shared<vector<COILibDataPtr>>(*mDataList);
+		tmp->erase(tmp->begin() + data_num);
+		atomic_store(&mDataList, Snapshot(tmp));
 	}
 }
 
-// Replaces the data stored in old_data_id with the new_data. The data must be of the same eize
+/// Replaces the data stored in old_data_id with new_data, which must be of the same size (see COILibData::Replace).
+/// The data set is not modified in place: a new one is uploaded from new_data, given the weights, covariance and
+/// bootstrap blocks of the old one, and published in its place. Readers holding an older snapshot continue to use
+/// the old data set until they release it.
+/// Throws a length_error if the sizes do not match.
 void COILibDataList::ReplaceData(unsigned int old_data_id, const OIDataList & new_data)
 {
 	// Lock the data, automatically unlocks
 	lock_guard<mutex> lock(mDataMutex);
 
-	COILibDataPtr temp = mDataList[old_data_id];
-	temp->Replace(new_data);
+	COILibDataPtr old_data = mDataList->at(old_data_id);
+	COILibDataPtr tmp(new COILibData(new_data, old_data->GetContext(), old_data->GetQueue(), mArena));
+
+	// When data is replaced (as is often done in bootstrapping), the number of UV points can be smaller,
+	// but for statistical information to make sense, the total number of data must match exactly.
+	if(tmp->GetNumUV() > old_data->GetNumUV())
+		throw length_error("Number of UV points exceeds allocated size.");
+
+	if(tmp->GetNumVis() != old_data->GetNumVis() || tmp->GetNumV2() != old_data->GetNumV2() ||
+			tmp->GetNumT3() != old_data->GetNumT3() || tmp->GetNumData() != old_data->GetNumData())
+		throw length_error("Size of data allocation does not match allocated size");
+
+	tmp->CopySettings(*old_data);
+
+	shared_ptr<vector<COILibDataPtr>> data_list = make_shared<vector<COILibDataPtr>>(*mDataList);
+	data_list->at(old_data_id) = tmp;
+	atomic_store(&mDataList, Snapshot(data_list));
 }
 
-unsigned int COILibDataList::size()
+/// Sets the arena in which the device buffers of data sets loaded from now on are allocated.
+/// The data sets hold a reference to the arena, it is freed once the last of them is.
+void COILibDataList::SetArena(CDeviceArenaPtr arena)
+{
+	// Lock the data, automatically unlocks
+	lock_guard<mutex> lock(mDataMutex);
+
+	mArena = arena;
+}
+
+/// Sets the directory in which preprocessed OIFITS files are cached, see COILibData::ReadCache.
+/// The directory must exist. An empty path disables the cache.
+void COILibDataList::SetCachePath(string cache_path)
+{
+	// Lock the data, automatically unlocks
+	lock_guard<mutex> lock(mDataMutex);
+
+	mCachePath = cache_path;
+}
+
+/// Sets whether data sets loaded from OIFITS files afterwards keep their tables in host memory. If keep is false,
+/// the tables are released once the data are on the OpenCL device and GetData re-reads the file when needed.
+/// Data sets loaded from an OIDataList are always kept. The default is true.
+void COILibDataList::SetKeepHostData(bool keep)
 {
 	// Lock the data, automatically unlocks
 	lock_guard<mutex> lock(mDataMutex);
 
-	return mDataList.size();
+	mKeepHostData = keep;
+}
+
+/// Returns the current list of data sets. The snapshot never changes, later changes to the list publish a new one.
+COILibDataList::Snapshot COILibDataList::GetSnapshot() const
+{
+	return atomic_load(&mDataList);
+}
+
+unsigned int COILibDataList::size()
+{
+	return GetSnapshot()->size();
 }
 
 } /* namespace liboi */
@@ -47,11 +47,19 @@ namespace liboi
 class COILibData;
 typedef shared_ptr<COILibData> COILibDataPtr;
 
+/// A list of data sets. Readers never lock: the list is an immutable vector published through an atomic
+/// shared_ptr. Functions which change the list copy it and publish the copy (copy-on-write), see Publish.
 class COILibDataList
 {
+public:
+	typedef shared_ptr<const vector<COILibDataPtr>> Snapshot;
+
 protected:
-	vector<COILibDataPtr> mDataList;
-	mutex mDataMutex;
+	Snapshot mDataList;		// Access with GetSnapshot and Publish only
+	mutex mDataMutex;		// Serializes changes to the list and guards the settings below
+	CDeviceArenaPtr mArena;	// Device memory for new data sets, may be NULL.
+	string mCachePath;		// Directory of the data cache, see COILibData::ReadCache. Empty disables the cache.
+	bool mKeepHostData;		// Keep the OIFITS tables of new data sets in host memory, see SetKeepHostData.
 
 public:
 	COILibDataList();
@@ -59,24 +67,38 @@ public:
 
 	COILibDataPtr at(unsigned int id);
 
+	void Compact();
+
 	void ExportData(unsigned int data_num, string file_basename, cl_mem simulated_data);
 
-	OIDataList GetData(unsigned int data_num);
+	OIDataSnapshot GetData(unsigned int data_num);
 	void GetData(int data_num, float * output, unsigned int & n);
 	void GetDataUncertainties(int data_num, float * output, unsigned int & n);
 	int GetNData();
 	int GetNDataAllocated();
 	int GetNDataAllocated(unsigned int data_num);
 
-	void LoadData(string filename, cl_context context, cl_command_queue queue);
-	void LoadData(const OIDataList & data, cl_context context, cl_command_queue queue);
+	unsigned int LoadData(string filename, cl_context context, cl_command_queue queue);
+	unsigned int LoadData(const OIDataList & data, cl_context context, cl_command_queue queue);
+	unsigned int LoadData(const vector<string> & filenames, cl_context context, cl_command_queue queue, unsigned int n_threads = 0);
+
+	Snapshot GetSnapshot() const;
 
 	int MaxNumData();
 	int MaxUVPoints();
 
+protected:
+	unsigned int Publish(const vector<COILibDataPtr> & data);
+
+public:
+
 	void RemoveData(unsigned int data_num);
 	void ReplaceData(unsigned int old_data_id, const OIDataList & new_data);
 
+	void SetArena(CDeviceArenaPtr arena);
+	void SetCachePath(string cache_path);
+	void SetKeepHostData(bool keep);
+
 	unsigned int size();
 };
 } /* namespace liboi */
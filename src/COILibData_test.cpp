@@ -0,0 +1,315 @@
+/*
+ * COILibData_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "liboi_tests.h"
+#include "COpenCL.hpp"
+#include "COILibData.h"
+#include "CDeviceArena.h"
+
+using namespace std;
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Returns the names of the files in directory.
+static vector<string> ListFiles(string directory)
+{
+	vector<string> files;
+	DIR * dir = opendir(directory.c_str());
+	if(dir == NULL)
+		return files;
+
+	for(struct dirent * entry = readdir(dir); entry != NULL; entry = readdir(dir))
+	{
+		string name = entry->d_name;
+		if(name != "." && name != "..")
+			files.push_back(name);
+	}
+
+	closedir(dir);
+	return files;
+}
+
+/// Returns the inode of filename. The cache is replaced by renaming a new file over it, so the inode only
+/// stays the same if the cache was not rewritten.
+static ino_t FileInode(string filename)
+{
+	struct stat info;
+	if(stat(filename.c_str(), &info) != 0)
+		return 0;
+
+	return info.st_ino;
+}
+
+/// Host copies of the device buffers of a data set which are restored from the cache.
+struct CachedArrays
+{
+	unsigned int n_vis, n_v2, n_t3, n_uv, n_data;
+	valarray<cl_float> data;
+	valarray<cl_float> data_err;
+	valarray<cl_float> data_inv_err;
+	valarray<cl_float2> uv_points;
+	valarray<cl_uint> uv_order;
+	size_t n_tables;
+};
+
+static CachedArrays ReadArrays(COILibData & data, cl_command_queue queue)
+{
+	CachedArrays arrays;
+	arrays.n_vis = data.GetNumVis();
+	arrays.n_v2 = data.GetNumV2();
+	arrays.n_t3 = data.GetNumT3();
+	arrays.n_uv = data.GetNumUV();
+	arrays.n_data = data.GetNumData();
+
+	unsigned int n = arrays.n_data;
+	arrays.data.resize(n);
+	data.GetData(&arrays.data[0], n);
+	arrays.data_err.resize(n);
+	data.GetDataUncertainties(&arrays.data_err[0], n);
+
+	arrays.data_inv_err.resize(n);
+	arrays.uv_points.resize(arrays.n_uv);
+	int status = clEnqueueReadBuffer(queue, data.GetLoc_DataInvErr(), CL_TRUE, 0, sizeof(cl_float) * n, &arrays.data_inv_err[0], 0, NULL, NULL);
+	status |= clEnqueueReadBuffer(queue, data.GetLoc_DataUVPoints(), CL_TRUE, 0, sizeof(cl_float2) * arrays.n_uv, &arrays.uv_points[0], 0, NULL, NULL);
+	EXPECT_EQ(CL_SUCCESS, status);
+
+	arrays.uv_order = data.GetUVOrder();
+	arrays.n_tables = data.GetData()->size();
+	return arrays;
+}
+
+static void CompareArrays(const CachedArrays & expected, const CachedArrays & actual)
+{
+	ASSERT_EQ(expected.n_vis, actual.n_vis);
+	ASSERT_EQ(expected.n_v2, actual.n_v2);
+	ASSERT_EQ(expected.n_t3, actual.n_t3);
+	ASSERT_EQ(expected.n_uv, actual.n_uv);
+	ASSERT_EQ(expected.n_data, actual.n_data);
+	EXPECT_EQ(expected.n_tables, actual.n_tables);
+
+	for(unsigned int i = 0; i < expected.n_data; i++)
+	{
+		EXPECT_EQ(expected.data[i], actual.data[i]) << " at index " << i;
+		EXPECT_EQ(expected.data_err[i], actual.data_err[i]) << " at index " << i;
+		EXPECT_EQ(expected.data_inv_err[i], actual.data_inv_err[i]) << " at index " << i;
+	}
+
+	for(unsigned int i = 0; i < expected.n_uv; i++)
+	{
+		EXPECT_EQ(expected.uv_points[i].s[0], actual.uv_points[i].s[0]) << " at index " << i;
+		EXPECT_EQ(expected.uv_points[i].s[1], actual.uv_points[i].s[1]) << " at index " << i;
+	}
+
+	ASSERT_EQ(expected.uv_order.size(), actual.uv_order.size());
+	for(unsigned int i = 0; i < expected.uv_order.size(); i++)
+		EXPECT_EQ(expected.uv_order[i], actual.uv_order[i]) << " at index " << i;
+}
+
+/// Reorders UV points into first-touch order, checks that every reference still points at the same
+/// UV coordinate, then restores the original order and checks that the input is recovered exactly.
+TEST(COILibData, ReorderUV_RoundTrip)
+{
+	vector<pair<double,double> > uv_points;
+	for(unsigned int i = 0; i < 6; i++)
+		uv_points.push_back(pair<double,double>(10.0 * i, -1.0 * i));
+
+	// Point 5 is never referenced and must go last.
+	vector<unsigned int> vis_uv_ref = {3, 1};
+	vector<unsigned int> vis2_uv_ref = {1, 4, 3, 0};
+	vector<tuple<unsigned int, unsigned int, unsigned int>> t3_uv_ref;
+	t3_uv_ref.push_back(make_tuple(2, 4, 0));
+	t3_uv_ref.push_back(make_tuple(0, 3, 2));
+
+	vector<pair<double,double> > t_uv_points(uv_points);
+	vector<unsigned int> t_vis_uv_ref(vis_uv_ref);
+	vector<unsigned int> t_vis2_uv_ref(vis2_uv_ref);
+	vector<tuple<unsigned int, unsigned int, unsigned int>> t_t3_uv_ref(t3_uv_ref);
+	valarray<cl_uint> uv_order;
+
+	COILibData::ReorderUV(t_uv_points, t_vis_uv_ref, t_vis2_uv_ref, t_t3_uv_ref, uv_order);
+
+	ASSERT_EQ(uv_points.size(), t_uv_points.size());
+	ASSERT_EQ(uv_points.size(), uv_order.size());
+
+	// First-touch order: 3, 1, 4, 0, 2, then the unreferenced 5.
+	unsigned int expected_order[] = {3, 1, 4, 0, 2, 5};
+	for(unsigned int i = 0; i < uv_order.size(); i++)
+	{
+		EXPECT_EQ(expected_order[i], uv_order[i]);
+		EXPECT_EQ(uv_points[uv_order[i]], t_uv_points[i]);
+	}
+
+	EXPECT_EQ(0u, t_vis_uv_ref[0]);
+	EXPECT_EQ(1u, t_vis_uv_ref[1]);
+	for(unsigned int i = 0; i < vis2_uv_ref.size(); i++)
+		EXPECT_EQ(uv_points[vis2_uv_ref[i]], t_uv_points[t_vis2_uv_ref[i]]);
+	for(unsigned int i = 0; i < t3_uv_ref.size(); i++)
+	{
+		EXPECT_EQ(uv_points[get<0>(t3_uv_ref[i])], t_uv_points[get<0>(t_t3_uv_ref[i])]);
+		EXPECT_EQ(uv_points[get<1>(t3_uv_ref[i])], t_uv_points[get<1>(t_t3_uv_ref[i])]);
+		EXPECT_EQ(uv_points[get<2>(t3_uv_ref[i])], t_uv_points[get<2>(t_t3_uv_ref[i])]);
+	}
+
+	// Device buffers are padded, padding points must keep their position.
+	pair<double,double> padding(0.0, 0.0);
+	t_uv_points.push_back(padding);
+
+	COILibData::RestoreUVOrder(uv_order, t_uv_points, t_vis_uv_ref, t_vis2_uv_ref, t_t3_uv_ref);
+
+	ASSERT_EQ(uv_points.size() + 1, t_uv_points.size());
+	for(unsigned int i = 0; i < uv_points.size(); i++)
+		EXPECT_EQ(uv_points[i], t_uv_points[i]);
+	EXPECT_EQ(padding, t_uv_points.back());
+	EXPECT_EQ(vis_uv_ref, t_vis_uv_ref);
+	EXPECT_EQ(vis2_uv_ref, t_vis2_uv_ref);
+	EXPECT_EQ(t3_uv_ref, t_t3_uv_ref);
+}
+
+/// Loads a file with the cache enabled, then loads it again and checks that the cache was used (the cache file
+/// is not rewritten) and that the counts, host data and device arrays match the first load. A damaged cache
+/// must be ignored and replaced.
+TEST(COILibData, CL_Cache)
+{
+	string filename = LIBOI_KERNEL_PATH + "../../samples/PointSource_noise.oifits";
+
+	char dir_template[] = "/tmp/liboi_cache_XXXXXX";
+	ASSERT_TRUE(mkdtemp(dir_template) != NULL);
+	string cache_path = dir_template;
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CachedArrays original;
+
+	// The data sets are destroyed before the next load, otherwise the buffers are shared instead of read
+	// from the cache, see ShareBuffers.
+	{
+		COILibData data(filename, cl.GetContext(), cl.GetQueue(), NULL, cache_path, false);
+		original = ReadArrays(data, cl.GetQueue());
+	}
+
+	// Exactly one cache file and no leftover temporary files.
+	vector<string> files = ListFiles(cache_path);
+	ASSERT_EQ(size_t(1), files.size());
+	string cache_file = cache_path + "/" + files[0];
+	ino_t inode = FileInode(cache_file);
+	ASSERT_NE(ino_t(0), inode);
+
+	{
+		COILibData data(filename, cl.GetContext(), cl.GetQueue(), NULL, cache_path, false);
+		CompareArrays(original, ReadArrays(data, cl.GetQueue()));
+	}
+
+	EXPECT_EQ(inode, FileInode(cache_file));
+	EXPECT_EQ(size_t(1), ListFiles(cache_path).size());
+
+	// Truncate the cache, it must be rejected, the file read instead and the cache rewritten.
+	struct stat info;
+	ASSERT_EQ(0, stat(cache_file.c_str(), &info));
+	ASSERT_EQ(0, truncate(cache_file.c_str(), info.st_size / 2));
+
+	{
+		COILibData data(filename, cl.GetContext(), cl.GetQueue(), NULL, cache_path, false);
+		CompareArrays(original, ReadArrays(data, cl.GetQueue()));
+	}
+
+	struct stat rewritten;
+	ASSERT_EQ(0, stat(cache_file.c_str(), &rewritten));
+	EXPECT_EQ(info.st_size, rewritten.st_size);
+	EXPECT_EQ(size_t(1), ListFiles(cache_path).size());
+
+	for(auto & file: ListFiles(cache_path))
+		remove((cache_path + "/" + file).c_str());
+	rmdir(cache_path.c_str());
+}
+
+/// Returns true if a and b are the same buffer or sub-buffers of the same region of one buffer.
+static bool SameStorage(cl_mem a, cl_mem b)
+{
+	if(a == b)
+		return true;
+
+	cl_mem parent_a = NULL;
+	cl_mem parent_b = NULL;
+	size_t offset_a = 0;
+	size_t offset_b = 0;
+	int status = clGetMemObjectInfo(a, CL_MEM_ASSOCIATED_MEMOBJECT, sizeof(cl_mem), &parent_a, NULL);
+	status |= clGetMemObjectInfo(b, CL_MEM_ASSOCIATED_MEMOBJECT, sizeof(cl_mem), &parent_b, NULL);
+	status |= clGetMemObjectInfo(a, CL_MEM_OFFSET, sizeof(size_t), &offset_a, NULL);
+	status |= clGetMemObjectInfo(b, CL_MEM_OFFSET, sizeof(size_t), &offset_b, NULL);
+	EXPECT_EQ(CL_SUCCESS, status);
+
+	return parent_a != NULL && parent_a == parent_b && offset_a == offset_b;
+}
+
+/// Uploads the same OIDataList three times, with and without an arena. The later copies must share the
+/// read-only buffers of the first but keep their own inverse uncertainties. Replacing the data of a shared
+/// data set, the source or a copy, must give it buffers of its own and leave the others intact.
+TEST(COILibData, CL_ShareBuffers)
+{
+	string filename = LIBOI_KERNEL_PATH + "../../samples/PointSource_noise.oifits";
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+
+	OIDataSnapshot snapshot;
+	CachedArrays original;
+	{
+		COILibData data(filename, cl.GetContext(), cl.GetQueue());
+		snapshot = data.GetData();
+		original = ReadArrays(data, cl.GetQueue());
+	}
+
+	for(unsigned int use_arena = 0; use_arena < 2; use_arena++)
+	{
+		CDeviceArenaPtr t_arena;
+		if(use_arena)
+			t_arena = make_shared<CDeviceArena>(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+
+		COILibData source(*snapshot, cl.GetContext(), cl.GetQueue(), t_arena);
+		COILibData copy_a(*snapshot, cl.GetContext(), cl.GetQueue(), t_arena);
+		COILibData copy_b(*snapshot, cl.GetContext(), cl.GetQueue(), t_arena);
+
+		EXPECT_TRUE(SameStorage(source.GetLoc_Data(), copy_a.GetLoc_Data())) << " arena " << use_arena;
+		EXPECT_TRUE(SameStorage(source.GetLoc_DataUVPoints(), copy_a.GetLoc_DataUVPoints())) << " arena " << use_arena;
+		EXPECT_TRUE(SameStorage(source.GetLoc_Data(), copy_b.GetLoc_Data())) << " arena " << use_arena;
+		EXPECT_FALSE(SameStorage(source.GetLoc_DataInvErr(), copy_a.GetLoc_DataInvErr())) << " arena " << use_arena;
+		CompareArrays(original, ReadArrays(copy_a, cl.GetQueue()));
+
+		// Replace a copy, then the source which is still shared with copy_b.
+		copy_a.Replace(*snapshot);
+		EXPECT_FALSE(SameStorage(source.GetLoc_Data(), copy_a.GetLoc_Data())) << " arena " << use_arena;
+		source.Replace(*snapshot);
+		EXPECT_FALSE(SameStorage(source.GetLoc_Data(), copy_b.GetLoc_Data())) << " arena " << use_arena;
+
+		CompareArrays(original, ReadArrays(source, cl.GetQueue()));
+		CompareArrays(original, ReadArrays(copy_a, cl.GetQueue()));
+		CompareArrays(original, ReadArrays(copy_b, cl.GetQueue()));
+	}
+}
+
+/// Data sets keep their arena alive, it is freed with the last data set allocated in it.
+TEST(COILibData, CL_ArenaLifetime)
+{
+	string filename = LIBOI_KERNEL_PATH + "../../samples/PointSource_noise.oifits";
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+
+	CDeviceArenaPtr arena = make_shared<CDeviceArena>(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	weak_ptr<CDeviceArena> weak_arena = arena;
+
+	shared_ptr<COILibData> data(new COILibData(filename, cl.GetContext(), cl.GetQueue(), arena));
+	arena.reset();
+	EXPECT_FALSE(weak_arena.expired());
+
+	data.reset();
+	EXPECT_TRUE(weak_arena.expired());
+}
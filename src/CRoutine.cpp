@@ -35,6 +35,9 @@
 
 #include <cstdio>
 #include <iostream>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include "CRoutine.h"
 
 using namespace std;
@@ -42,6 +45,33 @@ using namespace std;
 namespace liboi
 {
 
+atomic<int> CRoutine::sWaitPolicy(LibOIEnums::WAIT_BLOCK);
+atomic<unsigned int> CRoutine::sSpinBudget(0);
+
+#if MAX_OPENCL_VERSION >= 110
+/// State shared between waitForEventAndRelease and the event callback.
+struct EventWaitState
+{
+	mutex lock;
+	condition_variable cv;
+	bool done;
+	cl_int status;
+};
+
+/// Event callback for LibOIEnums::WAIT_CALLBACK. Called by the OpenCL runtime once the event is
+/// complete (or has terminated abnormally).
+static void CL_CALLBACK eventCompleteCallback(cl_event, cl_int status, void * user_data)
+{
+	EventWaitState * state = (EventWaitState *) user_data;
+
+	// Notify while holding the lock, the waiter may destroy state as soon as it is released.
+	lock_guard<mutex> guard(state->lock);
+	state->done = true;
+	state->status = status;
+	state->cv.notify_all();
+}
+#endif
+
 CRoutine::CRoutine(cl_device_id device, cl_context context, cl_command_queue queue)
 {
 	mDeviceID = device;
@@ -231,24 +261,77 @@ bool CRoutine::Verify(valarray<complex<float>> & cpu_buffer, cl_mem device_buffe
 	return true;
 }
 
-/// Polls for the status of an event and releases the event once it is complete.
+/// Sets how waitForEventAndRelease waits for events, for all routines in this process.
 ///
-/// From AMDAPP SDK /// Copyright ©2013 Advanced Micro Devices, Inc. All rights reserved.
+/// WAIT_SPIN polls the event status and gives the lowest latency at the cost of a host core.
+/// WAIT_BLOCK (the default) blocks in clWaitForEvents, WAIT_CALLBACK sleeps on a condition variable
+/// signaled by an event callback (OpenCL 1.1+, otherwise equivalent to WAIT_BLOCK).
+/// WAIT_HYBRID polls for up to spin_budget_us microseconds, then blocks, which suits latency-critical
+/// callers whose kernels usually complete quickly.
+void CRoutine::SetWaitPolicy(LibOIEnums::EventWaitPolicies policy, unsigned int spin_budget_us)
+{
+	sWaitPolicy = policy;
+	sSpinBudget = spin_budget_us;
+}
+
+/// Waits for the event to complete using the policy set in SetWaitPolicy, then releases it.
+/// Polling loop from AMDAPP SDK /// Copyright ©2013 Advanced Micro Devices, Inc. All rights reserved.
 /// @param event cl_event object
 /// @return 0 if success else nonzero
 int CRoutine::waitForEventAndRelease(cl_event *event)
 {
     cl_int status = CL_SUCCESS;
     cl_int eventStatus = CL_QUEUED;
-    while(eventStatus != CL_COMPLETE)
+    int policy = sWaitPolicy;
+
+    if(policy == LibOIEnums::WAIT_SPIN || policy == LibOIEnums::WAIT_HYBRID)
+    {
+    	auto start = chrono::steady_clock::now();
+    	auto budget = chrono::microseconds(sSpinBudget);
+
+		while(eventStatus != CL_COMPLETE)
+		{
+			status = clGetEventInfo(*event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &eventStatus, NULL);
+			CHECK_OPENCL_ERROR(status, "clGetEventInfo failed.");
+
+			if(eventStatus < 0)
+				break;
+
+			if(policy == LibOIEnums::WAIT_HYBRID && chrono::steady_clock::now() - start > budget)
+				break;
+		}
+    }
+
+#if MAX_OPENCL_VERSION >= 110
+    if(policy == LibOIEnums::WAIT_CALLBACK)
     {
-        status = clGetEventInfo(*event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &eventStatus, NULL);
-    	CHECK_OPENCL_ERROR(status, "clGetEventInfo failed.");
+    	EventWaitState state;
+    	state.done = false;
+    	state.status = CL_SUCCESS;
+
+    	status = clSetEventCallback(*event, CL_COMPLETE, eventCompleteCallback, &state);
+    	CHECK_OPENCL_ERROR(status, "clSetEventCallback failed.");
+
+    	unique_lock<mutex> guard(state.lock);
+    	state.cv.wait(guard, [&state]{ return state.done; });
+    	eventStatus = state.status;
+    }
+#endif
+
+    // WAIT_BLOCK, WAIT_HYBRID past its spin budget, and WAIT_CALLBACK without OpenCL 1.1
+    if(eventStatus != CL_COMPLETE && eventStatus >= 0)
+    {
+    	status = clWaitForEvents(1, event);
+    	CHECK_OPENCL_ERROR(status, "clWaitForEvents failed.");
+    	eventStatus = CL_COMPLETE;
     }
 
     status = clReleaseEvent(*event);
 	CHECK_OPENCL_ERROR(status, "clReleaseEvent failed.");
 
+	if(eventStatus < 0)
+		return eventStatus;
+
     return 0;
 }
 
@@ -73,6 +73,7 @@
 #include <cstdio>
 #include <valarray>
 #include <cassert>
+#include <atomic>
 
 #include "textio.hpp"
 #include "liboi.hpp"
@@ -112,6 +113,10 @@ protected:
 
 	string mKernelPath;
 
+	// Shared by all routines, see SetWaitPolicy
+	static atomic<int> sWaitPolicy;
+	static atomic<unsigned int> sSpinBudget;
+
 public:
 	CRoutine(cl_device_id mDevice, cl_context mContext, cl_command_queue mQueue);
 	virtual ~CRoutine();
@@ -128,6 +133,7 @@ public:
 	bool Verify(valarray<cl_float> & cpu_buffer, cl_mem device_buffer, int n_elements, size_t offset);
 	bool Verify(valarray<complex<float>> & cpu_buffer, cl_mem device_buffer, int num_elements, size_t offset);
 
+	static void SetWaitPolicy(LibOIEnums::EventWaitPolicies policy, unsigned int spin_budget_us = 0);
 	static int waitForEventAndRelease(cl_event *event);
 
 	static unsigned int next_multiple(unsigned int value, unsigned int base)
@@ -34,6 +34,7 @@
 
 #include "CRoutine_Chi.h"
 #include <cstdio>
+#include <cstdint>
 
 #include "CRoutine_Square.h"
 #include "CRoutine_Zero.h"
@@ -64,14 +65,37 @@ CRoutine_Chi::CRoutine_Chi(cl_device_id device, cl_context context, cl_command_q
 	mSource.push_back("chi_complex_nonconvex.cl");
 	mChiNonConvexSourceID = mSource.size() - 1;
 
+	mSource.push_back("chi2_segmented.cl");
+	mChi2SegmentedSourceID = mSource.size() - 1;
+
+	mSource.push_back("chi_whiten.cl");
+	mChiWhitenSourceID = mSource.size() - 1;
+
+	mSource.push_back("chi2_bootstrap.cl");
+	mChi2BootstrapSourceID = mSource.size() - 1;
+
 	mrSquare = NULL;
 
 	// Set the temporary buffers and compiled kernel IDs to something we can verify is invalid.
 	mChiOutput = NULL;
 	mChiSquaredOutput = NULL;
+	mSegmentOutput = NULL;
+	mSegmentBufferSize = 0;
+	mSegmentLocalSize = 0;
+	mBootstrapOutput = NULL;
+	mBootstrapBufferSize = 0;
+	mBootstrapLocalSize = 0;
 	mChiKernelID = -1;
 	mChiConvexKernelID = -1;
 	mChiNonConvexKernelID = -1;
+	mChi2SegmentedKernelID = -1;
+	mChi2RangesKernelID = -1;
+	mChiWhitenKernelID = -1;
+	mChi2BootstrapKernelID = -1;
+
+	mCovBlocks = NULL;
+	mCovFactors = NULL;
+	mNCovBlocks = 0;
 }
 
 CRoutine_Chi::CRoutine_Chi(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero, CRoutine_Square * rSquare)
@@ -87,14 +111,37 @@ CRoutine_Chi::CRoutine_Chi(cl_device_id device, cl_context context, cl_command_q
 	mSource.push_back("chi_complex_nonconvex.cl");
 	mChiNonConvexSourceID = mSource.size() - 1;
 
+	mSource.push_back("chi2_segmented.cl");
+	mChi2SegmentedSourceID = mSource.size() - 1;
+
+	mSource.push_back("chi_whiten.cl");
+	mChiWhitenSourceID = mSource.size() - 1;
+
+	mSource.push_back("chi2_bootstrap.cl");
+	mChi2BootstrapSourceID = mSource.size() - 1;
+
 	mrSquare = rSquare;
 
 	// Set the temporary buffers and compiled kernel IDs to something we can verify is invalid.
 	mChiOutput = NULL;
 	mChiSquaredOutput = NULL;
+	mSegmentOutput = NULL;
+	mSegmentBufferSize = 0;
+	mSegmentLocalSize = 0;
+	mBootstrapOutput = NULL;
+	mBootstrapBufferSize = 0;
+	mBootstrapLocalSize = 0;
 	mChiKernelID = -1;
 	mChiConvexKernelID = -1;
 	mChiNonConvexKernelID = -1;
+	mChi2SegmentedKernelID = -1;
+	mChi2RangesKernelID = -1;
+	mChiWhitenKernelID = -1;
+	mChi2BootstrapKernelID = -1;
+
+	mCovBlocks = NULL;
+	mCovFactors = NULL;
+	mNCovBlocks = 0;
 }
 
 CRoutine_Chi::~CRoutine_Chi()
@@ -102,13 +149,19 @@ CRoutine_Chi::~CRoutine_Chi()
 	// Note, the routines are deleted elsewhere, leave them alone.
 	if(mChiOutput) clReleaseMemObject(mChiOutput);
 	if(mChiSquaredOutput) clReleaseMemObject(mChiSquaredOutput);
+	if(mSegmentOutput) clReleaseMemObject(mSegmentOutput);
+	if(mBootstrapOutput) clReleaseMemObject(mBootstrapOutput);
 }
 
 /// Computes the chi on the entire data buffer. Results are stored on the OpenCL
 /// device for later use in mChiOutput.
-void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model_data,
+/// Note, the OpenCL routines take the inverse uncertainties, 1/data_err, see COILibData::GetLoc_DataInvErr.
+/// Only the observable types selected in observables (see LibOIEnums::ObservableFlags) are computed,
+/// all other elements are zero.
+void CRoutine_Chi::Chi(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 		LibOIEnums::Chi2Types complex_chi_method,
-		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3)
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		unsigned int observables)
 {
 	// Zero out the result buffer:
 	mrZero->Zero(mChiOutput, mChiBufferSize);
@@ -117,30 +170,69 @@ void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model_data,
 	unsigned int v2_offset = COILibData::CalculateOffset_V2(n_vis);
 	unsigned int t3_offset = COILibData::CalculateOffset_T3(n_vis, n_v2);
 
+	// Observable types which are not selected are skipped and remain zero.
+	unsigned int vis_n = (observables & (LibOIEnums::VIS_AMP_FLAG | LibOIEnums::VIS_PHI_FLAG)) ? n_vis : 0;
+	unsigned int v2_n = (observables & LibOIEnums::V2_FLAG) ? n_v2 : 0;
+	unsigned int t3_n = (observables & (LibOIEnums::T3_AMP_FLAG | LibOIEnums::T3_PHI_FLAG)) ? n_t3 : 0;
+
 	// V2 is always calculated using the standard chi routine.
-	Chi(data, data_err, model_data, mChiOutput, v2_offset, n_v2);
+	Chi(data, data_inv_err, model_data, mChiOutput, v2_offset, v2_n);
 
 	// Vis and T3 have different chi formulae
 	if(complex_chi_method == LibOIEnums::CONVEX)
 	{
-		ChiComplexConvex(data, data_err, model_data, mChiOutput, vis_offset, n_vis);
-		ChiComplexConvex(data, data_err, model_data, mChiOutput, t3_offset, n_t3);
+		ChiComplexConvex(data, data_inv_err, model_data, mChiOutput, vis_offset, vis_n);
+		ChiComplexConvex(data, data_inv_err, model_data, mChiOutput, t3_offset, t3_n);
 	}
 	else	// LibOIEnums::NON_CONVEX is the default method
 	{
-		ChiComplexNonConvex(data, data_err, model_data, mChiOutput, vis_offset, n_vis);
-		ChiComplexNonConvex(data, data_err, model_data, mChiOutput, t3_offset, n_t3);
+		ChiComplexNonConvex(data, data_inv_err, model_data, mChiOutput, vis_offset, vis_n);
+		ChiComplexNonConvex(data, data_inv_err, model_data, mChiOutput, t3_offset, t3_n);
+	}
+
+	// The complex kernels compute both the amplitude and phase, zero the half which was not selected.
+	if((observables & LibOIEnums::ALL_OBSERVABLES) != LibOIEnums::ALL_OBSERVABLES)
+		ZeroObservables(mChiOutput, n_vis, n_v2, n_t3, observables);
+
+	// Decorrelate the chi elements of correlated data. Blocks which span selected and deselected
+	// observables mix the two, so clear the deselected elements again afterwards.
+	if(mNCovBlocks > 0)
+	{
+		Whiten(mChiOutput, mCovBlocks, mCovFactors, mNCovBlocks);
+		if((observables & LibOIEnums::ALL_OBSERVABLES) != LibOIEnums::ALL_OBSERVABLES)
+			ZeroObservables(mChiOutput, n_vis, n_v2, n_t3, observables);
 	}
 }
 
+/// Zeros the chi elements of the observable types which are not selected in observables.
+void CRoutine_Chi::ZeroObservables(cl_mem chi_output, unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		unsigned int observables)
+{
+	unsigned int vis_offset = COILibData::CalculateOffset_Vis();
+	unsigned int v2_offset = COILibData::CalculateOffset_V2(n_vis);
+	unsigned int t3_offset = COILibData::CalculateOffset_T3(n_vis, n_v2);
+
+	if(!(observables & LibOIEnums::VIS_AMP_FLAG))
+		mrZero->Zero(chi_output, vis_offset, n_vis);
+	if(!(observables & LibOIEnums::VIS_PHI_FLAG))
+		mrZero->Zero(chi_output, vis_offset + n_vis, n_vis);
+	if(!(observables & LibOIEnums::V2_FLAG))
+		mrZero->Zero(chi_output, v2_offset, n_v2);
+	if(!(observables & LibOIEnums::T3_AMP_FLAG))
+		mrZero->Zero(chi_output, t3_offset, n_t3);
+	if(!(observables & LibOIEnums::T3_PHI_FLAG))
+		mrZero->Zero(chi_output, t3_offset + n_t3, n_t3);
+}
+
 /// Computes the chi on the entire data buffer and returns the result as an array of floats.
-void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model_data,
+void CRoutine_Chi::Chi(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 		LibOIEnums::Chi2Types complex_chi_method,
 		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
-		float * output, unsigned int & output_size)
+		float * output, unsigned int & output_size,
+		unsigned int observables)
 {
 	// Compute the chi
-	Chi(data, data_err, model_data, complex_chi_method, n_vis, n_v2, n_t3);
+	Chi(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, observables);
 
 	// Computations complete, copy back the chi values:
 	output_size = min(mChiBufferSize, output_size);
@@ -150,7 +242,7 @@ void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model_data,
 }
 
 /// Traditional chi computation under the convex approximation in cartesian coordinates
-void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n)
+void CRoutine_Chi::Chi(cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n)
 {
 	if(n == 0)
 		return;
@@ -165,7 +257,7 @@ void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output
 
 	// Set the arguments to our compute kernel
 	status  = clSetKernelArg(mKernels[mChiKernelID], 0, sizeof(cl_mem), &data);
-	status |= clSetKernelArg(mKernels[mChiKernelID], 1, sizeof(cl_mem), &data_err);
+	status |= clSetKernelArg(mKernels[mChiKernelID], 1, sizeof(cl_mem), &data_inv_err);
 	status |= clSetKernelArg(mKernels[mChiKernelID], 2, sizeof(cl_mem), &model);
 	status |= clSetKernelArg(mKernels[mChiKernelID], 3, sizeof(cl_mem), &output);
 	status |= clSetKernelArg(mKernels[mChiKernelID], 4, sizeof(unsigned int), &start);
@@ -180,63 +272,71 @@ void CRoutine_Chi::Chi(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output
 /// Traditional chi implementation for polar coordinantes in the convex assumption.
 /// Complex data and model vectors are converted to cartesian by rotating by the data phase. Then the
 /// convex elliptical approximation is applied in computing the chi values.
-void CRoutine_Chi::ChiComplexConvex(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n)
+void CRoutine_Chi::ChiComplexConvex(cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n)
 {
-	if(n == 0)
-		return;
-
-	int status = CL_SUCCESS;
-	size_t global = (size_t) n;
-	size_t local = 0;
-
-	// Get the maximum work-group size for executing the kernel on the device
-	status = clGetKernelWorkGroupInfo(mKernels[mChiConvexKernelID], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
-	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
-
-	// Set the arguments to our compute kernel
-	status  = clSetKernelArg(mKernels[mChiConvexKernelID], 0, sizeof(cl_mem), &data);
-	status |= clSetKernelArg(mKernels[mChiConvexKernelID], 1, sizeof(cl_mem), &data_err);
-	status |= clSetKernelArg(mKernels[mChiConvexKernelID], 2, sizeof(cl_mem), &model);
-	status |= clSetKernelArg(mKernels[mChiConvexKernelID], 3, sizeof(cl_mem), &output);
-	status |= clSetKernelArg(mKernels[mChiConvexKernelID], 4, sizeof(unsigned int), &start);
-	status |= clSetKernelArg(mKernels[mChiConvexKernelID], 5, sizeof(unsigned int), &n);
-	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
-
-	// Execute the kernel over the entire range of the data set
-	status = clEnqueueNDRangeKernel(mQueue, mKernels[mChiConvexKernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+	ChiComplex(mChiConvexKernelID, data, data_inv_err, model, output, start, n, 0, n);
 }
 
 /// Chi implementation for polar coordinantes under the non-convex assumption
 /// Chi values are computed between the complex data and model vectors in polar coordinates.
 /// The phase error is moduo TWO_PI to ensure the minimum difference is reported.
-void CRoutine_Chi::ChiComplexNonConvex(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n)
+void CRoutine_Chi::ChiComplexNonConvex(cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n)
 {
-	if(n == 0)
+	ChiComplex(mChiNonConvexKernelID, data, data_inv_err, model, output, start, n, 0, n);
+}
+
+/// Runs one of the complex chi kernels on elements [first, first + count) of the n complex values
+/// stored at start, amplitudes in [start, start + n) followed by the phases.
+void CRoutine_Chi::ChiComplex(int kernel_id, cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output,
+		unsigned int start, unsigned int n, unsigned int first, unsigned int count)
+{
+	if(count == 0)
 		return;
 
 	int status = CL_SUCCESS;
-	size_t global = (size_t) n;
-	size_t local = 0;
-
-	// Get the maximum work-group size for executing the kernel on the device
-	status = clGetKernelWorkGroupInfo(mKernels[mChiNonConvexKernelID], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
-	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
+	size_t global = (size_t) count;
+	// The kernels address the phases relative to the amplitudes, so shift both by first.
+	unsigned int kernel_start = start + first;
 
 	// Set the arguments to our compute kernel
-	status  = clSetKernelArg(mKernels[mChiNonConvexKernelID], 0, sizeof(cl_mem), &data);
-	status |= clSetKernelArg(mKernels[mChiNonConvexKernelID], 1, sizeof(cl_mem), &data_err);
-	status |= clSetKernelArg(mKernels[mChiNonConvexKernelID], 2, sizeof(cl_mem), &model);
-	status |= clSetKernelArg(mKernels[mChiNonConvexKernelID], 3, sizeof(cl_mem), &output);
-	status |= clSetKernelArg(mKernels[mChiNonConvexKernelID], 4, sizeof(unsigned int), &start);
-	status |= clSetKernelArg(mKernels[mChiNonConvexKernelID], 5, sizeof(unsigned int), &n);
+	status  = clSetKernelArg(mKernels[kernel_id], 0, sizeof(cl_mem), &data);
+	status |= clSetKernelArg(mKernels[kernel_id], 1, sizeof(cl_mem), &data_inv_err);
+	status |= clSetKernelArg(mKernels[kernel_id], 2, sizeof(cl_mem), &model);
+	status |= clSetKernelArg(mKernels[kernel_id], 3, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[kernel_id], 4, sizeof(unsigned int), &kernel_start);
+	status |= clSetKernelArg(mKernels[kernel_id], 5, sizeof(unsigned int), &n);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
 
-	// Execute the kernel over the entire range of the data set
-	status = clEnqueueNDRangeKernel(mQueue, mKernels[mChiNonConvexKernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
+	// Execute the kernel over the requested range of the data set
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[kernel_id], 1, NULL, &global, NULL, 0, NULL, NULL);
 	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
 }
 
+/// Computes the chi of part of the data buffer, as Chi above but without zeroing mChiOutput first.
+/// ranges holds the [start, end) range of the Vis, V2 and T3 data to compute, each counted within its
+/// observable type (see COILibData::GetUVChunkTypeRanges). Only the covariance blocks (see SetWhitening)
+/// whose elements are in segment according to segment_id are whitened, the others may hold partial values.
+/// Elements outside of the ranges keep their previous values.
+void CRoutine_Chi::ChiPartial(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+		LibOIEnums::Chi2Types complex_chi_method,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		const cl_uint2 * ranges, cl_mem segment_id, unsigned int segment)
+{
+	unsigned int vis_offset = COILibData::CalculateOffset_Vis();
+	unsigned int v2_offset = COILibData::CalculateOffset_V2(n_vis);
+	unsigned int t3_offset = COILibData::CalculateOffset_T3(n_vis, n_v2);
+	int kernel_id = (complex_chi_method == LibOIEnums::CONVEX) ? mChiConvexKernelID : mChiNonConvexKernelID;
+
+	ChiComplex(kernel_id, data, data_inv_err, model_data, mChiOutput, vis_offset, n_vis,
+			ranges[0].s[0], ranges[0].s[1] - ranges[0].s[0]);
+	Chi(data, data_inv_err, model_data, mChiOutput, v2_offset + ranges[1].s[0], ranges[1].s[1] - ranges[1].s[0]);
+	ChiComplex(kernel_id, data, data_inv_err, model_data, mChiOutput, t3_offset, n_t3,
+			ranges[2].s[0], ranges[2].s[1] - ranges[2].s[0]);
+
+	if(mNCovBlocks > 0)
+		Whiten(mChiOutput, mCovBlocks, mCovFactors, mNCovBlocks, 0, segment_id, segment);
+}
+
 /// Straight (traditional) chi computation under the convex approximation
 void CRoutine_Chi::Chi(valarray<cl_float> & data, valarray<cl_float> & data_err, valarray<cl_float> & model,
 		unsigned int start_index, unsigned int n,
@@ -328,9 +428,10 @@ void CRoutine_Chi::Chi_complex_nonconvex(valarray<cl_float> & data, valarray<cl_
 }
 
 /// Computes the Chi squared.
-float CRoutine_Chi::Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
+float CRoutine_Chi::Chi2(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 		LibOIEnums::Chi2Types complex_chi_method,
-		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, bool compute_sum)
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, bool compute_sum,
+		unsigned int observables)
 {
 	if(mrSquare == NULL)
 		throw "Square routine is not allocated. This is a programming error (wrong constructor called).";
@@ -339,7 +440,7 @@ float CRoutine_Chi::Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
 	mrZero->Zero(mChiSquaredOutput, mChiBufferSize);
 
 	// Calculate the chi, then square it.
-	Chi(data, data_err, model_data, complex_chi_method, n_vis, n_v2, n_t3);
+	Chi(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, observables);
 	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
 	mrSquare->Square(mChiOutput, mChiSquaredOutput, n_data, n_data);
 
@@ -350,13 +451,14 @@ float CRoutine_Chi::Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
 	return 0;
 }
 
-void CRoutine_Chi::Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
+void CRoutine_Chi::Chi2(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 		LibOIEnums::Chi2Types complex_chi_method,
 		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
-		float * output, unsigned int & output_size)
+		float * output, unsigned int & output_size,
+		unsigned int observables)
 {
 	// Compute the chi
-	Chi2(data, data_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, false);
+	Chi2(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, false, observables);
 
 	// Computations complete, copy back the chi values:
 	output_size = min(mChiBufferSize, output_size);
@@ -365,14 +467,333 @@ void CRoutine_Chi::Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
 	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
 }
 
-// Initialize the Chi2 routine.  Note, this internally allocates some memory for computing a parallel sum.
-void CRoutine_Chi::Init(unsigned int n)
+/// Computes the chi2 of the n_segments segments of the chi_output buffer starting with segment_start
+/// and stores the result in output[segment_start, segment_start + n_segments).
+/// segment_id assigns each element of chi_output to a segment, segment_range holds the [start, end)
+/// range in which the elements of each segment are found. See COILibData::BuildSegments.
+/// If cumulative is set, output[segment - 1] is added to the chi2 of each segment. This is only meaningful
+/// for n_segments = 1, see Chi2Running.
+void CRoutine_Chi::Chi2Segmented(cl_mem chi_output, cl_mem segment_id, cl_mem segment_range, cl_mem output,
+		unsigned int segment_start, unsigned int n_segments, bool cumulative)
 {
+	if(n_segments == 0)
+		return;
+
 	int status = CL_SUCCESS;
-	mChiBufferSize = n;
+	// One work group per segment.
+	size_t global = n_segments * mSegmentLocalSize;
+	size_t local = mSegmentLocalSize;
+	unsigned int t_cumulative = (cumulative) ? 1 : 0;
+
+	// Set the arguments to our compute kernel
+	status  = clSetKernelArg(mKernels[mChi2SegmentedKernelID], 0, sizeof(cl_mem), &chi_output);
+	status |= clSetKernelArg(mKernels[mChi2SegmentedKernelID], 1, sizeof(cl_mem), &segment_id);
+	status |= clSetKernelArg(mKernels[mChi2SegmentedKernelID], 2, sizeof(cl_mem), &segment_range);
+	status |= clSetKernelArg(mKernels[mChi2SegmentedKernelID], 3, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mChi2SegmentedKernelID], 4, local * sizeof(cl_float), NULL);
+	status |= clSetKernelArg(mKernels[mChi2SegmentedKernelID], 5, sizeof(unsigned int), &segment_start);
+	status |= clSetKernelArg(mKernels[mChi2SegmentedKernelID], 6, sizeof(unsigned int), &t_cumulative);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mChi2SegmentedKernelID], 1, NULL, &global, &local, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// Computes the chi on the entire data buffer, then the chi2 of the n_segments segments starting with
+/// segment_start. Only these n_segments chi2 values are copied back to output.
+void CRoutine_Chi::Chi2Segmented(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+		LibOIEnums::Chi2Types complex_chi_method,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		cl_mem segment_id, cl_mem segment_range,
+		unsigned int segment_start, unsigned int n_segments,
+		float * output, unsigned int observables)
+{
+	int status = CL_SUCCESS;
+	ReserveSegments(segment_start + n_segments);
+
+	Chi(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, observables);
+	Chi2Segmented(mChiOutput, segment_id, segment_range, mSegmentOutput, segment_start, n_segments);
+
+	status = clEnqueueReadBuffer(mQueue, mSegmentOutput, CL_TRUE, sizeof(cl_float) * segment_start,
+			sizeof(cl_float) * n_segments, output, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+}
+
+/// Adds the chi2 of one segment of a series to a running sum kept on the OpenCL device and starts copying the
+/// sum to output without blocking. The chi is computed for the data in ranges only, see ChiPartial.
+/// The segments must be computed in order starting with zero. The sum is in output once event completes,
+/// the caller must wait for (and release) event before output goes out of scope.
+void CRoutine_Chi::Chi2Running(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+		LibOIEnums::Chi2Types complex_chi_method,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		const cl_uint2 * ranges, cl_mem segment_id, cl_mem segment_range, unsigned int segment,
+		float * output, cl_event * event)
+{
+	int status = CL_SUCCESS;
+	ReserveSegments(segment + 1);
+
+	ChiPartial(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, ranges, segment_id, segment);
+	Chi2Segmented(mChiOutput, segment_id, segment_range, mSegmentOutput, segment, 1, true);
+
+	status = clEnqueueReadBuffer(mQueue, mSegmentOutput, CL_FALSE, sizeof(cl_float) * segment, sizeof(cl_float),
+			output, 0, NULL, event);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	status = clFlush(mQueue);
+	CHECK_OPENCL_ERROR(status, "clFlush failed.");
+}
 
-	// First initialize the base-class constructor:
-	CRoutine_Sum_AMD::Init(mChiBufferSize);
+/// Computes the chi2 of each segment of chi_output on the CPU. See the OpenCL version above.
+void CRoutine_Chi::Chi2Segmented(valarray<cl_float> & chi_output, valarray<cl_uint> & segment_id,
+		valarray<cl_uint2> & segment_range, valarray<cl_float> & output)
+{
+	assert(chi_output.size() == segment_id.size());
+
+	size_t n_segments = segment_range.size();
+	if(output.size() != n_segments)
+		output.resize(n_segments);
+
+	output = 0;
+	for(size_t seg = 0; seg < n_segments; seg++)
+	{
+		for(size_t i = segment_range[seg].s[0]; i < segment_range[seg].s[1]; i++)
+		{
+			if(segment_id[i] == seg)
+				output[seg] += chi_output[i] * chi_output[i];
+		}
+	}
+}
+
+/// Computes the chi2 of each of the n_ranges contiguous [start, end) ranges of chi_output
+/// and stores the result in output[0, n_ranges). All ranges are reduced in a single kernel launch.
+void CRoutine_Chi::Chi2Ranges(cl_mem chi_output, cl_mem ranges, cl_mem output, unsigned int n_ranges)
+{
+	if(n_ranges == 0)
+		return;
+
+	int status = CL_SUCCESS;
+	// One work group per range.
+	size_t global = n_ranges * mSegmentLocalSize;
+	size_t local = mSegmentLocalSize;
+
+	status  = clSetKernelArg(mKernels[mChi2RangesKernelID], 0, sizeof(cl_mem), &chi_output);
+	status |= clSetKernelArg(mKernels[mChi2RangesKernelID], 1, sizeof(cl_mem), &ranges);
+	status |= clSetKernelArg(mKernels[mChi2RangesKernelID], 2, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mChi2RangesKernelID], 3, local * sizeof(cl_float), NULL);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mChi2RangesKernelID], 1, NULL, &global, &local, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// CPU version of Chi2Ranges.
+void CRoutine_Chi::Chi2Ranges(valarray<cl_float> & chi_output, valarray<cl_uint2> & ranges, valarray<cl_float> & output)
+{
+	size_t n_ranges = ranges.size();
+	if(output.size() != n_ranges)
+		output.resize(n_ranges);
+
+	output = 0;
+	for(size_t r = 0; r < n_ranges; r++)
+	{
+		for(size_t i = ranges[r].s[0]; i < ranges[r].s[1]; i++)
+			output[r] += chi_output[i] * chi_output[i];
+	}
+}
+
+/// Computes the chi2 of the n_replicates bootstrap replicates starting with replicate_start from the first n
+/// elements of chi_output and stores the result in output[0, n_replicates). All replicates are reduced in a
+/// single kernel launch.
+///
+/// block_id assigns each element to a resampling block. Every element of a block is weighted by the same
+/// multiplicity, see BootstrapMultiplicity, which is generated on the fly from the seed, the replicate and the block.
+void CRoutine_Chi::Chi2Bootstrap(cl_mem chi_output, cl_mem block_id, unsigned int n, cl_uint seed,
+		unsigned int replicate_start, unsigned int n_replicates, cl_mem output)
+{
+	if(n_replicates == 0)
+		return;
+
+	int status = CL_SUCCESS;
+	// One work group per replicate.
+	size_t global = n_replicates * mBootstrapLocalSize;
+	size_t local = mBootstrapLocalSize;
+
+	status  = clSetKernelArg(mKernels[mChi2BootstrapKernelID], 0, sizeof(cl_mem), &chi_output);
+	status |= clSetKernelArg(mKernels[mChi2BootstrapKernelID], 1, sizeof(cl_mem), &block_id);
+	status |= clSetKernelArg(mKernels[mChi2BootstrapKernelID], 2, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mChi2BootstrapKernelID], 3, local * sizeof(cl_float), NULL);
+	status |= clSetKernelArg(mKernels[mChi2BootstrapKernelID], 4, sizeof(unsigned int), &n);
+	status |= clSetKernelArg(mKernels[mChi2BootstrapKernelID], 5, sizeof(cl_uint), &seed);
+	status |= clSetKernelArg(mKernels[mChi2BootstrapKernelID], 6, sizeof(unsigned int), &replicate_start);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mChi2BootstrapKernelID], 1, NULL, &global, &local, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// Computes the chi on the entire data buffer once, then the chi2 of the n_replicates bootstrap replicates
+/// starting with replicate_start. The data stay resident on the device, only the n_replicates chi2 values are
+/// copied back to output.
+void CRoutine_Chi::Chi2Bootstrap(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+		LibOIEnums::Chi2Types complex_chi_method,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		cl_mem block_id, cl_uint seed, unsigned int replicate_start, unsigned int n_replicates,
+		float * output, unsigned int observables)
+{
+	int status = CL_SUCCESS;
+
+	// (Re)allocate the replicate buffer if needed.
+	if(n_replicates > mBootstrapBufferSize)
+	{
+		if(mBootstrapOutput) clReleaseMemObject(mBootstrapOutput);
+		mBootstrapOutput = clCreateBuffer(mContext, CL_MEM_READ_WRITE, sizeof(cl_float) * n_replicates, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mBootstrapOutput) failed.");
+		mBootstrapBufferSize = n_replicates;
+	}
+
+	Chi(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, observables);
+	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
+	Chi2Bootstrap(mChiOutput, block_id, n_data, seed, replicate_start, n_replicates, mBootstrapOutput);
+
+	status = clEnqueueReadBuffer(mQueue, mBootstrapOutput, CL_TRUE, 0, sizeof(cl_float) * n_replicates, output, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+}
+
+/// Computes the chi2 of output.size() bootstrap replicates starting with replicate_start on the CPU.
+/// See the OpenCL version above.
+void CRoutine_Chi::Chi2Bootstrap(valarray<cl_float> & chi_output, valarray<cl_uint> & block_id, cl_uint seed,
+		unsigned int replicate_start, valarray<cl_float> & output)
+{
+	assert(chi_output.size() == block_id.size());
+
+	output = 0;
+	for(size_t r = 0; r < output.size(); r++)
+	{
+		for(size_t i = 0; i < chi_output.size(); i++)
+			output[r] += BootstrapMultiplicity(seed, replicate_start + r, block_id[i]) * chi_output[i] * chi_output[i];
+	}
+}
+
+/// Returns the multiplicity of block in the bootstrap replicate generated from seed. Multiplicities are
+/// Poisson(1) distributed, drawn by inverting the CDF with the output of a Philox2x32-10 counter-based
+/// generator keyed on seed with the counter [replicate, block]. Matches chi2_bootstrap.cl exactly.
+cl_uint CRoutine_Chi::BootstrapMultiplicity(cl_uint seed, cl_uint replicate, cl_uint block)
+{
+	// floor(2^32 * CDF(k)) of the Poisson(1) distribution for k = 0, 1, ...
+	static const cl_uint poisson_cdf[12] = {
+		0x5e2d58d8, 0xbc5ab1b1, 0xeb715e1d, 0xfb239797, 0xff1025f5, 0xffd90f3b,
+		0xfffa8b71, 0xffff540c, 0xffffed1f, 0xfffffe21, 0xffffffd4, 0xfffffffc};
+
+	cl_uint key = seed;
+	cl_uint ctr0 = replicate;
+	cl_uint ctr1 = block;
+	for(int r = 0; r < 10; r++)
+	{
+		uint64_t product = uint64_t(0xD256D193u) * ctr0;
+		ctr0 = cl_uint(product >> 32) ^ key ^ ctr1;
+		ctr1 = cl_uint(product);
+		key += 0x9E3779B9u;
+	}
+
+	cl_uint k = 0;
+	while(k < 12 && ctr0 >= poisson_cdf[k])
+		k++;
+
+	return k;
+}
+
+/// Sets the covariance blocks applied to the chi elements by the data-level Chi functions.
+/// The arguments are those stored in COILibData, see COILibData::SetCovariance. They apply to all
+/// subsequent calls, set n_cov_blocks = 0 for uncorrelated data.
+void CRoutine_Chi::SetWhitening(cl_mem cov_blocks, cl_mem cov_factors, unsigned int n_cov_blocks)
+{
+	mCovBlocks = cov_blocks;
+	mCovFactors = cov_factors;
+	mNCovBlocks = n_cov_blocks;
+}
+
+/// Whitens the chi elements of each covariance block in place by solving L * y = chi, where L is
+/// the Cholesky factor of the block's correlation matrix. See chi_whiten.cl for the storage format.
+/// The blocks are offset by offset elements, e.g. to whiten one row of a Jacobian.
+/// If segment_id is given, only the blocks whose elements are in segment are whitened.
+void CRoutine_Chi::Whiten(cl_mem chi_output, cl_mem cov_blocks, cl_mem cov_factors, unsigned int n_cov_blocks,
+		unsigned int offset, cl_mem segment_id, unsigned int segment)
+{
+	if(n_cov_blocks == 0)
+		return;
+
+	int status = CL_SUCCESS;
+	size_t global = (size_t) n_cov_blocks;
+
+	// Set the arguments to our compute kernel
+	status  = clSetKernelArg(mKernels[mChiWhitenKernelID], 0, sizeof(cl_mem), &chi_output);
+	status |= clSetKernelArg(mKernels[mChiWhitenKernelID], 1, sizeof(cl_mem), &cov_blocks);
+	status |= clSetKernelArg(mKernels[mChiWhitenKernelID], 2, sizeof(cl_mem), &cov_factors);
+	status |= clSetKernelArg(mKernels[mChiWhitenKernelID], 3, sizeof(unsigned int), &n_cov_blocks);
+	status |= clSetKernelArg(mKernels[mChiWhitenKernelID], 4, sizeof(unsigned int), &offset);
+	status |= clSetKernelArg(mKernels[mChiWhitenKernelID], 5, sizeof(cl_mem), &segment_id);
+	status |= clSetKernelArg(mKernels[mChiWhitenKernelID], 6, sizeof(unsigned int), &segment);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	// One work item per block
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mChiWhitenKernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// Whitens the chi elements on the CPU. See the OpenCL version above.
+void CRoutine_Chi::Whiten(valarray<cl_float> & chi_output, valarray<cl_uint4> & cov_blocks, valarray<cl_float> & cov_factors)
+{
+	for(size_t b = 0; b < cov_blocks.size(); b++)
+	{
+		unsigned int start = cov_blocks[b].s[0];
+		unsigned int size = cov_blocks[b].s[1];
+		unsigned int row = cov_blocks[b].s[2];
+
+		for(unsigned int i = 0; i < size; i++)
+		{
+			float sum = chi_output[start + i];
+			for(unsigned int j = 0; j < i; j++)
+				sum -= cov_factors[row + j] * chi_output[start + j];
+
+			chi_output[start + i] = sum * cov_factors[row + i];
+			row += i + 1;
+		}
+	}
+}
+
+/// Grows the segment buffer to hold at least n_segments values. Existing values are kept.
+void CRoutine_Chi::ReserveSegments(unsigned int n_segments)
+{
+	if(n_segments <= mSegmentBufferSize)
+		return;
+
+	int status = CL_SUCCESS;
+	cl_mem tmp = clCreateBuffer(mContext, CL_MEM_READ_WRITE, sizeof(cl_float) * n_segments, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer(mSegmentOutput) failed.");
+
+	if(mSegmentOutput)
+	{
+		// The old buffer is freed by OpenCL once the copy completes.
+		status = clEnqueueCopyBuffer(mQueue, mSegmentOutput, tmp, 0, 0, sizeof(cl_float) * mSegmentBufferSize, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+		clReleaseMemObject(mSegmentOutput);
+	}
+
+	mSegmentOutput = tmp;
+	mSegmentBufferSize = n_segments;
+}
+
+/// Changes the number of elements processed by this routine without recompiling any kernels.
+/// The output buffers are only reallocated if they are smaller than n.
+void CRoutine_Chi::Resize(unsigned int n)
+{
+	int status = CL_SUCCESS;
+	bool grow = (mChiOutput == NULL || mChiSquaredOutput == NULL || n > mChiBufferSize);
+
+	CRoutine_Sum_AMD::Resize(n);
+	mChiBufferSize = n;
+	if(!grow)
+		return;
 
 	// Output buffer
 	if(mChiOutput) clReleaseMemObject(mChiOutput);
@@ -382,6 +803,14 @@ void CRoutine_Chi::Init(unsigned int n)
 	if(mChiSquaredOutput) clReleaseMemObject(mChiSquaredOutput);
 	mChiSquaredOutput = clCreateBuffer(mContext, CL_MEM_READ_WRITE, sizeof(cl_float) * mChiBufferSize, NULL, &status);
 	CHECK_OPENCL_ERROR(status, "clCreateBuffer(mChiSquaredOutput) failed.");
+}
+
+// Initialize the Chi2 routine.  Note, this internally allocates some memory for computing a parallel sum.
+void CRoutine_Chi::Init(unsigned int n)
+{
+	// First initialize the base-class constructor, then allocate the output buffers:
+	CRoutine_Sum_AMD::Init(n);
+	Resize(n);
 
 	// Read the kernels, compile them
 	string source = ReadSource(mSource[mChiSourceID]);
@@ -400,6 +829,40 @@ void CRoutine_Chi::Init(unsigned int n)
     source = ReadSource(mSource[mChiNonConvexSourceID]);
     BuildKernel(tmp.str(), "chi_complex_nonconvex", mSource[mChiNonConvexSourceID]);
     mChiNonConvexKernelID = mKernels.size() - 1;
+
+	source = ReadSource(mSource[mChi2SegmentedSourceID]);
+    BuildKernel(source, "chi2_segmented", mSource[mChi2SegmentedSourceID]);
+    mChi2SegmentedKernelID = mKernels.size() - 1;
+    BuildKernel(source, "chi2_ranges", mSource[mChi2SegmentedSourceID]);
+    mChi2RangesKernelID = mKernels.size() - 1;
+
+	source = ReadSource(mSource[mChiWhitenSourceID]);
+    BuildKernel(source, "chi_whiten", mSource[mChiWhitenSourceID]);
+    mChiWhitenKernelID = mKernels.size() - 1;
+
+	source = ReadSource(mSource[mChi2BootstrapSourceID]);
+    BuildKernel(source, "chi2_bootstrap", mSource[mChi2BootstrapSourceID]);
+    mChi2BootstrapKernelID = mKernels.size() - 1;
+
+	// Each kernel may support a different work group size, query them separately.
+	mSegmentLocalSize = min(ReductionLocalSize(mChi2SegmentedKernelID), ReductionLocalSize(mChi2RangesKernelID));
+	mBootstrapLocalSize = ReductionLocalSize(mChi2BootstrapKernelID);
+}
+
+/// Returns the work group size for the reduction kernel kernel_id: the largest power of two (at most 256)
+/// which the kernel supports on this device. The reductions require a power-of-two work group size.
+size_t CRoutine_Chi::ReductionLocalSize(int kernel_id)
+{
+	int status = CL_SUCCESS;
+	size_t max_local = 0;
+	status = clGetKernelWorkGroupInfo(mKernels[kernel_id], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
+
+	size_t local = 1;
+	while(2 * local <= min(max_local, size_t(256)))
+		local *= 2;
+
+	return local;
 }
 
 } /* namespace liboi */
@@ -47,14 +47,32 @@ protected:
 	int mChiSourceID;
 	int mChiConvexSourceID;
 	int mChiNonConvexSourceID;
+	int mChi2SegmentedSourceID;
+	int mChiWhitenSourceID;
+	int mChi2BootstrapSourceID;
 
 	int mChiKernelID;
 	int mChiConvexKernelID;
 	int mChiNonConvexKernelID;
+	int mChi2SegmentedKernelID;
+	int mChi2RangesKernelID;
+	int mChiWhitenKernelID;
+	int mChi2BootstrapKernelID;
 
 	unsigned int mChiBufferSize;
 	cl_mem mChiOutput;	// All OpenCL calculations store their result here if the convenience functions are used.
 	cl_mem mChiSquaredOutput;	// Chi2 values are stored here.
+	cl_mem mSegmentOutput;		// Per-segment chi2 values are stored here.
+	unsigned int mSegmentBufferSize;
+	size_t mSegmentLocalSize;	// Work group size of chi2_segmented and chi2_ranges, a power of two
+	cl_mem mBootstrapOutput;	// Chi2 of each bootstrap replicate, see Chi2Bootstrap
+	size_t mBootstrapLocalSize;	// Work group size of chi2_bootstrap, a power of two
+	unsigned int mBootstrapBufferSize;
+
+	// Whitening applied to the chi elements of correlated data, see SetWhitening.
+	cl_mem mCovBlocks;
+	cl_mem mCovFactors;
+	unsigned int mNCovBlocks;
 
 	// External routines, deleted elsewhere.
 	CRoutine_Square * mrSquare;
@@ -64,18 +82,31 @@ public:
 	CRoutine_Chi(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero, CRoutine_Square * rSquare);
 	virtual ~CRoutine_Chi();
 
-	void Chi(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n);
-	void ChiComplexConvex(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n);
-	void ChiComplexNonConvex(cl_mem data, cl_mem data_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n);
+	void Chi(cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n);
+	void ChiComplexConvex(cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n);
+	void ChiComplexNonConvex(cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output, unsigned int start, unsigned int n);
 
-	void Chi(cl_mem data, cl_mem data_err, cl_mem model_data,
+protected:
+	void ChiComplex(int kernel_id, cl_mem data, cl_mem data_inv_err, cl_mem model, cl_mem output,
+			unsigned int start, unsigned int n, unsigned int first, unsigned int count);
+
+public:
+
+	void Chi(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+			LibOIEnums::Chi2Types complex_chi_method,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+
+	void Chi(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 			LibOIEnums::Chi2Types complex_chi_method,
-			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3);
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			float * output, unsigned int & output_size,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 
-	void Chi(cl_mem data, cl_mem data_err, cl_mem model_data,
+	void ChiPartial(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 			LibOIEnums::Chi2Types complex_chi_method,
 			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
-			float * output, unsigned int & output_size);
+			const cl_uint2 * ranges, cl_mem segment_id, unsigned int segment);
 
 	static void Chi(valarray<cl_float> & data, valarray<cl_float> & data_err, valarray<cl_float> & model,
 			unsigned int start_index, unsigned int n,
@@ -89,16 +120,71 @@ public:
 			unsigned int start_index, unsigned int n,
 			valarray<cl_float> & output);
 
-	float Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
+	float Chi2(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+			LibOIEnums::Chi2Types complex_chi_method,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, bool compute_sum,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+
+	void Chi2(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+			LibOIEnums::Chi2Types complex_chi_method,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			float * output, unsigned int & output_size,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+
+	void Chi2Segmented(cl_mem chi_output, cl_mem segment_id, cl_mem segment_range, cl_mem output,
+			unsigned int segment_start, unsigned int n_segments, bool cumulative = false);
+
+	void Chi2Segmented(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 			LibOIEnums::Chi2Types complex_chi_method,
-			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, bool compute_sum);
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			cl_mem segment_id, cl_mem segment_range,
+			unsigned int segment_start, unsigned int n_segments,
+			float * output,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+
+	static void Chi2Segmented(valarray<cl_float> & chi_output, valarray<cl_uint> & segment_id,
+			valarray<cl_uint2> & segment_range, valarray<cl_float> & output);
+
+	void Chi2Running(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
+			LibOIEnums::Chi2Types complex_chi_method,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			const cl_uint2 * ranges, cl_mem segment_id, cl_mem segment_range, unsigned int segment,
+			float * output, cl_event * event);
+
+	void Chi2Ranges(cl_mem chi_output, cl_mem ranges, cl_mem output, unsigned int n_ranges);
+	static void Chi2Ranges(valarray<cl_float> & chi_output, valarray<cl_uint2> & ranges, valarray<cl_float> & output);
+
+	void Chi2Bootstrap(cl_mem chi_output, cl_mem block_id, unsigned int n, cl_uint seed,
+			unsigned int replicate_start, unsigned int n_replicates, cl_mem output);
 
-	void Chi2(cl_mem data, cl_mem data_err, cl_mem model_data,
+	void Chi2Bootstrap(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 			LibOIEnums::Chi2Types complex_chi_method,
 			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
-			float * output, unsigned int & output_size);
+			cl_mem block_id, cl_uint seed, unsigned int replicate_start, unsigned int n_replicates,
+			float * output,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+
+	static void Chi2Bootstrap(valarray<cl_float> & chi_output, valarray<cl_uint> & block_id, cl_uint seed,
+			unsigned int replicate_start, valarray<cl_float> & output);
+	static cl_uint BootstrapMultiplicity(cl_uint seed, cl_uint replicate, cl_uint block);
+
+	cl_mem GetChiBuffer() { return mChiOutput; };
 
 	void Init(unsigned int num_elements);
+	virtual void Resize(unsigned int num_elements);
+
+protected:
+	size_t ReductionLocalSize(int kernel_id);
+	void ReserveSegments(unsigned int n_segments);
+	void ZeroObservables(cl_mem chi_output, unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			unsigned int observables);
+
+public:
+	void SetWhitening(cl_mem cov_blocks, cl_mem cov_factors, unsigned int n_cov_blocks);
+
+	void Whiten(cl_mem chi_output, cl_mem cov_blocks, cl_mem cov_factors, unsigned int n_cov_blocks,
+			unsigned int offset = 0, cl_mem segment_id = NULL, unsigned int segment = 0);
+	static void Whiten(valarray<cl_float> & chi_output, valarray<cl_uint4> & cov_blocks, valarray<cl_float> & cov_factors);
 };
 
 } /* namespace liboi */
@@ -163,7 +163,9 @@ protected:
 		// Fill the input buffer
 		int err = CL_SUCCESS;
 		err = clEnqueueWriteBuffer(cl->GetQueue(), data_cl, CL_TRUE, 0, sizeof(cl_float) * test_size, &data[0], 0, NULL, NULL);
-		err = clEnqueueWriteBuffer(cl->GetQueue(), data_err_cl, CL_TRUE, 0, sizeof(cl_float) * test_size, &data_err[0], 0, NULL, NULL);
+		// The OpenCL chi routines take the inverse of the uncertainties.
+		valarray<cl_float> data_inv_err = cl_float(1.0) / data_err;
+		err = clEnqueueWriteBuffer(cl->GetQueue(), data_err_cl, CL_TRUE, 0, sizeof(cl_float) * test_size, &data_inv_err[0], 0, NULL, NULL);
 		err = clEnqueueWriteBuffer(cl->GetQueue(), model_cl, CL_TRUE, 0, sizeof(cl_float) * test_size, &model[0], 0, NULL, NULL);
 		CHECK_ERROR(err, CL_SUCCESS, "clEnqueueWriteBuffer Failed");
 	}
@@ -513,6 +515,224 @@ TEST_F(ChiTest, CL_Chi2_T3)
 	EXPECT_NEAR(should_be_one, 1, MAX_REL_ERROR);
 }
 
+/// Checks that the OpenCL segmented chi2 matches the CPU version.
+/// Segments are interleaved within two ranges, similar to COILibData::BuildSegments.
+TEST_F(ChiTest, CL_Chi2Segmented_CPU)
+{
+	size_t test_size = 10000;
+	unsigned int n_segments = 8;
+	unsigned int bins = n_segments / 2;
+
+	// Create buffers, data are used as the chi values.
+	valarray<cl_float> data(test_size);
+	valarray<cl_float> data_err(test_size);
+	valarray<cl_float> model(test_size);
+	valarray<cl_float> output(test_size);
+	MakeChiOneBuffers(data, data_err, model, output, test_size / 2);
+
+	valarray<cl_uint> segment_id(test_size);
+	valarray<cl_uint2> segment_range(n_segments);
+	for(size_t i = 0; i < test_size; i++)
+		segment_id[i] = (i < test_size / 2) ? i % bins : bins + i % bins;
+
+	for(unsigned int i = 0; i < n_segments; i++)
+	{
+		segment_range[i].s[0] = (i < bins) ? 0 : test_size / 2;
+		segment_range[i].s[1] = (i < bins) ? test_size / 2 : test_size;
+	}
+
+	valarray<cl_float> cpu_output;
+	CRoutine_Chi::Chi2Segmented(data, segment_id, segment_range, cpu_output);
+
+	// Setup OpenCL and the Chi routine. Teardown is automatic.
+	SetUpCL(data, data_err, model);
+	cl_mem segment_id_cl = clCreateBuffer(cl->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_uint) * test_size, NULL, NULL);
+	cl_mem segment_range_cl = clCreateBuffer(cl->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_uint2) * n_segments, NULL, NULL);
+	int err = CL_SUCCESS;
+	err  = clEnqueueWriteBuffer(cl->GetQueue(), segment_id_cl, CL_TRUE, 0, sizeof(cl_uint) * test_size, &segment_id[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl->GetQueue(), segment_range_cl, CL_TRUE, 0, sizeof(cl_uint2) * n_segments, &segment_range[0], 0, NULL, NULL);
+	CHECK_ERROR(err, CL_SUCCESS, "clEnqueueWriteBuffer Failed");
+
+	r->Chi2Segmented(data_cl, segment_id_cl, segment_range_cl, output_cl, 0, n_segments);
+	valarray<cl_float> cl_output(n_segments);
+	ReadCLResult(cl_output);
+
+	clReleaseMemObject(segment_id_cl);
+	clReleaseMemObject(segment_range_cl);
+
+	for(unsigned int i = 0; i < n_segments; i++)
+		EXPECT_NEAR(cl_output[i], cpu_output[i], MAX_REL_ERROR * cpu_output[i]);
+}
+
+/// Checks that the chi2 of packed, contiguous ranges on the OpenCL device matches the CPU version.
+TEST_F(ChiTest, CL_Chi2Ranges_CPU)
+{
+	size_t test_size = 10000;
+	unsigned int n_ranges = 7;
+
+	// Create buffers, data are used as the chi values.
+	valarray<cl_float> data(test_size);
+	valarray<cl_float> data_err(test_size);
+	valarray<cl_float> model(test_size);
+	valarray<cl_float> output(test_size);
+	MakeChiOneBuffers(data, data_err, model, output, test_size / 2);
+
+	// Ranges of unequal length, the last ends before the end of the buffer.
+	valarray<cl_uint2> ranges(n_ranges);
+	unsigned int start = 0;
+	for(unsigned int i = 0; i < n_ranges; i++)
+	{
+		ranges[i].s[0] = start;
+		ranges[i].s[1] = start + 100 * (i + 1) + 13;
+		start = ranges[i].s[1];
+	}
+
+	valarray<cl_float> cpu_output;
+	CRoutine_Chi::Chi2Ranges(data, ranges, cpu_output);
+
+	// Setup OpenCL and the Chi routine. Teardown is automatic.
+	SetUpCL(data, data_err, model);
+	cl_mem ranges_cl = clCreateBuffer(cl->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_uint2) * n_ranges, NULL, NULL);
+	int err = CL_SUCCESS;
+	err = clEnqueueWriteBuffer(cl->GetQueue(), ranges_cl, CL_TRUE, 0, sizeof(cl_uint2) * n_ranges, &ranges[0], 0, NULL, NULL);
+	CHECK_ERROR(err, CL_SUCCESS, "clEnqueueWriteBuffer Failed");
+
+	r->Chi2Ranges(data_cl, ranges_cl, output_cl, n_ranges);
+	valarray<cl_float> cl_output(n_ranges);
+	ReadCLResult(cl_output);
+
+	clReleaseMemObject(ranges_cl);
+
+	for(unsigned int i = 0; i < n_ranges; i++)
+		EXPECT_NEAR(cl_output[i], cpu_output[i], MAX_REL_ERROR * cpu_output[i]);
+}
+
+/// Checks that the Poisson(1) bootstrap multiplicities are reproducible and have unit mean and variance.
+TEST(CRoutine_Chi, CPU_BootstrapMultiplicity)
+{
+	unsigned int n = 100000;
+	double sum = 0;
+	double sum_sq = 0;
+	for(unsigned int i = 0; i < n; i++)
+	{
+		cl_uint k = CRoutine_Chi::BootstrapMultiplicity(42, i / 100, i % 100);
+		EXPECT_EQ(k, CRoutine_Chi::BootstrapMultiplicity(42, i / 100, i % 100));
+		sum += k;
+		sum_sq += k * k;
+	}
+
+	double mean = sum / n;
+	double variance = sum_sq / n - mean * mean;
+	EXPECT_NEAR(1, mean, 0.02);
+	EXPECT_NEAR(1, variance, 0.05);
+}
+
+/// Checks that the chi2 of bootstrap replicates on the OpenCL device matches the CPU version.
+TEST_F(ChiTest, CL_Chi2Bootstrap_CPU)
+{
+	size_t test_size = 10000;
+	unsigned int n_replicates = 9;
+	unsigned int replicate_start = 5;
+	cl_uint seed = 1234;
+
+	// Create buffers, data are used as the chi values.
+	valarray<cl_float> data(test_size);
+	valarray<cl_float> data_err(test_size);
+	valarray<cl_float> model(test_size);
+	valarray<cl_float> output(test_size);
+	MakeChiOneBuffers(data, data_err, model, output, test_size / 2);
+
+	// Pairs of elements share a block, as for the amplitude and phase of a complex datum.
+	valarray<cl_uint> block_id(test_size);
+	for(unsigned int i = 0; i < test_size; i++)
+		block_id[i] = i / 2;
+
+	valarray<cl_float> cpu_output(n_replicates);
+	CRoutine_Chi::Chi2Bootstrap(data, block_id, seed, replicate_start, cpu_output);
+
+	// Setup OpenCL and the Chi routine. Teardown is automatic.
+	SetUpCL(data, data_err, model);
+	cl_mem block_cl = clCreateBuffer(cl->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_uint) * test_size, NULL, NULL);
+	int err = CL_SUCCESS;
+	err = clEnqueueWriteBuffer(cl->GetQueue(), block_cl, CL_TRUE, 0, sizeof(cl_uint) * test_size, &block_id[0], 0, NULL, NULL);
+	CHECK_ERROR(err, CL_SUCCESS, "clEnqueueWriteBuffer Failed");
+
+	r->Chi2Bootstrap(data_cl, block_cl, test_size, seed, replicate_start, n_replicates, output_cl);
+	valarray<cl_float> cl_output(n_replicates);
+	ReadCLResult(cl_output);
+
+	clReleaseMemObject(block_cl);
+
+	for(unsigned int i = 0; i < n_replicates; i++)
+		EXPECT_NEAR(cl_output[i], cpu_output[i], MAX_REL_ERROR * cpu_output[i]);
+}
+
+/// Checks that whitening correlated chi elements on the OpenCL device matches the CPU version.
+TEST_F(ChiTest, CL_Whiten_CPU)
+{
+	size_t test_size = 10000;
+	unsigned int block_size = 10;
+	unsigned int n_blocks = test_size / block_size;
+	unsigned int n_factors = block_size * (block_size + 1) / 2;
+
+	// Create buffers, data are used as the chi values.
+	valarray<cl_float> data(test_size);
+	valarray<cl_float> data_err(test_size);
+	valarray<cl_float> model(test_size);
+	valarray<cl_float> output(test_size);
+	MakeChiOneBuffers(data, data_err, model, output, test_size / 2);
+
+	// Every block uses the Cholesky factor of an exponentially-decaying correlation, rho = 0.5.
+	// For this matrix L_ij = rho^(i-j) * sqrt(1 - rho^2) for j > 0, L_i0 = rho^i
+	float rho = 0.5;
+	valarray<cl_float> factors(n_factors);
+	unsigned int row = 0;
+	for(unsigned int i = 0; i < block_size; i++)
+	{
+		for(unsigned int j = 0; j <= i; j++)
+		{
+			float L_ij = pow(rho, float(i - j));
+			if(j > 0)
+				L_ij *= sqrt(1 - rho * rho);
+
+			// The diagonal is stored inverted.
+			factors[row + j] = (i == j) ? 1 / L_ij : L_ij;
+		}
+		row += i + 1;
+	}
+
+	valarray<cl_uint4> blocks(n_blocks);
+	for(unsigned int b = 0; b < n_blocks; b++)
+	{
+		blocks[b].s[0] = b * block_size;
+		blocks[b].s[1] = block_size;
+		blocks[b].s[2] = 0;
+		blocks[b].s[3] = 0;
+	}
+
+	valarray<cl_float> cpu_output = data;
+	CRoutine_Chi::Whiten(cpu_output, blocks, factors);
+
+	// Setup OpenCL and the Chi routine. Teardown is automatic.
+	SetUpCL(data, data_err, model);
+	cl_mem blocks_cl = clCreateBuffer(cl->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_uint4) * n_blocks, NULL, NULL);
+	cl_mem factors_cl = clCreateBuffer(cl->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_float) * n_factors, NULL, NULL);
+	int err = CL_SUCCESS;
+	err  = clEnqueueWriteBuffer(cl->GetQueue(), blocks_cl, CL_TRUE, 0, sizeof(cl_uint4) * n_blocks, &blocks[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl->GetQueue(), factors_cl, CL_TRUE, 0, sizeof(cl_float) * n_factors, &factors[0], 0, NULL, NULL);
+	err |= clEnqueueCopyBuffer(cl->GetQueue(), data_cl, output_cl, 0, 0, sizeof(cl_float) * test_size, 0, NULL, NULL);
+	CHECK_ERROR(err, CL_SUCCESS, "clEnqueueWriteBuffer Failed");
+
+	r->Whiten(output_cl, blocks_cl, factors_cl, n_blocks);
+	ReadCLResult(output);
+
+	clReleaseMemObject(blocks_cl);
+	clReleaseMemObject(factors_cl);
+
+	for(size_t i = 0; i < test_size; i++)
+		EXPECT_NEAR(output[i], cpu_output[i], MAX_REL_ERROR * fabs(cpu_output[i]));
+}
+
 ///// Checks that a mixture of V2 and T3 yield a chi2 < 1
 //TEST_F(ChiTest, CL_Chi2_Mix)
 //{
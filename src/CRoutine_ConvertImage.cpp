@@ -0,0 +1,192 @@
+/*
+ * CRoutine_ConvertImage.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *
+ *  Description:
+ *      Routine to convert images in their native element type (double, half or
+ *      16-bit unsigned integer) to floating point images on the OpenCL device.
+ *      This lets callers upload their images without converting them on the host.
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CRoutine_ConvertImage.h"
+
+namespace liboi
+{
+
+CRoutine_ConvertImage::CRoutine_ConvertImage(cl_device_id device, cl_context context, cl_command_queue queue)
+	: CRoutine(device, context, queue)
+{
+	mSource.push_back("convert_image.cl");
+
+	mHasFP64 = false;
+	mConvertDoubleKernelID = -1;
+	mConvertHalfKernelID = -1;
+	mConvertUInt16KernelID = -1;
+}
+
+CRoutine_ConvertImage::~CRoutine_ConvertImage()
+{
+
+}
+
+/// Builds the conversion kernels. The double conversion kernel is only built if the device
+/// supports cl_khr_fp64.
+void CRoutine_ConvertImage::Init()
+{
+	mHasFP64 = COpenCL::checkExtensionAvailability(mDeviceID, "cl_khr_fp64");
+
+	stringstream tmp;
+	if(mHasFP64)
+		tmp << "#define LIBOI_FP64 1" << endl;
+	tmp << ReadSource(mSource[0]);
+	string source = tmp.str();
+
+	if(mHasFP64)
+	{
+		BuildKernel(source, "convert_double", mSource[0]);
+		mConvertDoubleKernelID = mKernels.size() - 1;
+	}
+
+	BuildKernel(source, "convert_half", mSource[0]);
+	mConvertHalfKernelID = mKernels.size() - 1;
+
+	BuildKernel(source, "convert_uint16", mSource[0]);
+	mConvertUInt16KernelID = mKernels.size() - 1;
+}
+
+/// Returns true if images of the specified type can be converted on the OpenCL device.
+bool CRoutine_ConvertImage::IsSupported(LibOIEnums::ImageElementTypes type)
+{
+	switch(type)
+	{
+	case LibOIEnums::IMAGE_DOUBLE:
+		return mHasFP64;
+	case LibOIEnums::IMAGE_HALF:
+	case LibOIEnums::IMAGE_UINT16:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/// Returns the size (in bytes) of one element of the specified type.
+size_t CRoutine_ConvertImage::ElementSize(LibOIEnums::ImageElementTypes type)
+{
+	switch(type)
+	{
+	case LibOIEnums::IMAGE_DOUBLE:
+		return sizeof(cl_double);
+	case LibOIEnums::IMAGE_HALF:
+	case LibOIEnums::IMAGE_UINT16:
+		return sizeof(cl_ushort);
+	default:
+		return sizeof(cl_float);
+	}
+}
+
+/// Converts the first n elements of input, of the specified type, to floating point values in output.
+void CRoutine_ConvertImage::Convert(cl_mem input, LibOIEnums::ImageElementTypes type, cl_mem output, unsigned int n)
+{
+	int kernel_id = -1;
+	switch(type)
+	{
+	case LibOIEnums::IMAGE_DOUBLE:
+		kernel_id = mConvertDoubleKernelID;
+		break;
+	case LibOIEnums::IMAGE_HALF:
+		kernel_id = mConvertHalfKernelID;
+		break;
+	case LibOIEnums::IMAGE_UINT16:
+		kernel_id = mConvertUInt16KernelID;
+		break;
+	default:
+		break;
+	}
+
+	if(kernel_id < 0)
+		throw runtime_error("The image element type cannot be converted on this OpenCL device.");
+
+	int status = CL_SUCCESS;
+	size_t global = (size_t) n;
+
+	status  = clSetKernelArg(mKernels[kernel_id], 0, sizeof(cl_mem), &input);
+	status |= clSetKernelArg(mKernels[kernel_id], 1, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[kernel_id], 2, sizeof(unsigned int), &n);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[kernel_id], 1, NULL, &global, NULL, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// CPU version of Convert. Also used for double images on devices without cl_khr_fp64.
+void CRoutine_ConvertImage::Convert(const void * input, LibOIEnums::ImageElementTypes type, valarray<cl_float> & output, unsigned int n)
+{
+	if(output.size() < n)
+		output.resize(n);
+
+	switch(type)
+	{
+	case LibOIEnums::IMAGE_DOUBLE:
+		for(unsigned int i = 0; i < n; i++)
+			output[i] = ((const double *) input)[i];
+		break;
+	case LibOIEnums::IMAGE_HALF:
+		for(unsigned int i = 0; i < n; i++)
+			output[i] = HalfToFloat(((const cl_ushort *) input)[i]);
+		break;
+	case LibOIEnums::IMAGE_UINT16:
+		for(unsigned int i = 0; i < n; i++)
+			output[i] = ((const cl_ushort *) input)[i];
+		break;
+	default:
+		for(unsigned int i = 0; i < n; i++)
+			output[i] = ((const float *) input)[i];
+		break;
+	}
+}
+
+/// Converts an IEEE 754 half precision value to a float.
+float CRoutine_ConvertImage::HalfToFloat(cl_ushort h)
+{
+	int sign = (h >> 15) & 0x1;
+	int exponent = (h >> 10) & 0x1f;
+	int mantissa = h & 0x3ff;
+	float value = 0;
+
+	if(exponent == 0)
+		value = ldexp(float(mantissa), -24);							// zero and subnormals
+	else if(exponent == 31)
+		value = (mantissa == 0) ? INFINITY : NAN;
+	else
+		value = ldexp(float(mantissa + 1024), exponent - 25);
+
+	return (sign) ? -value : value;
+}
+
+} /* namespace liboi */
@@ -0,0 +1,65 @@
+/*
+ * CRoutine_ConvertImage.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+ 
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CROUTINE_CONVERTIMAGE_H_
+#define CROUTINE_CONVERTIMAGE_H_
+
+#include "CRoutine.h"
+
+namespace liboi
+{
+
+class CRoutine_ConvertImage: public CRoutine
+{
+protected:
+	bool mHasFP64;
+	int mConvertDoubleKernelID;
+	int mConvertHalfKernelID;
+	int mConvertUInt16KernelID;
+
+public:
+	CRoutine_ConvertImage(cl_device_id device, cl_context context, cl_command_queue queue);
+	virtual ~CRoutine_ConvertImage();
+
+	void Init();
+
+	bool IsSupported(LibOIEnums::ImageElementTypes type);
+	static size_t ElementSize(LibOIEnums::ImageElementTypes type);
+
+	void Convert(cl_mem input, LibOIEnums::ImageElementTypes type, cl_mem output, unsigned int n);
+	static void Convert(const void * input, LibOIEnums::ImageElementTypes type, valarray<cl_float> & output, unsigned int n);
+
+	static float HalfToFloat(cl_ushort h);
+};
+
+} /* namespace liboi */
+
+#endif /* CROUTINE_CONVERTIMAGE_H_ */
@@ -0,0 +1,105 @@
+/*
+ * CRoutine_ConvertImage_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+
+#include "gtest/gtest.h"
+#include "liboi_tests.h"
+#include "COpenCL.hpp"
+#include "CRoutine_ConvertImage.h"
+
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Converts the input on the OpenCL device and on the CPU and compares the results.
+void CL_ConvertImage_CHECK(const void * input, LibOIEnums::ImageElementTypes type, size_t test_size)
+{
+	// Init the OpenCL device and necessary routines:
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CRoutine_ConvertImage r_convert(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	r_convert.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_convert.Init();
+
+	if(!r_convert.IsSupported(type))
+		return;
+
+	valarray<cl_float> cpu_val(test_size);
+	valarray<cl_float> cl_val(test_size);
+	size_t input_size = CRoutine_ConvertImage::ElementSize(type) * test_size;
+
+	// Create buffers
+	int status = CL_SUCCESS;
+	cl_mem input_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_ONLY, input_size, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+	cl_mem output_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * test_size, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+
+	// Fill the input buffer
+	status = clEnqueueWriteBuffer(cl.GetQueue(), input_cl, CL_TRUE, 0, input_size, input, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+
+	// Convert on the OpenCL device, do the same on the CPU:
+	r_convert.Convert(input_cl, type, output_cl, test_size);
+	CRoutine_ConvertImage::Convert(input, type, cpu_val, test_size);
+
+	// Read back the results.
+	status = clEnqueueReadBuffer(cl.GetQueue(), output_cl, CL_TRUE, 0, sizeof(cl_float) * test_size, &cl_val[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	// Free buffers
+	clReleaseMemObject(input_cl);
+	clReleaseMemObject(output_cl);
+
+	// Check the results.
+	for(size_t i = 0; i < test_size; i++)
+		EXPECT_NEAR(float(cpu_val[i]), float(cl_val[i]), MAX_REL_ERROR) << " at index " << i;
+}
+
+/// Checks the half to float conversion on the CPU against a few exactly representable values.
+TEST(CRoutine_ConvertImage, CPU_HalfToFloat)
+{
+	EXPECT_EQ(0.0f, CRoutine_ConvertImage::HalfToFloat(0x0000));
+	EXPECT_EQ(1.0f, CRoutine_ConvertImage::HalfToFloat(0x3C00));
+	EXPECT_EQ(-2.0f, CRoutine_ConvertImage::HalfToFloat(0xC000));
+	EXPECT_EQ(0.5f, CRoutine_ConvertImage::HalfToFloat(0x3800));
+	EXPECT_EQ(65504.0f, CRoutine_ConvertImage::HalfToFloat(0x7BFF));
+}
+
+/// Verifies that the CPU and OpenCL half conversions agree.
+TEST(CRoutine_ConvertImage, CL_Half)
+{
+	size_t test_size = 10000;
+	// Positive normal halfs, 0x0400 to 0x2b0f, stay well below 1.0
+	valarray<cl_ushort> input(test_size);
+	for(size_t i = 0; i < test_size; i++)
+		input[i] = 0x0400 + i;
+
+	CL_ConvertImage_CHECK(&input[0], LibOIEnums::IMAGE_HALF, test_size);
+}
+
+/// Verifies that the CPU and OpenCL uint16 conversions agree.
+TEST(CRoutine_ConvertImage, CL_UInt16)
+{
+	size_t test_size = 10000;
+	valarray<cl_ushort> input(test_size);
+	for(size_t i = 0; i < test_size; i++)
+		input[i] = i % 256;
+
+	CL_ConvertImage_CHECK(&input[0], LibOIEnums::IMAGE_UINT16, test_size);
+}
+
+/// Verifies that the CPU and OpenCL double conversions agree when the device supports cl_khr_fp64.
+TEST(CRoutine_ConvertImage, CL_Double)
+{
+	size_t test_size = 10000;
+	valarray<cl_double> input(test_size);
+	for(size_t i = 0; i < test_size; i++)
+		input[i] = double(i) / test_size;
+
+	CL_ConvertImage_CHECK(&input[0], LibOIEnums::IMAGE_DOUBLE, test_size);
+}
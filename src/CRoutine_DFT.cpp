@@ -45,6 +45,8 @@ CRoutine_DFT::CRoutine_DFT(cl_device_id device, cl_context context, cl_command_q
 	:CRoutine_FT(device, context, queue)
 {
 	mImageScale = 0;
+	mDFTKernelID = 0;
+	mDFTIndexedKernelID = 0;
 	// Specify the source location for the kernel.
 	mSource.push_back("ft_dft2d.cl");
 }
@@ -57,6 +59,13 @@ CRoutine_DFT::~CRoutine_DFT()
 /// Computes the discrete Fourier transform of a (real) image for the specified (cl_float2) UV points and stores
 /// the result in output.
 void CRoutine_DFT::FT(cl_mem uv_points, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output)
+{
+	FT(uv_points, 0, n_uv_points, image, image_width, image_height, output);
+}
+
+/// Computes the discrete Fourier transform of a (real) image for the n_uv_points (cl_float2) UV points
+/// starting at uv_start. The result is stored at the same location in output.
+void CRoutine_DFT::FT(cl_mem uv_points, int uv_start, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output)
 {
 	// NOTE: Below we use the clGetKernelWorkGroupInfo to determine the local execution size of the
 	// kernel.  On present-generation GPUs, the maximum work items per work group is 1024, so we
@@ -70,28 +79,66 @@ void CRoutine_DFT::FT(cl_mem uv_points, int n_uv_points, cl_mem image, int image
     // Init the local threads to something large
     size_t local = 2048;
     // Inform the kernel of the memory size requirements for shared/local memory:
-	status |= clSetKernelArg(mKernels[0], 6, local * sizeof(cl_float), NULL);
-	status |= clSetKernelArg(mKernels[0], 7, local * sizeof(cl_uint2), NULL);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 6, local * sizeof(cl_float), NULL);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 7, local * sizeof(cl_uint2), NULL);
 	// Now query to find the best workgroup size for the kernel.
-    status = clGetKernelWorkGroupInfo(mKernels[0], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
+    status = clGetKernelWorkGroupInfo(mKernels[mDFTKernelID], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
 	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
 
 	// Round the global workgroup size to the next greatest multiple of the local workgroup size
 	global = next_multiple(global, local);
 
 	// Set the kernel arguments and enqueue the kernel
-	status = clSetKernelArg(mKernels[0], 0, sizeof(cl_mem), &uv_points);
-	status |= clSetKernelArg(mKernels[0], 1, sizeof(int), &n_uv_points);
-	status |= clSetKernelArg(mKernels[0], 2, sizeof(cl_mem), &image);
-	status |= clSetKernelArg(mKernels[0], 3, sizeof(int), &image_width);
-	status |= clSetKernelArg(mKernels[0], 4, sizeof(int), &image_height);
-	status |= clSetKernelArg(mKernels[0], 5, sizeof(cl_mem), &output);
-	status |= clSetKernelArg(mKernels[0], 6, local * sizeof(cl_float), NULL);
-	status |= clSetKernelArg(mKernels[0], 7, local * sizeof(cl_uint2), NULL);
+	status = clSetKernelArg(mKernels[mDFTKernelID], 0, sizeof(cl_mem), &uv_points);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 1, sizeof(int), &n_uv_points);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 2, sizeof(cl_mem), &image);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 3, sizeof(int), &image_width);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 4, sizeof(int), &image_height);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 5, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 6, local * sizeof(cl_float), NULL);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 7, local * sizeof(cl_uint2), NULL);
+	status |= clSetKernelArg(mKernels[mDFTKernelID], 8, sizeof(unsigned int), &uv_start);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
 
     // Execute the kernel over the entire range of the data set
-	status = clEnqueueNDRangeKernel(mQueue, mKernels[0], 1, NULL, &global, &local, 0, NULL, NULL);
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mDFTKernelID], 1, NULL, &global, &local, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// Computes the discrete Fourier transform of a (real) image for the n_index (cl_float2) UV points
+/// uv_points[uv_index[i]]. The result is stored at the same location in output, the remaining
+/// elements of output are not modified.
+void CRoutine_DFT::FT(cl_mem uv_points, int /*n_uv_points*/, cl_mem uv_index, int n_index, cl_mem image, int image_width, int image_height, cl_mem output)
+{
+	if(n_index < 1)
+		return;
+
+	int status = CL_SUCCESS;
+    size_t global = (size_t) n_index;
+
+    // Determine the best workgroup size for this kernel, see the note above.
+    size_t local = 2048;
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 7, local * sizeof(cl_float), NULL);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 8, local * sizeof(cl_uint2), NULL);
+    status = clGetKernelWorkGroupInfo(mKernels[mDFTIndexedKernelID], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
+	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
+
+	// Round the global workgroup size to the next greatest multiple of the local workgroup size
+	global = next_multiple(global, local);
+
+	// Set the kernel arguments and enqueue the kernel
+	status = clSetKernelArg(mKernels[mDFTIndexedKernelID], 0, sizeof(cl_mem), &uv_points);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 1, sizeof(cl_mem), &uv_index);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 2, sizeof(int), &n_index);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 3, sizeof(cl_mem), &image);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 4, sizeof(int), &image_width);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 5, sizeof(int), &image_height);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 6, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 7, local * sizeof(cl_float), NULL);
+	status |= clSetKernelArg(mKernels[mDFTIndexedKernelID], 8, local * sizeof(cl_uint2), NULL);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mDFTIndexedKernelID], 1, NULL, &global, &local, 0, NULL, NULL);
 	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
 }
 
@@ -159,6 +206,9 @@ void CRoutine_DFT::Init(float image_scale)
     tmp << source;
 
     BuildKernel(tmp.str(), "dft_2d", mSource[0]);
+    mDFTKernelID = mKernels.size() - 1;
+    BuildKernel(tmp.str(), "dft_2d_indexed", mSource[0]);
+    mDFTIndexedKernelID = mKernels.size() - 1;
 }
 
 } /* namespace liboi */
@@ -40,12 +40,17 @@ namespace liboi
 class CRoutine_DFT: public CRoutine_FT
 {
 	float mImageScale;
+	int mDFTKernelID;
+	int mDFTIndexedKernelID;
+
 public:
 	CRoutine_DFT(cl_device_id device, cl_context context, cl_command_queue queue);
 	virtual ~CRoutine_DFT();
 
 	void Init(float image_scale);
 	void FT(cl_mem uv_points, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output);
+	void FT(cl_mem uv_points, int uv_start, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output);
+	void FT(cl_mem uv_points, int n_uv_points, cl_mem uv_index, int n_index, cl_mem image, int image_width, int image_height, cl_mem output);
 
 	void FT(cl_float2 uv_point,
 			valarray<cl_float> & image, unsigned int image_width, unsigned int image_height, float image_scale,
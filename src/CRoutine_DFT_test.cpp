@@ -286,3 +286,60 @@ TEST(CRoutine_DFT, CL_DFT_LARGE_UNEVEN_N_UV_POINTS)
 		EXPECT_NEAR(theory_val.s[1], output[i].s[1], two_degrees);	// imaginary
 	}
 }
+
+/// Checks that computing the OpenCL DFT in chunks of UV points matches computing it in one pass.
+TEST(CRoutine_DFT, CL_Chunked)
+{
+	int status = CL_SUCCESS;
+	size_t image_width = 128;
+	size_t image_height = 128;
+	size_t image_size = image_width * image_height;
+	float image_scale = 0.025; // mas/pixel
+	size_t n_uv_points = 64;
+	size_t chunk_size = 16;
+
+	// Create the model
+	CUniformDisk model(image_width, image_height, image_scale, float(image_width) / 4 * image_scale, 0, 0);
+
+	// Get UV points, the image, and init an output buffer:
+	valarray<cl_float2> uv_points = model.GenerateUVSpiral_CL(n_uv_points);
+	valarray<cl_float> image = model.GetImage_CL();
+	valarray<cl_float2> output(n_uv_points);
+	valarray<cl_float2> chunked_output(n_uv_points);
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CRoutine_DFT r(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	r.SetSourcePath(LIBOI_KERNEL_PATH);
+	r.Init(image_scale);
+
+	// Create the OpenCL memory locations
+	cl_mem uv_points_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float2) * n_uv_points, NULL, &status);
+	cl_mem image_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * image_size, NULL, &status);
+	cl_mem output_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float2) * n_uv_points, NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
+
+	status |= clEnqueueWriteBuffer(cl.GetQueue(), uv_points_cl, CL_TRUE, 0, sizeof(cl_float2) * uv_points.size(), &uv_points[0], 0, NULL, NULL);
+	status |= clEnqueueWriteBuffer(cl.GetQueue(), image_cl, CL_TRUE, 0, sizeof(cl_float) * image.size(), &image[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+
+	// Run the DFT in one pass, then in chunks:
+	r.FT(uv_points_cl, n_uv_points, image_cl, image_width, image_height, output_cl);
+	status = clEnqueueReadBuffer(cl.GetQueue(), output_cl, CL_TRUE, 0, sizeof(cl_float2) * n_uv_points, &output[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	for(size_t start = 0; start < n_uv_points; start += chunk_size)
+		r.FT(uv_points_cl, start, chunk_size, image_cl, image_width, image_height, output_cl);
+
+	status = clEnqueueReadBuffer(cl.GetQueue(), output_cl, CL_TRUE, 0, sizeof(cl_float2) * n_uv_points, &chunked_output[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	for(size_t i = 0; i < n_uv_points; i++)
+	{
+		EXPECT_FLOAT_EQ(output[i].s[0], chunked_output[i].s[0]);	// real
+		EXPECT_FLOAT_EQ(output[i].s[1], chunked_output[i].s[1]);	// imaginary
+	}
+
+	clReleaseMemObject(uv_points_cl);
+	clReleaseMemObject(image_cl);
+	clReleaseMemObject(output_cl);
+}
@@ -52,4 +52,23 @@ CRoutine_FT::~CRoutine_FT()
 	// TODO Auto-generated destructor stub
 }
 
+/// Computes the Fourier transform for the n_uv_points UV points starting at uv_start and
+/// stores the result at the same location in output.
+///
+/// This default implementation simply transforms all of the UV points up to uv_start + n_uv_points.
+/// Routines which can transform a subset of the UV points more efficiently should override it.
+void CRoutine_FT::FT(cl_mem uv_points, int uv_start, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output)
+{
+	FT(uv_points, uv_start + n_uv_points, image, image_width, image_height, output);
+}
+
+/// Computes the Fourier transform for the n_index UV points whose indices are stored in uv_index and
+/// stores the result at the same location in output.
+///
+/// This default implementation simply transforms all n_uv_points UV points.
+void CRoutine_FT::FT(cl_mem uv_points, int n_uv_points, cl_mem /*uv_index*/, int /*n_index*/, cl_mem image, int image_width, int image_height, cl_mem output)
+{
+	FT(uv_points, n_uv_points, image, image_width, image_height, output);
+}
+
 } /* namespace liboi */
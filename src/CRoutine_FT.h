@@ -52,6 +52,8 @@ public:
 
 	virtual void Init(float image_scale) = 0;
 	virtual void FT(cl_mem uv_points, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output) = 0;
+	virtual void FT(cl_mem uv_points, int uv_start, int n_uv_points, cl_mem image, int image_width, int image_height, cl_mem output);
+	virtual void FT(cl_mem uv_points, int n_uv_points, cl_mem uv_index, int n_index, cl_mem image, int image_width, int image_height, cl_mem output);
 	virtual void FT(valarray<cl_float2> & uv_points, unsigned int n_uv_points,
 			valarray<cl_float> & image, unsigned int image_width, unsigned int image_height, float image_scale,
 			valarray<cl_float2> & cpu_output) = 0;
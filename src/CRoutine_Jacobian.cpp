@@ -0,0 +1,334 @@
+/*
+ * CRoutine_Jacobian.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *
+ *  Description:
+ *      Routine to compute the Jacobian of the chi elements with respect to the parameters of an
+ *      analytic model, and the corresponding normal equations, on the OpenCL device.
+ *
+ *      The derivatives of the visibilities with respect to the model parameters are propagated
+ *      (forward mode) through the V2 and T3 computations and the chi. Because the weights are folded
+ *      into the inverse uncertainties, J^T J and J^T chi are the weighted J^T W J and J^T W r.
+ */
+
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+
+#include "CRoutine_Jacobian.h"
+#include "CRoutine_Zero.h"
+#include "COILibData.h"
+
+using namespace std;
+
+namespace liboi
+{
+
+CRoutine_Jacobian::CRoutine_Jacobian(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero)
+	: CRoutine(device, context, queue)
+{
+	mSource.push_back("jacobian.cl");
+
+	mJacobianV2KernelID = -1;
+	mJacobianT3KernelID = -1;
+	mNormalEquationsKernelID = -1;
+
+	mJacobian = NULL;
+	mNormal = NULL;
+	mDVis = NULL;
+	mJacobianSize = 0;
+	mNormalSize = 0;
+	mDVisSize = 0;
+	mLocalSize = 1;
+
+	mrZero = rZero;
+}
+
+CRoutine_Jacobian::~CRoutine_Jacobian()
+{
+	if(mJacobian) clReleaseMemObject(mJacobian);
+	if(mNormal) clReleaseMemObject(mNormal);
+	if(mDVis) clReleaseMemObject(mDVis);
+}
+
+/// Initialize the Jacobian routine.
+void CRoutine_Jacobian::Init()
+{
+	int status = CL_SUCCESS;
+
+	// Read the kernels, compile them
+	string source = ReadSource(mSource[0]);
+	BuildKernel(source, "jacobian_v2", mSource[0]);
+	mJacobianV2KernelID = mKernels.size() - 1;
+	BuildKernel(source, "jacobian_t3", mSource[0]);
+	mJacobianT3KernelID = mKernels.size() - 1;
+	BuildKernel(source, "normal_equations", mSource[0]);
+	mNormalEquationsKernelID = mKernels.size() - 1;
+
+	// The normal equations reduction requires a power-of-two work group size.
+	size_t max_local = 0;
+	status = clGetKernelWorkGroupInfo(mKernels[mNormalEquationsKernelID], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
+	mLocalSize = 1;
+	while(2 * mLocalSize <= min(max_local, size_t(256)))
+		mLocalSize *= 2;
+}
+
+/// Computes the Jacobian of the chi elements, output[param * n_data + i] = d chi_i / d param, where
+/// n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3).
+///
+/// ft_input holds the visibilities at the n_uv UV points (i.e. the output of the Fourier transform), dvis
+/// their derivatives with respect to the n_params parameters stored as [param * n_uv + uv].
+/// The non-convex chi is differentiated. The Vis are not simulated by CLibOI::FTToData, their rows are zero.
+void CRoutine_Jacobian::Jacobian(cl_mem ft_input, cl_mem dvis, unsigned int n_uv, unsigned int n_params,
+		cl_mem data_inv_err, cl_mem v2_uv_ref, cl_mem t3_uv_ref, cl_mem t3_uv_sign,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, cl_mem output)
+{
+	int status = CL_SUCCESS;
+	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
+	unsigned int v2_offset = COILibData::CalculateOffset_V2(n_vis);
+	unsigned int t3_offset = COILibData::CalculateOffset_T3(n_vis, n_v2);
+	size_t global = 0;
+
+	mrZero->Zero(output, n_params * n_data);
+
+	if(n_v2 > 0)
+	{
+		global = (size_t) n_v2;
+		status  = clSetKernelArg(mKernels[mJacobianV2KernelID], 0, sizeof(cl_mem), &ft_input);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 1, sizeof(cl_mem), &dvis);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 2, sizeof(cl_mem), &v2_uv_ref);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 3, sizeof(cl_mem), &data_inv_err);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 4, sizeof(unsigned int), &v2_offset);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 5, sizeof(unsigned int), &n_v2);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 6, sizeof(unsigned int), &n_uv);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 7, sizeof(unsigned int), &n_params);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 8, sizeof(cl_mem), &output);
+		status |= clSetKernelArg(mKernels[mJacobianV2KernelID], 9, sizeof(unsigned int), &n_data);
+		CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+		status = clEnqueueNDRangeKernel(mQueue, mKernels[mJacobianV2KernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+	}
+
+	if(n_t3 > 0)
+	{
+		global = (size_t) n_t3;
+		status  = clSetKernelArg(mKernels[mJacobianT3KernelID], 0, sizeof(cl_mem), &ft_input);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 1, sizeof(cl_mem), &dvis);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 2, sizeof(cl_mem), &t3_uv_ref);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 3, sizeof(cl_mem), &t3_uv_sign);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 4, sizeof(cl_mem), &data_inv_err);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 5, sizeof(unsigned int), &t3_offset);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 6, sizeof(unsigned int), &n_t3);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 7, sizeof(unsigned int), &n_uv);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 8, sizeof(unsigned int), &n_params);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 9, sizeof(cl_mem), &output);
+		status |= clSetKernelArg(mKernels[mJacobianT3KernelID], 10, sizeof(unsigned int), &n_data);
+		CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+		status = clEnqueueNDRangeKernel(mQueue, mKernels[mJacobianT3KernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+	}
+}
+
+/// Uploads the visibility derivatives dvis ([param * n_uv + uv]) and computes the Jacobian into the
+/// internal buffer, see GetJacobianBuffer. The buffers are (re)allocated as needed.
+void CRoutine_Jacobian::Jacobian(cl_mem ft_input, valarray<cl_float2> & dvis, unsigned int n_uv, unsigned int n_params,
+		cl_mem data_inv_err, cl_mem v2_uv_ref, cl_mem t3_uv_ref, cl_mem t3_uv_sign,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3)
+{
+	int status = CL_SUCCESS;
+	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
+	assert(dvis.size() >= n_params * n_uv);
+
+	if(n_params == 0)
+		return;
+
+	if(n_params * n_uv > mDVisSize)
+	{
+		if(mDVis) clReleaseMemObject(mDVis);
+		mDVis = clCreateBuffer(mContext, CL_MEM_READ_ONLY, sizeof(cl_float2) * n_params * n_uv, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mDVis) failed.");
+		mDVisSize = n_params * n_uv;
+	}
+
+	if(n_params * n_data > mJacobianSize)
+	{
+		if(mJacobian) clReleaseMemObject(mJacobian);
+		mJacobian = clCreateBuffer(mContext, CL_MEM_READ_WRITE, sizeof(cl_float) * n_params * n_data, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mJacobian) failed.");
+		mJacobianSize = n_params * n_data;
+	}
+
+	status = clEnqueueWriteBuffer(mQueue, mDVis, CL_TRUE, 0, sizeof(cl_float2) * n_params * n_uv, &dvis[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+
+	Jacobian(ft_input, mDVis, n_uv, n_params, data_inv_err, v2_uv_ref, t3_uv_ref, t3_uv_sign, n_vis, n_v2, n_t3, mJacobian);
+}
+
+/// Computes the Jacobian on the CPU. See the OpenCL version above.
+void CRoutine_Jacobian::Jacobian(valarray<cl_float2> & ft_input, valarray<cl_float2> & dvis, unsigned int n_uv, unsigned int n_params,
+		valarray<cl_float> & data_inv_err, valarray<cl_uint> & v2_uv_ref, valarray<cl_uint4> & t3_uv_ref,
+		valarray<cl_short4> & t3_uv_sign,
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, valarray<cl_float> & output)
+{
+	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
+	unsigned int v2_offset = COILibData::CalculateOffset_V2(n_vis);
+	unsigned int t3_offset = COILibData::CalculateOffset_T3(n_vis, n_v2);
+
+	output.resize(n_params * n_data);
+	output = 0;
+
+	for(unsigned int i = 0; i < n_v2; i++)
+	{
+		unsigned int uv = v2_uv_ref[i];
+		complex<float> vis(ft_input[uv].s[0], ft_input[uv].s[1]);
+		for(unsigned int p = 0; p < n_params; p++)
+		{
+			complex<float> dv(dvis[p * n_uv + uv].s[0], dvis[p * n_uv + uv].s[1]);
+			output[p * n_data + v2_offset + i] = -2 * real(conj(vis) * dv) * data_inv_err[v2_offset + i];
+		}
+	}
+
+	for(unsigned int i = 0; i < n_t3; i++)
+	{
+		complex<float> v[3];
+		float c_sign[3];
+		for(unsigned int j = 0; j < 3; j++)
+		{
+			unsigned int uv = t3_uv_ref[i].s[j];
+			c_sign[j] = (j < 2) ? t3_uv_sign[i].s[j] : -1 * t3_uv_sign[i].s[j];
+			v[j] = complex<float>(ft_input[uv].s[0], c_sign[j] * ft_input[uv].s[1]);
+		}
+
+		complex<float> t3 = v[0] * v[1] * v[2];
+		float amp = abs(t3);
+		for(unsigned int p = 0; p < n_params; p++)
+		{
+			complex<float> dt3 = 0;
+			for(unsigned int j = 0; j < 3; j++)
+			{
+				unsigned int uv = t3_uv_ref[i].s[j];
+				complex<float> dv(dvis[p * n_uv + uv].s[0], c_sign[j] * dvis[p * n_uv + uv].s[1]);
+				dt3 += dv * v[(j + 1) % 3] * v[(j + 2) % 3];
+			}
+
+			float d_amp = 0;
+			float d_phi = 0;
+			if(amp > 0)
+			{
+				d_amp = real(conj(t3) * dt3) / amp;
+				d_phi = imag(conj(t3) * dt3) / (amp * amp);
+			}
+
+			output[p * n_data + t3_offset + i] = -d_amp * data_inv_err[t3_offset + i];
+			output[p * n_data + t3_offset + n_t3 + i] = d_phi * data_inv_err[t3_offset + n_t3 + i];
+		}
+	}
+}
+
+/// Computes the normal equations, output = [J^T J (n_params * n_params, row-major), J^T chi (n_params)],
+/// from the jacobian ([param * n_data + i]) and chi buffers.
+void CRoutine_Jacobian::NormalEquations(cl_mem jacobian, cl_mem chi, unsigned int n_data, unsigned int n_params, cl_mem output)
+{
+	if(n_params == 0)
+		return;
+
+	int status = CL_SUCCESS;
+	// One work group per output element.
+	size_t local = mLocalSize;
+	size_t global = (n_params * n_params + n_params) * local;
+
+	status  = clSetKernelArg(mKernels[mNormalEquationsKernelID], 0, sizeof(cl_mem), &jacobian);
+	status |= clSetKernelArg(mKernels[mNormalEquationsKernelID], 1, sizeof(cl_mem), &chi);
+	status |= clSetKernelArg(mKernels[mNormalEquationsKernelID], 2, sizeof(unsigned int), &n_data);
+	status |= clSetKernelArg(mKernels[mNormalEquationsKernelID], 3, sizeof(unsigned int), &n_params);
+	status |= clSetKernelArg(mKernels[mNormalEquationsKernelID], 4, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mNormalEquationsKernelID], 5, local * sizeof(cl_float), NULL);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mNormalEquationsKernelID], 1, NULL, &global, &local, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// Computes the normal equations from the internal Jacobian buffer and chi, then copies J^T J
+/// (n_params * n_params, row-major) and J^T chi (n_params) back to the host in a single transfer.
+void CRoutine_Jacobian::NormalEquations(cl_mem chi, unsigned int n_data, unsigned int n_params, float * JtJ, float * Jtchi)
+{
+	if(n_params == 0)
+		return;
+
+	int status = CL_SUCCESS;
+	unsigned int n_normal = n_params * n_params + n_params;
+	if(n_normal > mNormalSize)
+	{
+		if(mNormal) clReleaseMemObject(mNormal);
+		mNormal = clCreateBuffer(mContext, CL_MEM_READ_WRITE, sizeof(cl_float) * n_normal, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mNormal) failed.");
+		mNormalSize = n_normal;
+	}
+
+	NormalEquations(mJacobian, chi, n_data, n_params, mNormal);
+
+	valarray<cl_float> t_output(n_normal);
+	status = clEnqueueReadBuffer(mQueue, mNormal, CL_TRUE, 0, sizeof(cl_float) * n_normal, &t_output[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	for(unsigned int i = 0; i < n_params * n_params; i++)
+		JtJ[i] = t_output[i];
+
+	for(unsigned int i = 0; i < n_params; i++)
+		Jtchi[i] = t_output[n_params * n_params + i];
+}
+
+/// Computes the normal equations on the CPU. See the OpenCL version above.
+void CRoutine_Jacobian::NormalEquations(valarray<cl_float> & jacobian, valarray<cl_float> & chi, unsigned int n_data, unsigned int n_params,
+		valarray<cl_float> & output)
+{
+	assert(jacobian.size() >= n_params * n_data);
+	assert(chi.size() >= n_data);
+
+	output.resize(n_params * n_params + n_params);
+	output = 0;
+
+	for(unsigned int a = 0; a < n_params; a++)
+	{
+		for(unsigned int b = 0; b < n_params; b++)
+		{
+			for(unsigned int i = 0; i < n_data; i++)
+				output[a * n_params + b] += jacobian[a * n_data + i] * jacobian[b * n_data + i];
+		}
+
+		for(unsigned int i = 0; i < n_data; i++)
+			output[n_params * n_params + a] += jacobian[a * n_data + i] * chi[i];
+	}
+}
+
+} /* namespace liboi */
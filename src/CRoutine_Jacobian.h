@@ -0,0 +1,93 @@
+/*
+ * CRoutine_Jacobian.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *
+ *  Description:
+ *      Routine to compute the Jacobian of the chi elements with respect to the parameters of an
+ *      analytic model, and the corresponding normal equations, on the OpenCL device.
+ */
+
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CROUTINE_JACOBIAN_H_
+#define CROUTINE_JACOBIAN_H_
+
+#include "CRoutine.h"
+
+namespace liboi
+{
+
+class CRoutine_Zero;
+
+class CRoutine_Jacobian: public CRoutine
+{
+protected:
+	int mJacobianV2KernelID;
+	int mJacobianT3KernelID;
+	int mNormalEquationsKernelID;
+
+	cl_mem mJacobian;	// d chi_i / d param, stored as [param * n_data + i]
+	cl_mem mNormal;		// [J^T J (n_params * n_params), J^T chi (n_params)]
+	cl_mem mDVis;		// d vis / d param, stored as [param * n_uv + uv]
+	unsigned int mJacobianSize;
+	unsigned int mNormalSize;
+	unsigned int mDVisSize;
+	size_t mLocalSize;
+
+	// External routines, deleted elsewhere.
+	CRoutine_Zero * mrZero;
+
+public:
+	CRoutine_Jacobian(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero);
+	virtual ~CRoutine_Jacobian();
+
+	void Init();
+
+	cl_mem GetJacobianBuffer() { return mJacobian; };
+
+	void Jacobian(cl_mem ft_input, cl_mem dvis, unsigned int n_uv, unsigned int n_params,
+			cl_mem data_inv_err, cl_mem v2_uv_ref, cl_mem t3_uv_ref, cl_mem t3_uv_sign,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, cl_mem output);
+
+	void Jacobian(cl_mem ft_input, valarray<cl_float2> & dvis, unsigned int n_uv, unsigned int n_params,
+			cl_mem data_inv_err, cl_mem v2_uv_ref, cl_mem t3_uv_ref, cl_mem t3_uv_sign,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3);
+
+	static void Jacobian(valarray<cl_float2> & ft_input, valarray<cl_float2> & dvis, unsigned int n_uv, unsigned int n_params,
+			valarray<cl_float> & data_inv_err, valarray<cl_uint> & v2_uv_ref, valarray<cl_uint4> & t3_uv_ref,
+			valarray<cl_short4> & t3_uv_sign,
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, valarray<cl_float> & output);
+
+	void NormalEquations(cl_mem jacobian, cl_mem chi, unsigned int n_data, unsigned int n_params, cl_mem output);
+	void NormalEquations(cl_mem chi, unsigned int n_data, unsigned int n_params, float * JtJ, float * Jtchi);
+	static void NormalEquations(valarray<cl_float> & jacobian, valarray<cl_float> & chi, unsigned int n_data, unsigned int n_params,
+			valarray<cl_float> & output);
+};
+
+} /* namespace liboi */
+
+#endif /* CROUTINE_JACOBIAN_H_ */
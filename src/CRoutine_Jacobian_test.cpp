@@ -0,0 +1,166 @@
+/*
+ * CRoutine_Jacobian_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ */
+
+#include "gtest/gtest.h"
+#include <cmath>
+
+#include "liboi_tests.h"
+#include "COpenCL.hpp"
+#include "COILibData.h"
+#include "CRoutine_Jacobian.h"
+#include "CRoutine_Zero.h"
+#include "CUniformDisk.h"
+
+using namespace std;
+using namespace liboi;
+
+extern string LIBOI_KERNEL_PATH;
+extern cl_device_type OPENCL_DEVICE_TYPE;
+
+/// Checks the analytic uniform disk derivatives against central differences.
+TEST(CRoutine_Jacobian, CPU_UniformDiskDerivatives)
+{
+	size_t n_uv = 1000;
+	double radius = 2.0;
+	double alpha = 1E-9;
+	double delta = -2E-9;
+	double h[3] = {1E-6, 1E-15, 1E-15};
+
+	CUniformDisk ud(128, 128, 0.025, radius, alpha, delta);
+	valarray<pair<double,double>> uv_points = CModel::GenerateUVSpiral(n_uv);
+	valarray<complex<double>> dvis;
+
+	for(size_t i = 1; i < n_uv; i++)
+	{
+		ud.GetVisDerivatives(uv_points[i], dvis);
+		ASSERT_EQ(dvis.size(), ud.GetNParams());
+
+		for(unsigned int p = 0; p < 3; p++)
+		{
+			double params_hi[3] = {radius, alpha, delta};
+			double params_lo[3] = {radius, alpha, delta};
+			params_hi[p] += h[p];
+			params_lo[p] -= h[p];
+			CUniformDisk hi(128, 128, 0.025, params_hi[0], params_hi[1], params_hi[2]);
+			CUniformDisk lo(128, 128, 0.025, params_lo[0], params_lo[1], params_lo[2]);
+
+			complex<double> fd = (hi.GetVis(uv_points[i]) - lo.GetVis(uv_points[i])) / (2 * h[p]);
+			double tol = MAX_REL_ERROR * max(abs(fd), 1.0);
+			EXPECT_NEAR(real(dvis[p]), real(fd), tol);
+			EXPECT_NEAR(imag(dvis[p]), imag(fd), tol);
+		}
+	}
+}
+
+/// Compares the OpenCL Jacobian and normal equations with the CPU versions.
+TEST(CRoutine_Jacobian, CL_Jacobian_CPU)
+{
+	unsigned int n_t3 = 1000;
+	unsigned int n_uv = 3 * n_t3;
+	unsigned int n_vis = 0;
+	unsigned int n_v2 = n_uv;
+	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
+
+	// Generate closed triangles, see CRoutine_FTtoT3_test.cpp
+	CUniformDisk ud(128, 128, 0.025, 2.0, 1E-9, -2E-9);
+	unsigned int n_params = ud.GetNParams();
+	valarray<cl_float2> uv_points = CModel::GenerateUVSpiral_CL(n_uv);
+	for(size_t i = 2; i < n_uv; i += 3)
+	{
+		uv_points[i].s[0] = -1*(uv_points[i-2].s[0] + uv_points[i-1].s[0]);
+		uv_points[i].s[1] = -1*(uv_points[i-2].s[1] + uv_points[i-1].s[1]);
+	}
+
+	valarray<cl_float2> ft_input = ud.GetVis_CL(uv_points);
+	valarray<cl_float2> dvis = ud.GetVisDerivatives_CL(uv_points);
+
+	valarray<cl_uint> v2_ref(n_v2);
+	for(size_t i = 0; i < n_v2; i++)
+		v2_ref[i] = i;
+
+	valarray<cl_uint4> t3_ref(n_t3);
+	valarray<cl_short4> t3_sign(n_t3);
+	for(size_t i = 0; i < n_t3; i++)
+	{
+		t3_ref[i].s[0] = 3*i;
+		t3_ref[i].s[1] = 3*i+1;
+		t3_ref[i].s[2] = 3*i+2;
+		t3_ref[i].s[3] = 0;
+
+		t3_sign[i].s[0] = 1;
+		t3_sign[i].s[1] = (i % 2) ? 1 : -1;
+		t3_sign[i].s[2] = 1;
+		t3_sign[i].s[3] = 0;
+	}
+
+	valarray<cl_float> inv_err(n_data);
+	valarray<cl_float> chi(n_data);
+	for(size_t i = 0; i < n_data; i++)
+	{
+		inv_err[i] = 1.0 + 0.001 * (i % 100);
+		chi[i] = cos(0.01 * i);
+	}
+
+	// CPU versions
+	valarray<cl_float> cpu_jacobian;
+	valarray<cl_float> cpu_normal;
+	CRoutine_Jacobian::Jacobian(ft_input, dvis, n_uv, n_params, inv_err, v2_ref, t3_ref, t3_sign, n_vis, n_v2, n_t3, cpu_jacobian);
+	CRoutine_Jacobian::NormalEquations(cpu_jacobian, chi, n_data, n_params, cpu_normal);
+
+	// Init the OpenCL device and necessary routines:
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CRoutine_Zero r_zero(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	r_zero.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_zero.Init();
+	CRoutine_Jacobian r(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), &r_zero);
+	r.SetSourcePath(LIBOI_KERNEL_PATH);
+	r.Init();
+
+	int err = CL_SUCCESS;
+	cl_mem ft_input_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float2) * n_uv, NULL, &err);
+	cl_mem v2_ref_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_uint) * n_v2, NULL, &err);
+	cl_mem t3_ref_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_uint4) * n_t3, NULL, &err);
+	cl_mem t3_sign_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_short4) * n_t3, NULL, &err);
+	cl_mem inv_err_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * n_data, NULL, &err);
+	cl_mem chi_cl = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * n_data, NULL, &err);
+	CHECK_ERROR(err, CL_SUCCESS, "clCreateBuffer Failed");
+
+	err  = clEnqueueWriteBuffer(cl.GetQueue(), ft_input_cl, CL_FALSE, 0, sizeof(cl_float2) * n_uv, &ft_input[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl.GetQueue(), v2_ref_cl, CL_FALSE, 0, sizeof(cl_uint) * n_v2, &v2_ref[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl.GetQueue(), t3_ref_cl, CL_FALSE, 0, sizeof(cl_uint4) * n_t3, &t3_ref[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl.GetQueue(), t3_sign_cl, CL_FALSE, 0, sizeof(cl_short4) * n_t3, &t3_sign[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl.GetQueue(), inv_err_cl, CL_FALSE, 0, sizeof(cl_float) * n_data, &inv_err[0], 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(cl.GetQueue(), chi_cl, CL_FALSE, 0, sizeof(cl_float) * n_data, &chi[0], 0, NULL, NULL);
+	CHECK_ERROR(err, CL_SUCCESS, "clEnqueueWriteBuffer Failed");
+	clFinish(cl.GetQueue());
+
+	// Run the OpenCL routines
+	r.Jacobian(ft_input_cl, dvis, n_uv, n_params, inv_err_cl, v2_ref_cl, t3_ref_cl, t3_sign_cl, n_vis, n_v2, n_t3);
+	valarray<cl_float> cl_jacobian(n_params * n_data);
+	err = clEnqueueReadBuffer(cl.GetQueue(), r.GetJacobianBuffer(), CL_TRUE, 0, sizeof(cl_float) * n_params * n_data, &cl_jacobian[0], 0, NULL, NULL);
+	CHECK_ERROR(err, CL_SUCCESS, "clEnqueueReadBuffer Failed");
+
+	valarray<float> JtJ(n_params * n_params);
+	valarray<float> Jtchi(n_params);
+	r.NormalEquations(chi_cl, n_data, n_params, &JtJ[0], &Jtchi[0]);
+
+	clReleaseMemObject(ft_input_cl);
+	clReleaseMemObject(v2_ref_cl);
+	clReleaseMemObject(t3_ref_cl);
+	clReleaseMemObject(t3_sign_cl);
+	clReleaseMemObject(inv_err_cl);
+	clReleaseMemObject(chi_cl);
+
+	for(size_t i = 0; i < cpu_jacobian.size(); i++)
+		EXPECT_NEAR(cl_jacobian[i], cpu_jacobian[i], MAX_REL_ERROR * max(fabs(cpu_jacobian[i]), 1.0f));
+
+	for(size_t i = 0; i < n_params * n_params; i++)
+		EXPECT_NEAR(JtJ[i], cpu_normal[i], MAX_REL_ERROR * fabs(cpu_normal[i]));
+
+	for(size_t i = 0; i < n_params; i++)
+		EXPECT_NEAR(Jtchi[i], cpu_normal[n_params * n_params + i], MAX_REL_ERROR * fabs(cpu_normal[n_params * n_params + i]));
+}
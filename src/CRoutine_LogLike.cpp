@@ -55,8 +55,8 @@ CRoutine_LogLike::~CRoutine_LogLike()
 	if(mLogLikeOutput) clReleaseMemObject(mLogLikeOutput);
 }
 
-// Computes the log likelihood of the individual elements in the chi_output buffer
-void CRoutine_LogLike::LogLike(cl_mem chi_output, cl_mem data_err, cl_mem output, unsigned int n)
+// Computes the (non-constant part of the) log likelihood of the individual elements in the chi_output buffer
+void CRoutine_LogLike::LogLike(cl_mem chi_output, cl_mem output, unsigned int n)
 {
 	int status = CL_SUCCESS;
 	// The loglikelihood kernel executes on the entire output buffer
@@ -71,9 +71,8 @@ void CRoutine_LogLike::LogLike(cl_mem chi_output, cl_mem data_err, cl_mem output
 
 	// Set the arguments to our compute kernel
 	status  = clSetKernelArg(mKernels[mLogLikeKernelID], 0, sizeof(cl_mem), &chi_output);
-	status |= clSetKernelArg(mKernels[mLogLikeKernelID], 1, sizeof(cl_mem), &data_err);
-	status |= clSetKernelArg(mKernels[mLogLikeKernelID], 2, sizeof(cl_mem), &output);
-	status |= clSetKernelArg(mKernels[mLogLikeKernelID], 3, sizeof(unsigned int), &n);
+	status |= clSetKernelArg(mKernels[mLogLikeKernelID], 1, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mLogLikeKernelID], 2, sizeof(unsigned int), &n);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
 
 	// Execute the kernel over the entire range of the data set
@@ -83,49 +82,52 @@ void CRoutine_LogLike::LogLike(cl_mem chi_output, cl_mem data_err, cl_mem output
 
 /// Computes the log-likeihoods for the specified OpenCL buffers.
 /// The result is stored in the (protected) buffer mLogLikeOutput
-void CRoutine_LogLike::LogLike(cl_mem data, cl_mem data_err, cl_mem model_data,
+void CRoutine_LogLike::LogLike(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 		LibOIEnums::Chi2Types complex_chi_method,
-		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3)
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		unsigned int observables)
 {
 	// First call the chi routine to compute the individual elements
-	Chi(data, data_err, model_data, complex_chi_method, n_vis, n_v2, n_t3);
+	Chi(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, observables);
 
 	// Now compute the loglike using the mChiOutput buffer:
 	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
-	LogLike(mChiOutput, data_err, mLogLikeOutput, n_data);
+	LogLike(mChiOutput, mLogLikeOutput, n_data);
 }
 
 /// Computes the log of the likelihoods for the specified OpenCL buffers then returns the sum if compute_sum is true.
-/// Returns -1*numeric_limits<double>::max();
-float CRoutine_LogLike::LogLike(cl_mem data, cl_mem data_err, cl_mem model_data,
+///
+/// loglike_constant is the -sum(log(data_err)) - N/2 log(TWO_PI) term which does not depend on the model.
+/// It is cached by COILibData, see COILibData::GetLogLikeConstant, and must match observables.
+/// Returns -1*numeric_limits<double>::max() if compute_sum is false.
+float CRoutine_LogLike::LogLike(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 		LibOIEnums::Chi2Types complex_chi_method,
-		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, bool compute_sum)
+		unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+		double loglike_constant, bool compute_sum,
+		unsigned int observables)
 {
 	float sum = 0;
-	unsigned int n_data = COILibData::TotalBufferSize(n_vis, n_v2, n_t3);
 
 	// Call the loglike kernel on the buffer.
-	LogLike(data, data_err, model_data, complex_chi_method, n_vis, n_v2, n_t3);
+	LogLike(data, data_inv_err, model_data, complex_chi_method, n_vis, n_v2, n_t3, observables);
 
 	// Now compute the sum and return the value
 	if(compute_sum)
 	{
 		sum = Sum(mLogLikeOutput);
-		return -0.5 * n_data * log(2 * PI) + sum;
+		return loglike_constant + sum;
 	}
 
-	// Compute the logZ value, don't forget to include the -N/2 log(TWO_PI) prefix!
 	return -1*numeric_limits<double>::max();
 }
 
 /// \brief Computes the log likelihood per each element, returns the result in output.
 ///
-/// Note, this does not include the -N/2 log(TWO_PI) prefix
-void CRoutine_LogLike::LogLike(valarray<cl_float> & chi_output, valarray<cl_float> & data_err, valarray<cl_float> & output, unsigned int n)
+/// Note, this does not include the -sum(log(data_err)) - N/2 log(TWO_PI) constant
+void CRoutine_LogLike::LogLike(valarray<cl_float> & chi_output, valarray<cl_float> & output, unsigned int n)
 {
 	// Verify the buffer sizes are valid
 	assert(n == chi_output.size());
-	assert(n == data_err.size());
 
 	// Resize the output buffer if the user didn't already do this.
 	if(n != output.size())
@@ -134,28 +136,35 @@ void CRoutine_LogLike::LogLike(valarray<cl_float> & chi_output, valarray<cl_floa
 	// Compute the individual loglike values.
 	for(size_t i = 0; i < n; i++)
 	{
-		output[i] = -2* log(data_err[i]) - chi_output[i] * chi_output[i] / 2;
+		output[i] = -1 * chi_output[i] * chi_output[i] / 2;
 	}
 }
 
 /// Initialize the Chi2 routine.  Note, this internally allocates some memory for computing a parallel sum.
 void CRoutine_LogLike::Init(int num_max_elements)
 {
-	int status = CL_SUCCESS;
-
-	// First initialize the base-class constructor:
+	// First initialize the base-class constructor, this also allocates mLogLikeOutput through Resize:
 	CRoutine_Chi::Init(num_max_elements);
 
 	// Read the kernel, compile it
 	string source = ReadSource(mSource[mLogLikeSourceID]);
     BuildKernel(source, "loglike", mSource[mLogLikeSourceID]);
     mLogLikeKernelID = mKernels.size() - 1;
+}
 
-	if(mLogLikeOutput == NULL)
-	{
-		mLogLikeOutput = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mInputSize * sizeof(cl_float), NULL, &status);
-		CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
-	}
+/// Changes the number of elements processed by this routine, reallocating mLogLikeOutput only if it is too small.
+void CRoutine_LogLike::Resize(unsigned int num_elements)
+{
+	int status = CL_SUCCESS;
+	bool grow = (mLogLikeOutput == NULL || num_elements > mInputSize);
+
+	CRoutine_Chi::Resize(num_elements);
+	if(!grow)
+		return;
+
+	if(mLogLikeOutput) clReleaseMemObject(mLogLikeOutput);
+	mLogLikeOutput = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mInputSize * sizeof(cl_float), NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
 }
 
 } /* namespace liboi */
@@ -53,18 +53,22 @@ public:
 	CRoutine_LogLike(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero);
 	virtual ~CRoutine_LogLike();
 
-	void LogLike(cl_mem chi_output, cl_mem data_err, cl_mem output, unsigned int n);
-	void LogLike(cl_mem data, cl_mem data_err, cl_mem model_data,
+	void LogLike(cl_mem chi_output, cl_mem output, unsigned int n);
+	void LogLike(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 			LibOIEnums::Chi2Types complex_chi_method,
-			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3);
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 
-	float LogLike(cl_mem data, cl_mem data_err, cl_mem model_data,
+	float LogLike(cl_mem data, cl_mem data_inv_err, cl_mem model_data,
 			LibOIEnums::Chi2Types complex_chi_method,
-			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3, bool compute_sum);
+			unsigned int n_vis, unsigned int n_v2, unsigned int n_t3,
+			double loglike_constant, bool compute_sum,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 
-	static void LogLike(valarray<cl_float> & chi_output, valarray<cl_float> & data_err, valarray<cl_float> & output, unsigned int n);
+	static void LogLike(valarray<cl_float> & chi_output, valarray<cl_float> & output, unsigned int n);
 
 	void Init(int num_elements);
+	void Resize(unsigned int num_elements);
 };
 
 } /* namespace liboi */
@@ -42,6 +42,10 @@ CRoutine_Normalize::CRoutine_Normalize(cl_device_id device, cl_context context,
 {
 	// Specify the source location for the kernel.
 	mSource.push_back("normalize_float.cl");
+
+	mNormalizeKernelID = -1;
+	mNormalizeDeviceKernelID = -1;
+	mNormalizeCopyKernelID = -1;
 }
 
 CRoutine_Normalize::~CRoutine_Normalize()
@@ -54,6 +58,11 @@ void CRoutine_Normalize::Init()
 {
 	string source = ReadSource(mSource[0]);
 	BuildKernel(source, "normalize_float", mSource[0]);
+	mNormalizeKernelID = mKernels.size() - 1;
+	BuildKernel(source, "normalize_float_device", mSource[0]);
+	mNormalizeDeviceKernelID = mKernels.size() - 1;
+	BuildKernel(source, "normalize_float_copy", mSource[0]);
+	mNormalizeCopyKernelID = mKernels.size() - 1;
 }
 
 /// Calls a kernel to normalize an OpenCL buffer
@@ -68,19 +77,19 @@ void CRoutine_Normalize::Normalize(cl_mem buffer, unsigned int buffer_size, floa
 	size_t local = 0;
 
 	// Get the maximum work-group size for executing the kernel on the device
-	status = clGetKernelWorkGroupInfo(mKernels[0], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
+	status = clGetKernelWorkGroupInfo(mKernels[mNormalizeKernelID], mDeviceID, CL_KERNEL_WORK_GROUP_SIZE , sizeof(size_t), &local, NULL);
 	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo failed.");
 
 	// Enqueue the kernel.
-    status |= clSetKernelArg(mKernels[0],  0, sizeof(cl_mem), &buffer);
+    status |= clSetKernelArg(mKernels[mNormalizeKernelID],  0, sizeof(cl_mem), &buffer);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
-    status |= clSetKernelArg(mKernels[0],  1, sizeof(unsigned int), &buffer_size);
+    status |= clSetKernelArg(mKernels[mNormalizeKernelID],  1, sizeof(unsigned int), &buffer_size);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
-    status |= clSetKernelArg(mKernels[0],  2, sizeof(cl_float), &one_over_sum);
+    status |= clSetKernelArg(mKernels[mNormalizeKernelID],  2, sizeof(cl_float), &one_over_sum);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
 
 	status = CL_SUCCESS;
-	status |= clEnqueueNDRangeKernel(mQueue, mKernels[0], 1, NULL, &global, NULL, 0, NULL, NULL);
+	status |= clEnqueueNDRangeKernel(mQueue, mKernels[mNormalizeKernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
 	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
 }
 
@@ -96,4 +105,56 @@ void CRoutine_Normalize::Normalize(cl_mem image, unsigned int image_width, unsig
 	Normalize(image, image_width * image_height, one_over_sum);
 }
 
+/// Calls a kernel to normalize an OpenCL buffer by a sum which resides on the OpenCL device
+/// (e.g. the output of CRoutine_Sum::Sum(cl_mem, cl_mem)), avoiding a round trip to the host.
+///
+/// @param buffer The buffer to be normalized
+/// @param buffer_size The size of buffer
+/// @param sum_buffer A buffer whose first element is sum(buffer)
+void CRoutine_Normalize::Normalize(cl_mem buffer, unsigned int buffer_size, cl_mem sum_buffer)
+{
+	int status = CL_SUCCESS;
+	size_t global = size_t(buffer_size);
+
+	status |= clSetKernelArg(mKernels[mNormalizeDeviceKernelID],  0, sizeof(cl_mem), &buffer);
+	status |= clSetKernelArg(mKernels[mNormalizeDeviceKernelID],  1, sizeof(unsigned int), &buffer_size);
+	status |= clSetKernelArg(mKernels[mNormalizeDeviceKernelID],  2, sizeof(cl_mem), &sum_buffer);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mNormalizeDeviceKernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
+/// Normalizes an image by a sum which resides on the OpenCL device.
+///
+/// @param image The image to be normalized
+/// @param image_width The width of the image
+/// @param image_height The width of the image
+/// @param sum_buffer A buffer whose first element is sum(image)
+void CRoutine_Normalize::Normalize(cl_mem image, unsigned int image_width, unsigned int image_height, cl_mem sum_buffer)
+{
+	Normalize(image, image_width * image_height, sum_buffer);
+}
+
+/// Normalizes input into output by a sum which resides on the OpenCL device, input is not modified.
+///
+/// @param input The buffer to be normalized
+/// @param output The buffer receiving the normalized values, at least buffer_size elements
+/// @param buffer_size The size of input
+/// @param sum_buffer A buffer whose first element is sum(input)
+void CRoutine_Normalize::Normalize(cl_mem input, cl_mem output, unsigned int buffer_size, cl_mem sum_buffer)
+{
+	int status = CL_SUCCESS;
+	size_t global = size_t(buffer_size);
+
+	status |= clSetKernelArg(mKernels[mNormalizeCopyKernelID],  0, sizeof(cl_mem), &input);
+	status |= clSetKernelArg(mKernels[mNormalizeCopyKernelID],  1, sizeof(cl_mem), &output);
+	status |= clSetKernelArg(mKernels[mNormalizeCopyKernelID],  2, sizeof(unsigned int), &buffer_size);
+	status |= clSetKernelArg(mKernels[mNormalizeCopyKernelID],  3, sizeof(cl_mem), &sum_buffer);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[mNormalizeCopyKernelID], 1, NULL, &global, NULL, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
 } /* namespace liboi */
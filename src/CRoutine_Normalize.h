@@ -40,6 +40,11 @@ namespace liboi
 
 class CRoutine_Normalize: public CRoutine
 {
+protected:
+	int mNormalizeKernelID;
+	int mNormalizeDeviceKernelID;
+	int mNormalizeCopyKernelID;
+
 public:
 	CRoutine_Normalize(cl_device_id device, cl_context context, cl_command_queue queue);
 	virtual ~CRoutine_Normalize();
@@ -48,6 +53,9 @@ public:
 
 	void Normalize(cl_mem buffer, unsigned int buffer_size, float one_over_sum);
 	void Normalize(cl_mem image, unsigned int image_width, unsigned int image_height, float one_over_sum);
+	void Normalize(cl_mem buffer, unsigned int buffer_size, cl_mem sum_buffer);
+	void Normalize(cl_mem image, unsigned int image_width, unsigned int image_height, cl_mem sum_buffer);
+	void Normalize(cl_mem input, cl_mem output, unsigned int buffer_size, cl_mem sum_buffer);
 
 	template <typename T>
 	static void Normalize(valarray<T> & buffer, size_t buffer_size)
@@ -38,6 +38,7 @@ CRoutine_Sum::CRoutine_Sum(cl_device_id device, cl_context context, cl_command_q
 {
 	// Specify the source location, set temporary buffers to null
 	mInputSize = 0;
+	mResultBuffer = NULL;
 
 	// External routines, do not delete/deallocate here.
 	mrZero = rZero;
@@ -45,7 +46,7 @@ CRoutine_Sum::CRoutine_Sum(cl_device_id device, cl_context context, cl_command_q
 
 CRoutine_Sum::~CRoutine_Sum()
 {
-	// TODO Auto-generated destructor stub
+	if(mResultBuffer) clReleaseMemObject(mResultBuffer);
 }
 
 /// Determines if the value x is a power of two.
@@ -66,19 +67,39 @@ unsigned int CRoutine_Sum::nextPow2( unsigned int x )
     return ++x;
 }
 
-/// Computes the sum on the OpenCL device, stores the result in final_buffer and returns the result.
-float CRoutine_Sum::Sum(cl_mem input_buffer, cl_mem final_buffer)
+/// Computes the sum on the OpenCL device and returns the result.
+float CRoutine_Sum::Sum(cl_mem input_buffer)
 {
-	// Compute the sum on the OpenCL device:
-	float result = Sum(input_buffer);
+	int status = CL_SUCCESS;
+
+	if(mResultBuffer == NULL)
+	{
+		mResultBuffer = clCreateBuffer(mContext, CL_MEM_READ_WRITE, sizeof(cl_float), NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mResultBuffer) failed.");
+	}
+
+	Sum(input_buffer, mResultBuffer);
+	return ReadSum(mResultBuffer);
+}
 
+/// Reads the sum stored in final_buffer[0] back to the host. Waits until all queued work
+/// (including the reduction) has completed using the policy set in CRoutine::SetWaitPolicy.
+float CRoutine_Sum::ReadSum(cl_mem final_buffer)
+{
 	int status = CL_SUCCESS;
+	cl_float result = 0;
+	cl_event read_event;
+
+	status = clEnqueueReadBuffer(mQueue, final_buffer, CL_FALSE, 0, sizeof(cl_float), &result, 0, NULL, &read_event);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	status = clFlush(mQueue);
+	CHECK_OPENCL_ERROR(status, "clFlush failed.");
 
-    // Copy the summed value to the OpenCL device:
-	status = clEnqueueWriteBuffer(mQueue, final_buffer, CL_TRUE, 0, sizeof(cl_float), &result, 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+	status = waitForEventAndRelease(&read_event);
+	CHECK_OPENCL_ERROR(status, "waitForEventAndRelease failed.");
 
-	return result;
+	return float(result);
 }
 
 } /* namespace liboi */
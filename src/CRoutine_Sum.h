@@ -42,6 +42,7 @@ class CRoutine_Sum: public CRoutine
 {
 protected:
 	unsigned int mInputSize;
+	cl_mem mResultBuffer;	// Receives the sum when no output buffer is supplied.
 
 	// External routines, deleted elsewhere
 	CRoutine_Zero * mrZero;
@@ -51,8 +52,10 @@ public:
 	virtual ~CRoutine_Sum();
 
 	/// Computes the sum on the OpenCL device, returns a float to the CPU.
-	virtual float Sum(cl_mem input_buffer) = 0;
-	virtual float Sum(cl_mem input_buffer, cl_mem final_buffer);
+	virtual float Sum(cl_mem input_buffer);
+	/// Enqueues the sum of input_buffer on the OpenCL device, the result is left in final_buffer[0].
+	virtual void Sum(cl_mem input_buffer, cl_mem final_buffer) = 0;
+	float ReadSum(cl_mem final_buffer);
 
 	virtual void Init(int n) = 0;
 
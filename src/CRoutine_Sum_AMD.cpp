@@ -29,6 +29,7 @@
  * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include "CRoutine_Sum_AMD.h"
 #include "CRoutine_Zero.h"
 #include "CRoutine_Sum_NVidia.h"
@@ -43,17 +44,13 @@ CRoutine_Sum_AMD::CRoutine_Sum_AMD(cl_device_id device, cl_context context, cl_c
 	// Specify the source location, set temporary buffers to null
 	mSource.push_back("reduce_sum_float_amd.cl");
 
-    globalThreads = new size_t[1];
-    localThreads = new size_t[1];
-
 	mrZero = rZero;
 
 	// Set temporary buffer sizes and memory addresses to zero:
 	mBufferSize = 0;
-	mInputBuffer = NULL;
-	mOutputBuffer = NULL;
+	mTempBuffer1 = NULL;
+	mTempBuffer2 = NULL;
 
-    numBlocks = 0;
     groupSize = GROUP_SIZE;
 
 
@@ -72,77 +69,59 @@ CRoutine_Sum_AMD::CRoutine_Sum_AMD(cl_device_id device, cl_context context, cl_c
 
 CRoutine_Sum_AMD::~CRoutine_Sum_AMD()
 {
-	if(mInputBuffer) clReleaseMemObject(mInputBuffer);
-	if(mOutputBuffer) clReleaseMemObject(mOutputBuffer);
+	if(mTempBuffer1) clReleaseMemObject(mTempBuffer1);
+	if(mTempBuffer2) clReleaseMemObject(mTempBuffer2);
 
-	delete globalThreads;
-	delete localThreads;
+	delete[] deviceInfo.maxWorkItemSizes;
 }
 
 
-/// Computes the sum of the input_buffer. Stores the result in the final_buffer and returns the result
-/// if return_value is true. Returns 0 otherwise.
-float CRoutine_Sum_AMD::Sum(cl_mem input_buffer)
+/// Returns the number of work groups needed to reduce n elements in one pass.
+unsigned int CRoutine_Sum_AMD::NumBlocks(unsigned int n)
+{
+	unsigned int per_block = groupSize * MULTIPLY;
+	return max(1u, (n + per_block - 1) / per_block);
+}
+
+/// Enqueues one reduction pass which sums the first n elements of input_buffer into
+/// blocks partial sums stored in output_buffer.
+void CRoutine_Sum_AMD::Reduce(cl_mem input_buffer, cl_mem output_buffer, unsigned int n, unsigned int blocks)
 {
 	int status = CL_SUCCESS;
-	cl_float output = 0;
-    cl_event sumCompleteEvent;
-	cl_event outputMappedEvent;
-	cl_event outputUnmapEvent;
-
-	// First zero out the temporary sum buffer.
-	mrZero->Zero(mInputBuffer, mBufferSize);
-
-	// Copy the input buffer into mTempBuffer1
-	// The work was all completed on the GPU.  Copy the summed value to the final buffer:
-	status = clEnqueueCopyBuffer(mQueue, input_buffer, mInputBuffer, 0, 0, mInputSize * sizeof(cl_float), 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
-	clFinish(mQueue);
-
-	// Set appropriate arguments to the kernel the input array
-	status  = clSetKernelArg(mKernels[0], 0, sizeof(cl_mem), (void *) &mInputBuffer);
-	status |= clSetKernelArg(mKernels[0], 1, sizeof(cl_mem), (void *) &mOutputBuffer);
-	status |= clSetKernelArg(mKernels[0], 2, groupSize * sizeof(cl_float), NULL);
+	size_t global = blocks * groupSize;
+	size_t local = groupSize;
+
+	status  = clSetKernelArg(mKernels[0], 0, sizeof(cl_mem), (void *) &input_buffer);
+	status |= clSetKernelArg(mKernels[0], 1, sizeof(cl_mem), (void *) &output_buffer);
+	status |= clSetKernelArg(mKernels[0], 2, sizeof(cl_uint), &n);
+	status |= clSetKernelArg(mKernels[0], 3, groupSize * sizeof(cl_float), NULL);
 	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
 
-	// Enqueue the kernel:
-	status = clEnqueueNDRangeKernel(mQueue, mKernels[0], 1, 0, globalThreads, localThreads, 0, NULL, &sumCompleteEvent);
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[0], 1, NULL, &global, &local, 0, NULL, NULL);
 	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
 
-	status = clFlush(mQueue);
-	CHECK_OPENCL_ERROR(status, "clFlush failed.");
-
-	status = waitForEventAndRelease(&sumCompleteEvent);
-	CHECK_OPENCL_ERROR(status, "waitForEventAndRelease failed.");
-
-	// Map the output buffer:
-	cl_float * output_map = (cl_float*)clEnqueueMapBuffer(mQueue, mOutputBuffer, CL_FALSE, CL_MAP_READ, 0,
-			numBlocks * sizeof(cl_float), 0, NULL, &outputMappedEvent, &status);
-	CHECK_OPENCL_ERROR(status, "clEnqueueMapBuffer failed.");
-
-	status = clFlush(mQueue);
-	CHECK_OPENCL_ERROR(status, "clFlush failed.");
-
-	status = waitForEventAndRelease(&outputMappedEvent);
-	CHECK_ERROR(status, OPENCL_SUCCESS, "waitForEventAndRelease failed.");
+/// Sums the first n elements (as set in Init) of input_buffer, storing the result in final_buffer[0].
+/// The input is read in place. Passes are repeated on the partial sums, alternating between the two
+/// temporary buffers, until a single work group remains; that pass writes to final_buffer.
+/// Nothing is copied to the host, use ReadSum or Sum(cl_mem) when the value is needed on the CPU.
+void CRoutine_Sum_AMD::Sum(cl_mem input_buffer, cl_mem final_buffer)
+{
+	cl_mem temp[2] = {mTempBuffer1, mTempBuffer2};
+	cl_mem input = input_buffer;
+	unsigned int n = mInputSize;
+	unsigned int pass = 0;
 
-	// Now that the buffer is mapped, sum it.
-	for(int i = 0; i < numBlocks; i++)
+	do
 	{
-		output += output_map[i];
-	}
-
-	// Release the mapped buffer:
-	status = clEnqueueUnmapMemObject(mQueue, mOutputBuffer, (void*) output_map, 0, NULL, &outputUnmapEvent);
-	CHECK_OPENCL_ERROR(status, "clEnqueueUnmapMemObject failed.");
-
-	status = clFlush(mQueue);
-	CHECK_OPENCL_ERROR(status, "clFlush failed.");
-
-	status = waitForEventAndRelease(&outputUnmapEvent);
-	CHECK_ERROR(status, OPENCL_SUCCESS, "waitForEventAndRelease failed.");
-
-	return output;
+		unsigned int blocks = NumBlocks(n);
+		cl_mem output = (blocks == 1) ? final_buffer : temp[pass % 2];
+		Reduce(input, output, n, blocks);
+
+		input = output;
+		n = blocks;
+		pass++;
+	} while(n > 1);
 }
 
 /// Run queries to get additional details about the kernel.
@@ -163,43 +142,38 @@ void CRoutine_Sum_AMD::setKernelInfo()
 	CHECK_OPENCL_ERROR(status, "clGetKernelWorkGroupInfo(CL_KERNEL_COMPILE_WORK_GROUP_SIZE) failed.");
 }
 
-/// Initializes the parallel sum object to sum num_element entries from a cl_mem buffer.
-/// allocate_temp_buffers: if true will automatically allocate/deallocate buffers. Otherwise you need to do this elsewhere
+/// Initializes the parallel sum object to sum n entries from a cl_mem buffer.
 void CRoutine_Sum_AMD::Init(int n)
 {
-	int status = CL_SUCCESS;
-	mInputSize = n;
-	mBufferSize = n;
-
-	// Push the buffer up to the next greatest power of two. This ensures that
-	// the global work size is evenly divisible by the local work size in
-	// the call to clEnqueueNDKernel.
-	if(!isPow2(mBufferSize))
-		mBufferSize = nextPow2(mBufferSize);
-
 	// Read the kernel, compile it
 	string source = ReadSource(mSource[0]);
     BuildKernel(source, "reduce_sum_float_amd", mSource[0]);
 
-    // Determine and set work group size, set the number of blocks apropriately.
+    // Determine and set work group size, then allocate the temporary buffers.
 	setWorkGroupSize();
-    numBlocks = mBufferSize / ((cl_float)groupSize * MULTIPLY);
+	Resize(n);
+}
 
-    if(mInputBuffer == NULL)
-	{
-    	mInputBuffer = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBufferSize * sizeof(cl_float), NULL, &status);
-    	CHECK_OPENCL_ERROR(status, "clCreateBuffer(mInputBuffer) failed.");
-    	// fill the buffer with zeros
-    	mrZero->Zero(mInputBuffer, mBufferSize);
-	}
+/// Changes the number of entries summed without recompiling the kernel. The temporary buffers
+/// need only hold the partial sums from the first pass and are only reallocated if they are too small.
+void CRoutine_Sum_AMD::Resize(int n)
+{
+	int status = CL_SUCCESS;
+	mInputSize = n;
 
-	if(mOutputBuffer == NULL)
-	{
-		mOutputBuffer = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBufferSize * sizeof(cl_float), NULL, &status);
-    	CHECK_OPENCL_ERROR(status, "clCreateBuffer(mOutputBuffer) failed.");
-    	// fill the buffer with zeros
-    	mrZero->Zero(mOutputBuffer, mBufferSize);
-	}
+	unsigned int n_blocks = NumBlocks(mInputSize);
+	if(mTempBuffer1 != NULL && mTempBuffer2 != NULL && n_blocks <= mBufferSize)
+		return;
+
+	mBufferSize = max(n_blocks, mBufferSize);
+
+	if(mTempBuffer1) clReleaseMemObject(mTempBuffer1);
+	mTempBuffer1 = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBufferSize * sizeof(cl_float), NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer(mTempBuffer1) failed.");
+
+	if(mTempBuffer2) clReleaseMemObject(mTempBuffer2);
+	mTempBuffer2 = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBufferSize * sizeof(cl_float), NULL, &status);
+	CHECK_OPENCL_ERROR(status, "clCreateBuffer(mTempBuffer2) failed.");
 }
 
 void CRoutine_Sum_AMD::setWorkGroupSize()
@@ -237,8 +211,9 @@ void CRoutine_Sum_AMD::setWorkGroupSize()
         std::cout << "Unsupported: Insufficient local memory on device." << std::endl;
     }
 
-    globalThreads[0] = mBufferSize / MULTIPLY;
-    localThreads[0] = groupSize;
+    // The tree reduction in the kernel requires a power-of-two work group size.
+    if(!isPow2(groupSize))
+    	groupSize = nextPow2(groupSize) / 2;
 }
 
 void CRoutine_Sum_AMD::setDeviceInfo()
@@ -260,7 +235,7 @@ void CRoutine_Sum_AMD::setDeviceInfo()
 
     //Get max work item sizes
 	if(deviceInfo.maxWorkItemSizes != NULL)
-		delete deviceInfo.maxWorkItemSizes;
+		delete[] deviceInfo.maxWorkItemSizes;
 
     deviceInfo.maxWorkItemSizes = new size_t[deviceInfo.maxWorkItemDims];
 
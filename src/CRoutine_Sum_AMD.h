@@ -47,13 +47,10 @@ protected:
 
 protected:
 
-	cl_mem mInputBuffer;				/// Local buffer of size n*group_size to store a copy of the input data
-	cl_mem mOutputBuffer;				/// Local buffer of size n*group_size to store the output from the reduction process.
+	cl_mem mTempBuffer1;				/// Partial sums from the odd reduction passes
+	cl_mem mTempBuffer2;				/// Partial sums from the even reduction passes
 	unsigned int mBufferSize;
 
-    size_t * globalThreads;        /**< Global NDRange for the kernel */
-    size_t * localThreads;         /**< Local WorkGroup for kernel */
-
 	struct
 	{
 		cl_ulong localMemoryUsed;           /**< localMemoryUsed amount of local memory used by kernel */
@@ -69,7 +66,6 @@ protected:
         cl_ulong localMemSize;              /**< localMemSize localMem Size of device*/
 	} deviceInfo;
 
-    int numBlocks;                  /**< Number of groups */
     size_t groupSize;               /**< Work-group size */
 
 
@@ -77,9 +73,17 @@ public:
 	CRoutine_Sum_AMD(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero);
 	virtual ~CRoutine_Sum_AMD();
 
-	float Sum(cl_mem input_buffer);
+	using CRoutine_Sum::Sum;
+	void Sum(cl_mem input_buffer, cl_mem final_buffer);
 
 	void Init(int n);
+	void Resize(int n);
+
+protected:
+	unsigned int NumBlocks(unsigned int n);
+	void Reduce(cl_mem input_buffer, cl_mem output_buffer, unsigned int n, unsigned int blocks);
+
+public:
 
 	void setKernelInfo();
 	void setDeviceInfo();
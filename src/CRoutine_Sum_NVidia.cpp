@@ -68,12 +68,10 @@ CRoutine_Sum_NVidia::CRoutine_Sum_NVidia(cl_device_id device, cl_context context
 {
 	// Specify the source location, set temporary buffers to null
 	mSource.push_back("reduce_sum_float_nvidia.cl");
-	mTempBuffer1 = NULL;
-	mTempBuffer2 = NULL;
-	mBufferSize = 0;
-	mInputSize = 0;
-	mFinalS = 0;
-	mReductionPasses = 0;
+	mTempBuffer = NULL;
+	mBlocks = 0;
+	mThreads = 0;
+	mUseSubgroups = false;
 
 	// External routines, do not delete/deallocate here.
 	mrZero = rZero;
@@ -81,176 +79,128 @@ CRoutine_Sum_NVidia::CRoutine_Sum_NVidia(cl_device_id device, cl_context context
 
 CRoutine_Sum_NVidia::~CRoutine_Sum_NVidia()
 {
-	if(mTempBuffer1) clReleaseMemObject(mTempBuffer1);
-	if(mTempBuffer2) clReleaseMemObject(mTempBuffer2);
+	if(mTempBuffer) clReleaseMemObject(mTempBuffer);
 }
 
-void CRoutine_Sum_NVidia::getNumBlocksAndThreads(int whichKernel, int n, int maxBlocks, int maxThreads, int &blocks, int &threads)
+/// Builds the reduction kernel. If use_subgroups is true and the device supports cl_khr_subgroups
+/// or cl_intel_subgroups, the kernel reduces each sub-group with sub_group_reduce_add. Otherwise, or if
+/// that kernel fails to build, a portable kernel which synchronizes every step with barriers is used.
+void CRoutine_Sum_NVidia::BuildKernels(bool use_subgroups)
 {
-
-	threads = (n < maxThreads*2) ? nextPow2((n + 1)/ 2) : maxThreads;
-	blocks = (n + (threads * 2 - 1)) / (threads * 2);
-
-	if (whichKernel == 6)
-		blocks = min(maxBlocks, blocks);
-}
-
-
-void CRoutine_Sum_NVidia::BuildKernels()
-{
-	int whichKernel = 6;
-	int numBlocks = 0;
-	int numThreads = 0;
 #ifdef __APPLE__
-	int maxThreads = 64;
+	unsigned int maxThreads = 64;
 #else
-	int maxThreads = 128;
+	unsigned int maxThreads = 128;
 #endif
-	int maxBlocks = 64;
-	int cpuFinalThreshold = 1;
+	unsigned int maxBlocks = 64;
 
-	getNumBlocksAndThreads(whichKernel, mBufferSize, maxBlocks, maxThreads, numBlocks, numThreads);
-	BuildReductionKernel(whichKernel, numThreads, isPow2(mBufferSize) );
-	mBlocks.push_back(numBlocks);
-	mThreads.push_back(numThreads);
-	mReductionPasses += 1;
+	// The kernels loop over the input with a stride of the grid size and check bounds, so the input
+	// need not be padded and the block size is independent of n.
+	mThreads = maxThreads;
+	mBlocks = (mInputSize + (mThreads * 2 - 1)) / (mThreads * 2);
+	mBlocks = max(1u, min(maxBlocks, mBlocks));
 
-	int s = numBlocks;
-	int threads = 0, blocks = 0;
-	int kernel = (whichKernel == 6) ? 5 : whichKernel;
-
-	while(s > cpuFinalThreshold)
+	string defines = "";
+	mUseSubgroups = false;
+	if(use_subgroups)
 	{
-		getNumBlocksAndThreads(kernel, s, maxBlocks, maxThreads, blocks, threads);
-		BuildReductionKernel(kernel, threads, isPow2(s) );
-		mBlocks.push_back(blocks);
-		mThreads.push_back(threads);
+		if(COpenCL::checkExtensionAvailability(mDeviceID, "cl_khr_subgroups"))
+		{
+			defines = "#define LIBOI_KHR_SUBGROUPS 1\n";
+			mUseSubgroups = true;
+		}
+		else if(COpenCL::checkExtensionAvailability(mDeviceID, "cl_intel_subgroups"))
+		{
+			defines = "#define LIBOI_INTEL_SUBGROUPS 1\n";
+			mUseSubgroups = true;
+		}
+	}
 
-		s = (s + (threads*2-1)) / (threads*2);
-		mReductionPasses += 1;
+	// Some drivers advertise the extensions but fail to compile the sub-group built-ins.
+	if(mUseSubgroups)
+	{
+		try
+		{
+			BuildReductionKernel("reduce_subgroup", mThreads, false, defines);
+			return;
+		}
+		catch(...)
+		{
+			mUseSubgroups = false;
+		}
 	}
 
-	mFinalS = s;
+	BuildReductionKernel("reduce_portable", mThreads, false);
 }
 
-cl_kernel CRoutine_Sum_NVidia::BuildReductionKernel(int whichKernel, int blockSize, int isPowOf2)
+cl_kernel CRoutine_Sum_NVidia::BuildReductionKernel(string kernel_name, int blockSize, int isPowOf2, string defines)
 {
     stringstream tmp;
     tmp << "#define T float" << std::endl;
     tmp << "#define blockSize " << blockSize << std::endl;
     tmp << "#define nIsPow2 " << isPowOf2 << std::endl;
+    tmp << defines;
     tmp << ReadSource(mSource[0]);
 
-    stringstream kernelName;
-    kernelName << "reduce" << whichKernel;
-    BuildKernel(tmp.str(), kernelName.str());
+    BuildKernel(tmp.str(), kernel_name, mSource[0]);
 
     return mKernels[mKernels.size() - 1];
 }
 
-float CRoutine_Sum_NVidia::Sum(cl_mem input_buffer)
+/// Enqueues one reduction pass which sums the first n elements of input_buffer into
+/// blocks partial sums stored in output_buffer.
+void CRoutine_Sum_NVidia::Reduce(cl_mem input_buffer, cl_mem output_buffer, unsigned int n, unsigned int blocks)
 {
-	// First zero out the temporary sum buffer.
-	mrZero->Zero(mTempBuffer1, mBufferSize);
-
 	int status = CL_SUCCESS;
-	// Copy the input buffer into mTempBuffer1
-	// The work was all completed on the GPU.  Copy the summed value to the final buffer:
-	status = clEnqueueCopyBuffer(mQueue, input_buffer, mTempBuffer1, 0, 0, mInputSize * sizeof(cl_float), 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+	size_t global = blocks * mThreads;
+	size_t local = mThreads;
 
-	status = clFinish(mQueue);
-	CHECK_OPENCL_ERROR(status, "clFinish failed.");
+	status  = clSetKernelArg(mKernels[0], 0, sizeof(cl_mem), (void *) &input_buffer);
+	status |= clSetKernelArg(mKernels[0], 1, sizeof(cl_mem), (void *) &output_buffer);
+	status |= clSetKernelArg(mKernels[0], 2, sizeof(cl_uint), &n);
+	status |= clSetKernelArg(mKernels[0], 3, sizeof(cl_float) * mThreads, NULL);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
 
-	// Init locals:
-	cl_float gpu_result = 0;
-	int numThreads = mThreads[0];
-
-	int threads = 0;
-	int blocks = 0;
-	cl_mem buff1 = mTempBuffer1;
-	cl_mem buff2 = mTempBuffer2;
-    size_t globalWorkSize[1];
-    size_t localWorkSize[1];
-    cl_kernel reductionKernel;
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[0], 1, NULL, &global, &local, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
 
-	for(int kernel_id = 0; kernel_id < mReductionPasses; kernel_id++)
+/// Sums the first n elements (as set in Init) of input_buffer, storing the result in final_buffer[0].
+/// The input is read in place and the result is not copied to the host, use ReadSum or Sum(cl_mem)
+/// when the value is needed on the CPU.
+void CRoutine_Sum_NVidia::Sum(cl_mem input_buffer, cl_mem final_buffer)
+{
+	if(mBlocks == 1)
 	{
-		threads = mThreads[kernel_id];
-		blocks = mBlocks[kernel_id];
-
-		globalWorkSize[0] = blocks * threads;
-		localWorkSize[0] = threads;
-		reductionKernel = mKernels[kernel_id];
-
-		clSetKernelArg(reductionKernel, 0, sizeof(cl_mem), (void *) &buff1);
-		clSetKernelArg(reductionKernel, 1, sizeof(cl_mem), (void *) &buff2);
-		clSetKernelArg(reductionKernel, 2, sizeof(cl_int), &mBufferSize);
-		clSetKernelArg(reductionKernel, 3, sizeof(cl_float) * numThreads, NULL);
-		status = clEnqueueNDRangeKernel(mQueue, reductionKernel, 1, 0, globalWorkSize, localWorkSize, 0, NULL, NULL);
-		CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
-
-		buff1 = buff2;
+		Reduce(input_buffer, final_buffer, mInputSize, 1);
+		return;
 	}
 
-	clFinish(mQueue);
-
-	// If a few elements remain, we will need to compute their sum on the CPU:
-    if (mFinalS > 1)
-    {
-    	cl_float h_odata[mFinalS];
-        // copy result from device to host
-    	status = clEnqueueReadBuffer(mQueue, mTempBuffer2, CL_TRUE, 0, mFinalS * sizeof(cl_float), h_odata, 0, NULL, NULL);
-		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
-
-        for(int i=0; i < mFinalS; i++)
-        {
-            gpu_result += h_odata[i];
-        }
-
-    }
-    else
-    {
-    	// The work was all completed on the GPU.  Copy the summed value to the CPU:
-		status = clEnqueueReadBuffer(mQueue, mTempBuffer2, CL_TRUE, 0, sizeof(cl_float), &gpu_result, 0, NULL, NULL);
-		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
-    }
-
-	return float(gpu_result);
+	// Reduce the input to one partial sum per block, then the partial sums to a single value.
+	Reduce(input_buffer, mTempBuffer, mInputSize, mBlocks);
+	Reduce(mTempBuffer, final_buffer, mBlocks, 1);
 }
 
-
-/// Initializes the parallel sum object to sum num_element entries from a cl_mem buffer.
-/// allocate_temp_buffers: if true will automatically allocate/deallocate buffers. Otherwise you need to do this elsewhere
+/// Initializes the parallel sum object to sum n entries from a cl_mem buffer.
+/// Sub-group reductions are used if the device supports them.
 void CRoutine_Sum_NVidia::Init(int n)
+{
+	Init(n, true);
+}
+
+/// Initializes the parallel sum object to sum n entries from a cl_mem buffer.
+/// If use_subgroups is false, the portable (barrier-only) kernel is used on all devices.
+void CRoutine_Sum_NVidia::Init(int n, bool use_subgroups)
 {
 	int status = CL_SUCCESS;
 
 	mInputSize = n;
-	mBufferSize = n;
-
-	// The NVidia SDK kernel on which this routine is based is designed only for power-of-two
-	// sized buffers. Because of this, we'll create internal buffers that round up to the
-	// next highest power of two.
-	if(!isPow2(mBufferSize))
-		mBufferSize = nextPow2(mBufferSize);
-
-	// TODO: Workaround for issue 32 in which kernel fails to compute sums for N = [33 - 64]
-	// https://github.com/bkloppenborg/liboi/issues/32
-	if(mBufferSize < 128)
-		mBufferSize = 128;
-
-	BuildKernels();
 
-	if(mTempBuffer1 == NULL)
-	{
-		mTempBuffer1 = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBufferSize * sizeof(cl_float), NULL, &status);
-		CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
-	}
+	BuildKernels(use_subgroups);
 
-	if(mTempBuffer2 == NULL)
+	if(mTempBuffer == NULL)
 	{
-		mTempBuffer2 = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBufferSize * sizeof(cl_float), NULL, &status);
+		mTempBuffer = clCreateBuffer(mContext, CL_MEM_READ_WRITE, mBlocks * sizeof(cl_float), NULL, &status);
 		CHECK_OPENCL_ERROR(status, "clCreateBuffer failed.");
 	}
 }
@@ -42,29 +42,31 @@ class CRoutine_Zero;
 class CRoutine_Sum_NVidia: public CRoutine_Sum
 {
 protected:
-	unsigned int mInputSize;
-	unsigned int mBufferSize;
-	cl_mem mTempBuffer1;
-	cl_mem mTempBuffer2;
-	vector<int> mBlocks;
-	vector<int> mThreads;
-	int mFinalS;
-	int mReductionPasses;
+	cl_mem mTempBuffer;		// Partial sums, one per block.
+	unsigned int mBlocks;
+	unsigned int mThreads;
+	bool mUseSubgroups;
 
 public:
 	CRoutine_Sum_NVidia(cl_device_id device, cl_context context, cl_command_queue queue, CRoutine_Zero * rZero);
 	virtual ~CRoutine_Sum_NVidia();
 
 public:
-	cl_kernel BuildReductionKernel(int whichKernel, int blockSize, int isPowOf2);
+	cl_kernel BuildReductionKernel(string kernel_name, int blockSize, int isPowOf2, string defines = "");
 
-	void BuildKernels();
+	void BuildKernels(bool use_subgroups);
 
-	float Sum(cl_mem input_buffer);
+protected:
+	void Reduce(cl_mem input_buffer, cl_mem output_buffer, unsigned int n, unsigned int blocks);
 
-	static void getNumBlocksAndThreads(int whichKernel, int n, int maxBlocks, int maxThreads, int &blocks, int &threads);
+public:
+	using CRoutine_Sum::Sum;
+	void Sum(cl_mem input_buffer, cl_mem final_buffer);
 
 	void Init(int n);
+	void Init(int n, bool use_subgroups);
+
+	bool UsesSubgroups() { return mUseSubgroups; };
 };
 
 } /* namespace liboi */
@@ -114,3 +114,147 @@ TEST(CRoutine_Sum_AMD, CL_Sum_CPU_CHECK)
 
 	EXPECT_EQ(cpu_sum, cl_sum);
 }
+
+/// Sums a non-power-of-two sized buffer in place, leaving the result on the OpenCL device,
+/// and checks the result and that the input buffer was not modified.
+template <typename T>
+void CL_Sum_NPOT_CHECK(size_t test_size)
+{
+	// Init the OpenCL device and necessary routines:
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CRoutine_Zero r_zero(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	r_zero.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_zero.Init();
+	T r_sum(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), &r_zero);
+	r_sum.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_sum.Init(test_size);
+
+	// Small integers so the float sums are exact.
+	valarray<cl_float> data(test_size);
+	valarray<cl_float> data_after(test_size);
+	for(size_t i = 0; i < test_size; i++)
+		data[i] = i % 7;
+
+	// Create buffers
+	int err = CL_SUCCESS;
+	cl_mem input_buffer = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * test_size, NULL, &err);
+	cl_mem final_buffer = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float), NULL, &err);
+    err = clEnqueueWriteBuffer(cl.GetQueue(), input_buffer, CL_TRUE, 0, sizeof(cl_float) * test_size, &data[0], 0, NULL, NULL);
+    CHECK_OPENCL_ERROR(err, "clEnqueueWriteBuffer failed");
+
+	cl_float cpu_sum = CRoutine_Sum::Sum(data);
+	r_sum.Sum(input_buffer, final_buffer);
+	float cl_sum = r_sum.ReadSum(final_buffer);
+
+    err = clEnqueueReadBuffer(cl.GetQueue(), input_buffer, CL_TRUE, 0, sizeof(cl_float) * test_size, &data_after[0], 0, NULL, NULL);
+    CHECK_OPENCL_ERROR(err, "clEnqueueReadBuffer failed");
+
+	// Free buffers
+	clReleaseMemObject(input_buffer);
+	clReleaseMemObject(final_buffer);
+
+	EXPECT_EQ(cpu_sum, cl_sum);
+	for(size_t i = 0; i < test_size; i++)
+		EXPECT_EQ(data[i], data_after[i]);
+}
+
+/// Checks non-power-of-two sizes, including N = [33 - 64] from issue #32
+TEST(CRoutine_Sum_NVidia, CL_Sum_NPOT)
+{
+	CL_Sum_NPOT_CHECK<CRoutine_Sum_NVidia>(1);
+	CL_Sum_NPOT_CHECK<CRoutine_Sum_NVidia>(37);
+	CL_Sum_NPOT_CHECK<CRoutine_Sum_NVidia>(100003);
+}
+
+/// Checks non-power-of-two sizes, including sizes requiring several reduction passes
+TEST(CRoutine_Sum_AMD, CL_Sum_NPOT)
+{
+	CL_Sum_NPOT_CHECK<CRoutine_Sum_AMD>(1);
+	CL_Sum_NPOT_CHECK<CRoutine_Sum_AMD>(37);
+	CL_Sum_NPOT_CHECK<CRoutine_Sum_AMD>(1000003);
+}
+
+/// Checks that a summation object grown with Resize gives the same results as a freshly initialized one.
+TEST(CRoutine_Sum_AMD, CL_Resize)
+{
+	size_t small_size = 37;
+	size_t large_size = 100003;
+
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CRoutine_Zero r_zero(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	r_zero.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_zero.Init();
+	CRoutine_Sum_AMD r_sum(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), &r_zero);
+	r_sum.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_sum.Init(small_size);
+
+	// Small integers so the float sums are exact.
+	valarray<cl_float> data(large_size);
+	for(size_t i = 0; i < large_size; i++)
+		data[i] = i % 7;
+
+	int err = CL_SUCCESS;
+	cl_mem input_buffer = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * large_size, NULL, &err);
+    err = clEnqueueWriteBuffer(cl.GetQueue(), input_buffer, CL_TRUE, 0, sizeof(cl_float) * large_size, &data[0], 0, NULL, NULL);
+    CHECK_OPENCL_ERROR(err, "clEnqueueWriteBuffer failed");
+
+	valarray<cl_float> small_data = data[slice(0, small_size, 1)];
+	EXPECT_EQ(CRoutine_Sum::Sum(small_data), r_sum.Sum(input_buffer));
+
+	r_sum.Resize(large_size);
+	EXPECT_EQ(CRoutine_Sum::Sum(data), r_sum.Sum(input_buffer));
+
+	// Shrinking keeps the larger temporary buffers.
+	r_sum.Resize(small_size);
+	EXPECT_EQ(CRoutine_Sum::Sum(small_data), r_sum.Sum(input_buffer));
+
+	clReleaseMemObject(input_buffer);
+}
+
+/// Checks that the sum is read back correctly with every event wait policy.
+TEST(CRoutine_Sum_NVidia, CL_Sum_WaitPolicies)
+{
+	LibOIEnums::EventWaitPolicies policies[] = {LibOIEnums::WAIT_SPIN, LibOIEnums::WAIT_BLOCK,
+			LibOIEnums::WAIT_CALLBACK, LibOIEnums::WAIT_HYBRID};
+
+	for(auto policy: policies)
+	{
+		CRoutine::SetWaitPolicy(policy, 50);
+		CL_Sum_NPOT_CHECK<CRoutine_Sum_NVidia>(10007);
+	}
+
+	CRoutine::SetWaitPolicy(LibOIEnums::WAIT_BLOCK);
+}
+
+/// Checks that the portable (barrier-only) reduction matches the CPU, regardless of whether the
+/// device would otherwise use sub-group reductions.
+TEST(CRoutine_Sum_NVidia, CL_Sum_Portable)
+{
+	size_t test_size = 10007;
+
+	// Init the OpenCL device and necessary routines:
+	COpenCL cl(OPENCL_DEVICE_TYPE);
+	CRoutine_Zero r_zero(cl.GetDevice(), cl.GetContext(), cl.GetQueue());
+	r_zero.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_zero.Init();
+	CRoutine_Sum_NVidia r_sum(cl.GetDevice(), cl.GetContext(), cl.GetQueue(), &r_zero);
+	r_sum.SetSourcePath(LIBOI_KERNEL_PATH);
+	r_sum.Init(test_size, false);
+	EXPECT_FALSE(r_sum.UsesSubgroups());
+
+	valarray<cl_float> data(test_size);
+	for(size_t i = 0; i < test_size; i++)
+		data[i] = i % 7;
+
+	int err = CL_SUCCESS;
+	cl_mem input_buffer = clCreateBuffer(cl.GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * test_size, NULL, &err);
+    err = clEnqueueWriteBuffer(cl.GetQueue(), input_buffer, CL_TRUE, 0, sizeof(cl_float) * test_size, &data[0], 0, NULL, NULL);
+    CHECK_OPENCL_ERROR(err, "clEnqueueWriteBuffer failed");
+
+	cl_float cpu_sum = CRoutine_Sum::Sum(data);
+	float cl_sum = r_sum.Sum(input_buffer);
+
+	clReleaseMemObject(input_buffer);
+
+	EXPECT_EQ(cpu_sum, cl_sum);
+}
@@ -77,4 +77,25 @@ void CRoutine_Zero::Zero(cl_mem input, int buffer_size)
 	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
 }
 
+/// Zeros the n elements of input starting at start.
+void CRoutine_Zero::Zero(cl_mem input, int start, int n)
+{
+	if(n < 1)
+		return;
+
+	int status = CL_SUCCESS;
+	size_t offset = (size_t) start;
+	size_t global = (size_t) n;
+	int end = start + n;
+
+	// Set the arguments to our compute kernel
+	status  = clSetKernelArg(mKernels[0], 0, sizeof(cl_mem), &input);
+	status |= clSetKernelArg(mKernels[0], 1, sizeof(int), &end);
+	CHECK_OPENCL_ERROR(status, "clSetKernelArg failed.");
+
+	// Execute the kernel over [start, start + n) using the global work offset
+	status = clEnqueueNDRangeKernel(mQueue, mKernels[0], 1, &offset, &global, NULL, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueNDRangeKernel failed.");
+}
+
 } /* namespace liboi */
@@ -45,6 +45,7 @@ public:
 
 	void Init();
 	void Zero(cl_mem input, int buffer_size);
+	void Zero(cl_mem input, int start, int n);
 
 	template <typename T>
 	void Zero(valarray<T> & buffer, unsigned int buffer_size)
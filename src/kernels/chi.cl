@@ -34,7 +34,7 @@
 
 __kernel void chi(
     __global float * data,
-    __global float * data_err,
+    __global float * data_inv_err,
     __global float * model,
     __global float * output,
     __private unsigned int start,
@@ -46,7 +46,7 @@ __kernel void chi(
     float temp = 0;
 
     if(i < n)
-		temp = (data[index] - model[index]) / data_err[index];
+		temp = (data[index] - model[index]) * data_inv_err[index];
     
     output[index] = temp;
 }
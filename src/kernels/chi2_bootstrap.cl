@@ -0,0 +1,109 @@
+/*
+ * chi2_bootstrap.cl
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *  
+ *  Description:
+ *      OpenCL Kernel to compute the chi2 of bootstrap replicates of a data set.
+ *      Each work group reduces one replicate, beginning with replicate_start.
+ *      The multiplicity of each resampling block is drawn from a Poisson(1)
+ *      distribution using the Philox2x32-10 counter-based generator keyed on
+ *      the seed with the counter [replicate, block], so replicates are
+ *      reproducible and no weights need to be stored.
+ *      The local work size must be a power of two.
+ */
+
+/* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library" 
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+ 
+// floor(2^32 * CDF(k)) of the Poisson(1) distribution for k = 0, 1, ...
+__constant uint poisson_cdf[12] = {
+    0x5e2d58d8, 0xbc5ab1b1, 0xeb715e1d, 0xfb239797, 0xff1025f5, 0xffd90f3b,
+    0xfffa8b71, 0xffff540c, 0xffffed1f, 0xfffffe21, 0xffffffd4, 0xfffffffc};
+
+// Philox2x32 with 10 rounds, returns the first word of the output.
+uint philox2x32_10(uint key, uint ctr0, uint ctr1)
+{
+    uint hi, lo;
+    for(int r = 0; r < 10; r++)
+    {
+        hi = mul_hi(0xD256D193u, ctr0);
+        lo = 0xD256D193u * ctr0;
+        ctr0 = hi ^ key ^ ctr1;
+        ctr1 = lo;
+        key += 0x9E3779B9u;
+    }
+
+    return ctr0;
+}
+
+uint bootstrap_multiplicity(uint seed, uint replicate, uint block)
+{
+    uint u = philox2x32_10(seed, replicate, block);
+    uint k = 0;
+    while(k < 12 && u >= poisson_cdf[k])
+        k++;
+
+    return k;
+}
+
+__kernel void chi2_bootstrap(
+    __global float * chi_buffer,
+    __global unsigned int * block_id,
+    __global float * output,
+    __local float * sdata,
+    __private unsigned int n,
+    __private unsigned int seed,
+    __private unsigned int replicate_start)
+{
+    unsigned int tid = get_local_id(0);
+    unsigned int replicate = replicate_start + get_group_id(0);
+    unsigned int localSize = get_local_size(0);
+    float temp = 0;
+    float sum = 0;
+
+    // Accumulate the weighted chi2 of the elements in this replicate.
+    for(unsigned int i = tid; i < n; i += localSize)
+    {
+        temp = chi_buffer[i];
+        sum += bootstrap_multiplicity(seed, replicate, block_id[i]) * temp * temp;
+    }
+
+    sdata[tid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // do reduction in shared mem
+    for(unsigned int s = localSize >> 1; s > 0; s >>= 1) 
+    {
+        if(tid < s) 
+        {
+            sdata[tid] += sdata[tid + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // write result for this replicate to global mem
+    if(tid == 0) output[get_group_id(0)] = sdata[0];
+}
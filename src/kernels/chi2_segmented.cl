@@ -0,0 +1,121 @@
+/*
+ * chi2_segmented.cl
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *  
+ *  Description:
+ *      OpenCL Kernel to compute the sum of the squares of the chi elements
+ *      in each segment of the data buffer.  Each work group reduces one
+ *      segment, beginning with segment_start.  A segment may only contain elements in the [start, end)
+ *      range specified for it in segment_range.
+ *      If cumulative is set, the chi2 of the previous segment is added to
+ *      each result, so that a series of single-segment launches keeps a
+ *      running sum on the device.
+ *      The local work size must be a power of two.
+ *
+ *      chi2_ranges is the same reduction for segments which are contiguous,
+ *      such as the chi buffers of several data sets packed end-to-end.
+ */
+
+/* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library" 
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+ 
+__kernel void chi2_segmented(
+    __global float * chi_buffer,
+    __global unsigned int * segment_id,
+    __global uint2 * segment_range,
+    __global float * output,
+    __local float * sdata,
+    __private unsigned int segment_start,
+    __private unsigned int cumulative)
+{
+    unsigned int tid = get_local_id(0);
+    unsigned int segment = segment_start + get_group_id(0);
+    unsigned int localSize = get_local_size(0);
+    uint2 range = segment_range[segment];
+    float temp = 0;
+    float sum = 0;
+
+    // Accumulate the chi2 of the elements in this segment.
+    for(unsigned int i = range.s0 + tid; i < range.s1; i += localSize)
+    {
+        temp = chi_buffer[i];
+        if(segment_id[i] == segment)
+            sum += temp * temp;
+    }
+
+    sdata[tid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // do reduction in shared mem
+    for(unsigned int s = localSize >> 1; s > 0; s >>= 1) 
+    {
+        if(tid < s) 
+        {
+            sdata[tid] += sdata[tid + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // write result for this segment to global mem
+    if(tid == 0) output[segment] = sdata[0] + ((cumulative && segment > 0) ? output[segment - 1] : 0);
+}
+
+__kernel void chi2_ranges(
+    __global float * chi_buffer,
+    __global uint2 * ranges,
+    __global float * output,
+    __local float * sdata)
+{
+    unsigned int tid = get_local_id(0);
+    unsigned int range_id = get_group_id(0);
+    unsigned int localSize = get_local_size(0);
+    uint2 range = ranges[range_id];
+    float temp = 0;
+    float sum = 0;
+
+    // Accumulate the chi2 of the elements in this range.
+    for(unsigned int i = range.s0 + tid; i < range.s1; i += localSize)
+    {
+        temp = chi_buffer[i];
+        sum += temp * temp;
+    }
+
+    sdata[tid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // do reduction in shared mem
+    for(unsigned int s = localSize >> 1; s > 0; s >>= 1) 
+    {
+        if(tid < s) 
+        {
+            sdata[tid] += sdata[tid + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // write result for this range to global mem
+    if(tid == 0) output[range_id] = sdata[0];
+}
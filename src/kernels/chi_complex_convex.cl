@@ -67,7 +67,7 @@ float carg(float2 A)
 /// phase of the bispectra.  
 __kernel void chi_complex_convex(
     __global float * data,
-    __global float * data_err,
+    __global float * data_inv_err,
     __global float * model,
     __global float * output,
     __private unsigned int start,
@@ -81,9 +81,9 @@ __kernel void chi_complex_convex(
     tmp_data.s0 = data[index];
     tmp_data.s1 = data[n + index];
     
-    float2 tmp_data_err;
-    tmp_data_err.s0 = data_err[index];
-    tmp_data_err.s1 = tmp_data.s0 * data_err[n + index];
+    float2 tmp_data_inv_err;
+    tmp_data_inv_err.s0 = data_inv_err[index];
+    tmp_data_inv_err.s1 = data_inv_err[n + index] / tmp_data.s0;
 
     float2 tmp_model;
     tmp_model.s0 = model[index];
@@ -100,7 +100,7 @@ __kernel void chi_complex_convex(
     // Compute the chi, store the result:
     if(i < n)
     {
-        output[index] = (cabs(tmp_data) - cabs(tmp_model)) / tmp_data_err.s0;
-        output[n + index] = (carg(tmp_data) - carg(tmp_model)) / (cabs(tmp_data) * tmp_data_err.s1);
+        output[index] = (cabs(tmp_data) - cabs(tmp_model)) * tmp_data_inv_err.s0;
+        output[n + index] = (carg(tmp_data) - carg(tmp_model)) * tmp_data_inv_err.s1 / cabs(tmp_data);
     }  
 }
@@ -71,7 +71,7 @@ void complex_to_oi(float real, float imag, float * amp, float * phase)
 /// phase of the bispectra.  
 __kernel void chi_complex_nonconvex(
     __global float * data,
-    __global float * data_err,
+    __global float * data_inv_err,
     __global float * model,
     __global float * output,
     __private unsigned int start,
@@ -82,8 +82,8 @@ __kernel void chi_complex_nonconvex(
     
     float data_amp = 0;
     float data_phi = 0;
-    float data_amp_err = data_err[index];
-    float data_phi_err = data_err[n+index];
+    float data_amp_inv_err = data_inv_err[index];
+    float data_phi_inv_err = data_inv_err[n+index];
     float model_amp = 0;
     float model_phi = 0;
     
@@ -94,7 +94,7 @@ __kernel void chi_complex_nonconvex(
     // Store the result:
     if(i < n)
     {
-        output[index] = (data_amp - model_amp) / data_amp_err;
-        output[n+index] = sdist(data_phi, model_phi, PI, -1*PI) / data_phi_err;
+        output[index] = (data_amp - model_amp) * data_amp_inv_err;
+        output[n+index] = sdist(data_phi, model_phi, PI, -1*PI) * data_phi_inv_err;
     }   
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+ * chi_whiten.cl
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *  
+ *  Description:
+ *      OpenCL Kernel to whiten the chi elements of correlated data.  Each
+ *      work item solves L * y = chi for one block of the block-diagonal
+ *      correlation matrix, storing y in place of chi.
+ *      L is packed by rows, [L_00, L_10, L_11, L_20, ...] with the diagonal
+ *      elements stored as 1 / L_ii.
+ *      If segment_id is given, only the blocks whose first element is in
+ *      the specified segment are whitened.
+ */
+
+/* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library" 
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+ 
+__kernel void chi_whiten(
+    __global float * chi,
+    __global uint4 * blocks,
+    __global float * factors,
+    __private unsigned int n_blocks,
+    __private unsigned int offset,
+    __global unsigned int * segment_id,
+    __private unsigned int segment)
+{
+    size_t b = get_global_id(0);
+    
+    if(b >= n_blocks)
+        return;
+
+    // blocks are [start, size, factor offset, 0]
+    uint4 block = blocks[b];
+    if(segment_id != 0 && segment_id[block.s0] != segment)
+        return;
+
+    __global float * x = chi + offset + block.s0;
+    __global float * L = factors + block.s2;
+
+    // Forward substitution, in place.
+    unsigned int row = 0;
+    float sum = 0;
+    for(unsigned int i = 0; i < block.s1; i++)
+    {
+        sum = x[i];
+        for(unsigned int j = 0; j < i; j++)
+            sum -= L[row + j] * x[j];
+
+        x[i] = sum * L[row + i];
+        row += i + 1;
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * convert_image.cl
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *  
+ *  Description:
+ *      OpenCL Kernels to convert images uploaded in their native element type
+ *      (double, half or 16-bit unsigned integer) to floating point images.
+ *      convert_double is only compiled if LIBOI_FP64 is defined, see
+ *      CRoutine_ConvertImage::Init.
+ */
+
+ /* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library"
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef LIBOI_FP64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+__kernel void convert_double(
+    __global double * input,
+    __global float * output,
+    __private unsigned int n)
+{
+    size_t i = get_global_id(0);
+
+    if(i < n)
+        output[i] = (float) input[i];
+}
+#endif
+
+__kernel void convert_half(
+    __global half * input,
+    __global float * output,
+    __private unsigned int n)
+{
+    size_t i = get_global_id(0);
+
+    if(i < n)
+        output[i] = vload_half(i, input);
+}
+
+__kernel void convert_uint16(
+    __global ushort * input,
+    __global float * output,
+    __private unsigned int n)
+{
+    size_t i = get_global_id(0);
+
+    if(i < n)
+        output[i] = (float) input[i];
+}
@@ -49,6 +49,9 @@ void load_pixels(__global float * image, unsigned int image_size, unsigned int s
 void compute_indicies(unsigned int start, unsigned int image_width, unsigned int image_height,
     __local uint2 * shared_coords, unsigned int shared_coords_size);
 
+float2 dft_uv_point(float2 uv_point, __global float * restrict image, unsigned image_width, unsigned image_height,
+    __local float * shared_image, __local uint2 * shared_coords);
+
 
 /// Computes the contribution a pixel makes to the Fourier transform.
 ///
@@ -101,20 +104,14 @@ void compute_indicies(unsigned int start, unsigned int image_width, unsigned int
     shared_coords[lid] = (uint2){x, y};
 }
 
-/// Computes the DFT of a 2D image.
-__kernel void dft_2d(
-	__global float2 * restrict uv_points,
-	__private unsigned int nuv,
+/// Computes the DFT of a 2D image at uv_point. All work items in the group must call this function.
+float2 dft_uv_point(float2 uv_point,
 	__global float * restrict image,
-	__private unsigned image_width,
-	__private unsigned image_height,
-	__global float2 * restrict output,
+	unsigned image_width,
+	unsigned image_height,
 	__local float * shared_image,
-	__local uint2 * shared_coords
-)
-{     
-    size_t tid = get_global_id(0);
-    size_t lid = get_local_id(0);
+	__local uint2 * shared_coords)
+{
     size_t local_size = get_local_size(0);
     
     unsigned int image_size = image_width * image_height;
@@ -126,7 +123,6 @@ __kernel void dft_2d(
     float col_temp = 0;
     float2 dft_output = (float2) (0.0f, 0.0f);
 
-    float2 uv_point = uv_points[tid];
     float arg_u =  ARG * uv_point.s0; // note, positive due to U definition in interferometry.
     float arg_v = -ARG * uv_point.s1;
     
@@ -173,8 +169,62 @@ __kernel void dft_2d(
 //        }
 //    }
 
+    return dft_output;
+}
+
+/// Computes the DFT of a 2D image.
+__kernel void dft_2d(
+	__global float2 * restrict uv_points,
+	__private unsigned int nuv,
+	__global float * restrict image,
+	__private unsigned image_width,
+	__private unsigned image_height,
+	__global float2 * restrict output,
+	__local float * shared_image,
+	__local uint2 * shared_coords,
+	__private unsigned int uv_start
+)
+{     
+    size_t tid = get_global_id(0);
+
+    // Only nuv points, starting at uv_start, are computed.
+    float2 uv_point = (float2) (0.0f, 0.0f);
+    if(tid < nuv)
+        uv_point = uv_points[uv_start + tid];
+
+    float2 dft_output = dft_uv_point(uv_point, image, image_width, image_height, shared_image, shared_coords);
+
     // assign the output 
     if(tid < nuv)  
-        output[tid] = dft_output;
+        output[uv_start + tid] = dft_output;
 }
 
+/// Computes the DFT of a 2D image at the n_index UV points uv_points[uv_index[i]].
+/// The output is stored at output[uv_index[i]], all other elements are untouched.
+__kernel void dft_2d_indexed(
+	__global float2 * restrict uv_points,
+	__global unsigned int * restrict uv_index,
+	__private unsigned int n_index,
+	__global float * restrict image,
+	__private unsigned image_width,
+	__private unsigned image_height,
+	__global float2 * restrict output,
+	__local float * shared_image,
+	__local uint2 * shared_coords
+)
+{     
+    size_t tid = get_global_id(0);
+
+    unsigned int uv = 0;
+    float2 uv_point = (float2) (0.0f, 0.0f);
+    if(tid < n_index)
+    {
+        uv = uv_index[tid];
+        uv_point = uv_points[uv];
+    }
+
+    float2 dft_output = dft_uv_point(uv_point, image, image_width, image_height, shared_image, shared_coords);
+
+    if(tid < n_index)  
+        output[uv] = dft_output;
+}
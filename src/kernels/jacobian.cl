@@ -0,0 +1,200 @@
+/*
+ * jacobian.cl
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: bkloppenborg
+ *  
+ *  Description:
+ *      OpenCL Kernels which propagate the derivatives of the visibilities
+ *      with respect to the model parameters (forward mode) through the V2,
+ *      T3 and chi computations to form the Jacobian of the chi elements,
+ *      J[param * n_data + i] = d chi_i / d param, and the normal equations
+ *      J^T J and J^T chi.
+ *      Signs follow chi.cl and chi_complex_nonconvex.cl.
+ */
+
+/* 
+ * Copyright (c) 2012 Brian Kloppenborg
+ *
+ * If you use this software as part of a scientific publication, please cite as:
+ *
+ * Kloppenborg, B.; Baron, F. (2012), "LibOI: The OpenCL Interferometry Library" 
+ * (Version X). Available from  <https://github.com/bkloppenborg/liboi>.
+ *
+ * This file is part of the OpenCL Interferometry Library (LIBOI).
+ * 
+ * LIBOI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * as published by the Free Software Foundation, either version 3 
+ * of the License, or (at your option) any later version.
+ * 
+ * LIBOI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with LIBOI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+ 
+// Function prototypes:
+float2 MultComplex2(float2 A, float2 B);
+float2 MultComplex3(float2 A, float2 B, float2 C);
+
+// Multiply two complex numbers
+float2 MultComplex2(float2 A, float2 B)
+{
+    // (a + bi) * (c + di) = (ac - bd) + (bc + ad)i
+    float2 temp;
+    temp.s0 = A.s0*B.s0 - A.s1*B.s1;
+    temp.s1 = A.s1*B.s0 + A.s0*B.s1;
+    return temp;
+}
+
+// Multiply three complex numbers
+float2 MultComplex3(float2 A, float2 B, float2 C)
+{
+    A = MultComplex2(A, B);
+    return MultComplex2(A, C);
+}
+
+/// Computes the Jacobian rows of the V2 chi elements.
+/// dvis holds the derivatives of the visibilities, dvis[param * n_uv + uv].
+__kernel void jacobian_v2(
+    __global float2 * ft_input,
+    __global float2 * dvis,
+    __global unsigned int * uv_ref,
+    __global float * data_inv_err,
+    __private unsigned int offset,
+    __private unsigned int n_v2,
+    __private unsigned int n_uv,
+    __private unsigned int n_params,
+    __global float * jacobian,
+    __private unsigned int n_data)
+{
+    size_t i = get_global_id(0);
+    if(i >= n_v2)
+        return;
+
+    unsigned int uv_index = uv_ref[i];
+    float2 vis = ft_input[uv_index];
+    float inv_err = data_inv_err[offset + i];
+
+    // V2 = |V|^2, dV2 = 2 Re(conj(V) dV), chi = (data - model) / err
+    for(unsigned int p = 0; p < n_params; p++)
+    {
+        float2 dv = dvis[p * n_uv + uv_index];
+        jacobian[p * n_data + offset + i] = -2 * (vis.s0 * dv.s0 + vis.s1 * dv.s1) * inv_err;
+    }
+}
+
+/// Computes the Jacobian rows of the T3 amplitude and phase chi elements.
+/// The conjugation of the UV points follows ft_to_t3.cl
+__kernel void jacobian_t3(
+    __global float2 * ft_input,
+    __global float2 * dvis,
+    __global uint4 * uv_ref,
+    __global short4 * uv_sign,
+    __global float * data_inv_err,
+    __private unsigned int offset,
+    __private unsigned int n_t3,
+    __private unsigned int n_uv,
+    __private unsigned int n_params,
+    __global float * jacobian,
+    __private unsigned int n_data)
+{
+    size_t i = get_global_id(0);
+    if(i >= n_t3)
+        return;
+
+    uint4 uvpnt = uv_ref[i];
+    short4 sign = uv_sign[i];
+    // The sign of the imaginary part, including the conjugation of vca.
+    float3 c_sign = (float3) (sign.s0, sign.s1, -1 * sign.s2);
+
+    float2 vab = ft_input[uvpnt.s0];
+    float2 vbc = ft_input[uvpnt.s1];
+    float2 vca = ft_input[uvpnt.s2];
+    vab.s1 *= c_sign.s0;
+    vbc.s1 *= c_sign.s1;
+    vca.s1 *= c_sign.s2;
+
+    float2 t3 = MultComplex3(vab, vbc, vca);
+    float amp2 = t3.s0 * t3.s0 + t3.s1 * t3.s1;
+    float amp = sqrt(amp2);
+    float amp_inv_err = data_inv_err[offset + i];
+    float phi_inv_err = data_inv_err[offset + n_t3 + i];
+
+    for(unsigned int p = 0; p < n_params; p++)
+    {
+        float2 dab = dvis[p * n_uv + uvpnt.s0];
+        float2 dbc = dvis[p * n_uv + uvpnt.s1];
+        float2 dca = dvis[p * n_uv + uvpnt.s2];
+        dab.s1 *= c_sign.s0;
+        dbc.s1 *= c_sign.s1;
+        dca.s1 *= c_sign.s2;
+
+        // Product rule
+        float2 dt3 = MultComplex3(dab, vbc, vca) + MultComplex3(vab, dbc, vca) + MultComplex3(vab, vbc, dca);
+
+        // d|T3| = Re(conj(T3) dT3) / |T3|, d arg(T3) = Im(conj(T3) dT3) / |T3|^2
+        float d_amp = 0;
+        float d_phi = 0;
+        if(amp > 0)
+        {
+            d_amp = (t3.s0 * dt3.s0 + t3.s1 * dt3.s1) / amp;
+            d_phi = (t3.s0 * dt3.s1 - t3.s1 * dt3.s0) / amp2;
+        }
+
+        // chi_amp = (data - model) / err, chi_phi = (model - data) / err
+        jacobian[p * n_data + offset + i] = -d_amp * amp_inv_err;
+        jacobian[p * n_data + offset + n_t3 + i] = d_phi * phi_inv_err;
+    }
+}
+
+/// Computes the normal equations from the Jacobian and chi buffers. Each work group computes one element
+/// of output = [J^T J (n_params * n_params, row-major), J^T chi (n_params)].
+/// The local work size must be a power of two.
+__kernel void normal_equations(
+    __global float * jacobian,
+    __global float * chi,
+    __private unsigned int n_data,
+    __private unsigned int n_params,
+    __global float * output,
+    __local float * sdata)
+{
+    unsigned int tid = get_local_id(0);
+    unsigned int element = get_group_id(0);
+    unsigned int localSize = get_local_size(0);
+
+    // Rows a and b of J (b = n_params selects chi)
+    unsigned int a = element / n_params;
+    unsigned int b = element % n_params;
+    if(element >= n_params * n_params)
+    {
+        a = element - n_params * n_params;
+        b = n_params;
+    }
+
+    __global float * row_a = jacobian + a * n_data;
+    __global float * row_b = (b < n_params) ? jacobian + b * n_data : chi;
+
+    float sum = 0;
+    for(unsigned int i = tid; i < n_data; i += localSize)
+        sum += row_a[i] * row_b[i];
+
+    sdata[tid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // do reduction in shared mem
+    for(unsigned int s = localSize >> 1; s > 0; s >>= 1) 
+    {
+        if(tid < s) 
+        {
+            sdata[tid] += sdata[tid + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(tid == 0) output[element] = sdata[0];
+}
@@ -34,15 +34,16 @@
  
 __kernel void loglike(
     __global float * chi_buffer,
-    __global float * data_err,
     __global float * output,
     __private unsigned int n)
 {
     size_t i = get_global_id(0);
+    float temp = 0;
     
-    // Computes the log of the likelihood
+    // Computes the data-dependent part of the log of the likelihood. The
+    // -sum(log(data_err)) - N/2 log(2 pi) terms are constant and added on the host.
     if(i < n)
-	{
-	    output[i] = -1*native_log(data_err[i]) - chi_buffer[i] * chi_buffer[i] / 2;
-    }
+        temp = chi_buffer[i];
+
+    output[i] = -0.5f * temp * temp;
 }
@@ -55,3 +55,42 @@ __kernel void normalize_float(
         	buffer[i] = 0;
 	}
 }
+
+/// Identical to normalize_float, but reads the sum from the first element of
+/// sum_buffer so that the output of the reduction never leaves the device.
+__kernel void normalize_float_device(
+    __global float * buffer,
+    __private unsigned int buffer_size,
+    __global float * sum_buffer)
+{
+    size_t i = get_global_id(0);
+
+    if(i < buffer_size)
+    {
+        buffer[i] = buffer[i] / sum_buffer[0];
+
+        if(buffer[i] < 0 || !isfinite(buffer[i]) || isnan(buffer[i]))
+        	buffer[i] = 0;
+    }
+}
+
+/// Identical to normalize_float_device, but reads from input and writes to output
+/// so that input (e.g. a zero-copy wrapper of a host image) is never modified.
+__kernel void normalize_float_copy(
+    __global const float * input,
+    __global float * output,
+    __private unsigned int buffer_size,
+    __global float * sum_buffer)
+{
+    size_t i = get_global_id(0);
+
+    if(i < buffer_size)
+    {
+        float value = input[i] / sum_buffer[0];
+
+        if(value < 0 || !isfinite(value) || isnan(value))
+        	value = 0;
+
+        output[i] = value;
+    }
+}
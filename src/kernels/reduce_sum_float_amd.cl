@@ -22,6 +22,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
  * to a single value and writes this value to output.
  * 
  * Each work-item loads its data from input array to shared memory of block. 
+ * Work-items past the end of the input (n elements) load zeros.
  * Reduction of each block is done in multiple passes. In first pass 
  * first half work-items are active and they update their values in shared memory 
  * by adding other half values in shared memory. In subsequent passes number 
@@ -29,7 +30,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
  * other half values of shared memory. 
  */
 
-__kernel void reduce_sum_float_amd(__global float * input, __global float * output, __local float * sdata)
+__kernel void reduce_sum_float_amd(__global float * input, __global float * output, unsigned int n, __local float * sdata)
 {
     // load shared mem
     unsigned int tid = get_local_id(0);
@@ -38,7 +39,11 @@ __kernel void reduce_sum_float_amd(__global float * input, __global float * outp
 
     unsigned int localSize = get_local_size(0);
     unsigned int stride = gid * 2;
-    sdata[tid] = input[stride] + input[stride + 1];
+    // Elements beyond n contribute zero, so the input need not be padded.
+    float sum = 0;
+    if(stride < n) sum = input[stride];
+    if(stride + 1 < n) sum += input[stride + 1];
+    sdata[tid] = sum;
 
     barrier(CLK_LOCAL_MEM_FENCE);
     // do reduction in shared mem
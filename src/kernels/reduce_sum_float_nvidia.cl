@@ -17,93 +17,88 @@
 // #define T float
 // #define blockSize 128
 // #define nIsPow2 1
+// and optionally one of (see CRoutine_Sum_NVidia::BuildKernels)
+// #define LIBOI_KHR_SUBGROUPS 1
+// #define LIBOI_INTEL_SUBGROUPS 1
+
+#if defined(LIBOI_KHR_SUBGROUPS)
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#elif defined(LIBOI_INTEL_SUBGROUPS)
+#pragma OPENCL EXTENSION cl_intel_subgroups : enable
+#endif
 
 #ifndef _REDUCE_KERNEL_H_
 #define _REDUCE_KERNEL_H_
 
 /*
-    This version is completely unrolled.  It uses a template parameter to achieve 
-    optimal code for any (power of 2) number of threads.  This requires a switch 
-    statement in the host code to handle all the different thread block sizes at 
-    compile time.
+    This version adds multiple elements per thread sequentially, then reduces in local memory
+    with a barrier at every step instead of relying on implicit warp-synchronous execution
+    below 32 threads. This is safe on all devices (including CPUs and GPUs with independent
+    thread scheduling).
 */
-__kernel void reduce5(__global T *g_idata, __global T *g_odata, unsigned int n, __local volatile T* sdata)
+__kernel void reduce_portable(__global T *g_idata, __global T *g_odata, unsigned int n, __local T* sdata)
 {
-    // perform first level of reduction,
-    // reading from global memory, writing to shared memory
     unsigned int tid = get_local_id(0);
     unsigned int i = get_group_id(0)*(get_local_size(0)*2) + get_local_id(0);
+    unsigned int gridSize = blockSize*2*get_num_groups(0);
+    T sum = 0;
 
-    sdata[tid] = (i < n) ? g_idata[i] : 0;
-    if (i + blockSize < n) 
-        sdata[tid] += g_idata[i+blockSize];  
+    while (i < n)
+    {
+        sum += g_idata[i];
+        if (nIsPow2 || i + blockSize < n)
+            sum += g_idata[i+blockSize];
+        i += gridSize;
+    }
 
+    sdata[tid] = sum;
     barrier(CLK_LOCAL_MEM_FENCE);
 
-    // do reduction in shared mem
-    if (blockSize >= 512) { if (tid < 256) { sdata[tid] += sdata[tid + 256]; } barrier(CLK_LOCAL_MEM_FENCE); }
-    if (blockSize >= 256) { if (tid < 128) { sdata[tid] += sdata[tid + 128]; } barrier(CLK_LOCAL_MEM_FENCE); }
-    if (blockSize >= 128) { if (tid <  64) { sdata[tid] += sdata[tid +  64]; } barrier(CLK_LOCAL_MEM_FENCE); }
-    
-    if (tid < 32)
+    for(unsigned int s = blockSize >> 1; s > 0; s >>= 1)
     {
-        if (blockSize >=  64) { sdata[tid] += sdata[tid + 32]; }
-        if (blockSize >=  32) { sdata[tid] += sdata[tid + 16]; }
-        if (blockSize >=  16) { sdata[tid] += sdata[tid +  8]; }
-        if (blockSize >=   8) { sdata[tid] += sdata[tid +  4]; }
-        if (blockSize >=   4) { sdata[tid] += sdata[tid +  2]; }
-        if (blockSize >=   2) { sdata[tid] += sdata[tid +  1]; }
+        if(tid < s)
+            sdata[tid] += sdata[tid + s];
+        barrier(CLK_LOCAL_MEM_FENCE);
     }
-    
-    // write result for this block to global mem 
+
     if (tid == 0) g_odata[get_group_id(0)] = sdata[0];
 }
 
+#if defined(LIBOI_KHR_SUBGROUPS) || defined(LIBOI_INTEL_SUBGROUPS)
 /*
-    This version adds multiple elements per thread sequentially.  This reduces the overall
-    cost of the algorithm while keeping the work complexity O(n) and the step complexity O(log n).
-    (Brent's Theorem optimization)
+    Same as reduce_portable, but each sub-group is reduced in hardware with
+    sub_group_reduce_add. Only one value per sub-group passes through local memory.
 */
-__kernel void reduce6(__global T *g_idata, __global T *g_odata, unsigned int n, __local volatile T* sdata)
+__kernel void reduce_subgroup(__global T *g_idata, __global T *g_odata, unsigned int n, __local T* sdata)
 {
-    // perform first level of reduction,
-    // reading from global memory, writing to shared memory
     unsigned int tid = get_local_id(0);
     unsigned int i = get_group_id(0)*(get_local_size(0)*2) + get_local_id(0);
     unsigned int gridSize = blockSize*2*get_num_groups(0);
-    sdata[tid] = 0;
+    T sum = 0;
 
-    // we reduce multiple elements per thread.  The number is determined by the 
-    // number of active thread blocks (via gridDim).  More blocks will result
-    // in a larger gridSize and therefore fewer elements per thread
     while (i < n)
-    {         
-        sdata[tid] += g_idata[i];
-        // ensure we don't read out of bounds -- this is optimized away for powerOf2 sized arrays
-        if (nIsPow2 || i + blockSize < n) 
-            sdata[tid] += g_idata[i+blockSize];  
+    {
+        sum += g_idata[i];
+        if (nIsPow2 || i + blockSize < n)
+            sum += g_idata[i+blockSize];
         i += gridSize;
-    } 
+    }
+
+    sum = sub_group_reduce_add(sum);
+    if (get_sub_group_local_id() == 0)
+        sdata[get_sub_group_id()] = sum;
 
     barrier(CLK_LOCAL_MEM_FENCE);
 
-    // do reduction in shared mem
-    if (blockSize >= 512) { if (tid < 256) { sdata[tid] += sdata[tid + 256]; } barrier(CLK_LOCAL_MEM_FENCE); }
-    if (blockSize >= 256) { if (tid < 128) { sdata[tid] += sdata[tid + 128]; } barrier(CLK_LOCAL_MEM_FENCE); }
-    if (blockSize >= 128) { if (tid <  64) { sdata[tid] += sdata[tid +  64]; } barrier(CLK_LOCAL_MEM_FENCE); }
-    
-    if (tid < 32)
+    if (tid == 0)
     {
-        if (blockSize >=  64) { sdata[tid] += sdata[tid + 32]; }
-        if (blockSize >=  32) { sdata[tid] += sdata[tid + 16]; }
-        if (blockSize >=  16) { sdata[tid] += sdata[tid +  8]; }
-        if (blockSize >=   8) { sdata[tid] += sdata[tid +  4]; }
-        if (blockSize >=   4) { sdata[tid] += sdata[tid +  2]; }
-        if (blockSize >=   2) { sdata[tid] += sdata[tid +  1]; }
+        T total = 0;
+        for(unsigned int sg = 0; sg < get_num_sub_groups(); sg++)
+            total += sdata[sg];
+
+        g_odata[get_group_id(0)] = total;
     }
-    
-    // write result for this block to global mem 
-    if (tid == 0) g_odata[get_group_id(0)] = sdata[0];
 }
+#endif
 
 #endif // #ifndef _REDUCE_KERNEL_H_
\ No newline at end of file
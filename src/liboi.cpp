@@ -34,6 +34,7 @@
 
 #include "liboi.hpp"
 #include <cstdio>
+#include <cstring>
 #include <algorithm>
 #include <cassert>
 
@@ -50,6 +51,12 @@
 #include "CRoutine_LogLike.h"
 #include "CRoutine_Square.h"
 #include "CRoutine_Zero.h"
+#include "CRoutine_Jacobian.h"
+#include "CModel.h"
+#include "CImageRing.h"
+#include "CRoutine_ConvertImage.h"
+#include "CImageWriter.h"
+#include "CDeviceArena.h"
 
 namespace liboi
 {
@@ -76,8 +83,13 @@ CLibOI::CLibOI(cl_device_id device, cl_context context, cl_command_queue queue)
 
 CLibOI::~CLibOI()
 {
+	// Finish writing exported images before their OpenCL reads are torn down.
+	delete mImageWriter;
+
 	// First free datamembers:
+	// Data sets still held by the caller keep the arena alive, it is freed with the last of them.
 	delete mDataList;
+	mArena.reset();
 	delete mrTotalFlux;
 	delete mrCopyImage;
 	delete mrNormalize;
@@ -87,29 +99,96 @@ CLibOI::~CLibOI()
 	delete mrChi;
 	delete mrLogLike;
 	delete mrSquare;
+	delete mrJacobian;
+	delete mrConvertImage;
 	delete mrZeroBuffer;
 
 	// Now free OpenCL buffers:
 	if(mFluxBuffer) clReleaseMemObject(mFluxBuffer);
 	if(mFTBuffer) clReleaseMemObject(mFTBuffer);
 	if(mSimDataBuffer) clReleaseMemObject(mSimDataBuffer);
+	if(mEvaluateBuffer) clReleaseMemObject(mEvaluateBuffer);
+	if(mPackedChi) clReleaseMemObject(mPackedChi);
+	if(mPackedRanges) clReleaseMemObject(mPackedRanges);
+	if(mPackedChi2) clReleaseMemObject(mPackedChi2);
 	if(mImage_gl) clReleaseMemObject(mImage_gl);
+	SetImageRing(0);
 	if(mImage_cl) clReleaseMemObject(mImage_cl);
+	if(mImage_raw) clReleaseMemObject(mImage_raw);
+	if(mImage_delta_base) clReleaseMemObject(mImage_delta_base);
+	FreeHostImageBuffers();
+}
+
+/// Releases the buffers used to transfer host images to the device (see CopyImageToBuffer).
+void CLibOI::FreeHostImageBuffers()
+{
+	int status = CL_SUCCESS;
+
+	if(mImage_upload_event)
+	{
+		CRoutine::waitForEventAndRelease(&mImage_upload_event);
+		mImage_upload_event = NULL;
+	}
+
+	if(mImage_staging)
+	{
+		status = clEnqueueUnmapMemObject(mOCL->GetQueue(), mImage_staging, mImage_staging_ptr, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueUnmapMemObject failed.");
+		clFinish(mOCL->GetQueue());
+		clReleaseMemObject(mImage_staging);
+	}
+
+	if(mImage_hostwrap)
+	{
+		// The wrapper is mapped between uploads, see UploadHostImage.
+		status = clEnqueueUnmapMemObject(mOCL->GetQueue(), mImage_hostwrap, mImage_hostwrap_map, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueUnmapMemObject failed.");
+		clFinish(mOCL->GetQueue());
+		clReleaseMemObject(mImage_hostwrap);
+	}
+
+	mImage_staging = NULL;
+	mImage_staging_ptr = NULL;
+	mImage_staging_size = 0;
+	mImage_hostwrap = NULL;
+	mImage_hostwrap_ptr = NULL;
+	mImage_hostwrap_map = NULL;
+	mImage_hostwrap_size = 0;
+}
+
+/// Removes the gaps left in device memory by removed data sets, see COILibDataList::Compact.
+/// RemoveData does not compact because the buffers of the remaining data sets move. Call this only
+/// while no other thread evaluates data.
+void CLibOI::CompactData()
+{
+	mDataList->Compact();
 }
 
 /// Copies the specified layer from the registered image buffer over to an OpenCL memory buffer.
 /// If the image is already in an OpenCL buffer, this function need not be called.
 void CLibOI::CopyImageToBuffer(int layer)
 {
+	mImageLayer = layer;
+
 	// Decide where we need to copy from
 
 	if(mImageType == LibOIEnums::OPENGL_FRAMEBUFFER || mImageType == LibOIEnums::OPENGL_TEXTUREBUFFER)
 	{
 		CopyImageToBuffer(mImage_gl, mImage_cl, mImageWidth, mImageHeight, layer);
+		MarkImageDirty();
+		mImageChanged.swap(mImageDirty);
+		mImageDirty.clear();
+	}
+	else if(mImageType == LibOIEnums::HOST_MEMORY && mImageDeltaEnabled && mImageElementType == LibOIEnums::IMAGE_FLOAT)
+	{
+		UploadHostImageDelta((const float *) mImage_host, mImage_cl, layer);
 	}
 	else if(mImageType == LibOIEnums::HOST_MEMORY)
 	{
-		CopyImageToBuffer(mImage_host, mImage_cl, mImageWidth, mImageHeight, layer);
+		CopyImageToBuffer(mImage_host, mImageElementType, mImage_cl, mImageWidth, mImageHeight, layer);
+		MarkImageDirty();
+		mImageChanged.swap(mImageDirty);
+		mImageDirty.clear();
 	}
 //	else if(mImageType == LibOIEnums::OPENCL_BUFFER)
 //	{
@@ -128,40 +207,383 @@ void CLibOI::CopyImageToBuffer(cl_mem gl_image, cl_mem cl_buffer, int width, int
 	mrCopyImage->CopyImage(gl_image, cl_buffer, width, height, layer);
 }
 
-/// Copies host memory to a cl_mem buffer
+/// Copies the specified layer of a width x height x depth image in host memory to a cl_mem buffer using the
+/// mode set in SetHostImageMode, see UploadHostImage. In HOST_IMAGE_ZERO_COPY mode cl_buffer receives the
+/// normalized image.
 void CLibOI::CopyImageToBuffer(float * host_mem, cl_mem cl_buffer, int width, int height, int layer)
+{
+	CopyImageToBuffer((const void *) host_mem, LibOIEnums::IMAGE_FLOAT, cl_buffer, width, height, layer);
+}
+
+/// Copies the specified layer of a width x height x depth image of the specified element type from host memory
+/// to a floating point cl_mem buffer. The native bytes are uploaded (see UploadHostImage) and converted on the
+/// OpenCL device. Double images on devices without cl_khr_fp64 are converted on the host.
+void CLibOI::CopyImageToBuffer(const void * host_mem, LibOIEnums::ImageElementTypes type, cl_mem cl_buffer, int width, int height, int layer)
+{
+	int status = CL_SUCCESS;
+	unsigned int n = width * height;
+
+	// Layers are stored one after another.
+	host_mem = (const char *) host_mem + layer * n * CRoutine_ConvertImage::ElementSize(type);
+
+	bool zero_copy = (GetHostImageMode() == LibOIEnums::HOST_IMAGE_ZERO_COPY);
+	// The flux routine is sized for the registered image.
+	if(type == LibOIEnums::IMAGE_FLOAT && zero_copy && n == size_t(mImageWidth) * mImageHeight)
+	{
+		// The image is never copied, cl_buffer receives the normalized image (see Normalize) straight from the
+		// caller's array.
+		cl_mem wrapper = WrapHostImage(host_mem, sizeof(cl_float) * n);
+		mrTotalFlux->Sum(wrapper, mFluxBuffer);
+		mrNormalize->Normalize(wrapper, cl_buffer, n, mFluxBuffer);
+		UnwrapHostImage();
+		return;
+	}
+
+	if(type == LibOIEnums::IMAGE_FLOAT)
+	{
+		UploadHostImage(host_mem, sizeof(cl_float) * n, cl_buffer);
+		return;
+	}
+
+	if(!mrConvertImage->IsSupported(type))
+	{
+		// Convert reallocates the conversion buffer when it grows, release any wrapper of the old one first.
+		if(mImage_converted.size() < n)
+			FreeHostImageBuffers();
+
+		CRoutine_ConvertImage::Convert(host_mem, type, mImage_converted, n);
+		UploadHostImage(&mImage_converted[0], sizeof(cl_float) * n, cl_buffer);
+		return;
+	}
+
+	size_t size = CRoutine_ConvertImage::ElementSize(type) * n;
+	if(zero_copy)
+	{
+		// Convert straight from the caller's array.
+		cl_mem wrapper = WrapHostImage(host_mem, size);
+		mrConvertImage->Convert(wrapper, type, cl_buffer, n);
+		UnwrapHostImage();
+		return;
+	}
+
+	if(mImage_raw_size < size)
+	{
+		if(mImage_raw) clReleaseMemObject(mImage_raw);
+		mImage_raw = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_ONLY, size, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mImage_raw) failed.");
+		mImage_raw_size = size;
+	}
+
+	UploadHostImage(host_mem, size, mImage_raw);
+	mrConvertImage->Convert(mImage_raw, type, cl_buffer, n);
+}
+
+/// Copies the regions of host_mem marked with MarkImageDirty to the device copy of the image and then
+/// copies that image to cl_buffer on the device. The whole image is uploaded the first time and after the
+/// image source, size or layer changes. The uploaded regions are available from GetChangedRegions.
+void CLibOI::UploadHostImageDelta(const float * host_mem, cl_mem cl_buffer, int layer)
+{
+	int status = CL_SUCCESS;
+	cl_command_queue queue = mOCL->GetQueue();
+	size_t size = sizeof(cl_float) * mImageWidth * mImageHeight;
+
+	// The device copy holds a single layer.
+	host_mem += layer * mImageWidth * mImageHeight;
+	if(layer != mImageDeltaLayer)
+	{
+		mImageDeltaValid = false;
+		mImageDeltaLayer = layer;
+	}
+
+	if(mImage_delta_base == NULL)
+	{
+		mImage_delta_base = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_WRITE, size, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mImage_delta_base) failed.");
+	}
+
+	if(!mImageDeltaValid)
+	{
+		UploadHostImage(host_mem, size, mImage_delta_base);
+		mImageDirty.clear();
+		MarkImageDirty();
+		mImageDeltaValid = true;
+	}
+	else
+	{
+		size_t row_pitch = sizeof(cl_float) * mImageWidth;
+		for(size_t i = 0; i < mImageDirty.size(); i++)
+		{
+			const ImageRect & rect = mImageDirty[i];
+			// The queue is in-order, so blocking on the last write covers all of them.
+			cl_bool blocking = (i + 1 == mImageDirty.size()) ? CL_TRUE : CL_FALSE;
+
+#if MAX_OPENCL_VERSION >= 110
+			size_t origin[3] = {sizeof(cl_float) * rect.x, rect.y, 0};
+			size_t region[3] = {sizeof(cl_float) * rect.width, rect.height, 1};
+			status = clEnqueueWriteBufferRect(queue, mImage_delta_base, blocking, origin, origin, region,
+					row_pitch, 0, row_pitch, 0, host_mem, 0, NULL, NULL);
+			CHECK_OPENCL_ERROR(status, "clEnqueueWriteBufferRect failed.");
+#else
+			for(unsigned int row = rect.y; row < rect.y + rect.height; row++)
+			{
+				size_t offset = row * row_pitch + sizeof(cl_float) * rect.x;
+				status = clEnqueueWriteBuffer(queue, mImage_delta_base, (row + 1 == rect.y + rect.height) ? blocking : CL_FALSE,
+						offset, sizeof(cl_float) * rect.width, (const char *) host_mem + offset, 0, NULL, NULL);
+				CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+			}
+#endif // MAX_OPENCL_VERSION >= 110
+		}
+	}
+
+	mImageChanged.swap(mImageDirty);
+	mImageDirty.clear();
+
+	// Normalize works in place, so cl_buffer is refreshed from the unnormalized copy.
+	status = clEnqueueCopyBuffer(queue, mImage_delta_base, cl_buffer, 0, 0, size, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+}
+
+/// Copies size bytes of host memory to a cl_mem buffer using the mode set in SetHostImageMode.
+/// No memory is allocated per call.
+///
+/// HOST_IMAGE_COPY performs a blocking write directly from host_mem.
+/// HOST_IMAGE_PINNED copies host_mem into a pinned, persistently mapped staging buffer and enqueues a
+/// non-blocking write from it, host_mem may be modified as soon as this function returns.
+/// HOST_IMAGE_ZERO_COPY wraps host_mem (see WrapHostImage) and copies it on the device. Floating point images are
+/// not uploaded with this function in that mode, CopyImageToBuffer normalizes them straight from the wrapper.
+void CLibOI::UploadHostImage(const void * host_mem, size_t size, cl_mem cl_buffer)
+{
+	int status = CL_SUCCESS;
+	cl_command_queue queue = mOCL->GetQueue();
+	cl_mem wrapper = NULL;
+
+	switch(GetHostImageMode())
+	{
+	case LibOIEnums::HOST_IMAGE_ZERO_COPY:
+		wrapper = WrapHostImage(host_mem, size);
+		status = clEnqueueCopyBuffer(queue, wrapper, cl_buffer, 0, 0, size, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+		UnwrapHostImage();
+		break;
+
+	case LibOIEnums::HOST_IMAGE_PINNED:
+		if(mImage_staging_size < size)
+		{
+			FreeHostImageBuffers();
+			mImage_staging = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, size, NULL, &status);
+			CHECK_OPENCL_ERROR(status, "clCreateBuffer(mImage_staging) failed.");
+			mImage_staging_ptr = clEnqueueMapBuffer(queue, mImage_staging, CL_TRUE, CL_MAP_WRITE, 0, size, 0, NULL, NULL, &status);
+			CHECK_OPENCL_ERROR(status, "clEnqueueMapBuffer(mImage_staging) failed.");
+			mImage_staging_size = size;
+		}
+
+		// The previous upload must finish reading the staging buffer before it is overwritten.
+		if(mImage_upload_event)
+		{
+			CRoutine::waitForEventAndRelease(&mImage_upload_event);
+			mImage_upload_event = NULL;
+		}
+
+		memcpy(mImage_staging_ptr, host_mem, size);
+		status = clEnqueueWriteBuffer(queue, cl_buffer, CL_FALSE, 0, size, mImage_staging_ptr, 0, NULL, &mImage_upload_event);
+		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+		break;
+
+	default:
+		// Enqueue a blocking write
+		status = clEnqueueWriteBuffer(queue, cl_buffer, CL_TRUE, 0, size, host_mem, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+		break;
+	}
+}
+
+/// Wraps size bytes of host memory at host_mem in a CL_MEM_USE_HOST_PTR buffer for HOST_IMAGE_ZERO_COPY and
+/// returns it. On CPU and integrated devices kernels read the caller's array in place (for Intel devices host_mem
+/// should be 4096-byte aligned). The wrapper is only read, the caller's array is never written.
+///
+/// host_mem must not be modified until a result depending on the image has been returned, and must stay allocated
+/// until a different array is wrapped. The wrapper is kept mapped between uploads so that the caller may rewrite
+/// host_mem, this function unmaps it to make the new contents visible to the device. Call UnwrapHostImage once
+/// the work reading the wrapper has been enqueued.
+cl_mem CLibOI::WrapHostImage(const void * host_mem, size_t size)
+{
+	int status = CL_SUCCESS;
+
+	if(mImage_hostwrap_ptr != host_mem || mImage_hostwrap_size != size)
+	{
+		FreeHostImageBuffers();
+		mImage_hostwrap = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, size,
+				const_cast<void *>(host_mem), &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mImage_hostwrap) failed.");
+		mImage_hostwrap_ptr = host_mem;
+		mImage_hostwrap_size = size;
+	}
+	else
+	{
+		// Hand the (possibly rewritten) array back to the device.
+		status = clEnqueueUnmapMemObject(mOCL->GetQueue(), mImage_hostwrap, mImage_hostwrap_map, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueUnmapMemObject failed.");
+	}
+
+	return mImage_hostwrap;
+}
+
+/// Returns the array wrapped by WrapHostImage to the host once the work enqueued thus far has read it. The queue
+/// is in-order, so the map completes before any result depending on the image is returned.
+void CLibOI::UnwrapHostImage()
 {
 	int status = CL_SUCCESS;
-	int size = width *  height;
 
-	cl_float * tmp = new cl_float[size];
-	for(int i = 0; i < size; i++)
-		tmp[i] = host_mem[i];
+#if MAX_OPENCL_VERSION >= 120
+	mImage_hostwrap_map = clEnqueueMapBuffer(mOCL->GetQueue(), mImage_hostwrap, CL_FALSE, CL_MAP_WRITE_INVALIDATE_REGION, 0,
+			mImage_hostwrap_size, 0, NULL, NULL, &status);
+#else
+	mImage_hostwrap_map = clEnqueueMapBuffer(mOCL->GetQueue(), mImage_hostwrap, CL_FALSE, CL_MAP_WRITE, 0,
+			mImage_hostwrap_size, 0, NULL, NULL, &status);
+#endif // MAX_OPENCL_VERSION >= 120
+	CHECK_OPENCL_ERROR(status, "clEnqueueMapBuffer(mImage_hostwrap) failed.");
+}
 
-	// Enqueue a blocking write
-    status = clEnqueueWriteBuffer(mOCL->GetQueue(), cl_buffer, CL_TRUE, 0, sizeof(cl_float) * size, tmp, 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer failed.");
+/// Copies the specified layer of the image source to the device and normalizes it. Only image sources
+/// from which layers can be copied (host memory and OpenGL) support this, a runtime_error is thrown otherwise.
+void CLibOI::LoadLayer(unsigned int layer)
+{
+	if(mImageType == LibOIEnums::OPENCL_BUFFER)
+		throw runtime_error("Layers cannot be copied from an OpenCL buffer image source.");
 
-	delete[] tmp;
+	CopyImageToBuffer(int(layer));
+	Normalize();
 }
 
 /// Computes the chi2 between the current simulated data, and the observed data set specified in data
-float CLibOI::DataToChi2(COILibDataPtr data)
+/// Only the observable types selected in observables (see LibOIEnums::ObservableFlags) are included.
+float CLibOI::DataToChi2(COILibDataPtr data, unsigned int observables)
 {
 	unsigned int n_vis = data->GetNumVis();
 	unsigned int n_v2 = data->GetNumV2();
 	unsigned int n_t3 = data->GetNumT3();
 
-	return mrChi->Chi2(data->GetLoc_Data(), data->GetLoc_DataErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, true);
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	return mrChi->Chi2(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, true, observables);
 }
 
-float CLibOI::DataToLogLike(COILibDataPtr data)
+/// Computes the log-likelihood between the current simulated data, and the observed data set specified in data
+/// Only the observable types selected in observables (see LibOIEnums::ObservableFlags) are included.
+float CLibOI::DataToLogLike(COILibDataPtr data, unsigned int observables)
 {
 	unsigned int n_vis = data->GetNumVis();
 	unsigned int n_v2 = data->GetNumV2();
 	unsigned int n_t3 = data->GetNumT3();
 
-	return mrLogLike->LogLike(data->GetLoc_Data(), data->GetLoc_DataErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, true);
+	mrLogLike->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	return mrLogLike->LogLike(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3,
+			data->GetLogLikeConstant(observables), true, observables);
+}
+
+/// Uses the current active image to compute any combination of the chi2, log-likelihood, chi elements,
+/// simulated data and chi2 of each observable type with respect to the specified data.
+///
+/// outputs is a bitmask of LibOIEnums::EvaluateOutputs. The image is normalized and transformed once,
+/// the chi elements are computed once and the chi2, log-likelihood and per-observable chi2 all follow from
+/// a single segmented reduction. The requested outputs are gathered into one buffer on the device and copied
+/// to the host in a single transfer. Only the members of result selected in outputs are modified.
+void CLibOI::EvaluateAll(COILibDataPtr data, unsigned int outputs, EvaluateResult & result, unsigned int observables)
+{
+	int status = CL_SUCCESS;
+	cl_command_queue queue = mOCL->GetQueue();
+
+	Normalize();
+	FTToData(data, observables);
+
+	unsigned int n_vis = data->GetNumVis();
+	unsigned int n_v2 = data->GetNumV2();
+	unsigned int n_t3 = data->GetNumT3();
+	unsigned int n_data = data->GetNumData();
+	unsigned int n_segments = COILibData::NumSegments();
+
+	bool need_sums = outputs & (LibOIEnums::EVAL_CHI2 | LibOIEnums::EVAL_LOGLIKE | LibOIEnums::EVAL_OBSERVABLE_CHI2);
+	bool need_chi = outputs & LibOIEnums::EVAL_CHI;
+	bool need_sim = outputs & LibOIEnums::EVAL_SIMULATED_DATA;
+
+	// Pack the requested outputs into mEvaluateBuffer as [segments, chi, simulated data]
+	unsigned int chi_offset = (need_sums) ? n_segments : 0;
+	unsigned int sim_offset = chi_offset + ((need_chi) ? n_data : 0);
+	unsigned int total_size = sim_offset + ((need_sim) ? n_data : 0);
+	if(total_size == 0)
+		return;
+
+	if(need_sums || need_chi)
+	{
+		mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+		mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX,
+				n_vis, n_v2, n_t3, observables);
+	}
+
+	if(need_sums)
+		mrChi->Chi2Segmented(mrChi->GetChiBuffer(), data->GetLoc_SegmentID(), data->GetLoc_SegmentRange(),
+				mEvaluateBuffer, 0, n_segments);
+
+	if(need_chi)
+	{
+		status = clEnqueueCopyBuffer(queue, mrChi->GetChiBuffer(), mEvaluateBuffer, 0, sizeof(cl_float) * chi_offset,
+				sizeof(cl_float) * n_data, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+	}
+
+	if(need_sim)
+	{
+		status = clEnqueueCopyBuffer(queue, mSimDataBuffer, mEvaluateBuffer, 0, sizeof(cl_float) * sim_offset,
+				sizeof(cl_float) * n_data, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+	}
+
+	valarray<cl_float> t_output(total_size);
+	status = clEnqueueReadBuffer(queue, mEvaluateBuffer, CL_TRUE, 0, sizeof(cl_float) * total_size, &t_output[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	// Unpack the results.
+	if(need_sums)
+	{
+		// The chi2 is accumulated in double precision from the (float) segment sums.
+		double chi2 = 0;
+		for(unsigned int i = 0; i < LibOIEnums::N_OBSERVABLE_TYPES; i++)
+		{
+			double type_chi2 = 0;
+			for(unsigned int j = 0; j < LIBOI_N_UV_BINS; j++)
+				type_chi2 += t_output[i * LIBOI_N_UV_BINS + j];
+
+			if(outputs & LibOIEnums::EVAL_OBSERVABLE_CHI2)
+				result.observable_chi2[i] = type_chi2;
+
+			chi2 += type_chi2;
+		}
+
+		if(outputs & LibOIEnums::EVAL_CHI2)
+			result.chi2 = chi2;
+
+		// The per-element log-likelihood is -chi^2 / 2, see loglike.cl
+		if(outputs & LibOIEnums::EVAL_LOGLIKE)
+			result.loglike = data->GetLogLikeConstant(observables) - 0.5 * chi2;
+	}
+
+	if(need_chi)
+		result.chi = valarray<float>(t_output[slice(chi_offset, n_data, 1)]);
+
+	if(need_sim)
+		result.sim_data = valarray<float>(t_output[slice(sim_offset, n_data, 1)]);
+}
+
+/// Same as EvaluateAll above.
+/// Returns false if the data number does not exist, true otherwise.
+bool CLibOI::EvaluateAll(size_t data_num, unsigned int outputs, EvaluateResult & result, unsigned int observables)
+{
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
+		return false;
+
+	COILibDataPtr data = data_list->at(data_num);
+	EvaluateAll(data, outputs, result, observables);
+	return true;
 }
 
 /// \brief Exports both the real and simulated data to a file.
@@ -175,71 +597,56 @@ void CLibOI::ExportData(int data_num, string file_basename)
 
 /// Saves the current image in the OpenCL memory buffer to the specified FITS file
 /// If the OpenCL memory has not been initialzed, this function immediately returns
+/// Images with more than one layer are written as a cube, see ExportImage(float*, ...). See also ExportImageAsync.
 void   CLibOI::ExportImage(string filename)
 {
 	if(mImage_cl == NULL)
 		return;
 
-	// TODO: Adapt for multi-spectral images
-	Normalize();
+	if(mImageDepth == 1)
+		Normalize();
 
 	// Create a storage buffer for the image and copoy the image to it:
 	valarray<float> image(mImageWidth * mImageHeight * mImageDepth);
 	ExportImage(&image[0], mImageWidth, mImageHeight, mImageDepth);
 
 	// write out the FITS file:
-	fitsfile *fptr;
-	int status = 0;
-	long fpixel = 1, naxis = 2, nelements;
-	long naxes[2];
-
-	/*Initialise storage*/
-	naxes[0] = (long) mImageWidth;
-	naxes[1] = (long) mImageHeight;
-	nelements = mImageWidth * mImageWidth;
-
-	/*Create new file*/
-	if (status == 0)
-		fits_create_file(&fptr, filename.c_str(), &status);
-
-	/*Create primary array image*/
-	if (status == 0)
-		fits_create_img(fptr, FLOAT_IMG, naxis, naxes, &status);
-
-	double RPMAS = (M_PI / 180.0) / 3600000.0;
-	double image_scale_rad = mImageScale * RPMAS;
-
-	// Write keywords to get WCS to work //
-	fits_write_key_dbl(fptr, "CDELT1", -image_scale_rad, 3, "Radians per pixel", &status);
-	fits_write_key_dbl(fptr, "CDELT2", image_scale_rad, 3, "Radians per pixel", &status);
-	fits_write_key_dbl(fptr, "CRVAL1", 0.0, 3, "X-coordinate of reference pixel", &status);
-	fits_write_key_dbl(fptr, "CRVAL2", 0.0, 3, "Y-coordinate of reference pixel", &status);
-	fits_write_key_lng(fptr, "CRPIX1", naxes[0]/2, "reference pixel in X", &status);
-	fits_write_key_lng(fptr, "CRPIX2", naxes[1]/2, "reference pixel in Y", &status);
-	fits_write_key_str(fptr, "CTYPE1", "RA",  "Name of X-coordinate", &status);
-	fits_write_key_str(fptr, "CTYPE2", "DEC", "Name of Y-coordinate", &status);
-	fits_write_key_str(fptr, "CUNIT1", "rad", "Unit of X-coordinate", &status);
-	fits_write_key_str(fptr, "CUNIT2", "rad", "Unit of Y-coordinate", &status);
-
-	/*Write a keywords (datafile, target, image scale) */
-//	if (status == 0)
-//		fits_update_key(fptr, TSTRING, "DATAFILE", "FakeImage", "Data File Name", &status);
-//	if (status == 0)
-//		fits_update_key(fptr, TSTRING, "TARGET", "FakeImage", "Target Name", &status);
-//	if (status == 0)
-//		fits_update_key(fptr, TFLOAT, "SCALE", &mImageScale, "Scale (mas/pixel)", &status);
-
-
-	/*Write image*/
-	if (status == 0)
-		fits_write_img(fptr, TFLOAT, fpixel, nelements, &image[0], &status);
-
-	/*Close file*/
-	if (status == 0)
-		fits_close_file(fptr, &status);
-
-	/*Report any errors*/
-	fits_report_error(stderr, status);
+	CImageWriter::WriteFITS(filename, &image[0], mImageWidth, mImageHeight, mImageDepth, mImageScale);
+}
+
+/// Normalizes the image and writes it to a FITS file without blocking the calling thread.
+/// The image is read into a pooled buffer asynchronously and the FITS file is written on a background
+/// thread, thus the image may be modified as soon as this function returns. Use FlushExports to wait
+/// until all files are written. Images with more than one layer are copied to the device and normalized
+/// layer by layer and written as a cube, the layer which was loaded beforehand is then restored.
+void CLibOI::ExportImageAsync(string filename)
+{
+	if(mImage_cl == NULL)
+		return;
+
+	if(mImageWriter == NULL)
+		mImageWriter = new CImageWriter();
+
+	if(mImageDepth == 1)
+	{
+		Normalize();
+		mImageWriter->Export(mOCL->GetQueue(), mImage_cl, filename, mImageWidth, mImageHeight, mImageDepth, mImageScale);
+		return;
+	}
+
+	int current_layer = mImageLayer;
+	mImageWriter->Export(mOCL->GetQueue(), mImage_cl, filename, mImageWidth, mImageHeight, mImageDepth, mImageScale,
+			[this](unsigned int layer) { LoadLayer(layer); });
+
+	if(current_layer != mImageLayer)
+		LoadLayer(current_layer);
+}
+
+/// Blocks until all images scheduled by ExportImageAsync have been written.
+void CLibOI::FlushExports()
+{
+	if(mImageWriter)
+		mImageWriter->Flush();
 }
 
 /// Prints error message.
@@ -249,29 +656,54 @@ void CLibOI::error(std::string errorMsg)
 }
 
 /// Copies the current image in mCLImage to the floating point buffer, image, iff the sizes match exactly.
+/// mCLImage holds a single layer, so images with more than one layer are copied to the device and normalized
+/// layer by layer (see CopyImageToBuffer(int)) and stored one after another in image. The layer which was
+/// loaded beforehand is then restored.
 void CLibOI::ExportImage(float * image, unsigned int width, unsigned int height, unsigned int depth)
 {
 	if(width != mImageWidth || height != mImageHeight || depth != mImageDepth)
 		return;
 
 	int status = CL_SUCCESS;
-	size_t num_elements = mImageWidth * mImageHeight * mImageDepth;
-	cl_float tmp[num_elements];
-	status |= clEnqueueReadBuffer(mOCL->GetQueue(), mImage_cl, CL_TRUE, 0, num_elements * sizeof(cl_float), tmp, 0, NULL, NULL);
-	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+	cl_command_queue queue = mOCL->GetQueue();
+	size_t layer_size = size_t(mImageWidth) * mImageHeight;
+
+	if(mImageDepth == 1)
+	{
+		// cl_float is a float, so read directly into the output buffer.
+		status |= clEnqueueReadBuffer(queue, mImage_cl, CL_TRUE, 0, layer_size * sizeof(cl_float), image, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+		return;
+	}
 
-	// Copy to the output buffer, converting as we go.
-	for(size_t i = 0; i < num_elements; i++)
-		image[i] = tmp[i];
+	// The queue is in-order, so blocking on the last read covers all layers.
+	int current_layer = mImageLayer;
+	for(unsigned int layer = 0; layer < mImageDepth; layer++)
+	{
+		LoadLayer(layer);
+		cl_bool blocking = (layer + 1 == mImageDepth) ? CL_TRUE : CL_FALSE;
+		status = clEnqueueReadBuffer(queue, mImage_cl, blocking, 0, layer_size * sizeof(cl_float), image + layer * layer_size, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+	}
 
+	if(current_layer != mImageLayer)
+		LoadLayer(current_layer);
 }
 
 /// Computes the Fourier transform of the image, then generates Vis2 and T3's.
 /// This routine assumes the image has been normalized using Normalize() (and that the total flux is stored in mFluxBuffer)
-void CLibOI::FTToData(COILibDataPtr data)
+///
+/// UV points which are only referenced by masked data or observable types not selected in observables
+/// are skipped by the Fourier transform. The simulated data computed from them are not meaningful.
+void CLibOI::FTToData(COILibDataPtr data, unsigned int observables)
 {
 	// First compute the Fourier transform
-	mrFT->FT(data->GetLoc_DataUVPoints(), data->GetNumUV(), mImage_cl, mImageWidth, mImageHeight, mFTBuffer);
+	unsigned int n_active = 0;
+	cl_mem uv_index = data->GetLoc_ActiveUV(observables, n_active);
+	if(uv_index)
+		mrFT->FT(data->GetLoc_DataUVPoints(), data->GetNumUV(), uv_index, n_active, mImage_cl, mImageWidth, mImageHeight, mFTBuffer);
+	else if(n_active > 0)
+		mrFT->FT(data->GetLoc_DataUVPoints(), data->GetNumUV(), mImage_cl, mImageWidth, mImageHeight, mFTBuffer);
 
 	// Now create the V2 and T3's
 	int n_vis = data->GetNumVis();
@@ -284,11 +716,27 @@ void CLibOI::FTToData(COILibDataPtr data)
 			data->GetLoc_T3_sign(), mSimDataBuffer, n_vis, n_v2, n_t3);
 }
 
-OIDataList CLibOI::GetData(unsigned int data_num)
+/// Returns a shared, read-only copy of the OIFITS data of the specified data set. See COILibData::GetData.
+OIDataSnapshot CLibOI::GetData(unsigned int data_num)
 {
 	return mDataList->GetData(data_num);
 }
 
+/// Returns the mode used to transfer host images, HOST_IMAGE_AUTO is resolved for the current device.
+LibOIEnums::HostImageModes CLibOI::GetHostImageMode()
+{
+	if(mHostImageMode != LibOIEnums::HOST_IMAGE_AUTO)
+		return mHostImageMode;
+
+	return (IsIntegratedDevice()) ? LibOIEnums::HOST_IMAGE_ZERO_COPY : LibOIEnums::HOST_IMAGE_PINNED;
+}
+
+/// Returns the Jacobian computed by the last call to ImageToJacobian, stored as [param * n_data + i].
+cl_mem CLibOI::GetJacobianBuffer()
+{
+	return mrJacobian->GetJacobianBuffer();
+}
+
 double CLibOI::GetDataAveJD(int data_num)
 {
 	return mDataList->at(data_num)->GetAveJD();
@@ -337,8 +785,9 @@ int CLibOI::GetNDataSets()
 /// Returns the number of T3 data points in the specified data set.  If the data set does not exist, returns 0.
 int CLibOI::GetNT3(size_t data_num)
 {
-	if(data_num < mDataList->size())
-		return mDataList->at(data_num)->GetNumT3();
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num < data_list->size())
+		return data_list->at(data_num)->GetNumT3();
 
 	return 0;
 }
@@ -346,12 +795,26 @@ int CLibOI::GetNT3(size_t data_num)
 /// Returns the number of V2 data points in the specified data set.  If the data set does not exist, returns 0.
 int CLibOI::GetNV2(size_t data_num)
 {
-	if(data_num < mDataList->size())
-		return mDataList->at(data_num)->GetNumV2();
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num < data_list->size())
+		return data_list->at(data_num)->GetNumV2();
 
 	return 0;
 }
 
+/// Copies up to n values of the simulated data computed by the last call to ImageToData (or any of the
+/// ImageTo* functions which compute it) to output. On return n is set to the number of values copied.
+void CLibOI::GetSimulatedData(float * output, unsigned int & n)
+{
+	int status = CL_SUCCESS;
+	n = min(n, mMaxData);
+	if(n == 0)
+		return;
+
+	status = clEnqueueReadBuffer(mOCL->GetQueue(), mSimDataBuffer, CL_TRUE, 0, sizeof(cl_float) * n, output, 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+}
+
 bool CLibOI::isInteropEnabled()
 {
 	if(mOCL)
@@ -360,6 +823,26 @@ bool CLibOI::isInteropEnabled()
 	return false;
 }
 
+/// Returns true if the OpenCL device shares memory with the host (i.e. it is a CPU or an integrated GPU).
+bool CLibOI::IsIntegratedDevice()
+{
+	if(!mOCL)
+		return false;
+
+	cl_device_type type = 0;
+	clGetDeviceInfo(mOCL->GetDevice(), CL_DEVICE_TYPE, sizeof(cl_device_type), &type, NULL);
+	if(type & CL_DEVICE_TYPE_CPU)
+		return true;
+
+#if MAX_OPENCL_VERSION >= 110
+	cl_bool unified = CL_FALSE;
+	clGetDeviceInfo(mOCL->GetDevice(), CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+	return unified == CL_TRUE;
+#else
+	return false;
+#endif
+}
+
 /// Uses the current active image to compute the chi (i.e. non-squared version) with respect to the
 /// specified data and returns the chi elements in the floating point array, output.
 /// This is a convenience function that calls FTToData, DataToChi
@@ -373,40 +856,127 @@ void CLibOI::ImageToChi(COILibDataPtr data, float * output, unsigned int & n)
 	unsigned int n_v2 = data->GetNumV2();
 	unsigned int n_t3 = data->GetNumT3();
 
-	return mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, output, n);
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	return mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, output, n);
 }
 
 /// Same as ImageToChi above.
 /// Returns false if the data number does not exist, true otherwise.
 bool CLibOI::ImageToChi(size_t data_num, float * output, unsigned int & n)
 {
-	if(data_num > mDataList->size() - 1)
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
 		return false;
 
-	COILibDataPtr data = mDataList->at(data_num);
+	COILibDataPtr data = data_list->at(data_num);
 	ImageToChi(data, output, n);
 	return true;
 }
 
 /// Uses the current active image to compute the chi2 with respect to the specified data.
 /// This is a convenience function that calls FTToData and DataToChi2.
-float CLibOI::ImageToChi2(COILibDataPtr data)
+float CLibOI::ImageToChi2(COILibDataPtr data, unsigned int observables)
 {
 	// Simple, call the other functions
 	Normalize();
-	FTToData(data);
-	float chi2 = DataToChi2(data);
+	FTToData(data, observables);
+	float chi2 = DataToChi2(data, observables);
 	return chi2;
 }
 
 /// Same as ImageToChi2 above
-float CLibOI::ImageToChi2(size_t data_num)
+float CLibOI::ImageToChi2(size_t data_num, unsigned int observables)
 {
-	if(data_num > mDataList->size() - 1)
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
 		return -1;
 
-	COILibDataPtr data = mDataList->at(data_num);
-	return ImageToChi2(data);
+	COILibDataPtr data = data_list->at(data_num);
+	return ImageToChi2(data, observables);
+}
+
+/// Uses the current active image to compute the chi2 with respect to the specified data,
+/// stopping as soon as the chi2 is known to exceed threshold.
+///
+/// The Fourier transform is computed in UV chunks (see COILibData::BuildUVChunks). After each chunk the chi of
+/// the data which became complete is computed and its chi2 added to a running sum on the OpenCL device, see
+/// CRoutine_Chi::Chi2Running. The sum is copied back without blocking while the next chunk is enqueued, the host
+/// only waits for the sum of chunk k once chunk k + 1 is queued. Because the chi2 only increases, the remaining
+/// chunks are skipped once the running sum exceeds threshold.
+/// If exceeded is false, the exact chi2 is returned. Otherwise the (partial) chi2 computed thus far is
+/// returned, which is a lower bound on the true chi2. The chi buffer (see GetChiBuffer) is not meaningful afterwards.
+float CLibOI::ImageToChi2(COILibDataPtr data, float threshold, bool & exceeded)
+{
+	Normalize();
+
+	unsigned int n_vis = data->GetNumVis();
+	unsigned int n_v2 = data->GetNumV2();
+	unsigned int n_t3 = data->GetNumT3();
+	unsigned int n_uv = data->GetNumUV();
+	unsigned int n_chunks = data->GetNumUVChunks();
+	unsigned int chunk_size = data->GetUVChunkSize();
+
+	// Running sum after each chunk, filled in by non-blocking reads.
+	valarray<cl_float> running_chi2(0.0f, n_chunks);
+	vector<cl_event> read_events(n_chunks, NULL);
+	float chi2 = 0;
+	exceeded = false;
+
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	unsigned int chunk = 0;
+	for(chunk = 0; chunk < n_chunks; chunk++)
+	{
+		unsigned int uv_start = chunk * chunk_size;
+		mrFT->FT(data->GetLoc_DataUVPoints(), uv_start, min(chunk_size, n_uv - uv_start),
+				mImage_cl, mImageWidth, mImageHeight, mFTBuffer);
+
+		// The V2 and T3 kernels are inexpensive compared to the FT, we simply recompute all of them.
+		// Only the chi of the data which reference UV points in this chunk are computed and summed.
+		mrV2->FTtoV2(mFTBuffer, data->GetLoc_V2_UVRef(), mSimDataBuffer, n_vis, n_v2);
+		mrT3->FTtoT3(mFTBuffer, data->GetLoc_T3_UVRef(), data->GetLoc_T3_sign(), mSimDataBuffer, n_vis, n_v2, n_t3);
+
+		mrChi->Chi2Running(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX,
+				n_vis, n_v2, n_t3, data->GetUVChunkTypeRanges(chunk), data->GetLoc_UVChunkID(), data->GetLoc_UVChunkRange(),
+				chunk, &running_chi2[chunk], &read_events[chunk]);
+
+		// Check the sum of the previous chunk while this one runs.
+		if(chunk > 0)
+		{
+			CRoutine::waitForEventAndRelease(&read_events[chunk - 1]);
+			chi2 = running_chi2[chunk - 1];
+			if(chi2 > threshold)
+			{
+				exceeded = true;
+				break;
+			}
+		}
+	}
+
+	// The read of the last enqueued chunk writes to running_chi2, wait for it before returning.
+	unsigned int last = min(chunk, n_chunks - 1);
+	if(n_chunks > 0)
+		CRoutine::waitForEventAndRelease(&read_events[last]);
+
+	if(!exceeded && n_chunks > 0)
+	{
+		chi2 = running_chi2[last];
+		exceeded = (chi2 > threshold);
+	}
+
+	return chi2;
+}
+
+/// Same as ImageToChi2(data, threshold, exceeded) above.
+/// Returns -1 if the data number does not exist.
+float CLibOI::ImageToChi2(size_t data_num, float threshold, bool & exceeded)
+{
+	exceeded = false;
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
+		return -1;
+
+	COILibDataPtr data = data_list->at(data_num);
+	return ImageToChi2(data, threshold, exceeded);
 }
 
 /// Uses the current active image to compute the chi2 with respect to the
@@ -422,29 +992,260 @@ void CLibOI::ImageToChi2(COILibDataPtr data, float * output, unsigned int & n)
 	unsigned int n_v2 = data->GetNumV2();
 	unsigned int n_t3 = data->GetNumT3();
 
-	return mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, output, n);
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	return mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3, output, n);
 }
 
 /// Same as ImageToChi above.
 /// Returns false if the data number does not exist, true otherwise.
 bool CLibOI::ImageToChi2(size_t data_num, float * output, unsigned int & n)
 {
-	if(data_num > mDataList->size() - 1)
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
 		return false;
 
-	COILibDataPtr data = mDataList->at(data_num);
+	COILibDataPtr data = data_list->at(data_num);
 	ImageToChi2(data, output, n);
 	return true;
 }
 
+/// Uses the current active image to compute the chi2 of n_replicates bootstrap replicates of the specified data,
+/// starting with replicate_start, and stores them in output[0, n_replicates).
+///
+/// Rather than replacing the data with a resampled copy (see ReplaceData), the original data stay on the device and
+/// each replicate weights the chi2 of every resampling block (see COILibData::SetBootstrapBlocks) by a Poisson(1)
+/// multiplicity generated on the device from seed. The image is transformed once, after which all replicates are
+/// reduced in a single kernel launch. The same seed and replicate always give the same resample.
+void CLibOI::ImageToChi2Bootstrap(COILibDataPtr data, cl_uint seed, unsigned int replicate_start, unsigned int n_replicates,
+		float * output, unsigned int observables)
+{
+	Normalize();
+	FTToData(data, observables);
+
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	mrChi->Chi2Bootstrap(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX,
+			data->GetNumVis(), data->GetNumV2(), data->GetNumT3(), data->GetLoc_BootstrapBlock(),
+			seed, replicate_start, n_replicates, output, observables);
+}
+
+/// Same as ImageToChi2Bootstrap above.
+/// Returns false if the data number does not exist, true otherwise.
+bool CLibOI::ImageToChi2Bootstrap(size_t data_num, cl_uint seed, unsigned int replicate_start, unsigned int n_replicates,
+		float * output, unsigned int observables)
+{
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
+		return false;
+
+	COILibDataPtr data = data_list->at(data_num);
+	ImageToChi2Bootstrap(data, seed, replicate_start, n_replicates, output, observables);
+	return true;
+}
+
+/// Uses the current active image to compute the chi2 with respect to every loaded data set.
+///
+/// The image is normalized once. The chi elements of each data set are computed and packed end-to-end
+/// on the OpenCL device, then the chi2 of all data sets is reduced in a single kernel launch and copied
+/// to the host in a single transfer. This avoids the per-data set reductions and blocking reads of calling
+/// ImageToChi2(i) in a loop, which dominate when there are many small data sets.
+/// On return data_chi2[i] holds the chi2 of data set i, the total chi2 is returned.
+float CLibOI::ImageToChi2All(vector<float> & data_chi2, unsigned int observables)
+{
+	int status = CL_SUCCESS;
+	cl_command_queue queue = mOCL->GetQueue();
+	// Use one snapshot of the list throughout, data sets may be added or removed concurrently.
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	unsigned int n_sets = data_list->size();
+
+	data_chi2.resize(n_sets);
+	if(n_sets == 0)
+		return 0;
+
+	// Determine the location of each data set in the packed buffer.
+	valarray<cl_uint2> ranges(n_sets);
+	unsigned int total_size = 0;
+	for(unsigned int i = 0; i < n_sets; i++)
+	{
+		ranges[i].s[0] = total_size;
+		total_size += data_list->at(i)->GetNumData();
+		ranges[i].s[1] = total_size;
+	}
+
+	// (Re)allocate the packed buffers if they are too small.
+	if(total_size > mPackedChiSize)
+	{
+		if(mPackedChi) clReleaseMemObject(mPackedChi);
+		mPackedChi = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * total_size, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mPackedChi) failed.");
+		mPackedChiSize = total_size;
+	}
+
+	if(n_sets > mPackedNData)
+	{
+		if(mPackedRanges) clReleaseMemObject(mPackedRanges);
+		mPackedRanges = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_ONLY, sizeof(cl_uint2) * n_sets, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mPackedRanges) failed.");
+
+		if(mPackedChi2) clReleaseMemObject(mPackedChi2);
+		mPackedChi2 = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * n_sets, NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mPackedChi2) failed.");
+		mPackedNData = n_sets;
+	}
+
+	// ranges remains valid until the blocking read below completes, so this write need not block.
+	status = clEnqueueWriteBuffer(queue, mPackedRanges, CL_FALSE, 0, sizeof(cl_uint2) * n_sets, &ranges[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer(mPackedRanges) failed.");
+
+	Normalize();
+
+	for(unsigned int i = 0; i < n_sets; i++)
+	{
+		COILibDataPtr data = data_list->at(i);
+		unsigned int n_data = data->GetNumData();
+		if(n_data == 0)
+			continue;
+
+		FTToData(data, observables);
+
+		mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+		mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX,
+				data->GetNumVis(), data->GetNumV2(), data->GetNumT3(), observables);
+
+		status = clEnqueueCopyBuffer(queue, mrChi->GetChiBuffer(), mPackedChi, 0, sizeof(cl_float) * ranges[i].s[0],
+				sizeof(cl_float) * n_data, 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueCopyBuffer failed.");
+	}
+
+	mrChi->Chi2Ranges(mPackedChi, mPackedRanges, mPackedChi2, n_sets);
+
+	valarray<cl_float> t_output(n_sets);
+	status = clEnqueueReadBuffer(queue, mPackedChi2, CL_TRUE, 0, sizeof(cl_float) * n_sets, &t_output[0], 0, NULL, NULL);
+	CHECK_OPENCL_ERROR(status, "clEnqueueReadBuffer failed.");
+
+	// The total is accumulated in double precision from the per-data set sums.
+	double chi2 = 0;
+	for(unsigned int i = 0; i < n_sets; i++)
+	{
+		data_chi2[i] = t_output[i];
+		chi2 += t_output[i];
+	}
+
+	return chi2;
+}
+
+/// Uses the current active image to compute the chi2 of each observable type with respect to the
+/// specified data. The chi2 is reduced on the OpenCL device, only the per-segment values are copied back.
+///
+/// If uv_bins is false, output contains one chi2 value per LibOIEnums::ObservableTypes.
+/// If uv_bins is true, output contains LIBOI_N_UV_BINS values per observable type in
+/// [type * LIBOI_N_UV_BINS + bin] order, see COILibData::BuildSegments.
+/// n should be the size of output. On return n is set to the number of values written.
+void CLibOI::ImageToChi2Breakdown(COILibDataPtr data, float * output, unsigned int & n, bool uv_bins)
+{
+	// Simple, call the other functions
+	Normalize();
+	FTToData(data);
+
+	unsigned int n_vis = data->GetNumVis();
+	unsigned int n_v2 = data->GetNumV2();
+	unsigned int n_t3 = data->GetNumT3();
+	unsigned int n_segments = COILibData::NumSegments();
+
+	valarray<float> segments(n_segments);
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	mrChi->Chi2Segmented(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX,
+			n_vis, n_v2, n_t3, data->GetLoc_SegmentID(), data->GetLoc_SegmentRange(), 0, n_segments, &segments[0]);
+
+	if(uv_bins)
+	{
+		n = min(n, n_segments);
+		for(unsigned int i = 0; i < n; i++)
+			output[i] = segments[i];
+		return;
+	}
+
+	// Sum the UV bins of each observable type.
+	n = min(n, (unsigned int) LibOIEnums::N_OBSERVABLE_TYPES);
+	for(unsigned int i = 0; i < n; i++)
+		output[i] = valarray<float>(segments[slice(i * LIBOI_N_UV_BINS, LIBOI_N_UV_BINS, 1)]).sum();
+}
+
+/// Same as ImageToChi2Breakdown above.
+/// Returns false if the data number does not exist, true otherwise.
+bool CLibOI::ImageToChi2Breakdown(size_t data_num, float * output, unsigned int & n, bool uv_bins)
+{
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
+		return false;
+
+	COILibDataPtr data = data_list->at(data_num);
+	ImageToChi2Breakdown(data, output, n, uv_bins);
+	return true;
+}
+
+/// Computes the normal equations of a parametric fit of model to the specified data.
+///
+/// The simulated data are computed from the current image, which should be model.GetImage(). The derivatives
+/// of the model visibilities with respect to its model.GetNParams() parameters are propagated through the
+/// V2, T3 and chi computations on the OpenCL device to form the Jacobian J = d chi / d param (see GetJacobianBuffer).
+/// The weights and covariance of the data are applied, thus J^T W J (row-major, n_params * n_params) and
+/// J^T W r (n_params) are copied to JtWJ and JtWr in a single transfer. The Levenberg-Marquardt step solves
+/// (J^T W J + lambda * diag) dp = -J^T W r; the inverse of J^T W J is the Fisher estimate of the parameter covariance.
+/// Throws if the model has no parameters (e.g. CPointSource), as there is nothing to fit.
+void CLibOI::ImageToJacobian(COILibDataPtr data, CModel & model, float * JtWJ, float * JtWr)
+{
+	unsigned int n_params = model.GetNParams();
+	if(n_params == 0)
+		throw runtime_error("The model has no parameters to compute derivatives for.");
+
+	unsigned int n_vis = data->GetNumVis();
+	unsigned int n_v2 = data->GetNumV2();
+	unsigned int n_t3 = data->GetNumT3();
+	unsigned int n_uv = data->GetNumUV();
+	unsigned int n_data = data->GetNumData();
+
+	// Simulated data and the (whitened) chi elements.
+	Normalize();
+	FTToData(data);
+	mrChi->SetWhitening(data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(), data->GetNumCovBlocks());
+	mrChi->Chi(data->GetLoc_Data(), data->GetLoc_DataInvErr(), mSimDataBuffer, LibOIEnums::NON_CONVEX, n_vis, n_v2, n_t3);
+
+	// Propagate the model derivatives.
+	valarray<cl_float2> uv_points = data->GetUVPoints();
+	valarray<cl_float2> dvis = model.GetVisDerivatives_CL(uv_points);
+	mrJacobian->Jacobian(mFTBuffer, dvis, n_uv, n_params, data->GetLoc_DataInvErr(),
+			data->GetLoc_V2_UVRef(), data->GetLoc_T3_UVRef(), data->GetLoc_T3_sign(), n_vis, n_v2, n_t3);
+
+	// Decorrelate each row of J in the same way as chi.
+	for(unsigned int p = 0; p < n_params && data->GetNumCovBlocks() > 0; p++)
+		mrChi->Whiten(mrJacobian->GetJacobianBuffer(), data->GetLoc_CovBlocks(), data->GetLoc_CovFactors(),
+				data->GetNumCovBlocks(), p * n_data);
+
+	mrJacobian->NormalEquations(mrChi->GetChiBuffer(), n_data, n_params, JtWJ, JtWr);
+}
+
+/// Same as ImageToJacobian above.
+/// Returns false if the data number does not exist, true otherwise.
+bool CLibOI::ImageToJacobian(size_t data_num, CModel & model, float * JtWJ, float * JtWr)
+{
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
+		return false;
+
+	COILibDataPtr data = data_list->at(data_num);
+	ImageToJacobian(data, model, JtWJ, JtWr);
+	return true;
+}
+
 /// Uses the currently loaded image and specified data set to
 /// compute simulated data.
 void CLibOI::ImageToData(size_t data_num)
 {
-	if(data_num > mDataList->size() - 1)
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
 		return;
 
-	COILibDataPtr data = mDataList->at(data_num);
+	COILibDataPtr data = data_list->at(data_num);
 	ImageToData(data);
 }
 
@@ -456,21 +1257,22 @@ void CLibOI::ImageToData(COILibDataPtr data)
 	FTToData(data);
 }
 
-float CLibOI::ImageToLogLike(COILibDataPtr data)
+float CLibOI::ImageToLogLike(COILibDataPtr data, unsigned int observables)
 {
 	// Simple, call the other functions
 	Normalize();
-	FTToData(data);
-	float llike = DataToLogLike(data);
+	FTToData(data, observables);
+	float llike = DataToLogLike(data, observables);
 	return llike;
 }
-float CLibOI::ImageToLogLike(size_t data_num)
+float CLibOI::ImageToLogLike(size_t data_num, unsigned int observables)
 {
-	if(data_num > mDataList->size() - 1)
+	COILibDataList::Snapshot data_list = mDataList->GetSnapshot();
+	if(data_num >= data_list->size())
 		return -1;
 
-	COILibDataPtr data = mDataList->at(data_num);
-	return ImageToLogLike(data);
+	COILibDataPtr data = data_list->at(data_num);
+	return ImageToLogLike(data, observables);
 }
 
 void CLibOI::Init()
@@ -484,12 +1286,39 @@ void CLibOI::InitMembers()
 {
 	mDataList = new COILibDataList();
 
+	// Data sets share device memory blocks, see CDeviceArena.
+	mArena.reset();
+#if MAX_OPENCL_VERSION >= 110
+	mArena = CDeviceArenaPtr(new CDeviceArena(mOCL->GetDevice(), mOCL->GetContext(), mOCL->GetQueue()));
+	mDataList->SetArena(mArena);
+#endif // MAX_OPENCL_VERSION >= 110
+
 	mImage_cl = NULL;
 	mImage_gl = NULL;
 	mImage_host = NULL;
+	mImageElementType = LibOIEnums::IMAGE_FLOAT;
+	mImage_raw = NULL;
+	mImage_raw_size = 0;
+	mHostImageMode = LibOIEnums::HOST_IMAGE_AUTO;
+	mImage_hostwrap = NULL;
+	mImage_hostwrap_ptr = NULL;
+	mImage_hostwrap_map = NULL;
+	mImage_hostwrap_size = 0;
+	mImage_staging = NULL;
+	mImage_staging_ptr = NULL;
+	mImage_staging_size = 0;
+	mImage_upload_event = NULL;
+	mImageRing = NULL;
+	mImage_cl_base = NULL;
+	mImageDeltaEnabled = false;
+	mImageDeltaValid = false;
+	mImageDeltaLayer = 0;
+	mImage_delta_base = NULL;
+	mImageWriter = NULL;
 	mImageHeight = 1;
 	mImageWidth = 1;
 	mImageDepth = 1;
+	mImageLayer = 0;
 	mFluxBuffer = NULL;
 	mImageType = LibOIEnums::OPENCL_BUFFER;	// By default we assume the image is stored in an OpenCL buffer.
 	mImageScale = 1;
@@ -500,6 +1329,12 @@ void CLibOI::InitMembers()
 	mFluxBuffer = NULL;
 	mFTBuffer = NULL;
 	mSimDataBuffer = NULL;
+	mEvaluateBuffer = NULL;
+	mPackedChi = NULL;
+	mPackedRanges = NULL;
+	mPackedChi2 = NULL;
+	mPackedChiSize = 0;
+	mPackedNData = 0;
 
 	// Routines
 	mDataRoutinesInitialized = false;
@@ -512,6 +1347,8 @@ void CLibOI::InitMembers()
 	mrChi = NULL;
 	mrLogLike = NULL;
 	mrSquare = NULL;
+	mrJacobian = NULL;
+	mrConvertImage = NULL;
 	mrZeroBuffer = NULL;
 }
 
@@ -538,15 +1375,61 @@ void CLibOI::InitMemory()
 		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mFluxBuffer) failed.");
 	}
 
+	AllocateDataBuffers();
+}
+
+/// (Re)allocates the scratch buffers whose size depends on the data, see mMaxData and mMaxUV.
+void CLibOI::AllocateDataBuffers()
+{
+	int status = CL_SUCCESS;
+
 	if(mMaxData > 0)
 	{
+		if(mFTBuffer) clReleaseMemObject(mFTBuffer);
 		mFTBuffer = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float2) * mMaxUV, NULL, &status);
 		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mFTBuffer) failed.");
+		// UV points skipped by FTToData keep their previous value. Start from zero so masked data never see
+		// uninitialized memory.
+		valarray<cl_float2> t_zero(mMaxUV);
+		for(unsigned int i = 0; i < mMaxUV; i++)
+			t_zero[i].s[0] = t_zero[i].s[1] = 0;
+		status = clEnqueueWriteBuffer(mOCL->GetQueue(), mFTBuffer, CL_TRUE, 0, sizeof(cl_float2) * mMaxUV, &t_zero[0], 0, NULL, NULL);
+		CHECK_OPENCL_ERROR(status, "clEnqueueWriteBuffer(mFTBuffer) failed.");
+		if(mSimDataBuffer) clReleaseMemObject(mSimDataBuffer);
 		mSimDataBuffer = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_WRITE, sizeof(cl_float) * mMaxData, NULL, &status);
 		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mSimDataBuffer) failed.");
+
+		// [chi2 segments, chi, simulated data], see EvaluateAll
+		if(mEvaluateBuffer) clReleaseMemObject(mEvaluateBuffer);
+		mEvaluateBuffer = clCreateBuffer(mOCL->GetContext(), CL_MEM_READ_WRITE,
+				sizeof(cl_float) * (COILibData::NumSegments() + 2 * mMaxData), NULL, &status);
+		CHECK_OPENCL_ERROR(status, "clCreateBuffer(mEvaluateBuffer) failed.");
 	}
 }
 
+/// Grows the data-dependent scratch buffers after data sets were added to an initialized object.
+/// The capacity at least doubles whenever it is exceeded so that repeatedly adding data only rarely
+/// reallocates. The routines and their compiled kernels are kept, only their buffers are resized.
+void CLibOI::GrowDataBuffers()
+{
+	unsigned int n_data = mDataList->MaxNumData();
+	unsigned int n_uv = mDataList->MaxUVPoints();
+	if(n_data <= mMaxData && n_uv <= mMaxUV)
+		return;
+
+	// Make sure nothing in flight still uses the old buffers.
+	clFinish(mOCL->GetQueue());
+
+	if(n_data > mMaxData)
+		mMaxData = max(n_data, 2 * mMaxData);
+	if(n_uv > mMaxUV)
+		mMaxUV = max(n_uv, 2 * mMaxUV);
+
+	AllocateDataBuffers();
+	mrChi->Resize(mMaxData);
+	mrLogLike->Resize(mMaxData);
+}
+
 void CLibOI::InitRoutines()
 {
 	// Init all routines.  For now pre-allocate all buffers.
@@ -587,6 +1470,13 @@ void CLibOI::InitRoutines()
 		mrNormalize->Init();
 	}
 
+	if(mrConvertImage == NULL)
+	{
+		mrConvertImage = new CRoutine_ConvertImage(mOCL->GetDevice(), mOCL->GetContext(), mOCL->GetQueue());
+		mrConvertImage->SetSourcePath(mKernelSourcePath);
+		mrConvertImage->Init();
+	}
+
 
 	// only initialize these routines if we have data:
 	if(mMaxData > 0)
@@ -628,40 +1518,103 @@ void CLibOI::InitRoutines()
 			mrLogLike->SetSourcePath(mKernelSourcePath);
 			mrLogLike->Init(mMaxData);
 		}
+
+		if(mrJacobian == NULL)
+		{
+			mrJacobian = new CRoutine_Jacobian(mOCL->GetDevice(), mOCL->GetContext(), mOCL->GetQueue(), mrZeroBuffer);
+			mrJacobian->SetSourcePath(mKernelSourcePath);
+			mrJacobian->Init();
+		}
 	}
 }
 
-/// Reads in an OIFITS file and stores it into OpenCL memory
-/// Note, this routine will not load data any routine that uses data is initialized.
+/// Reads in an OIFITS file and stores it into OpenCL memory. Data may also be added after Init,
+/// in which case the scratch buffers are grown as needed, see GrowDataBuffers.
+/// Loading a file (or data list) which is already loaded shares its data buffers on the device,
+/// the weights, covariance and bootstrap blocks of each copy remain independent.
 int CLibOI::LoadData(string filename)
 {
-	if(!mDataRoutinesInitialized)
-	{
-		mDataList->LoadData(filename, mOCL->GetContext(), mOCL->GetQueue());
-		return mDataList->size() - 1;
-	}
+	int data_num = mDataList->LoadData(filename, mOCL->GetContext(), mOCL->GetQueue());
+	if(mDataRoutinesInitialized)
+		GrowDataBuffers();
 
-	return -1;
+	return data_num;
 }
 
 int CLibOI::LoadData(const OIDataList & data)
 {
-	if(!mDataRoutinesInitialized)
+	int data_num = mDataList->LoadData(data, mOCL->GetContext(), mOCL->GetQueue());
+	if(mDataRoutinesInitialized)
+		GrowDataBuffers();
+
+	return data_num;
+}
+
+/// Loads several OIFITS files in parallel, see COILibDataList::LoadData. The data sets are numbered in the
+/// order of filenames. Returns the number of the first data set.
+int CLibOI::LoadData(const vector<string> & filenames, unsigned int n_threads)
+{
+	int first = mDataList->LoadData(filenames, mOCL->GetContext(), mOCL->GetQueue(), n_threads);
+	if(mDataRoutinesInitialized)
+		GrowDataBuffers();
+
+	return first;
+}
+
+/// Marks the entire image as changed, see MarkImageDirty(x, y, width, height).
+void CLibOI::MarkImageDirty()
+{
+	MarkImageDirty(0, 0, mImageWidth, mImageHeight);
+}
+
+/// Marks a rectangle of the image as changed. When delta uploads are enabled (see SetImageDeltaUpload)
+/// only the marked regions of a host image are transferred by the next CopyImageToBuffer.
+/// Regions extending past the edge of the image are clipped.
+void CLibOI::MarkImageDirty(unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	if(x >= mImageWidth || y >= mImageHeight)
+		return;
+
+	ImageRect rect;
+	rect.x = x;
+	rect.y = y;
+	rect.width = min(width, mImageWidth - x);
+	rect.height = min(height, mImageHeight - y);
+
+	if(rect.width > 0 && rect.height > 0)
+		mImageDirty.push_back(rect);
+}
+
+/// Marks a list of pixels, given as indices x + y * width, as changed. Consecutive pixels on the same row
+/// are combined into a single region.
+void CLibOI::MarkImageDirty(const vector<unsigned int> & pixels)
+{
+	vector<unsigned int> sorted(pixels);
+	sort(sorted.begin(), sorted.end());
+	sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+
+	size_t i = 0;
+	while(i < sorted.size())
 	{
-		mDataList->LoadData(data, mOCL->GetContext(), mOCL->GetQueue());
-		return mDataList->size() - 1;
+		unsigned int x = sorted[i] % mImageWidth;
+		unsigned int y = sorted[i] / mImageWidth;
+		unsigned int width = 1;
+		while(i + width < sorted.size() && sorted[i + width] == sorted[i] + width && x + width < mImageWidth)
+			width++;
+
+		MarkImageDirty(x, y, width, 1);
+		i += width;
 	}
-
-	return -1;
 }
 
 /// Normalizes a floating point buffer by dividing by the sum of the buffer
+/// The sum is computed into mFluxBuffer and consumed there, it is not copied to the host.
 void CLibOI::Normalize()
 {
-	float sum = TotalFlux();
+	mrTotalFlux->Sum(mImage_cl, mFluxBuffer);
 
 	// Now normalize the image
-	mrNormalize->Normalize(mImage_cl, mImageWidth, mImageHeight, 1.0/sum);
+	mrNormalize->Normalize(mImage_cl, mImageWidth, mImageHeight, mFluxBuffer);
 }
 
 void CLibOI::PrintDeviceInfo()
@@ -674,7 +1627,19 @@ void CLibOI::PrintDeviceInfo()
 /// The result is stored in mFluxBuffer AND returned by default.
 float CLibOI::TotalFlux()
 {
-	return mrTotalFlux->Sum(mImage_cl, mFluxBuffer);
+	mrTotalFlux->Sum(mImage_cl, mFluxBuffer);
+	return mrTotalFlux->ReadSum(mFluxBuffer);
+}
+
+/// Copies host_mem to the next slot of the image ring and starts a non-blocking upload to the OpenCL device.
+/// Returns the slot, see SetImageRing and SelectImage. A two-slot ring is allocated if none exists.
+/// host_mem may be modified as soon as this function returns.
+unsigned int CLibOI::UploadImage(float * host_mem)
+{
+	if(mImageRing == NULL)
+		SetImageRing(2);
+
+	return mImageRing->Upload(host_mem);
 }
 
 /// Removes the specified data set from memory.
@@ -683,6 +1648,61 @@ void CLibOI::RemoveData(int data_num)
 	mDataList->RemoveData(data_num);
 }
 
+/// Sets the directory in which OIFITS files are cached after they have been read and preprocessed.
+/// Later calls to LoadData(filename) with an unchanged file map the cache and upload it directly to the
+/// OpenCL device instead of parsing the OIFITS file. An empty path (the default) disables the cache.
+void CLibOI::SetDataCachePath(string path)
+{
+	mDataList->SetCachePath(path);
+}
+
+/// Sets the block-diagonal covariance of the specified data set. See COILibData::SetCovariance.
+void CLibOI::SetDataCovariance(unsigned int data_num, const vector<CovarianceBlock> & blocks)
+{
+	mDataList->at(data_num)->SetCovariance(blocks);
+}
+
+/// Sets the bootstrap resampling block of each of the n data in the specified data set, in the same order as GetData.
+/// See COILibData::SetBootstrapBlocks.
+void CLibOI::SetDataBootstrapBlocks(unsigned int data_num, unsigned int * blocks, unsigned int n)
+{
+	valarray<cl_uint> t_blocks(blocks, n);
+	mDataList->at(data_num)->SetBootstrapBlocks(t_blocks);
+}
+
+/// Sets the weights of the n data in the specified data set, in the same order as GetData.
+/// A weight of zero masks the datum. See COILibData::SetWeights.
+void CLibOI::SetDataWeights(unsigned int data_num, float * weights, unsigned int n)
+{
+	valarray<cl_float> t_weights(weights, n);
+	mDataList->at(data_num)->SetWeights(t_weights);
+}
+
+/// Sets whether data sets loaded afterwards keep their OIFITS tables in host memory.
+/// See COILibDataList::SetKeepHostData.
+void CLibOI::SetKeepHostData(bool keep)
+{
+	mDataList->SetKeepHostData(keep);
+}
+
+/// Sets how the host waits for OpenCL events, see CRoutine::SetWaitPolicy.
+/// This applies to all CLibOI instances in the process.
+void CLibOI::SetEventWaitPolicy(LibOIEnums::EventWaitPolicies policy, unsigned int spin_budget_us)
+{
+	CRoutine::SetWaitPolicy(policy, spin_budget_us);
+}
+
+/// Makes the image uploaded to slot by UploadImage the current image. Subsequent evaluations
+/// wait on the OpenCL device for that upload only, the host does not block.
+void CLibOI::SelectImage(unsigned int slot)
+{
+	if(mImageRing == NULL)
+		throw runtime_error("No image ring has been allocated, call UploadImage or SetImageRing first.");
+
+	mImageRing->Select(slot);
+	mImage_cl = mImageRing->GetImage(slot);
+}
+
 /// Tells OpenCL about the size of the image.
 /// The image must have a depth of at least one.
 void   CLibOI::SetImageInfo(unsigned int width, unsigned int height, unsigned int depth, float scale)
@@ -693,18 +1713,89 @@ void   CLibOI::SetImageInfo(unsigned int width, unsigned int height, unsigned in
 	assert(depth > 0);
 	assert(scale > 0);
 
+	bool resized = (width != mImageWidth || height != mImageHeight);
 	mImageWidth = width;
 	mImageHeight = height;
 	mImageDepth = depth;
 	mImageScale = scale;
+
+	// The device copy used by delta uploads no longer matches the image size.
+	if(mImage_delta_base) clReleaseMemObject(mImage_delta_base);
+	mImage_delta_base = NULL;
+	mImageDeltaValid = false;
+
+	// The slots of an existing image ring are reallocated at the new size. Images uploaded to it are lost.
+	if(mImageRing && resized)
+		SetImageRing(mImageRing->GetNSlots());
+}
+
+/// Enables or disables delta uploads of host images. When enabled, CopyImageToBuffer transfers only
+/// the regions marked with MarkImageDirty since the previous call; if nothing was marked, nothing is
+/// transferred. The first upload after enabling, or after the image source or size changes, is complete.
+/// Only floating point host images use delta uploads.
+void CLibOI::SetImageDeltaUpload(bool enabled)
+{
+	mImageDeltaEnabled = enabled;
+	mImageDeltaValid = false;
+	mImageDirty.clear();
+}
+
+/// Sets how images in host memory are transferred to the OpenCL device, see CopyImageToBuffer(float*, ...).
+void CLibOI::SetHostImageMode(LibOIEnums::HostImageModes mode)
+{
+	if(mode != mHostImageMode && mOCL != NULL)
+		FreeHostImageBuffers();
+
+	mHostImageMode = mode;
+}
+
+/// Allocates a ring of n_slots images which are uploaded asynchronously on a separate transfer queue,
+/// so that the upload of the next image overlaps with the evaluation of the current one:
+///
+///   unsigned int slot = UploadImage(image_0);
+///   for(...)
+///   {
+///       SelectImage(slot);
+///       slot = UploadImage(image_k+1);	// overlaps with the evaluation below
+///       chi2 = ImageToChi2(data_num);
+///   }
+///
+/// Must be called after Init. n_slots = 0 releases the ring and restores the original image buffer.
+void CLibOI::SetImageRing(unsigned int n_slots)
+{
+	if(mImageRing)
+	{
+		clFinish(mOCL->GetQueue());
+		mImage_cl = mImage_cl_base;
+		delete mImageRing;
+		mImageRing = NULL;
+	}
+
+	if(n_slots == 0)
+		return;
+
+	mImage_cl_base = mImage_cl;
+	mImageRing = new CImageRing(mOCL->GetDevice(), mOCL->GetContext(), mOCL->GetQueue(), n_slots,
+			sizeof(cl_float) * mImageWidth * mImageHeight);
+	mImage_cl = mImageRing->GetImage(0);
 }
 
 /// Tells LibOI that the image source is located in host memory at the address specified by host_memory.
 /// All subsequent CopyImageToBuffer commands will read from this location.
 void CLibOI::SetImageSource(float * host_memory)
+{
+	SetImageSource(host_memory, LibOIEnums::IMAGE_FLOAT);
+}
+
+/// Tells LibOI that the image source is located in host memory at the address specified by host_memory
+/// and that its elements are of the specified type. Images which are not floating point are uploaded
+/// as-is and converted on the OpenCL device, see CopyImageToBuffer.
+void CLibOI::SetImageSource(const void * host_memory, LibOIEnums::ImageElementTypes type)
 {
 	mImageType = LibOIEnums::ImageTypes::HOST_MEMORY;
 	mImage_host = host_memory;
+	mImageElementType = type;
+	mImageDeltaValid = false;
 }
 
 /// Tells LibOI that the image source is already in device memory.
@@ -778,7 +1869,7 @@ void CLibOI::SetKernelSourcePath(string path_to_kernels)
 	mKernelSourcePath = path_to_kernels;
 }
 
-/// Replaces the data set loaded into old_data_id with new_data
+/// Replaces the data set loaded into old_data_id with new_data, see COILibDataList::ReplaceData.
 void CLibOI::ReplaceData(unsigned int old_data_id, const OIDataList & new_data)
 {
 	mDataList->ReplaceData(old_data_id, new_data);
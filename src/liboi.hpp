@@ -57,6 +57,7 @@
 
 #include <string>
 #include <memory>
+#include <valarray>
 #include "oi_file.hpp"
 
 using namespace std;
@@ -71,6 +72,11 @@ namespace liboi
 #define LIBOI_SUCCESS 0
 #define LIBOI_FAILURE 1
 
+// Number of UV-radius bins per observable type in the chi2 breakdown
+#define LIBOI_N_UV_BINS 8
+// Maximum number of UV chunks evaluated by the early-terminating ImageToChi2
+#define LIBOI_N_UV_CHUNKS 8
+
 class CLibOI;
 #define CHECK_ERROR(actual, reference, msg) \
     if(actual != reference) \
@@ -90,11 +96,20 @@ class CRoutine_Chi;
 class CRoutine_LogLike;
 class CRoutine_Square;
 class CRoutine_Zero;
+class CRoutine_Jacobian;
+class CRoutine_ConvertImage;
+class CImageWriter;
+class CDeviceArena;
+typedef shared_ptr<CDeviceArena> CDeviceArenaPtr;
+class CModel;
+class CImageRing;
 
 class COILibDataList;
 
 class COILibData;
 typedef shared_ptr<COILibData> COILibDataPtr;
+typedef shared_ptr<const OIDataList> OIDataSnapshot;
+struct CovarianceBlock;
 
 namespace LibOIEnums
 {
@@ -107,18 +122,98 @@ namespace LibOIEnums
 		HOST_MEMORY
 	};
 
+	// How images in host memory are transferred to the OpenCL device, see CLibOI::SetHostImageMode
+	enum HostImageModes
+	{
+		HOST_IMAGE_AUTO,		// ZERO_COPY on CPU and integrated devices, PINNED otherwise
+		HOST_IMAGE_COPY,		// Blocking write from the caller's array
+		HOST_IMAGE_PINNED,		// Copy into a persistently mapped, pinned staging buffer then write asynchronously
+		HOST_IMAGE_ZERO_COPY	// Wrap the caller's array with CL_MEM_USE_HOST_PTR
+	};
+
+	// Element types of images in host memory, see CLibOI::SetImageSource
+	enum ImageElementTypes
+	{
+		IMAGE_FLOAT,
+		IMAGE_DOUBLE,
+		IMAGE_HALF,		// IEEE 754 half precision, stored as 16-bit unsigned integers
+		IMAGE_UINT16
+	};
+
 	enum Chi2Types
 	{
 		CONVEX,
 		NON_CONVEX
 	};
+
+	// Observable types, in the order they are stored in the data buffers.
+	enum ObservableTypes
+	{
+		VIS_AMP,
+		VIS_PHI,
+		V2,
+		T3_AMP,
+		T3_PHI,
+		N_OBSERVABLE_TYPES
+	};
+
+	// Bitmask used to select observable types, e.g. V2_FLAG | T3_PHI_FLAG
+	enum ObservableFlags
+	{
+		VIS_AMP_FLAG = 1 << VIS_AMP,
+		VIS_PHI_FLAG = 1 << VIS_PHI,
+		V2_FLAG = 1 << V2,
+		T3_AMP_FLAG = 1 << T3_AMP,
+		T3_PHI_FLAG = 1 << T3_PHI,
+		ALL_OBSERVABLES = (1 << N_OBSERVABLE_TYPES) - 1
+	};
+
+	// How the host waits for OpenCL events to complete, see CRoutine::waitForEventAndRelease
+	enum EventWaitPolicies
+	{
+		WAIT_SPIN,		// Poll the event status. Lowest latency, but occupies a host core.
+		WAIT_BLOCK,		// Block in clWaitForEvents
+		WAIT_CALLBACK,	// Sleep on a condition variable signaled by an event callback
+		WAIT_HYBRID		// Poll for up to the spin budget, then block
+	};
+
+	// Bitmask used to select the outputs of CLibOI::EvaluateAll
+	enum EvaluateOutputs
+	{
+		EVAL_CHI2 = 1,
+		EVAL_LOGLIKE = 2,
+		EVAL_CHI = 4,
+		EVAL_SIMULATED_DATA = 8,
+		EVAL_OBSERVABLE_CHI2 = 16,
+		EVAL_ALL = 31
+	};
 }
 
+/// A rectangular region of the image in pixels, see CLibOI::MarkImageDirty
+struct ImageRect
+{
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+/// Results of CLibOI::EvaluateAll. Only the members selected in the outputs bitmask are filled.
+struct EvaluateResult
+{
+	float chi2;
+	float loglike;
+	valarray<float> chi;		// Chi elements, same layout as the data buffer
+	valarray<float> sim_data;	// Simulated data, same layout as the data buffer
+	float observable_chi2[LibOIEnums::N_OBSERVABLE_TYPES];	// chi2 of each observable type
+};
+
 class CLibOI
 {
 protected:
 	// Datamembers:
 	COILibDataList * mDataList;
+	CDeviceArenaPtr mArena;		// Shared with the data sets allocated in it, see COILibData
 
 	// OpenCL Context, manager, etc.
 	COpenCLPtr mOCL;
@@ -136,17 +231,46 @@ protected:
 	CRoutine_Chi * mrChi;
 	CRoutine_LogLike * mrLogLike;
 	CRoutine_Square * mrSquare;
+	CRoutine_Jacobian * mrJacobian;
+	CRoutine_ConvertImage * mrConvertImage;
 
 	// Memory objects (OpenCL or otherwise)
 	LibOIEnums::ImageTypes mImageType;
 	// Memory locations.
 	cl_mem mImage_cl;
 	cl_mem mImage_gl;	// OpenCL - OpenGL interop buffer.
-	float * mImage_host;	// Allocated externally. DO NOT FREE
+	const void * mImage_host;	// Allocated externally. DO NOT FREE
+	LibOIEnums::ImageElementTypes mImageElementType;
+	cl_mem mImage_raw;		// Non-float images are uploaded here before conversion
+	size_t mImage_raw_size;
+	valarray<cl_float> mImage_converted;	// Host conversion when the device cannot convert the image
+	// Host image transfers, see CopyImageToBuffer(float*, ...)
+	LibOIEnums::HostImageModes mHostImageMode;
+	cl_mem mImage_hostwrap;		// CL_MEM_USE_HOST_PTR buffer wrapping mImage_hostwrap_ptr
+	const void * mImage_hostwrap_ptr;
+	void * mImage_hostwrap_map;	// Mapped pointer of mImage_hostwrap, held by the host between uploads
+	size_t mImage_hostwrap_size;
+	cl_mem mImage_staging;		// Pinned staging buffer, mapped for the lifetime of the buffer
+	void * mImage_staging_ptr;
+	size_t mImage_staging_size;
+	cl_event mImage_upload_event;
+	// Asynchronous N-slot image uploads, see SetImageRing
+	CImageRing * mImageRing;
+	cl_mem mImage_cl_base;	// mImage_cl before the ring was enabled
+	// Delta uploads of host images, see SetImageDeltaUpload
+	bool mImageDeltaEnabled;
+	bool mImageDeltaValid;		// mImage_delta_base holds the current host image
+	int mImageDeltaLayer;		// Layer of the host image in mImage_delta_base
+	cl_mem mImage_delta_base;	// Unnormalized copy of the host image on the device
+	vector<ImageRect> mImageDirty;		// Regions marked since the last upload
+	vector<ImageRect> mImageChanged;	// Regions changed by the last upload
+	// Background FITS writing, see ExportImageAsync
+	CImageWriter * mImageWriter;
 	// Image properties
 	unsigned int mImageWidth;
 	unsigned int mImageHeight;
 	unsigned int mImageDepth;
+	int mImageLayer;	// Layer last copied to mImage_cl by CopyImageToBuffer(int)
 	float mImageScale;
 
 	unsigned int mMaxData;
@@ -156,6 +280,13 @@ protected:
 	cl_mem mFluxBuffer;
 	cl_mem mFTBuffer;
 	cl_mem mSimDataBuffer;
+	cl_mem mEvaluateBuffer;	// Outputs of EvaluateAll are gathered here for a single transfer to the host
+	// Chi elements of all data sets packed end-to-end, see ImageToChi2All
+	cl_mem mPackedChi;
+	cl_mem mPackedRanges;
+	cl_mem mPackedChi2;
+	unsigned int mPackedChiSize;
+	unsigned int mPackedNData;
 
 
 public:
@@ -166,22 +297,30 @@ public:
 
 public:
 
+	void CompactData();
 	void CopyImageToBuffer(int layer);
 	void CopyImageToBuffer(cl_mem gl_image, cl_mem cl_buffer, int width, int height, int layer);
 	void CopyImageToBuffer(float * host_mem, cl_mem cl_buffer, int width, int height, int layer);
+	void CopyImageToBuffer(const void * host_mem, LibOIEnums::ImageElementTypes type, cl_mem cl_buffer, int width, int height, int layer);
 
-	float DataToChi2(COILibDataPtr data);
-	float DataToLogLike(COILibDataPtr data);
+	float DataToChi2(COILibDataPtr data, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	float DataToLogLike(COILibDataPtr data, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 
 public:
 	static void error(std::string errorMsg);
+	void EvaluateAll(COILibDataPtr data, unsigned int outputs, EvaluateResult & result,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	bool EvaluateAll(size_t data_num, unsigned int outputs, EvaluateResult & result,
+			unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 	void ExportData(int data_num, string file_basename);
 	void ExportImage(string filename);
 	void ExportImage(float * image, unsigned int width, unsigned int height, unsigned int depth);
+	void ExportImageAsync(string filename);
+	void FlushExports();
 	void FreeOpenCLMem();
-	void FTToData(COILibDataPtr data);
+	void FTToData(COILibDataPtr data, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 
-	OIDataList GetData(unsigned int data_num);
+	OIDataSnapshot GetData(unsigned int data_num);
 	double GetDataAveJD(int data_num);
 	double GetDataAveWavelength(int data_num);
 	string GetDataFileName(int data_num);
@@ -191,24 +330,43 @@ public:
 	int GetNDataAllocated();
 	int GetNDataAllocated(int data_num);
 	int GetNDataSets();
+	const vector<ImageRect> & GetChangedRegions() { return mImageChanged; };
 	int GetNT3(size_t data_num);
 	int GetNV2(size_t data_num);
+	void GetSimulatedData(float * output, unsigned int & n);
 	int GetMaxDataSize() { return mMaxData; };
+	LibOIEnums::HostImageModes GetHostImageMode();
+	cl_mem GetJacobianBuffer();
 
 	bool isInteropEnabled();
 	void ImageToChi(COILibDataPtr data, float * output, unsigned int & n);
 	bool ImageToChi(size_t data_num, float * output, unsigned int & n);
-	float ImageToChi2(COILibDataPtr data);
-	float ImageToChi2(size_t data_num);
+	float ImageToChi2(COILibDataPtr data, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	float ImageToChi2(size_t data_num, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	float ImageToChi2(COILibDataPtr data, float threshold, bool & exceeded);
+	float ImageToChi2(size_t data_num, float threshold, bool & exceeded);
 	void ImageToChi2(COILibDataPtr data, float * output, unsigned int & n);
+	float ImageToChi2All(vector<float> & data_chi2, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 	bool ImageToChi2(size_t data_num, float * output, unsigned int & n);
+	void ImageToChi2Bootstrap(COILibDataPtr data, cl_uint seed, unsigned int replicate_start, unsigned int n_replicates,
+			float * output, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	bool ImageToChi2Bootstrap(size_t data_num, cl_uint seed, unsigned int replicate_start, unsigned int n_replicates,
+			float * output, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	void ImageToChi2Breakdown(COILibDataPtr data, float * output, unsigned int & n, bool uv_bins = false);
+	bool ImageToChi2Breakdown(size_t data_num, float * output, unsigned int & n, bool uv_bins = false);
+	void ImageToJacobian(COILibDataPtr data, CModel & model, float * JtWJ, float * JtWr);
+	bool ImageToJacobian(size_t data_num, CModel & model, float * JtWJ, float * JtWr);
 	void ImageToData(size_t data_num);
 	void ImageToData(COILibDataPtr data);
-	float ImageToLogLike(COILibDataPtr data);
-	float ImageToLogLike(size_t data_num);
+	float ImageToLogLike(COILibDataPtr data, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
+	float ImageToLogLike(size_t data_num, unsigned int observables = LibOIEnums::ALL_OBSERVABLES);
 	void Init();
 private:
+	void AllocateDataBuffers();
+	void FreeHostImageBuffers();
+	void GrowDataBuffers();
 	void InitMembers();
+	void LoadLayer(unsigned int layer);
 public:
 	void InitMemory();
 	void InitRoutines();
@@ -216,6 +374,11 @@ public:
 
 	int LoadData(string filename);
 	int LoadData(const OIDataList & data);
+	int LoadData(const vector<string> & filenames, unsigned int n_threads = 0);
+
+	void MarkImageDirty();
+	void MarkImageDirty(unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+	void MarkImageDirty(const vector<unsigned int> & pixels);
 
 	void Normalize();
 
@@ -224,13 +387,31 @@ public:
 	void RemoveData(int data_num);
 	void ReplaceData(unsigned int old_data_id, const OIDataList & new_data);
 
+	void SetDataBootstrapBlocks(unsigned int data_num, unsigned int * blocks, unsigned int n);
+	void SetDataCachePath(string path);
+	void SetDataCovariance(unsigned int data_num, const vector<CovarianceBlock> & blocks);
+	void SetDataWeights(unsigned int data_num, float * weights, unsigned int n);
+	void SetKeepHostData(bool keep);
+	static void SetEventWaitPolicy(LibOIEnums::EventWaitPolicies policy, unsigned int spin_budget_us = 0);
+	void SelectImage(unsigned int slot);
+	void SetImageDeltaUpload(bool enabled);
 	void SetImageInfo(unsigned int width, unsigned int height, unsigned int depth, float scale);
+	void SetImageRing(unsigned int n_slots);
+	void SetHostImageMode(LibOIEnums::HostImageModes mode);
 	void SetImageSource(float * host_memory);
+	void SetImageSource(const void * host_memory, LibOIEnums::ImageElementTypes type);
 	void SetImageSource(cl_mem cl_device_memory);
 	void SetImageSource(GLuint gl_device_memory, LibOIEnums::ImageTypes type);
 	void SetKernelSourcePath(string path_to_kernels);
 
 	float TotalFlux();
+
+	unsigned int UploadImage(float * host_mem);
+protected:
+	void UnwrapHostImage();
+	void UploadHostImage(const void * host_mem, size_t size, cl_mem cl_buffer);
+	void UploadHostImageDelta(const float * host_mem, cl_mem cl_buffer, int layer = 0);
+	cl_mem WrapHostImage(const void * host_mem, size_t size);
 };
 
 } /* namespace liboi */
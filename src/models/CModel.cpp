@@ -9,6 +9,7 @@
 #include <cassert>
 #include <fitsio.h>
 #include <iostream>
+#include <stdexcept>
 
 using namespace std;
 
@@ -66,6 +67,51 @@ valarray<cl_float2> CModel::GetVis_CL(valarray<cl_float2> & uv_list)
 	return output;
 }
 
+/// Returns the number of model parameters for which GetVisDerivatives computes derivatives.
+unsigned int CModel::GetNParams()
+{
+	return 0;
+}
+
+/// Computes the derivatives of the visibility at uv with respect to each of the GetNParams() model parameters
+/// and stores them in dvis. Models without parameters leave dvis empty, models with parameters must override
+/// this function.
+void CModel::GetVisDerivatives(pair<double,double> & /*uv*/, valarray<complex<double>> & dvis)
+{
+	if(GetNParams() > 0)
+		throw runtime_error("The model does not implement GetVisDerivatives.");
+
+	dvis.resize(0);
+}
+
+/// Computes the derivatives of the visibility with respect to the model parameters for a list of UV points.
+/// The output is stored by parameter, output[param * n_uv + uv]. UV points which are not finite (e.g. padding)
+/// are set to zero.
+valarray<cl_float2> CModel::GetVisDerivatives_CL(valarray<cl_float2> & uv_list)
+{
+	unsigned int n_uv = uv_list.size();
+	unsigned int n_params = GetNParams();
+	valarray<cl_float2> output(n_uv * n_params);
+	valarray<complex<double>> dvis(n_params);
+
+	for(size_t i = 0; i < n_uv; i++)
+	{
+		pair<double,double> t_uv(uv_list[i].s[0], uv_list[i].s[1]);
+		if(std::isfinite(t_uv.first) && std::isfinite(t_uv.second))
+			GetVisDerivatives(t_uv, dvis);
+		else
+			dvis = 0;
+
+		for(size_t p = 0; p < n_params; p++)
+		{
+			output[p * n_uv + i].s[0] = real(dvis[p]);
+			output[p * n_uv + i].s[1] = imag(dvis[p]);
+		}
+	}
+
+	return output;
+}
+
 /// Computes the V2
 double CModel::GetV2(pair<double,double> & uv)
 {
@@ -55,6 +55,10 @@ public:
 	cl_float2 GetVis_CL(cl_float2 & uv);
 	valarray<cl_float2> GetVis_CL(valarray<cl_float2> & uv_list);
 
+	virtual unsigned int GetNParams();
+	virtual void GetVisDerivatives(pair<double,double> & uv, valarray<complex<double>> & dvis);
+	valarray<cl_float2> GetVisDerivatives_CL(valarray<cl_float2> & uv_list);
+
 	double GetV2(pair<double,double> & uv);
 	cl_float GetV2_CL(cl_float2 & uv);
 	valarray<cl_float> GetV2_CL(valarray<cl_float2> & uv_list);
@@ -54,6 +54,41 @@ complex<double> CUniformDisk::GetVis(pair<double,double> & uv)
 	return V * phase;
 }
 
+/// The uniform disk has three parameters, [radius, alpha, delta].
+unsigned int CUniformDisk::GetNParams()
+{
+	return 3;
+}
+
+/// Computes the analytic derivatives of the visibility with respect to [radius, alpha, delta].
+void CUniformDisk::GetVisDerivatives(pair<double,double> & uv, valarray<complex<double>> & dvis)
+{
+	dvis.resize(GetNParams());
+
+	double radius = MasToRad(mRadius);
+	double baseline = sqrt(uv.first * uv.first + uv.second * uv.second);
+	double phi = -2 * PI * (mAlpha * uv.first + mDelta * uv.second);
+	double bess = 2 * PI * radius * baseline;
+
+	// Mirror the special case in GetVis, V = 1 and dV/dr = 0 near the origin.
+	complex<double> phase(1, 0);
+	double V = 1;
+	double dV_dbess = 0;
+	if(bess >= 1E-8)
+	{
+		phase = complex<double>(cos(phi), sin(phi));
+		V = 2 * j1(bess)/bess;
+		// d/dx [2 J1(x) / x] = 2 (x J0(x) - 2 J1(x)) / x^2
+		dV_dbess = 2 * (bess * j0(bess) - 2 * j1(bess)) / (bess * bess);
+	}
+
+	complex<double> vis = V * phase;
+	complex<double> i_unit(0, 1);
+	dvis[0] = dV_dbess * (2 * PI * baseline * RPMAS) * phase;
+	dvis[1] = vis * i_unit * (-2 * PI * uv.first);
+	dvis[2] = vis * i_unit * (-2 * PI * uv.second);
+}
+
 valarray<double> CUniformDisk::GetImage()
 {
 	double radius = mRadius / mImageScale;
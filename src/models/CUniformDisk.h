@@ -28,6 +28,8 @@ public:
 	virtual ~CUniformDisk();
 
 	virtual complex<double> GetVis(pair<double,double> & uv);
+	virtual unsigned int GetNParams();
+	virtual void GetVisDerivatives(pair<double,double> & uv, valarray<complex<double>> & dvis);
 	virtual valarray<double> GetImage();
 };
 